@@ -39,6 +39,7 @@
 #include "ftl.h"
 #include "misc.h"
 #include "env_unix.h"
+#include "sidecar.h"
 
 /* Function prototypes */
 
@@ -94,9 +95,12 @@ DRIVER dummydriver = {
   NIL,                          /* sort messages */
   NIL,                          /* thread messages */
   dummy_ping,                   /* ping mailbox to see if still alive */
+  NIL,                          /* watch mailbox for changes */
+  NIL,                          /* highest modseq */
   dummy_check,                  /* check for new messages */
   dummy_expunge,                /* expunge deleted messages */
   dummy_copy,                   /* copy messages to another mailbox */
+  NIL,                          /* move messages to another mailbox */
   dummy_append,                 /* append string message to mailbox */
   NIL                           /* garbage collect stream */
 };
@@ -295,7 +299,7 @@ void dummy_list_work (MAILSTREAM *stream,char *dir,char *pat,char *contents,
 
                                 /* scan directory, ignore . and .. */
     if (!dir || dir[(len = strlen (dir)) - 1] == '/') while (d = readdir (dp))
-      if ((!(dt && (*dt) (d->d_name))) &&
+      if ((!(dt && (*dt) (d->d_name))) && !sidecar_test (d->d_name) &&
           ((d->d_name[0] != '.') ||
            (((long) mail_parameters (NIL,GET_HIDEDOTFILES,NIL)) ? NIL :
             (d->d_name[1] && (((d->d_name[1] != '.') || d->d_name[2]))))) &&
@@ -426,7 +430,7 @@ long dummy_listed (MAILSTREAM *stream,char delimiter,char *name,
         dt = mail_parameters ((*d->open) (NIL),GET_DIRFMTTEST,NIL);
                                 /* scan directory for children */
     for (nochild = T; nochild && (dr = readdir (dp)); )
-      if ((!(dt && (*dt) (dr->d_name))) &&
+      if ((!(dt && (*dt) (dr->d_name))) && !sidecar_test (dr->d_name) &&
           ((dr->d_name[0] != '.') ||
            (((long) mail_parameters (NIL,GET_HIDEDOTFILES,NIL)) ? NIL :
             (dr->d_name[1] && ((dr->d_name[1] != '.') || dr->d_name[2])))))
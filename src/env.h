@@ -33,9 +33,12 @@ void rfc822_date (char *date);
 void rfc822_timezone (char *s,void *t);
 void internal_date (char *date);
 long server_input_wait (long seconds);
+long server_input_wait_fd (long seconds,int fd);
 void server_init (char *server,char *service,char *sasl,
 		  void *clkint,void *kodint,void *hupint,void *trmint,
 		  void *staint);
+void server_daemon (char *server,char *service,char *sslservice,
+		    unsigned long workers,unsigned long sessions);
 long server_login (char *user,char *pass,char *authuser,int argc,char *argv[]);
 long authserver_login (char *user,char *authuser,int argc,char *argv[]);
 long anonymous_login (int argc,char *argv[]);
@@ -43,3 +46,5 @@ char *mylocalhost (void);
 char *myhomedir (void);
 char *mailboxfile (char *dst,char *name);
 MAILSTREAM *default_proto (long type);
+unsigned char *search_workers (MAILSTREAM *stream,SEARCHPGM *pgm);
+long sort_workers (MAILSTREAM *stream,SORTCACHE **sc);
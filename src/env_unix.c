@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
@@ -50,7 +51,11 @@
 #include "mail.h"
 #include "misc.h"
 #include "env_unix.h"
+#include "sidecar.h"
 #include "config.h"
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 /* Linux gets this wrong */
 
@@ -114,6 +119,7 @@ static short blackBox = NIL;	/* is a black box */
 static short closedBox = NIL;	/* is a closed box (uses chroot() jail) */
 static long restrictBox = NIL;	/* is a restricted box */
 static short has_no_life = NIL;	/* is a cretin with no life */
+static short statusCache = T;	/* keep mailbox status cache sidecars */
 				/* block environment init */
 static short block_env_init = NIL;
 static short hideDotFiles = NIL;/* hide files whose names start with . */
@@ -127,6 +133,9 @@ static short no822tztext = NIL;	/* disable RFC [2]822 timezone text */
 				/* client principals include service name */
 static short kerb_cp_svr_name = NIL;
 static long locktimeout = 5;	/* default lock timeout in minutes */
+static long searchprocs = 4;	/* maximum search worker processes */
+				/* header names in header indexes */
+static char *indexHeaders = NIL;
 				/* default prototypes */
 static MAILSTREAM *createProto = NIL;
 static MAILSTREAM *appendProto = NIL;
@@ -382,6 +391,11 @@ void *env_parameters (long function,void *value)
   case GET_SSLCAPATH:
     ret = (void *) sslCApath;
     break;
+  case SET_STATUSCACHE:
+    statusCache = value ? T : NIL;
+  case GET_STATUSCACHE:
+    ret = (void *) (statusCache ? VOIDT : NIL);
+    break;
   case SET_LISTMAXLEVEL:
     list_max_level = (long) value;
   case GET_LISTMAXLEVEL:
@@ -443,6 +457,17 @@ void *env_parameters (long function,void *value)
   case GET_LOCKTIMEOUT:
     ret = (void *) locktimeout;
     break;
+  case SET_SEARCHPROCS:
+    searchprocs = (long) value;
+  case GET_SEARCHPROCS:
+    ret = (void *) searchprocs;
+    break;
+  case SET_INDEXHEADERS:	/* space separated header names */
+    if (indexHeaders) fs_give ((void **) &indexHeaders);
+    indexHeaders = value ? cpystr ((char *) value) : NIL;
+  case GET_INDEXHEADERS:
+    ret = (void *) indexHeaders;
+    break;
   case SET_DISABLEFCNTLLOCK:
     fcntlhangbug = value ? T : NIL;
   case GET_DISABLEFCNTLLOCK:
@@ -662,12 +687,622 @@ server_init(char *server,
   }
 }
 
+/* Standalone daemon */
+
+typedef struct daemon_worker {
+  pid_t pid;			/* worker process ID, 0 if none */
+  int fd;			/* socket to pass connections to worker */
+  unsigned long passed;		/* connections passed to worker */
+} DAEMONWORKER;
+
+static int daemon_lfd[2];	/* listening sockets */
+static int daemon_nlfd = 0;	/* number of listening sockets */
+static int daemon_term = 0;	/* non-zero if daemon told to terminate */
+
+static void daemon_trmint (void);
+static int daemon_listen (char *service);
+static long daemon_spawn (DAEMONWORKER *w,DAEMONWORKER *pool,
+			  unsigned long workers,char *server,
+			  unsigned long sessions);
+static long daemon_worker (int fd,char *server,unsigned long sessions);
+static long daemon_pass (DAEMONWORKER *pool,unsigned long workers,
+			 unsigned long sessions,unsigned long *next,int fd);
+
+
+/* Run as standalone daemon
+ * Accepts: server name for syslog
+ *	    /etc/services service name
+ *	    alternate /etc/services SSL service name
+ *	    number of worker processes
+ *	    number of sessions before a worker is recycled
+ *
+ * Only returns in a session process, with the connection on stdin/stdout, in
+ * which case the caller continues exactly as if started by inetd.  The master
+ * process listens on both service ports and passes each accepted connection
+ * to one of a pool of pre-forked workers.  Workers have already done all the
+ * startup work that doesn't depend upon the connection, and fork a session
+ * process for each connection they receive.
+ */
+
+void server_daemon (char *server,char *service,char *sslservice,
+		    unsigned long workers,unsigned long sessions)
+{
+  unsigned long i,next = 0;
+  int fd,status;
+  pid_t pid;
+  struct pollfd pfd[2];
+  DAEMONWORKER *pool;
+  if (!workers) workers = 1;	/* sanity checks */
+  if (!sessions) sessions = 1;
+  openlog (server,LOG_PID,syslog_facility);
+  if ((daemon_lfd[daemon_nlfd] = daemon_listen (service)) >= 0) daemon_nlfd++;
+  if ((daemon_lfd[daemon_nlfd] = daemon_listen (sslservice)) >= 0)
+    daemon_nlfd++;
+  if (!daemon_nlfd) fatal ("Daemon has no ports to listen on");
+  pool = (DAEMONWORKER *) memset (fs_get (workers * sizeof (DAEMONWORKER)),0,
+				  workers * sizeof (DAEMONWORKER));
+  arm_signal (SIGTERM,daemon_trmint);
+  arm_signal (SIGINT,daemon_trmint);
+  arm_signal (SIGPIPE,SIG_IGN);
+  syslog (LOG_INFO,"Daemon started, %lu workers, %lu sessions per worker",
+	  workers,sessions);
+  while (!daemon_term) {
+				/* reap dead workers */
+    while ((pid = waitpid (-1,&status,WNOHANG)) > 0)
+      for (i = 0; i < workers; ++i) if (pool[i].pid == pid) {
+	close (pool[i].fd);
+	pool[i].pid = 0;
+      }
+				/* replace them */
+    for (i = 0; i < workers; ++i) if (!pool[i].pid &&
+				      daemon_spawn (pool + i,pool,workers,
+						    server,sessions)) {
+      fs_give ((void **) &pool);/* in a session process now */
+      return;
+    }
+    for (i = 0; i < daemon_nlfd; ++i) {
+      pfd[i].fd = daemon_lfd[i];
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+				/* wait for connections, take one from
+				   each port so that retired workers are
+				   replaced between connections */
+    if (poll (pfd,daemon_nlfd,1000) > 0) for (i = 0; i < daemon_nlfd; ++i)
+      if ((pfd[i].revents & POLLIN) &&
+	  ((fd = accept (pfd[i].fd,NIL,NIL)) >= 0)) {
+	if (!daemon_pass (pool,workers,sessions,&next,fd))
+	  syslog (LOG_ALERT,"No daemon worker available for connection");
+	close (fd);		/* worker has its own copy now */
+      }
+  }
+  syslog (LOG_INFO,"Daemon terminating");
+  for (i = 0; i < workers; ++i) if (pool[i].pid) kill (pool[i].pid,SIGTERM);
+  exit (0);
+}
+
+
+/* Daemon termination interrupt
+ */
+
+static void daemon_trmint (void)
+{
+  daemon_term = T;
+}
+
+/* Daemon open listening socket
+ * Accepts: /etc/services service name
+ * Returns: listening socket, or -1 if failure
+ *
+ * IPv4 only, since the TCP routines this is built with (ip4_unix.c) can't
+ * report IPv6 client addresses; inetd is still needed for IPv6.
+ */
+
+static int daemon_listen (char *service)
+{
+  int fd;
+  int on = 1;
+  struct servent *sv;
+  struct sockaddr_in sin;
+  if (!(sv = getservbyname (service,"tcp"))) {
+    syslog (LOG_ERR,"Unknown service %.80s, not listening",service);
+    return -1;
+  }
+  memset (&sin,0,sizeof (sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl (INADDR_ANY);
+  sin.sin_port = sv->s_port;
+  if ((fd = socket (AF_INET,SOCK_STREAM,0)) < 0) {
+    syslog (LOG_ERR,"Unable to create %.80s socket: %s",service,
+	    strerror (errno));
+    return -1;
+  }
+  setsockopt (fd,SOL_SOCKET,SO_REUSEADDR,(void *) &on,sizeof (on));
+  if (bind (fd,(struct sockaddr *) &sin,sizeof (sin)) ||
+      listen (fd,SOMAXCONN) || (fcntl (fd,F_SETFL,O_NONBLOCK) < 0)) {
+    syslog (LOG_ERR,"Unable to listen on %.80s port %d: %s",service,
+	    ntohs (sv->s_port),strerror (errno));
+    close (fd);
+    return -1;
+  }
+  fcntl (fd,F_SETFD,FD_CLOEXEC);
+  return fd;
+}
+
+/* Daemon start worker
+ * Accepts: worker slot
+ *	    worker pool
+ *	    number of workers
+ *	    server name
+ *	    number of sessions before worker is recycled
+ * Returns: T if in a session process, else NIL
+ */
+
+static long daemon_spawn (DAEMONWORKER *w,DAEMONWORKER *pool,
+			  unsigned long workers,char *server,
+			  unsigned long sessions)
+{
+  unsigned long i;
+  int sv[2];
+				/* keeps message boundaries, and the worker
+				   sees end of file if the master dies */
+  if (socketpair (AF_UNIX,SOCK_SEQPACKET,0,sv)) {
+    syslog (LOG_ALERT,"Unable to create daemon worker socket: %s",
+	    strerror (errno));
+    return NIL;
+  }
+  switch (w->pid = fork ()) {
+  case -1:			/* failed */
+    syslog (LOG_ALERT,"Unable to fork daemon worker: %s",strerror (errno));
+    w->pid = 0;
+    close (sv[0]);
+    close (sv[1]);
+    return NIL;
+  case 0:			/* worker */
+    close (sv[0]);		/* don't need master side descriptors */
+    for (i = 0; i < workers; ++i) if (pool[i].pid) close (pool[i].fd);
+    for (i = 0; i < daemon_nlfd; ++i) close (daemon_lfd[i]);
+    return daemon_worker (sv[1],server,sessions);
+  default:			/* master */
+    close (sv[1]);
+    w->fd = sv[0];
+    w->passed = 0;		/* nothing passed to it yet */
+    return NIL;
+  }
+}
+
+/* Daemon worker
+ * Accepts: socket to receive connections from
+ *	    server name
+ *	    number of sessions before exiting
+ * Returns: T in a session process, never returns in worker
+ *
+ * Every connection received counts as a session, even one that couldn't be
+ * forked, so that the worker exits exactly when the master stops passing it
+ * connections and none are left queued for it.
+ */
+
+static long daemon_worker (int fd,char *server,unsigned long sessions)
+{
+  int cfd;
+  char c;
+  ssize_t n;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  char buf[CMSG_SPACE (sizeof (int))];
+  arm_signal (SIGTERM,SIG_DFL);	/* default termination while a worker */
+  arm_signal (SIGINT,SIG_DFL);
+  arm_signal (SIGCHLD,SIG_IGN);	/* don't care about session status */
+  ssl_server_preinit (server);	/* load certificate and key once */
+  while (sessions) {
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    memset (&msg,0,sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof (buf);
+    if ((n = recvmsg (fd,&msg,0)) < 0) {
+      if (errno == EINTR) continue;
+      syslog (LOG_ALERT,"Daemon worker receive failed: %s",strerror (errno));
+      exit (1);
+    }
+    if (!n) exit (0);		/* master went away, shut down quietly */
+    --sessions;			/* master counted this one */
+    if (!(cmsg = CMSG_FIRSTHDR (&msg)) || (cmsg->cmsg_level != SOL_SOCKET) ||
+	(cmsg->cmsg_type != SCM_RIGHTS)) continue;
+    memcpy (&cfd,CMSG_DATA (cmsg),sizeof (int));
+    switch (fork ()) {
+    case -1:			/* failed */
+      syslog (LOG_ALERT,"Unable to fork daemon session: %s",strerror (errno));
+      break;
+    case 0:			/* session */
+      close (fd);
+      arm_signal (SIGCHLD,SIG_DFL);
+      arm_signal (SIGPIPE,SIG_DFL);
+      dup2 (cfd,0);		/* connection becomes stdin/stdout */
+      dup2 (cfd,1);
+      if (cfd > 1) close (cfd);
+      return T;
+    default:			/* worker */
+      break;
+    }
+    close (cfd);
+  }
+  exit (0);			/* recycle this worker */
+  return NIL;			/* not reached */
+}
+
+/* Daemon pass connection to a worker
+ * Accepts: worker pool
+ *	    number of workers
+ *	    number of sessions before a worker is recycled
+ *	    pointer to next worker to try
+ *	    connection
+ * Returns: T if passed, NIL if no worker could take it
+ *
+ * A worker which has been passed all of its sessions is retired: it gets no
+ * more, and its slot is freed for a replacement.  It still receives what is
+ * queued for it, and exits when it has received them all.
+ */
+
+static long daemon_pass (DAEMONWORKER *pool,unsigned long workers,
+			 unsigned long sessions,unsigned long *next,int fd)
+{
+  unsigned long i;
+  char c = 0;
+  struct iovec iov;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  char buf[CMSG_SPACE (sizeof (int))];
+  for (i = 0; i < workers; ++i) {
+    DAEMONWORKER *w = pool + ((*next)++ % workers);
+    if (!w->pid) continue;	/* skip dead worker */
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    memset (&msg,0,sizeof (msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof (buf);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cmsg),&fd,sizeof (int));
+				/* busy or dead worker, try next */
+    if (sendmsg (w->fd,&msg,MSG_DONTWAIT|MSG_NOSIGNAL) > 0) {
+				/* retire worker after its last session */
+      if (++w->passed >= sessions) {
+	close (w->fd);
+	w->pid = 0;
+      }
+      return LONGT;
+    }
+  }
+  return NIL;
+}
+
+/* Search workers
+ *
+ * A search that has to read message data is split into slices of the
+ * message range, each searched by a forked worker process.  The driver's
+ * search worker routine gives the worker its own descriptors so that the
+ * workers' reads don't move each other's file offsets.  Each worker writes
+ * its slice of the result bitmap to a pipe; a slice whose worker fails is
+ * searched by the caller instead.
+ *
+ * Sort keys which aren't cached are loaded the same way, each worker taking
+ * a slice of the uncached messages in message order and so reading its part
+ * of the mailbox in file order.
+ */
+
+static long search_worker (MAILSTREAM *stream,SEARCHPGM *pgm,
+			   searchworker_t sw,unsigned char *hits,
+			   unsigned long i,unsigned long j,int fd);
+static long sort_worker (MAILSTREAM *stream,SORTCACHE **sc,unsigned long *u,
+			 unsigned long j,searchworker_t sw,int fd);
+static void sort_worker_results (SORTCACHE **sc,unsigned long *u,
+				 unsigned long j,STCBUFFER *b);
+static void worker_init (void);
+
+
+/* Search in worker processes
+ * Accepts: MAIL stream
+ *	    search program, already charset converted
+ * Returns: bitmap of matching messages (bit msgno-1), or NIL if the search
+ *	    is to be done by the caller
+ */
+
+unsigned char *search_workers (MAILSTREAM *stream,SEARCHPGM *pgm)
+{
+  int p[2];
+  int *fd;
+  pid_t *pid;
+  long r;
+  unsigned long i,j,k,m,n,per,len;
+  unsigned char *hits;
+  searchworker_t sw;
+  if ((searchprocs < 2) || (stream->nmsgs < 2 * SEARCHPROCMSGS) ||
+      !(sw = (searchworker_t) mail_parameters (stream,GET_SEARCHWORKER,NIL)))
+    return NIL;			/* not worth it or driver can't */
+  n = min (searchprocs,stream->nmsgs / SEARCHPROCMSGS);
+				/* slices are whole bitmap bytes */
+  per = (((stream->nmsgs + n - 1) / n) + 7) & ~7;
+  n = (stream->nmsgs + per - 1) / per;
+  hits = (unsigned char *)
+    memset (fs_get (len = (stream->nmsgs + 7) >> 3),0,len);
+  fd = (int *) fs_get (n * sizeof (int));
+  pid = (pid_t *) fs_get (n * sizeof (pid_t));
+  for (k = 0; k < n; ++k) {	/* start workers */
+    fd[k] = -1;
+    i = k * per;		/* first message in slice, origin 0 */
+    j = min (per,stream->nmsgs - i);
+    if (pipe (p)) pid[k] = 0;
+    else switch (pid[k] = fork ()) {
+    case -1:			/* failed, caller does this slice */
+      pid[k] = 0;
+      close (p[0]);
+      close (p[1]);
+      break;
+    case 0:			/* worker */
+      close (p[0]);		/* don't need other workers' pipes */
+      for (m = 0; m < k; ++m) if (fd[m] >= 0) close (fd[m]);
+      _exit (search_worker (stream,pgm,sw,hits,i,j,p[1]) ? 0 : 1);
+    default:			/* caller */
+      close (p[1]);
+      fd[k] = p[0];
+      break;
+    }
+  }
+  for (k = 0; k < n; ++k) {	/* collect slices in order */
+    i = k * per;		/* first message in slice, origin 0 */
+    j = min (per,stream->nmsgs - i);
+    len = (j + 7) >> 3;		/* size of slice in bitmap */
+    m = 0;
+    if (fd[k] >= 0) {		/* read worker's results */
+      while ((m < len) && (((r = read (fd[k],hits + (i >> 3) + m,len - m)) > 0)
+			   || ((r < 0) && (errno == EINTR))))
+	if (r > 0) m += r;
+      close (fd[k]);
+    }
+    if (pid[k]) grim_pid_reap (pid[k],NIL);
+    if (m < len) {		/* worker failed, do slice here */
+      memset (hits + (i >> 3),0,len);
+      for (; j; --j,++i) if (mail_search_msg (stream,i + 1,NIL,pgm))
+	hits[i >> 3] |= 1 << (i & 7);
+    }
+  }
+  fs_give ((void **) &pid);
+  fs_give ((void **) &fd);
+  return hits;
+}
+
+/* Search worker process
+ * Accepts: MAIL stream
+ *	    search program
+ *	    driver search worker routine
+ *	    result bitmap
+ *	    first message in slice, origin 0
+ *	    number of messages in slice
+ *	    pipe to write slice of bitmap to
+ * Returns: T if slice searched and written, NIL if failure
+ */
+
+static long search_worker (MAILSTREAM *stream,SEARCHPGM *pgm,
+			   searchworker_t sw,unsigned char *hits,
+			   unsigned long i,unsigned long j,int fd)
+{
+  unsigned char *s = hits + (i >> 3);
+  long len = (j + 7) >> 3;
+  worker_init ();		/* detach from server */
+  if (!(*sw) (stream)) return NIL;
+  for (; j; --j,++i) if (mail_search_msg (stream,i + 1,NIL,pgm))
+    hits[i >> 3] |= 1 << (i & 7);
+  textindex_save (stream);	/* keep messages indexed by this worker */
+  return (safe_write (fd,(char *) s,len) == len) ? LONGT : NIL;
+}
+
+/* Load sort keys in worker processes
+ * Accepts: MAIL stream
+ *	    sortcache vector of messages to sort, with sort program
+ * Returns: T if workers were used, NIL if keys are to be loaded by caller
+ *
+ * Keys which a worker fails to send back are left for the caller to load.
+ */
+
+long sort_workers (MAILSTREAM *stream,SORTCACHE **sc)
+{
+  int p[2];
+  int *fd;
+  pid_t *pid;
+  long r;
+  unsigned long i,j,k,m,n,per;
+  unsigned long *u;
+  char tmp[MAILTMPLEN];
+  STCBUFFER b;
+  searchworker_t sw;
+  SORTPGM *pgm = sc[0]->pgm;
+  if ((searchprocs < 2) || (pgm->nmsgs < 2 * SEARCHPROCMSGS) ||
+      !(sw = (searchworker_t) mail_parameters (stream,GET_SEARCHWORKER,NIL)))
+    return NIL;			/* not worth it or driver can't */
+				/* note messages without cached keys */
+  u = (unsigned long *) fs_get (pgm->nmsgs * sizeof (unsigned long));
+  for (i = m = 0; i < pgm->nmsgs; ++i) if (!mail_sort_loaded (sc[i])) u[m++] = i;
+  if (m < 2 * SEARCHPROCMSGS) {	/* not worth it */
+    fs_give ((void **) &u);
+    return NIL;
+  }
+  n = min (searchprocs,m / SEARCHPROCMSGS);
+  per = (m + n - 1) / n;
+  n = (m + per - 1) / per;
+  fd = (int *) fs_get (n * sizeof (int));
+  pid = (pid_t *) fs_get (n * sizeof (pid_t));
+  for (k = 0; k < n; ++k) {	/* start workers */
+    fd[k] = -1;
+    i = k * per;		/* first uncached message in slice */
+    j = min (per,m - i);
+    if (pipe (p)) pid[k] = 0;
+    else switch (pid[k] = fork ()) {
+    case -1:			/* failed, caller does this slice */
+      pid[k] = 0;
+      close (p[0]);
+      close (p[1]);
+      break;
+    case 0:			/* worker */
+      close (p[0]);		/* don't need other workers' pipes */
+      for (r = 0; r < (long) k; ++r) if (fd[r] >= 0) close (fd[r]);
+      _exit (sort_worker (stream,sc,u + i,j,sw,p[1]) ? 0 : 1);
+    default:			/* caller */
+      close (p[1]);
+      fd[k] = p[0];
+      break;
+    }
+  }
+  for (k = 0; k < n; ++k) {	/* collect slices in order */
+    if (fd[k] >= 0) {		/* read worker's keys */
+      memset (&b,0,sizeof (STCBUFFER));
+      while (((r = read (fd[k],tmp,MAILTMPLEN)) > 0) ||
+	     ((r < 0) && (errno == EINTR)))
+	if (r > 0) structcache_put (&b,tmp,r);
+      close (fd[k]);
+      i = k * per;
+      sort_worker_results (sc,u + i,min (per,m - i),&b);
+      if (b.s) fs_give ((void **) &b.s);
+    }
+    if (pid[k]) grim_pid_reap (pid[k],NIL);
+  }
+  fs_give ((void **) &pid);
+  fs_give ((void **) &fd);
+  fs_give ((void **) &u);
+  return LONGT;
+}
+
+/* Sort worker process
+ * Accepts: MAIL stream
+ *	    sortcache vector
+ *	    indices in vector of slice's messages
+ *	    number of messages in slice
+ *	    driver search worker routine
+ *	    pipe to write keys to
+ * Returns: T if keys loaded and written, NIL if failure
+ */
+
+static long sort_worker (MAILSTREAM *stream,SORTCACHE **sc,unsigned long *u,
+			 unsigned long j,searchworker_t sw,int fd)
+{
+  long ret;
+  SORTCACHE *s;
+  STCBUFFER b;
+  worker_init ();		/* detach from server */
+  if (!(*sw) (stream)) return NIL;
+  memset (&b,0,sizeof (STCBUFFER));
+  for (; j; --j) {		/* load and serialize each message's keys */
+    mail_sort_loadmsg (stream,s = sc[*u++]);
+    structcache_put_number (&b,s->date);
+    structcache_put_number (&b,s->arrival);
+    structcache_put_number (&b,s->size);
+    structcache_put_number (&b,s->refwd);
+    structcache_put_string (&b,s->from);
+    structcache_put_string (&b,s->to);
+    structcache_put_string (&b,s->cc);
+    structcache_put_string (&b,s->subject);
+  }
+  ret = (safe_write (fd,(char *) b.s,b.len) == (long) b.len) ? LONGT : NIL;
+  fs_give ((void **) &b.s);
+  return ret;
+}
+
+
+/* Sort worker store results
+ * Accepts: sortcache vector
+ *	    indices in vector of slice's messages
+ *	    number of messages in slice
+ *	    worker's serialized keys
+ */
+
+static void sort_worker_results (SORTCACHE **sc,unsigned long *u,
+				 unsigned long j,STCBUFFER *b)
+{
+  unsigned long date,arrival,size,refwd;
+  char *from,*to,*cc,*subject;
+  SORTCACHE *s;
+  STCPARSE p;
+  p.s = b->s;
+  p.end = b->s + b->len;
+  p.error = NIL;
+  for (; j && (p.s < p.end); --j) {
+    s = sc[*u++];
+    date = structcache_get_number (&p,'.');
+    arrival = structcache_get_number (&p,'.');
+    size = structcache_get_number (&p,'.');
+    refwd = structcache_get_number (&p,'.');
+    from = structcache_get_string (&p);
+    to = structcache_get_string (&p);
+    cc = structcache_get_string (&p);
+    subject = structcache_get_string (&p);
+    if (p.error) j = 1;		/* damaged, caller loads the rest */
+    else {			/* fill in keys not already known */
+      if (!s->date && date) s->date = date;
+      if (!s->arrival && arrival) s->arrival = arrival;
+      if (!s->size && size) s->size = size;
+      if (!s->from && from) s->from = from,from = NIL;
+      if (!s->to && to) s->to = to,to = NIL;
+      if (!s->cc && cc) s->cc = cc,cc = NIL;
+      if (!s->subject && subject) {
+	s->subject = subject,subject = NIL;
+	s->refwd = refwd ? T : NIL;
+      }
+      s->dirty = T;		/* keys to save */
+    }
+    if (from) fs_give ((void **) &from);
+    if (to) fs_give ((void **) &to);
+    if (cc) fs_give ((void **) &cc);
+    if (subject) fs_give ((void **) &subject);
+  }
+}
+
+
+/* Worker process initialization
+ */
+
+static void worker_init (void)
+{
+  int fd;
+				/* no server interrupt handling here */
+  arm_signal (SIGALRM,SIG_DFL);
+  arm_signal (SIGUSR2,SIG_DFL);
+  arm_signal (SIGHUP,SIG_DFL);
+  arm_signal (SIGPIPE,SIG_DFL);
+  arm_signal (SIGTERM,SIG_DFL);
+  arm_signal (SIGINT,SIG_DFL);
+				/* keep stray output away from client */
+  if ((fd = open ("/dev/null",O_RDWR,NIL)) >= 0) {
+    dup2 (fd,0);
+    dup2 (fd,1);
+    if (fd > 1) close (fd);
+  }
+}
+
 /* Wait for stdin input
  * Accepts: timeout in seconds
  * Returns: T if have input on stdin, else NIL
  */
 
 long server_input_wait (long seconds)
+{
+  return server_input_wait_fd (seconds,-1);
+}
+
+
+/* Wait for stdin input or activity on another descriptor
+ * Accepts: timeout in seconds
+ *	    additional descriptor to wait for, or -1 if none
+ * Returns: T if have input on stdin, -1 if descriptor readable, else NIL
+ */
+
+long server_input_wait_fd (long seconds,int fd)
 {
   int err;
   fd_set rfd,efd;
@@ -677,11 +1312,138 @@ long server_input_wait (long seconds)
     FD_ZERO (&efd);
     FD_SET (0,&rfd);
     FD_SET (0,&efd);
+    if (fd >= 0) FD_SET (fd,&rfd);
     tmo.tv_sec = seconds; tmo.tv_usec = 0;
-  } while (((err = select (1,&rfd,0,&efd,&tmo)) < 0) && (errno = EINTR));
-  return err ? LONGT : NIL;
+  } while (((err = select ((fd > 0) ? fd + 1 : 1,&rfd,0,&efd,&tmo)) < 0) &&
+	   (errno == EINTR));
+  if (err <= 0) return NIL;	/* timeout or error */
+				/* stdin takes precedence */
+  return (FD_ISSET (0,&rfd) || FD_ISSET (0,&efd)) ? LONGT : -1;
+}
+
+/* Watch files for changes
+ * Accepts: pointer to notification descriptor, or -1 if none yet
+ *	    NIL-terminated list of file names
+ *	    non-NIL to watch directory entries rather than file contents
+ * Returns: T if any changes were noted since the last call, else NIL
+ *
+ * The descriptor is created on the first call and becomes readable when any
+ * of the files changes.  Pending notifications are discarded, and the watches
+ * are renewed in case a file was replaced since the last call.
+ */
+
+long notify_watch (int *fd,char *files[],long dir)
+{
+  long ret = NIL;
+#ifdef HAVE_SYS_INOTIFY_H
+  int i;
+  char tmp[MAILTMPLEN];
+  if (*fd < 0) {		/* create descriptor if first time */
+    if ((*fd = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC)) < 0) return NIL;
+  }
+				/* discard pending notifications */
+  else while (((i = read (*fd,tmp,MAILTMPLEN)) > 0) ||
+	      ((i < 0) && (errno == EINTR))) if (i > 0) ret = T;
+  while (*files) inotify_add_watch (*fd,*files++,dir ?
+				    (IN_CREATE|IN_DELETE|IN_MOVED_FROM|
+				     IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF) :
+				    (IN_MODIFY|IN_DELETE_SELF|IN_MOVE_SELF));
+#endif
+  return ret;
 }
 
+/* Mailbox status via cache
+ * Accepts: mailbox name
+ *	    mailbox file name
+ *	    cache key function
+ *	    status flags
+ * Returns: T on success, NIL on failure
+ *
+ * The key is some summary of the mailbox file's state, such as its size and
+ * ctime, which changes whenever the status could.  Its last field must be
+ * the ctime, which opening the mailbox to fill a miss may itself change by
+ * resetting the access time; the entry is cached under the key after the
+ * open provided nothing but that field moved.
+ */
+
+long statuscache_status (char *mbx,char *file,statuskey_t keyf,long flags)
+{
+  MAILSTATUS status;
+  char key[MAILTMPLEN],tmp[MAILTMPLEN];
+  char *s;
+  char *k = (*keyf) (mbx,file,key);
+  if (!(k && statuscache_read (file,key,&status))) {
+    if (!mail_status_fill (NIL,mbx,SA_MESSAGES|SA_RECENT|SA_UNSEEN|SA_UIDNEXT|
+			   SA_UIDVALIDITY|SA_HIGHESTMODSEQ,&status))
+      return NIL;
+    if (k && (*keyf) (mbx,file,tmp) && (s = strrchr (tmp,':')) &&
+	!strncmp (key,tmp,++s - tmp)) statuscache_write (file,tmp,&status);
+  }
+  status.flags = flags;		/* return requested values */
+  MM_STATUS (NIL,mbx,&status);
+  return T;
+}
+
+
+/* Read mailbox status from cache
+ * Accepts: mailbox file name
+ *	    cache key
+ *	    status to return
+ * Returns: T if cached status with matching key found, else NIL
+ */
+
+long statuscache_read (char *file,char *key,MAILSTATUS *status)
+{
+  int fd;
+  FILE *f;
+  char tmp[MAILTMPLEN],buf[MAILTMPLEN];
+  long ret = NIL;
+  if (statusCache && sidecar_file (tmp,file,SIDECARSTATUS) &&
+      ((fd = sidecar_open (tmp,O_RDONLY)) >= 0)) {
+    if (!(f = fdopen (fd,"r"))) close (fd);
+    else {			/* key must match */
+      if (!flock (fd,LOCK_SH) && fgets (buf,MAILTMPLEN,f) &&
+	  (strlen (buf) == strlen (key) + 1) &&
+	  !strncmp (buf,key,strlen (key)) &&
+	  (fscanf (f,"%lu %lu %lu %lu %lu %lu",&status->messages,
+		   &status->recent,&status->unseen,&status->uidnext,
+		   &status->uidvalidity,&status->highestmodseq) == 6)) ret = T;
+      fclose (f);		/* also releases the lock */
+    }
+  }
+  return ret;
+}
+
+
+/* Write mailbox status to cache
+ * Accepts: mailbox file name
+ *	    cache key
+ *	    status to write
+ *
+ * The cache is a sidecar of the mailbox, so it is hidden from listings and
+ * follows the mailbox when renamed or deleted.  Failure is silent since this
+ * is only a cache.
+ */
+
+void statuscache_write (char *file,char *key,MAILSTATUS *status)
+{
+  int fd;
+  FILE *f;
+  char tmp[MAILTMPLEN];
+  if (statusCache && (strlen (key) < (MAILTMPLEN - 2)) &&
+      sidecar_file (tmp,file,SIDECARSTATUS) &&
+      ((fd = sidecar_open (tmp,O_WRONLY|O_CREAT)) >= 0)) {
+    if (!(f = fdopen (fd,"w"))) close (fd);
+    else {
+      if (!flock (fd,LOCK_EX) && !ftruncate (fd,0))
+	fprintf (f,"%s\n%lu %lu %lu %lu %lu %lu\n",key,status->messages,
+		 status->recent,status->unseen,status->uidnext,
+		 status->uidvalidity,status->highestmodseq);
+      fclose (f);		/* also releases the lock */
+    }
+  }
+}
+
 /* Return UNIX password entry for user name
  * Accepts: user name string
  * Returns: password entry
@@ -843,6 +1605,34 @@ long pw_login (struct passwd *pw,char *auser,char *user,char *home,int argc,
   endpwent ();			/* in case shadow passwords in pw data */
   return ret;			/* return status */
 }
+
+/* Do system-wide configuration
+ * Accepts: configuration file name
+ *
+ * Only settings that the server has no other way to get are read here, see
+ * imaprc.txt.  The file is ignored unless its first line is the enable string.
+ */
+
+static void dorc (char *file)
+{
+  char *s,*k,tmp[MAILTMPLEN];
+  FILE *f = fopen (file,"r");
+  if (!f) return;		/* no file is the normal case */
+  if (fgets (tmp,MAILTMPLEN,f) && !strncmp (tmp,"I accept the risk",17))
+    while (fgets (tmp,MAILTMPLEN,f)) {
+      if (s = strpbrk (tmp,"\015\012")) *s = '\0';
+				/* set <key> <value> */
+      if ((s = strtok (tmp," \t")) && !compare_cstring (s,"set") &&
+	  (k = strtok (NIL," \t")) && (s = strtok (NIL,"")) && *s) {
+	if (!compare_cstring (k,"search-processes"))
+	  mail_parameters (NIL,SET_SEARCHPROCS,(void *) strtol (s,NIL,10));
+	else if (!compare_cstring (k,"index-headers"))
+	  mail_parameters (NIL,SET_INDEXHEADERS,(void *) s);
+      }				/* unrecognized commands are ignored */
+    }
+  fclose (f);
+}
+
 
 /* Initialize environment
  * Accepts: user name (NIL for anonymous)
@@ -862,9 +1652,8 @@ long env_init (char *user,char *home)
   if (myUserName) fatal ("env_init called twice!");
 				/* initially nothing in namespace list */
   nslist[0] = nslist[1] = nslist[2] = NIL;
-                                /* myUserName must be set before (removed) */
-                                /* dorc() call */
   myUserName = cpystr (user ? user : ANONYMOUSUSER);
+  dorc (SYSCONFIG);		/* do system-wide configuration */
 				/* force default prototypes to be set */
   if (!createProto) createProto = &CREATEPROTO;
   if (!appendProto) appendProto = &EMPTYPROTO;
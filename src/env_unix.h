@@ -35,6 +35,11 @@ typedef struct dotlock_base {
 } DOTLOCK;
 
 
+/* Status cache key, returns NIL if mailbox too recently changed to cache */
+
+typedef char *(*statuskey_t) (char *mbx,char *file,char *key);
+
+
 /* Bits that can be set in restrictBox */
 
 #define RESTRICTROOT 0x1	/* restricted box doesn't allow root */
@@ -45,6 +50,16 @@ typedef struct dotlock_base {
 #define SUBSCRIPTIONFILE(t) sprintf (t,"%s/.mailboxlist",myhomedir ())
 #define SUBSCRIPTIONTEMP(t) sprintf (t,"%s/.mlbxlsttmp",myhomedir ())
 
+
+/* System-wide configuration file */
+
+#define SYSCONFIG "/etc/c-client.cf"
+
+
+/* Minimum messages per search worker process */
+
+#define SEARCHPROCMSGS 500
+
 /* Special users */
 
 #define ANONYMOUSUSER "nobody"	/* anonymous user */
@@ -91,5 +106,10 @@ long authserver_login (char *user,char *authuser,int argc,char *argv[]);
 char *mylocalhost ();
 long server_login (char *user,char *pwd,char *authuser,int argc,char *argv[]);
 long server_input_wait(long seconds);
+long server_input_wait_fd (long seconds,int fd);
+long notify_watch (int *fd,char *files[],long dir);
+long statuscache_status (char *mbx,char *file,statuskey_t keyf,long flags);
+long statuscache_read (char *file,char *key,MAILSTATUS *status);
+void statuscache_write (char *file,char *key,MAILSTATUS *status);
 
 #endif /* #ifndef _ENV_UNIX_H_ */
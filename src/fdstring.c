@@ -37,11 +37,13 @@
 static void fd_string_init (STRING *s,void *data,unsigned long size);
 static char fd_string_next (STRING *s);
 static void fd_string_setpos (STRING *s,unsigned long i);
+static int fd_string_fd (STRING *s,unsigned long *offset);
 
 STRINGDRIVER fd_string = {
   fd_string_init,		/* initialize string structure */
   fd_string_next,		/* get next byte in string structure */
-  fd_string_setpos		/* set position in string structure */
+  fd_string_setpos,		/* set position in string structure */
+  fd_string_fd			/* get file descriptor of string */
 };
 
 
@@ -98,3 +100,16 @@ static void fd_string_setpos (STRING *s,unsigned long i)
     read ((long) s->data,s->curpos,(size_t) s->cursize);
   }
 }
+
+
+/* Get file descriptor of fd stringstruct
+ * Accepts: string structure
+ *	    pointer to return file offset of current position
+ * Returns: file descriptor
+ */
+
+static int fd_string_fd (STRING *s,unsigned long *offset)
+{
+  *offset = s->data1 + GETPOS (s);
+  return (int) (long) s->data;
+}
@@ -36,11 +36,13 @@
 static void file_string_init (STRING *s,void *data,unsigned long size);
 static char file_string_next (STRING *s);
 static void file_string_setpos (STRING *s,unsigned long i);
+static int file_string_fd (STRING *s,unsigned long *offset);
 
 STRINGDRIVER file_string = {
   file_string_init,		/* initialize string structure */
   file_string_next,		/* get next byte in string structure */
-  file_string_setpos		/* set position in string structure */
+  file_string_setpos,		/* set position in string structure */
+  file_string_fd		/* get file descriptor of string */
 };
 
 
@@ -89,3 +91,17 @@ static void file_string_setpos (STRING *s,unsigned long i)
   s->chunk = s->curpos = (char *) &s->data1;
   *s->curpos = (char) getc ((FILE *) s->data);
 }
+
+
+/* Get file descriptor of string
+ * Accepts: string structure
+ *	    pointer to return file offset of current position
+ * Returns: file descriptor
+ */
+
+static int file_string_fd (STRING *s,unsigned long *offset)
+{
+  fflush ((FILE *) s->data);	/* make sure file is current */
+  *offset = GETPOS (s);
+  return fileno ((FILE *) s->data);
+}
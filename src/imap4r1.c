@@ -298,9 +298,12 @@ DRIVER imapdriver = {
   imap_sort,			/* sort messages */
   imap_thread,			/* thread messages */
   imap_ping,			/* ping mailbox to see if still alive */
+  NIL,				/* watch mailbox for changes */
+  NIL,				/* highest modseq */
   imap_check,			/* check for new messages */
   imap_expunge,			/* expunge deleted messages */
   imap_copy,			/* copy messages to another mailbox */
+  NIL,				/* move messages to another mailbox */
   imap_append,			/* append string message to mailbox */
   imap_gc			/* garbage collect stream */
 };
@@ -740,6 +743,8 @@ long imap_status (MAILSTREAM *stream,char *mbx,long flags)
     if (flags & SA_UNSEEN) strcat (tmp," UNSEEN");
     if (flags & SA_UIDNEXT) strcat (tmp," UIDNEXT");
     if (flags & SA_UIDVALIDITY) strcat (tmp," UIDVALIDITY");
+    if ((flags & SA_HIGHESTMODSEQ) && LEVELCONDSTORE (stream))
+      strcat (tmp," HIGHESTMODSEQ");
     tmp[0] = '(';
     strcat (tmp,")");
 				/* send "STATUS mailbox flag" */
@@ -754,7 +759,7 @@ long imap_status (MAILSTREAM *stream,char *mbx,long flags)
 				/* IMAP2 way */
   else if (imap_OK (stream,imap_send (stream,"EXAMINE",args))) {
     MAILSTATUS status;
-    status.flags = flags & ~ (SA_UIDNEXT | SA_UIDVALIDITY);
+    status.flags = flags & ~ (SA_UIDNEXT | SA_UIDVALIDITY | SA_HIGHESTMODSEQ);
     status.messages = stream->nmsgs;
     status.recent = stream->recent;
     status.unseen = 0;
@@ -3963,7 +3968,7 @@ void imap_parse_unsolicited (MAILSTREAM *stream,IMAPPARSEDREPLY *reply)
       *s = '\0';		/* tie off status data */
 				/* initialize data block */
       status.flags = status.messages = status.recent = status.unseen =
-	status.uidnext = status.uidvalidity = 0;
+	status.uidnext = status.uidvalidity = status.highestmodseq = 0;
       while (*txt && (s = strchr (txt,' '))) {
 	*s++ = '\0';		/* tie off status attribute name */
 				/* get attribute value */
@@ -3987,6 +3992,10 @@ void imap_parse_unsolicited (MAILSTREAM *stream,IMAPPARSEDREPLY *reply)
 	else if (!compare_cstring (txt,"UIDVALIDITY")) {
 	  status.flags |= SA_UIDVALIDITY;
 	  status.uidvalidity = i;
+	}
+	else if (!compare_cstring (txt,"HIGHESTMODSEQ")) {
+	  status.flags |= SA_HIGHESTMODSEQ;
+	  status.highestmodseq = i;
 	}
 				/* next attribute */
 	txt = (*s == ' ') ? s + 1 : s;
@@ -0,0 +1,741 @@
+/*
+ * Program:	IMAP server load generator
+ *
+ * Date:	16 October 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+
+/* Spawns a number of pre-authenticated imapd processes, each over its own
+ * socketpair and against its own generated mailbox, and replays a weighted
+ * random mix of commands on each.  Reports per-command throughput, latency
+ * percentiles, and response bandwidth.
+ *
+ * imapd pre-authenticates when run by an ordinary user, using $HOME for the
+ * mailbox directory; hence this program must not be run as root.
+ *
+ * With -S all clients open the same mailbox; this needs a format that
+ * permits concurrent read-write sessions, e.g. -f mix.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NIL 0
+#define T 1
+
+#define BENCHMBX "bench"	/* name of generated mailbox */
+#define BENCHBUFLEN 65536	/* size of response input buffer */
+
+
+/* Command types */
+
+#define BC_SELECT 0		/* re-select the mailbox */
+#define BC_FETCH 1		/* fetch envelopes of a range */
+#define BC_SEARCH 2		/* UID SEARCH on assorted criteria */
+#define BC_STORE 3		/* change a flag */
+#define BC_APPEND 4		/* append a new message */
+#define BC_IDLE 5		/* brief IDLE */
+#define NBENCHCMDS 6
+
+static char *cmdnames[NBENCHCMDS] = {
+  "select","fetch","search","store","append","idle"
+};
+
+static unsigned long weights[NBENCHCMDS] = {
+  1,10,5,5,2,1			/* default command mix */
+};
+
+
+/* Words for subjects and bodies */
+
+static char *words[] = {
+  "alpha","bravo","charlie","delta","echo","foxtrot","golf","hotel",
+  "india","juliet","kilo","lima","mike","november","oscar","papa",
+  "quebec","romeo","sierra","tango","uniform","victor","whiskey","xray",
+  "yankee","zulu","meeting","report","budget","invoice","lunch","release"
+};
+
+#define NWORDS (sizeof (words) / sizeof (words[0]))
+
+/* Benchmark parameters */
+
+typedef struct bench_params {
+  char *server;			/* path of imapd */
+  char *dir;			/* working directory */
+  char *format;			/* mailbox format */
+  unsigned long clients;	/* number of concurrent clients */
+  unsigned long commands;	/* commands per client */
+  unsigned long messages;	/* messages per generated mailbox */
+  unsigned long bodysize;	/* approximate body size of each message */
+  unsigned long range;		/* messages per FETCH */
+  unsigned long idle;		/* msec to stay in IDLE */
+  int shared;			/* all clients use the same mailbox */
+  int keep;			/* keep working directory */
+} BENCHPARAMS;
+
+
+/* Result of one command, as written by a client */
+
+typedef struct bench_result {
+  int type;			/* command type */
+  unsigned long usec;		/* latency */
+  unsigned long bytes;		/* bytes of response */
+} BENCHRESULT;
+
+
+/* Buffered server connection */
+
+typedef struct bench_io {
+  pid_t pid;			/* server process */
+  int fd;			/* socket */
+  char *ptr;			/* current input pointer */
+  long cnt;			/* bytes remaining in buffer */
+  unsigned long bytes;		/* bytes read so far */
+  unsigned long exists;		/* last reported message count */
+  char head[64];		/* start of last response line */
+  char buf[BENCHBUFLEN];	/* input buffer */
+} BENCHIO;
+
+
+/* Function prototypes */
+
+int main (int argc,char *argv[]);
+void bench_usage (char *pgm);
+int bench_mix (char *s);
+int bench_mailbox (char *home,BENCHPARAMS *bp,unsigned int seed);
+char *bench_message (char *s,unsigned long n,unsigned long size,
+		     unsigned int *seed,char *nl);
+int bench_client (BENCHPARAMS *bp,unsigned long n,char *home,char *result);
+BENCHIO *bench_open (BENCHPARAMS *bp,char *home);
+void bench_close (BENCHIO *io);
+int bench_command (BENCHIO *io,BENCHPARAMS *bp,int type,unsigned long seq,
+		   unsigned int *seed,char *msg,unsigned long *usec);
+int bench_send (BENCHIO *io,char *s,size_t len);
+int bench_getc (BENCHIO *io);
+int bench_line (BENCHIO *io,char *tag);
+int bench_response (BENCHIO *io,char *tag);
+unsigned long bench_usec (struct timespec *start);
+void bench_report (BENCHPARAMS *bp,double elapsed);
+int bench_compare (const void *a,const void *b);
+void bench_cleanup (char *dir);
+
+/* Main program
+ * Accepts: argument count
+ *	    argument vector
+ * Returns: exit status
+ */
+
+int main (int argc,char *argv[])
+{
+  BENCHPARAMS bp;
+  struct timespec start;
+  char home[1024],result[1024],tmpl[64];
+  unsigned long i,failed = 0;
+  pid_t *pids;
+  int c,status;
+  memset (&bp,0,sizeof (BENCHPARAMS));
+  bp.server = "./imapd";
+  bp.format = "unix";
+  bp.clients = 4;
+  bp.commands = 200;
+  bp.messages = 1000;
+  bp.bodysize = 2048;
+  bp.range = 50;
+  bp.idle = 100;
+  while ((c = getopt (argc,argv,"s:d:f:c:n:m:b:r:i:x:Sk")) != -1) switch (c) {
+  case 's': bp.server = optarg; break;
+  case 'd': bp.dir = optarg; break;
+  case 'f': bp.format = optarg; break;
+  case 'c': bp.clients = strtoul (optarg,NIL,10); break;
+  case 'n': bp.commands = strtoul (optarg,NIL,10); break;
+  case 'm': bp.messages = strtoul (optarg,NIL,10); break;
+  case 'b': bp.bodysize = strtoul (optarg,NIL,10); break;
+  case 'r': bp.range = strtoul (optarg,NIL,10); break;
+  case 'i': bp.idle = strtoul (optarg,NIL,10); break;
+  case 'x':
+    if (!bench_mix (optarg)) {
+      fprintf (stderr,"%s: bad command mix: %s\n",argv[0],optarg);
+      return 1;
+    }
+    break;
+  case 'S': bp.shared = T; break;
+  case 'k': bp.keep = T; break;
+  default:
+    bench_usage (argv[0]);
+    return 1;
+  }
+  if ((optind < argc) || !bp.clients || !bp.messages || !bp.range) {
+    bench_usage (argv[0]);
+    return 1;
+  }
+  if (!geteuid ()) {		/* root gets a login prompt, not PREAUTH */
+    fprintf (stderr,"%s: must not be run as root\n",argv[0]);
+    return 1;
+  }
+  if (access (bp.server,X_OK)) {
+    fprintf (stderr,"%s: can't execute %s: %s\n",argv[0],bp.server,
+	     strerror (errno));
+    return 1;
+  }
+  if (bp.dir) bp.keep = T;	/* never remove caller's directory */
+  else if (!(bp.dir = mkdtemp (strcpy (tmpl,"/tmp/imapbench.XXXXXX")))) {
+    fprintf (stderr,"%s: can't create working directory: %s\n",argv[0],
+	     strerror (errno));
+    return 1;
+  }
+  signal (SIGPIPE,SIG_IGN);	/* report dead servers as errors */
+				/* generate mailboxes */
+  for (i = 0; i < (bp.shared ? 1 : bp.clients); i++) {
+    sprintf (home,"%.900s/c%lu",bp.dir,i);
+    if ((mkdir (home,0700) && (errno != EEXIST)) ||
+	!bench_mailbox (home,&bp,(unsigned int) i + 1)) {
+      fprintf (stderr,"%s: can't create mailbox in %s: %s\n",argv[0],home,
+	       strerror (errno));
+      if (!bp.keep) bench_cleanup (bp.dir);
+      return 1;
+    }
+  }
+
+  printf ("%lu clients, %lu commands each, %lu %s messages of %lu bytes%s\n",
+	  bp.clients,bp.commands,bp.messages,bp.format,bp.bodysize,
+	  bp.shared ? ", shared mailbox" : "");
+  fflush (stdout);		/* don't duplicate in children */
+  pids = (pid_t *) malloc (bp.clients * sizeof (pid_t));
+  clock_gettime (CLOCK_MONOTONIC,&start);
+  for (i = 0; i < bp.clients; i++) {
+    sprintf (home,"%.900s/c%lu",bp.dir,bp.shared ? 0 : i);
+    sprintf (result,"%.900s/r%lu",bp.dir,i);
+    if (!(pids[i] = fork ())) _exit (bench_client (&bp,i,home,result));
+    else if (pids[i] < 0) {
+      perror ("fork");
+      failed++;
+    }
+  }
+  for (i = 0; i < bp.clients; i++) if (pids[i] > 0) {
+    while ((waitpid (pids[i],&status,0) < 0) && (errno == EINTR));
+    if (!WIFEXITED (status) || WEXITSTATUS (status)) failed++;
+  }
+  free (pids);
+  bench_report (&bp,bench_usec (&start) / 1000000.0);
+  if (failed) fprintf (stderr,"%lu client(s) failed\n",failed);
+  if (bp.keep) printf ("working directory kept in %s\n",bp.dir);
+  else bench_cleanup (bp.dir);
+  return failed ? 1 : 0;
+}
+
+
+/* Show usage
+ * Accepts: program name
+ */
+
+void bench_usage (char *pgm)
+{
+  fprintf (stderr,"usage: %s [-s imapd] [-d dir] [-f format] [-c clients]"
+	   " [-n commands]\n\t[-m messages] [-b bodysize] [-r fetchrange]"
+	   " [-i idlemsec] [-x mix] [-S] [-k]\n",pgm);
+  fprintf (stderr,"mix is a list such as fetch=10,search=5,store=5,append=2,"
+	   "idle=1,select=1\n");
+}
+
+
+/* Parse command mix
+ * Accepts: mix string
+ * Returns: T if success, NIL if bogus
+ */
+
+int bench_mix (char *s)
+{
+  char *t,*v;
+  int i;
+  unsigned long total = 0;
+  unsigned long w[NBENCHCMDS];
+  memset (w,0,sizeof (w));	/* unmentioned commands are not done */
+  for (t = strtok (s,","); t; t = strtok (NIL,",")) {
+    if (!(v = strchr (t,'='))) return NIL;
+    *v++ = '\0';
+    for (i = 0; (i < NBENCHCMDS) && strcmp (t,cmdnames[i]); i++);
+    if (i == NBENCHCMDS) return NIL;
+    total += w[i] = strtoul (v,NIL,10);
+  }
+  if (!total) return NIL;
+  memcpy (weights,w,sizeof (w));
+  return T;
+}
+
+/* Generate mailbox
+ * Accepts: home directory
+ *	    benchmark parameters
+ *	    random seed
+ * Returns: T if success, NIL if failure
+ *
+ * A UNIX mailbox is written directly, any other format is created by the
+ * server and filled by APPEND.
+ */
+
+int bench_mailbox (char *home,BENCHPARAMS *bp,unsigned int seed)
+{
+  BENCHIO *io;
+  FILE *f;
+  unsigned long i;
+  size_t len;
+  int ret = T;
+  char *msg = (char *) malloc (bp->bodysize + 1024);
+  char file[1024];
+  if (strcmp (bp->format,"unix")) {
+    if (!(io = bench_open (bp,home))) ret = NIL;
+    else {
+      sprintf (file,"C CREATE #driver.%.80s/%s\r\n",bp->format,BENCHMBX);
+      if (!bench_send (io,file,strlen (file)) ||
+	  (bench_response (io,"C ") != T)) ret = NIL;
+      for (i = 1; ret && (i <= bp->messages); i++) {
+	len = bench_message (msg,i,bp->bodysize,&seed,"\r\n") - msg;
+	sprintf (file,"A APPEND %s {%lu+}\r\n",BENCHMBX,(unsigned long) len);
+	if (!(bench_send (io,file,strlen (file)) && bench_send (io,msg,len) &&
+	      bench_send (io,"\r\n",2)) || (bench_response (io,"A ") != T))
+	  ret = NIL;
+      }
+      bench_close (io);
+    }
+  }
+  else if (!(f = fopen ((sprintf (file,"%.900s/%s",home,BENCHMBX),file),"w")))
+    ret = NIL;
+  else {
+    for (i = 1; ret && (i <= bp->messages); i++) {
+      bench_message (msg,i,bp->bodysize,&seed,"\n");
+      if ((fprintf (f,"From bench@example.com Mon Jan  3 10:00:00 2022\n") < 0)
+	  || (fputs (msg,f) == EOF) || (putc ('\n',f) == EOF)) ret = NIL;
+    }
+    if (fclose (f)) ret = NIL;
+  }
+  free (msg);
+  return ret;
+}
+
+
+/* Generate message text
+ * Accepts: destination buffer, must be at least size + 1024 bytes
+ *	    message number
+ *	    approximate body size
+ *	    pointer to random seed
+ *	    newline string
+ * Returns: end of generated text
+ */
+
+char *bench_message (char *s,unsigned long n,unsigned long size,
+		     unsigned int *seed,char *nl)
+{
+  char *body,*line;
+  char *w;
+  s += sprintf (s,"Date: Mon, 3 Jan 2022 %02lu:%02lu:00 +0000%s",
+		(n / 60) % 24,n % 60,nl);
+  s += sprintf (s,"From: Sender %lu <sender%lu@example.com>%s",n % 50,n % 50,
+		nl);
+  s += sprintf (s,"To: bench@example.com%s",nl);
+  s += sprintf (s,"Subject: %s %s %s number %lu%s",
+		words[rand_r (seed) % NWORDS],words[rand_r (seed) % NWORDS],
+		words[rand_r (seed) % NWORDS],n,nl);
+  s += sprintf (s,"Message-ID: <%lu.%u@bench.example.com>%s%s",n,*seed,nl,nl);
+				/* body of ~72 character lines */
+  for (body = line = s; (unsigned long) (s - body) < size;) {
+    if (s > line) *s++ = ' ';	/* delimit words */
+    for (w = words[rand_r (seed) % NWORDS]; *w; *s++ = *w++);
+    if ((s - line) >= 72) line = s += sprintf (s,"%s",nl);
+  }
+  if (s > line) s += sprintf (s,"%s",nl);
+  return s;
+}
+
+/* Run one client
+ * Accepts: benchmark parameters
+ *	    client number
+ *	    home directory
+ *	    result file
+ * Returns: exit status
+ */
+
+int bench_client (BENCHPARAMS *bp,unsigned long n,char *home,char *result)
+{
+  BENCHIO *io;
+  BENCHRESULT r;
+  FILE *f;
+  unsigned long i,j,w,total;
+  unsigned int seed = (unsigned int) (n * 7919 + 17);
+  int ret = 0;
+  char *msg;
+  if (!(f = fopen (result,"w"))) {
+    perror (result);
+    return 1;
+  }
+  if (!(io = bench_open (bp,home))) {
+    fclose (f);
+    return 1;
+  }
+  msg = (char *) malloc (bp->bodysize + 1024);
+  for (total = 0, j = 0; j < NBENCHCMDS; j++) total += weights[j];
+				/* always start with a SELECT */
+  for (i = 0; !ret && (i <= bp->commands); i++) {
+    if (!i) r.type = BC_SELECT;
+    else for (w = rand_r (&seed) % total, r.type = 0;
+	      w >= weights[r.type]; w -= weights[r.type++]);
+    r.bytes = io->bytes;
+    if (bench_command (io,bp,r.type,i,&seed,msg,&r.usec) != T) {
+      fprintf (stderr,"client %lu: %s failed: %s",n,cmdnames[r.type],io->head);
+      ret = 1;
+    }
+    r.bytes = io->bytes - r.bytes;
+    if (i && (fwrite (&r,sizeof (BENCHRESULT),1,f) != 1)) ret = 1;
+  }
+  bench_close (io);
+  if (fclose (f)) ret = 1;
+  free (msg);
+  return ret;
+}
+
+
+/* Start a pre-authenticated server
+ * Accepts: benchmark parameters
+ *	    home directory
+ * Returns: server connection, or NIL if failure
+ */
+
+BENCHIO *bench_open (BENCHPARAMS *bp,char *home)
+{
+  BENCHIO *io;
+  pid_t pid;
+  int sv[2];
+  if (socketpair (AF_UNIX,SOCK_STREAM,0,sv)) {
+    perror ("socketpair");
+    return NIL;
+  }
+  if (!(pid = fork ())) {	/* server side */
+    int fd = open ("/dev/null",O_WRONLY);
+    dup2 (sv[1],0);
+    dup2 (sv[1],1);
+    if (fd >= 0) dup2 (fd,2);
+    close (sv[0]);
+    close (sv[1]);
+    setenv ("HOME",home,T);
+    execl (bp->server,bp->server,(char *) NIL);
+    _exit (127);
+  }
+  close (sv[1]);
+  if (pid < 0) {
+    perror ("fork");
+    close (sv[0]);
+    return NIL;
+  }
+  io = (BENCHIO *) calloc (1,sizeof (BENCHIO));
+  io->pid = pid;
+  io->fd = sv[0];
+				/* must be pre-authenticated */
+  if (bench_line (io,"* PREAUTH ") != T) {
+    fprintf (stderr,"server did not pre-authenticate\n");
+    bench_close (io);
+    return NIL;
+  }
+  return io;
+}
+
+
+/* Stop a server
+ * Accepts: server connection
+ */
+
+void bench_close (BENCHIO *io)
+{
+  int status;
+  if (bench_send (io,"Z LOGOUT\r\n",10)) bench_response (io,"Z ");
+  close (io->fd);
+  while ((waitpid (io->pid,&status,0) < 0) && (errno == EINTR));
+  free (io);
+}
+
+/* Run one command
+ * Accepts: server connection
+ *	    benchmark parameters
+ *	    command type
+ *	    command sequence number
+ *	    pointer to random seed
+ *	    message buffer
+ *	    where to return latency
+ * Returns: T if OK, NIL if NO or BAD, -1 if connection lost
+ */
+
+int bench_command (BENCHIO *io,BENCHPARAMS *bp,int type,unsigned long seq,
+		   unsigned int *seed,char *msg,unsigned long *usec)
+{
+  struct timespec start;
+  struct timespec pause;
+  unsigned long i,j;
+  size_t len = 0;
+  int ret;
+  char tag[32],cmd[1024];
+  sprintf (tag,"A%lu ",seq);
+  switch (type) {
+  case BC_SELECT:
+    sprintf (cmd,"%sSELECT %s\r\n",tag,BENCHMBX);
+    break;
+  case BC_FETCH:
+    i = (io->exists > bp->range) ?
+      1 + rand_r (seed) % (io->exists - bp->range + 1) : 1;
+    j = i + bp->range - 1;
+    sprintf (cmd,"%sFETCH %lu:%lu (ENVELOPE)\r\n",tag,i,j);
+    break;
+  case BC_SEARCH:
+    switch (rand_r (seed) % 4) {
+    case 0:
+      sprintf (cmd,"%sUID SEARCH SUBJECT %s\r\n",tag,
+	       words[rand_r (seed) % NWORDS]);
+      break;
+    case 1:
+      sprintf (cmd,"%sUID SEARCH FROM sender%u\r\n",tag,rand_r (seed) % 50);
+      break;
+    case 2:
+      sprintf (cmd,"%sUID SEARCH UNSEEN\r\n",tag);
+      break;
+    default:
+      sprintf (cmd,"%sUID SEARCH BODY %s\r\n",tag,
+	       words[rand_r (seed) % NWORDS]);
+      break;
+    }
+    break;
+  case BC_STORE:
+    sprintf (cmd,"%sSTORE %lu %cFLAGS (%s)\r\n",tag,
+	     io->exists ? 1 + rand_r (seed) % io->exists : 1,
+	     (rand_r (seed) % 2) ? '+' : '-',
+	     (rand_r (seed) % 2) ? "\\Seen" : "\\Flagged");
+    break;
+  case BC_APPEND:
+    len = bench_message (msg,bp->messages + seq,bp->bodysize,seed,"\r\n") -
+      msg;
+    sprintf (cmd,"%sAPPEND %s {%lu+}\r\n",tag,BENCHMBX,(unsigned long) len);
+    break;
+  case BC_IDLE:
+    sprintf (cmd,"%sIDLE\r\n",tag);
+    break;
+  }
+  clock_gettime (CLOCK_MONOTONIC,&start);
+  if (!bench_send (io,cmd,strlen (cmd))) return -1;
+  switch (type) {
+  case BC_APPEND:		/* send the literal */
+    if (!bench_send (io,msg,len) || !bench_send (io,"\r\n",2)) return -1;
+    break;
+  case BC_IDLE:			/* wait for continuation */
+    if (bench_line (io,"+") != T) return -1;
+    *usec = bench_usec (&start);
+    pause.tv_sec = bp->idle / 1000;
+    pause.tv_nsec = (bp->idle % 1000) * 1000000;
+    while (nanosleep (&pause,&pause) && (errno == EINTR));
+    clock_gettime (CLOCK_MONOTONIC,&start);
+    if (!bench_send (io,"DONE\r\n",6)) return -1;
+    ret = bench_response (io,tag);
+    *usec += bench_usec (&start);
+    return ret;
+  }
+  ret = bench_response (io,tag);
+  *usec = bench_usec (&start);
+  return ret;
+}
+
+/* Send data to server
+ * Accepts: server connection
+ *	    data
+ *	    length of data
+ * Returns: T if success, NIL if failure
+ */
+
+int bench_send (BENCHIO *io,char *s,size_t len)
+{
+  ssize_t i;
+  while (len) {
+    if ((i = write (io->fd,s,len)) > 0) s += i,len -= i;
+    else if ((i < 0) && (errno == EINTR)) continue;
+    else return NIL;
+  }
+  return T;
+}
+
+
+/* Get character from server
+ * Accepts: server connection
+ * Returns: character or EOF
+ */
+
+int bench_getc (BENCHIO *io)
+{
+  while (io->cnt <= 0) {
+    if ((io->cnt = read (io->fd,io->ptr = io->buf,BENCHBUFLEN)) > 0)
+      io->bytes += io->cnt;
+    else if ((io->cnt < 0) && (errno == EINTR)) continue;
+    else return EOF;
+  }
+  io->cnt--;
+  return (unsigned char) *io->ptr++;
+}
+
+/* Read one response line, skipping literals
+ * Accepts: server connection
+ *	    prefix to look for
+ * Returns: T if line starts with prefix, NIL if not, -1 if connection lost
+ *
+ * Any literal is skipped and the line continues after it, so a literal can't
+ * be mistaken for a tagged response.  Untagged EXISTS is noted.
+ */
+
+int bench_line (BENCHIO *io,char *prefix)
+{
+  char *head = io->head;
+  char tail[32];
+  size_t i = 0;
+  size_t len = strlen (prefix);
+  unsigned long n,k = 0;
+  int c;
+  char *s;
+  for (;;) {			/* read line, remembering head and tail */
+    if ((c = bench_getc (io)) == EOF) return -1;
+    if (i < sizeof (io->head) - 1) head[i++] = c;
+    memmove (tail,tail + 1,sizeof (tail) - 1);
+    tail[sizeof (tail) - 1] = c;
+    if (k < sizeof (tail)) k++;
+    if (c != '\n') continue;
+				/* literal at end of line? */
+    if ((k >= 4) && (tail[sizeof (tail) - 2] == '\r') &&
+	(tail[sizeof (tail) - 3] == '}')) {
+      for (s = tail + sizeof (tail) - 4;
+	   (s > tail + sizeof (tail) - k) && isdigit ((unsigned char) *s); s--);
+      if ((*s == '{') && (s < tail + sizeof (tail) - 4)) {
+	for (n = strtoul (s + 1,NIL,10); n; n--)
+	  if (bench_getc (io) == EOF) return -1;
+	k = 0;			/* line continues after literal */
+	continue;
+      }
+    }
+    break;
+  }
+  head[i] = '\0';
+  if ((head[0] == '*') && (head[1] == ' ') && isdigit ((unsigned char) head[2])
+      && (s = strchr (head + 2,' ')) && !strncmp (s," EXISTS",7))
+    io->exists = strtoul (head + 2,NIL,10);
+  return strncmp (head,prefix,len) ? NIL : T;
+}
+
+
+/* Read a tagged response
+ * Accepts: server connection
+ *	    tag with trailing space
+ * Returns: T if OK, NIL if NO or BAD, -1 if connection lost
+ */
+
+int bench_response (BENCHIO *io,char *tag)
+{
+  int i;
+  while (!(i = bench_line (io,tag)));
+  if (i < 0) return -1;
+  return strncmp (io->head + strlen (tag),"OK ",3) ? NIL : T;
+}
+
+/* Microseconds elapsed
+ * Accepts: start time
+ * Returns: microseconds since start
+ */
+
+unsigned long bench_usec (struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC,&now);
+  return (now.tv_sec - start->tv_sec) * 1000000 +
+    (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+/* Report results
+ * Accepts: benchmark parameters
+ *	    elapsed seconds
+ */
+
+void bench_report (BENCHPARAMS *bp,double elapsed)
+{
+  FILE *f;
+  BENCHRESULT r;
+  unsigned long i,j,k,n[NBENCHCMDS + 1];
+  unsigned long *lat[NBENCHCMDS + 1];
+  double b[NBENCHCMDS + 1];
+  char result[1024];
+  size_t max = bp->clients * bp->commands;
+  for (j = 0; j <= NBENCHCMDS; j++) {
+    lat[j] = (unsigned long *) malloc ((max + 1) * sizeof (unsigned long));
+    n[j] = 0;
+    b[j] = 0;
+  }
+  for (i = 0; i < bp->clients; i++) {
+    sprintf (result,"%.900s/r%lu",bp->dir,i);
+    if (f = fopen (result,"r")) {
+      while (fread (&r,sizeof (BENCHRESULT),1,f) == 1) {
+	lat[r.type][n[r.type]++] = lat[NBENCHCMDS][n[NBENCHCMDS]++] = r.usec;
+	b[r.type] += r.bytes;
+	b[NBENCHCMDS] += r.bytes;
+      }
+      fclose (f);
+    }
+  }
+  printf ("%.2f seconds elapsed\n",elapsed);
+  printf ("%-8s %8s %10s %10s %10s %12s\n","command","count","cmds/s",
+	  "p50 ms","p99 ms","KB/s");
+  for (j = 0; j <= NBENCHCMDS; j++) {
+    if (k = n[j]) {
+      qsort (lat[j],k,sizeof (unsigned long),bench_compare);
+      printf ("%-8s %8lu %10.1f %10.3f %10.3f %12.1f\n",
+	      (j < NBENCHCMDS) ? cmdnames[j] : "total",k,k / elapsed,
+	      lat[j][(k - 1) * 50 / 100] / 1000.0,
+	      lat[j][(k - 1) * 99 / 100] / 1000.0,b[j] / 1024.0 / elapsed);
+    }
+    free (lat[j]);
+  }
+}
+
+
+/* Compare latencies for qsort()
+ * Accepts: first latency
+ *	    second latency
+ * Returns: negative, zero, or positive
+ */
+
+int bench_compare (const void *a,const void *b)
+{
+  unsigned long i = *(unsigned long *) a;
+  unsigned long j = *(unsigned long *) b;
+  return (i < j) ? -1 : ((i > j) ? 1 : 0);
+}
+
+
+/* Remove working directory
+ * Accepts: directory name
+ */
+
+void bench_cleanup (char *dir)
+{
+  pid_t pid;
+  int status;
+  if (!(pid = fork ())) {
+    execlp ("rm","rm","-rf",dir,(char *) NIL);
+    _exit (127);
+  }
+  if (pid > 0) while ((waitpid (pid,&status,0) < 0) && (errno == EINTR));
+}
@@ -33,9 +33,15 @@
 #include <time.h>
 #include <limits.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
 #include "c-client.h"
+#include "fdstring.h"
 #include "newsrc.h"
 #include "config.h"
+#ifdef HAVE_MALLOC_TRIM
+#include <malloc.h>
+#endif
 
 #define CRLF PSOUT ("\015\012") /* primary output terpri */
 
@@ -54,6 +60,26 @@
 #define SIGNALTIMER 10 MINUTES  /* allocated time to die at signal */
 
 
+/* Standalone daemon defaults */
+
+#define DAEMONWORKERS 4         /* number of pre-forked workers */
+#define DAEMONSESSIONS 100      /* sessions before a worker is recycled */
+
+
+/* Command latency trace */
+
+#define TRACESIZE 64            /* number of commands remembered */
+#define TRACESLOW 1000          /* msec of work after which trace is logged */
+#define TRACEDEPTH 8            /* depth of nested blocking operations */
+
+#define TRACE_SERVER 0          /* in imapd itself */
+#define TRACE_DRIVER 1          /* in mailbox driver calls */
+#define TRACE_FLUSH 2           /* writing output to the network */
+#define TRACE_LOCK 3            /* waiting for a mailbox lock */
+#define TRACE_INPUT 4           /* waiting for network input */
+#define NTRACEPHASES 5
+
+
 #define MAXNLIBADCOMMAND 3      /* limit on number of NLI bad commands */
 #define MAXTAG 50               /* maximum tag length */
 #define LITSTKLEN 20            /* length of literal stack */
@@ -63,7 +89,12 @@
 #define MAXAPPENDTXT 0x40000000 /* maximum APPEND literal size
                                  * must be smaller than 4294967295
                                  */
+#define APPENDSPOOL 0x100000    /* APPEND literals larger than this are
+                                 * spooled to a scratch file
+                                 */
+#define SPOOLCHUNK 65536        /* read chunk size of spooled literal */
 #define CMDLEN 65536            /* size of command buffer */
+#define MINSENDFILE 16384       /* smallest text worth sending from file */
 
 
 /* Server states */
@@ -90,6 +121,24 @@ typedef struct text_args {
 #define FTB_SIZE 0x2            /* fetch size only */
 
 
+/* Window of decoded binary data to output */
+
+typedef struct binary_window {
+  unsigned long skip;           /* octets to skip */
+  unsigned long size;           /* octets still to output */
+  int error;                    /* non-zero if output failed */
+} BINARYWINDOW;
+
+
+/* Search return options */
+
+#define SR_MIN 0x1              /* lowest match */
+#define SR_MAX 0x2              /* highest match */
+#define SR_ALL 0x4              /* all matches as a sequence set */
+#define SR_SAVE 0x8             /* save result for reference as $ */
+#define SR_COUNT 0x10           /* number of matches */
+
+
 /* Append data */
 
 typedef struct append_data {
@@ -97,6 +146,7 @@ typedef struct append_data {
   char *flags;                  /* message flags */
   char *date;                   /* message date */
   char *msg;                    /* message text */
+  FILE *spool;                  /* scratch file of spooled message text */
   STRING *message;              /* message stringstruct */
 } APPENDDATA;
 
@@ -110,11 +160,48 @@ typedef struct msg_data {
   char *date;                   /* current date */
   STRING *message;              /* stringstruct of message */
 } MSGDATA;
+
+
+/* Command trace entry */
+
+typedef struct trace_entry {
+  time_t when;                  /* when command started */
+  char cmd[16];                 /* command name */
+  char mailbox[64];             /* mailbox when command completed */
+  unsigned long msgs;           /* messages touched */
+  unsigned long in;             /* bytes read from client */
+  unsigned long out;            /* bytes written to client */
+                                /* microseconds spent in each phase */
+  unsigned long usec[NTRACEPHASES];
+} TRACE;
+
+
+/* QRESYNC resynchronization data */
+
+typedef struct qresync_data {
+  unsigned long uidvalidity;    /* client's last known UID validity */
+  unsigned long modseq;         /* client's last known modseq */
+  char *uids;                   /* client's known UIDs, or NIL if all */
+} QRESYNCDATA;
 
 /* Function prototypes */
 
 int main (int argc,char *argv[]);
 void ping_mailbox (unsigned long uid);
+void flags_changed (MAILSTREAM *s,unsigned long msgno);
+unsigned long first_unseen (void);
+void unseen_save (void);
+void unseen_restore (void);
+long status_flags (char *s);
+long list_return (unsigned char *s);
+void trace_begin (void);
+void trace_end (void);
+int trace_phase (int phase);
+void *trace_blocknotify (int reason,void *data);
+void trace_log (void);
+char *trace_out (char *s,TRACE *t);
+long idle_wait (long seconds,unsigned long uid,int fd);
+long idle_park (void);
 time_t palert (char *file,time_t oldtime);
 void msg_string_init (STRING *s,void *data,unsigned long size);
 char msg_string_next (STRING *s);
@@ -131,6 +218,8 @@ char *sout (char *s,char *t);
 char *nout (char *s,unsigned long n,unsigned long base);
 void slurp (char *s,int n,unsigned long timeout);
 void inliteral (char *s,unsigned long n);
+long inliteralspool (FILE *f,unsigned long n);
+void readyliteral (void);
 unsigned char *flush (void);
 void ioerror (FILE *f,char *reason);
 unsigned char *parse_astring (unsigned char **arg,unsigned long *i,
@@ -148,17 +237,24 @@ long parse_criterion (SEARCHPGM *pgm,unsigned char **arg,unsigned long msgmsg,
 long crit_date (unsigned short *date,unsigned char **arg);
 long crit_date_work (unsigned short *date,unsigned char **arg);
 long crit_set (SEARCHSET **set,unsigned char **arg,unsigned long maxima);
+long crit_saved (SEARCHSET **set,unsigned char **arg,long uid);
 long crit_number (unsigned long *number,unsigned char **arg);
 long crit_string (STRINGLIST **string,unsigned char **arg);
 
-void fetch (char *t,unsigned long uid);
+long fetch_modifiers (char *t,unsigned long *changedsince,long *vanished);
+void fetch (char *t,SEARCHSET *set,unsigned long uid,
+            unsigned long changedsince);
 typedef void (*fetchfn_t) (unsigned long i,void *args);
-void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[]);
+void fetch_work (char *t,SEARCHSET *set,unsigned long uid,
+                 unsigned long changedsince,fetchfn_t f[],void *fa[]);
 void fetch_bodystructure (unsigned long i,void *args);
 void fetch_body (unsigned long i,void *args);
 void fetch_body_part_mime (unsigned long i,void *args);
 void fetch_body_part_contents (unsigned long i,void *args);
 void fetch_body_part_binary (unsigned long i,void *args);
+long binary_decode (RFC822DECODE *dc,SIZEDTEXT *st,STRING *bs,
+                    unsigned long pos);
+long binary_out (void *arg,unsigned char *s,unsigned long n);
 void fetch_body_part_header (unsigned long i,void *args);
 void fetch_body_part_text (unsigned long i,void *args);
 void remember (unsigned long uid,char *id,SIZEDTEXT *st);
@@ -169,6 +265,7 @@ void fetch_flags (unsigned long i,void *args);
 void put_flag (int *c,char *s);
 void fetch_internaldate (unsigned long i,void *args);
 void fetch_uid (unsigned long i,void *args);
+void fetch_modseq (unsigned long i,void *args);
 void fetch_rfc822 (unsigned long i,void *args);
 void fetch_rfc822_header (unsigned long i,void *args);
 void fetch_rfc822_size (unsigned long i,void *args);
@@ -179,6 +276,14 @@ void pbody (BODY *body);
 void pparam (PARAMETER *param);
 void paddr (ADDRESS *a);
 void pset (SEARCHSET **set);
+void pvanished (char *sequence,unsigned long modseq);
+char *sequence_string (long uid);
+int search_return (unsigned char **arg);
+void pesearch (unsigned long *lst,unsigned long n,long uid,int retval,
+               unsigned long maxmod);
+void searchres_save (unsigned long *lst,unsigned long n,int retval);
+char *searchres_sequence (char *sequence,long uid,char **tmp);
+long parse_select (unsigned char **arg,QRESYNCDATA *qr);
 void pnum (unsigned long i);
 void pstring (char *s);
 void pnstring (char *s);
@@ -192,6 +297,8 @@ void pnstringorlist (STRINGLIST *s);
 void pbodypartstring (unsigned long msgno,char *id,SIZEDTEXT *st,STRING *bs,
                       TEXTARGS *ta);
 void ptext (SIZEDTEXT *s,STRING *st);
+long ptextfd (STRING *st,unsigned long size);
+void pmessage (unsigned long i,char *id,long flags);
 void pthread (THREADNODE *thr);
 void pcapability (long flag);
 long nameok (char *ref,char *name);
@@ -206,6 +313,7 @@ long append_msg (MAILSTREAM *stream,void *data,char **flags,char **date,
                  STRING **message);
 void copyuid (MAILSTREAM *stream,char *mailbox,unsigned long uidvalidity,
               SEARCHSET *sourceset,SEARCHSET *destset);
+void pcopyuid (void);
 void appenduid (char *mailbox,unsigned long uidvalidity,SEARCHSET *set);
 char *referral (MAILSTREAM *stream,char *url,long code);
 void mm_list_work (char *what,int delimiter,char *name,long attributes);
@@ -231,12 +339,34 @@ int critical = NIL;             /* non-zero if in critical code */
 int quell_events = NIL;         /* non-zero if in FETCH response */
 int existsquelled = NIL;        /* non-zero if an EXISTS was quelled */
 int proxylist = NIL;            /* doing a proxy LIST */
+int moving = NIL;               /* doing a MOVE */
+long liststatus = NIL;          /* STATUS items for LIST-STATUS */
+STRINGLIST *statuslist = NIL;   /* mailboxes to report LIST-STATUS on */
+STRINGLIST **statustail = NIL;  /* tail of LIST-STATUS mailbox list */
 MAILSTREAM *stream = NIL;       /* mailbox stream */
 DRIVER *curdriver = NIL;        /* note current driver */
 MAILSTREAM *tstream = NIL;      /* temporary mailbox stream */
 unsigned int nflags = 0;        /* current number of keywords */
 unsigned long nmsgs =0xffffffff;/* last reported # of messages and recent */
 unsigned long recent = 0xffffffff;
+unsigned long *dirty = NIL;     /* messages with flag changes to report */
+unsigned long ndirty = 0;       /* number of dirty list entries */
+unsigned long dirtysize = 0;    /* size of dirty list */
+unsigned long unseenlow = 1;    /* all messages below this are seen */
+char *unseenmbx = NIL;          /* mailbox of saved first unseen mark */
+unsigned long unseenvalidity = 0;/* its UID validity */
+unsigned long unseenmodseq = 0; /* its highest modseq */
+unsigned long unseensaved = 0;  /* its first unseen mark */
+TRACE trace[TRACESIZE];         /* ring of recent command traces */
+TRACE *curtrace = NIL;          /* trace of command in progress */
+unsigned long ntrace = 0;       /* number of commands traced */
+unsigned long tracelogged = 0;  /* number of commands already logged */
+unsigned long tracein = 0;      /* bytes read as of last command */
+unsigned long traceout = 0;     /* bytes written as of last command */
+int tracephase = TRACE_SERVER;  /* phase being charged */
+int tracestack[TRACEDEPTH];     /* phases interrupted by blocking */
+int tracesp = 0;                /* depth of interrupted phases */
+struct timeval tracemark;       /* when current phase started */
 char *nntpproxy = NIL;          /* NNTP proxy name */
 unsigned char *user = NIL;      /* user name */
 unsigned char *pass = NIL;      /* password */
@@ -265,6 +395,11 @@ SIZEDTEXT lastst = {NIL,0};     /* last sizedtext */
 unsigned long cauidvalidity = 0;/* UIDVALIDITY for COPYUID/APPENDUID */
 SEARCHSET *csset = NIL;         /* COPYUID source set */
 SEARCHSET *caset = NIL;         /* COPYUID/APPENDUID destination set */
+SEARCHSET *modified = NIL;      /* conditional STORE MODIFIED set */
+unsigned long okmodseq = 0;     /* HIGHESTMODSEQ for tagged OK */
+int condstore = NIL;            /* non-zero if CONDSTORE enabled */
+int qresync = NIL;              /* non-zero if QRESYNC enabled */
+int searchmodseq = NIL;         /* non-zero if search used MODSEQ */
 jmp_buf jmpenv;                 /* stack context for setjmp */
 
 
@@ -277,6 +412,7 @@ char *lose = "%.80s NO ";
 char *logwin = "%.80s OK [";
 char *losetry = "%.80s NO [TRYCREATE] %.80s failed: %.800s\015\012";
 char *loseunknowncte = "%.80s NO [UNKNOWN-CTE] %.80s failed: %.800s\015\012";
+char *losecompress = "%.80s NO [COMPRESSIONACTIVE] %.80s failed: %.800s\015\012";
 char *badcmd = "%.80s BAD Command unrecognized: %.80s\015\012";
 char *badcml = "%.80s BAD Command unrecognized\015\012";
 char *misarg = "%.80s BAD Missing or invalid argument to %.80s\015\012";
@@ -284,13 +420,15 @@ char *badarg = "%.80s BAD Argument given to %.80s when none expected\015\012";
 char *badseq = "%.80s BAD Bogus sequence in %.80s: %.80s\015\012";
 char *badatt = "%.80s BAD Bogus attribute list in %.80s\015\012";
 char *badbin = "%.80s BAD Syntax error in binary specifier\015\012";
+char *badmodseq = "%.80s BAD Mailbox does not support mod-sequences\015\012";
 
 /* Message string driver for message stringstructs */
 
 STRINGDRIVER msg_string = {
   msg_string_init,              /* initialize string structure */
   msg_string_next,              /* get next byte in string structure */
-  msg_string_setpos             /* set position in string structure */
+  msg_string_setpos,            /* set position in string structure */
+  NIL                           /* not file-backed */
 };
 
 /* Main program */
@@ -301,6 +439,8 @@ int main (int argc,char *argv[])
   long f;
   unsigned char *s,*t,*u,*v,tmp[MAILTMPLEN];
   struct stat sbuf;
+  STRINGLIST *sl;
+  DRIVER *d;
   logouthook_t lgoh;
   int ret = 0;
   time_t autologouttime = 0;
@@ -329,6 +469,11 @@ int main (int argc,char *argv[])
   mail_versioncheck (CCLIENTVERSION);
   ssl_onceonlyinit ();
   mail_parameters (NIL,SET_DISABLEPLAINTEXT,(void *) 2);
+                                /* standalone daemon? */
+  if ((argc > 1) && !strcmp (argv[1],"-D"))
+    server_daemon (pgmname,"imap","imaps",
+                   (argc > 2) ? strtoul (argv[2],NIL,10) : DAEMONWORKERS,
+                   (argc > 3) ? strtoul (argv[3],NIL,10) : DAEMONSESSIONS);
   rfc822_date (tmp);            /* get date/time at startup */
                                 /* initialize server */
   server_init (pgmname,"imap","imaps",clkint,kodint,hupint,trmint,staint);
@@ -342,6 +487,8 @@ int main (int argc,char *argv[])
   mail_parameters (NIL,SET_COPYUID,(void *) copyuid);
                                 /* arm APPENDUID callback */
   mail_parameters (NIL,SET_APPENDUID,(void *) appenduid);
+                                /* arm command trace callback */
+  mail_parameters (NIL,SET_BLOCKNOTIFY,(void *) trace_blocknotify);
 
   if (stat (MAIL_NOLOGIN_FILE,&sbuf)) {
     char proxy[MAILTMPLEN];
@@ -415,11 +562,15 @@ int main (int argc,char *argv[])
   }
   else while (state != LOGOUT) {/* command processing loop */
     slurp (cmdbuf,CMDLEN,TIMEOUT);
+    trace_begin ();             /* start tracing this command */
                                 /* no more last error or literal */
     if (lstwrn) fs_give ((void **) &lstwrn);
     if (lsterr) fs_give ((void **) &lsterr);
     if (lstref) fs_give ((void **) &lstref);
     while (litsp) fs_give ((void **) &litstk[--litsp]);
+                                /* no more tagged OK response codes */
+    if (modified) mail_free_searchset (&modified);
+    okmodseq = 0;
                                 /* find end of line */
     if (t = strchr (cmdbuf,'\012')) {
                                 /* tie off command termination */
@@ -637,23 +788,79 @@ int main (int argc,char *argv[])
       case OPEN:                /* valid only when mailbox open */
                                 /* fetch mailbox attributes */
         if (!strcmp (cmd,"FETCH") || !strcmp (cmd,"UID FETCH")) {
+          unsigned long changedsince;
+          long vanished;
+          char *cs = NIL;
+          SEARCHSET *set;
           if (!(arg && (s = strtok_r (arg," ",&sstate)) &&
-                (t = strtok_r (NIL,"\015\012",&sstate))))
+                (t = strtok_r (NIL,"\015\012",&sstate)) &&
+                fetch_modifiers (t,&changedsince,&vanished) &&
+                (!vanished || (uid && qresync && changedsince))))
             response = misarg;
-          else if (uid ? mail_uid_sequence (stream,s) :
-                   mail_sequence (stream,s)) fetch (t,uid);
+          else if (changedsince && !mail_highestmodseq (stream))
+            response = badmodseq;
+                                /* nothing to do if saved result empty */
+          else if (!(s = searchres_sequence (s,uid,&cs)));
+          else if (mail_sequence_set (stream,s,uid ? FT_UID : NIL,&set)) {
+            if (vanished) pvanished (s,changedsince);
+            fetch (t,set,uid,changedsince);
+            mail_free_searchset (&set);
+          }
           else response = badseq;
+          if (cs) fs_give ((void **) &cs);
         }
                                 /* store mailbox attributes */
         else if (!strcmp (cmd,"STORE") || !strcmp (cmd,"UID STORE")) {
+          unsigned long unchangedsince = 0;
+          int conditional = NIL;
+          char *cs = NIL;
+          MESSAGECACHE *elt;
+          SEARCHSET *ss;
+          SEARCHSET *set = NIL;
+          if (arg && (s = strtok_r (arg," ",&sstate)) &&
+              (v = strtok_r (NIL," ",&sstate)) &&
+              !strcmp (ucase (v),"(UNCHANGEDSINCE")) {
+            conditional = T;    /* conditional store, get modseq */
+            v = ((u = strtok_r (NIL," ",&sstate)) && isdigit (*u) &&
+                 ((unchangedsince = strtoul (u,(char **) &u,10)) || T) &&
+                 (*u++ == ')') && !*u) ? strtok_r (NIL," ",&sstate) : NIL;
+          }
                                 /* must have three arguments */
-          if (!(arg && (s = strtok_r (arg," ",&sstate)) &&
-                (v = strtok_r (NIL," ",&sstate)) &&
-                (t = strtok_r (NIL,"\015\012",&sstate)))) response = misarg;
-          else if (!(uid ? mail_uid_sequence (stream,s) :
-                     mail_sequence (stream,s))) response = badseq;
+          if (!(arg && s && v && (t = strtok_r (NIL,"\015\012",&sstate))))
+            response = misarg;
+                                /* nothing to do if saved result empty */
+          else if (!(s = searchres_sequence (s,uid,&cs)));
+          else if (!mail_sequence_set (stream,s,uid ? ST_UID : NIL,&set))
+            response = badseq;
+          else if (conditional && !mail_highestmodseq (stream))
+            response = badmodseq;
           else {
             f = ST_SET | (uid ? ST_UID : NIL)|((v[5]&&v[6]) ? ST_SILENT : NIL);
+            if (conditional) {  /* weed out messages modified since */
+              condstore = T;
+              if (uid) mail_uid_sequence (stream,s);
+              else mail_sequence (stream,s);
+              for (i = 1; i <= nmsgs; i++)
+                if ((elt = mail_elt (stream,i))->sequence &&
+                    (elt->private.mod > unchangedsince)) {
+                  elt->sequence = NIL;
+                  if (!modified) modified = mail_newsearchset ();
+                  mail_append_set (modified,uid ? elt->private.uid : i);
+                }
+                                /* store on the remainder by number */
+              if (cs) fs_give ((void **) &cs);
+              if (!(s = cs = sequence_string (NIL))) {
+                if (strcmp (ucase (v),"FLAGS") && strcmp (v,"FLAGS.SILENT") &&
+                    strcmp (v,"+FLAGS") && strcmp (v,"+FLAGS.SILENT") &&
+                    strcmp (v,"-FLAGS") && strcmp (v,"-FLAGS.SILENT"))
+                  response = badatt;
+                mail_free_searchset (&set);
+                break;          /* nothing left to store */
+              }
+              f &= ~ST_UID;
+              mail_free_searchset (&set);
+              mail_sequence_set (stream,s,NIL,&set);
+            }
             if (!strcmp (ucase (v),"FLAGS") || !strcmp (v,"FLAGS.SILENT")) {
               strcpy (tmp,"\\Answered \\Flagged \\Deleted \\Draft \\Seen");
               for (i = 0, u = tmp;
@@ -668,19 +875,28 @@ int main (int argc,char *argv[])
             else if (!strcmp (v,"-FLAGS") || !strcmp (v,"-FLAGS.SILENT"))
               f &= ~ST_SET;     /* clear flags */
             else if (strcmp (v,"+FLAGS") && strcmp (v,"+FLAGS.SILENT")) {
+              if (cs) fs_give ((void **) &cs);
+              mail_free_searchset (&set);
               response = badatt;
               break;
             }
                                 /* find last keyword */
             for (i = 0; (i < NUSERFLAGS) && stream->user_flags[i]; i++);
+            trace_phase (TRACE_DRIVER);
             mail_flag (stream,s,t,f);
+            trace_phase (TRACE_SERVER);
                                 /* any new keywords appeared? */
             if (i < NUSERFLAGS && stream->user_flags[i]) new_flags (stream);
                                 /* return flags if silence not wanted */
-            if (uid ? mail_uid_sequence (stream,s) : mail_sequence (stream,s))
-              for (i = 1; i <= nmsgs; i++) if (mail_elt(stream,i)->sequence)
-                mail_elt (stream,i)->spare2 = (f & ST_SILENT) ? NIL : T;
+            for (ss = set,i = 0; i = mail_next_set (&ss,i);) {
+              if ((f & ST_SILENT) && !conditional)
+                mail_elt (stream,i)->spare2 = NIL;
+              else flags_changed (stream,i);
+              if (curtrace) curtrace->msgs++;
+            }
           }
+          if (cs) fs_give ((void **) &cs);
+          mail_free_searchset (&set);
         }
 
                                 /* check for new mail */
@@ -696,13 +912,19 @@ int main (int argc,char *argv[])
                                 /* expunge deleted messages */
         else if (!(anonymous || (strcmp (cmd,"EXPUNGE") &&
                                  strcmp (cmd,"UID EXPUNGE")))) {
+          char *cs = NIL;
           if (uid && !arg) response = misarg;
           else if (!uid && arg) response = badarg;
+                                /* nothing to do if saved result empty */
+          else if (arg && !(arg = searchres_sequence (arg,T,&cs)));
           else {                /* expunge deleted or specified UIDs */
             mail_expunge_full (stream,arg,arg ? EX_UID : NIL);
                                 /* remember last checkpoint */
             lastcheck = time (0);
+                                /* report new highest modseq */
+            if (condstore) okmodseq = mail_highestmodseq (stream);
           }
+          if (cs) fs_give ((void **) &cs);
         }
                                 /* close mailbox */
         else if (!strcmp (cmd,"CLOSE") || !strcmp (cmd,"UNSELECT")) {
@@ -711,6 +933,7 @@ int main (int argc,char *argv[])
           else {
                                 /* no last uid */
             uidvalidity = lastuid = 0;
+            unseen_save ();     /* before lastsel goes away */
             if (lastsel) fs_give ((void **) &lastsel);
             if (lastid) fs_give ((void **) &lastid);
             if (lastst.data) fs_give ((void **) &lastst.data);
@@ -722,6 +945,7 @@ int main (int argc,char *argv[])
         }
         else if (!anonymous &&  /* copy message(s) */
                  (!strcmp (cmd,"COPY") || !strcmp (cmd,"UID COPY"))) {
+          char *cs = NIL;
           trycreate = NIL;      /* no trycreate status */
           if (!(arg && (s = strtok_r (arg," ",&sstate)) &&
                 (arg = strtok_r (NIL,"\015\012",&sstate))
@@ -731,6 +955,8 @@ int main (int argc,char *argv[])
             response = lose;
             if (!lsterr) lsterr = cpystr ("Mailbox is empty");
           }
+                                /* nothing to do if saved result empty */
+          else if (!(s = searchres_sequence (s,uid,&cs)));
           else if (!(uid ? mail_uid_sequence (stream,s) :
                      mail_sequence (stream,s))) response = badseq;
                                 /* try copy */
@@ -738,12 +964,50 @@ int main (int argc,char *argv[])
             response = trycreate ? losetry : lose;
             if (!lsterr) lsterr = cpystr ("No such destination mailbox");
           }
+          if (cs) fs_give ((void **) &cs);
+        }
+        else if (!anonymous &&  /* move message(s) */
+                 (!strcmp (cmd,"MOVE") || !strcmp (cmd,"UID MOVE"))) {
+          char *cs = NIL;
+          trycreate = NIL;      /* no trycreate status */
+          if (!(arg && (s = strtok_r (arg," ",&sstate)) &&
+                (arg = strtok_r (NIL,"\015\012",&sstate))
+                && (t = snarf (&arg)))) response = misarg;
+          else if (arg) response = badarg;
+          else if (stream->rdonly) {
+            response = lose;
+            if (!lsterr) lsterr = cpystr ("Mailbox is read-only");
+          }
+          else if (!nmsgs) {
+            response = lose;
+            if (!lsterr) lsterr = cpystr ("Mailbox is empty");
+          }
+                                /* nothing to do if saved result empty */
+          else if (!(s = searchres_sequence (s,uid,&cs)));
+          else if (!(uid ? mail_uid_sequence (stream,s) :
+                     mail_sequence (stream,s))) response = badseq;
+          else {                /* COPYUID must precede the expunges */
+            moving = T;
+            if (!mail_move_full (stream,s,t,uid ? CP_UID : NIL)) {
+              response = trycreate ? losetry : lose;
+              if (!lsterr) lsterr = cpystr ("No such destination mailbox");
+            }
+            moving = NIL;
+            if (cauidvalidity) pcopyuid ();
+                                /* remember last checkpoint */
+            lastcheck = time (0);
+                                /* report new highest modseq */
+            if (condstore) okmodseq = mail_highestmodseq (stream);
+          }
+          if (cs) fs_give ((void **) &cs);
         }
 
                                 /* sort mailbox */
         else if (!strcmp (cmd,"SORT") || !strcmp (cmd,"UID SORT")) {
+          int retval = arg ? search_return (&arg) : 0;
                                 /* must have four arguments */
-          if (!(arg && (*arg == '(') && (t = strchr (s = arg + 1,')')) &&
+          if ((retval < 0) ||
+              !(arg && (*arg == '(') && (t = strchr (s = arg + 1,')')) &&
                 (t[1] == ' ') && (*(arg = t + 2)))) response = misarg;
           else {                /* read criteria */
             SEARCHPGM *spg = NIL;
@@ -781,20 +1045,39 @@ int main (int argc,char *argv[])
               else if (!parse_criteria (spg = mail_newsearchpgm (),&arg,nmsgs,
                                         uidmax (stream),0)) response = badatt;
               else if (arg && *arg) response = badarg;
-              else if (slst = mail_sort (stream,cs,spg,pgm,uid ? SE_UID:NIL)) {
-                PSOUT ("* SORT");
-                for (sl = slst; *sl; sl++) {
-                  PBOUT (' ');
-                  pnum (*sl);
+              else {            /* sort and output */
+                trace_phase (TRACE_DRIVER);
+                if (curtrace) curtrace->msgs += nmsgs;
+                if (retval) {   /* ESORT desired, sort by message number */
+                  if (slst = mail_sort (stream,cs,spg,pgm,NIL)) {
+                    for (sl = slst; *sl; sl++);
+                    if (retval != SR_SAVE)
+                      pesearch (slst,sl - slst,uid,retval,0);
+                    if (retval & SR_SAVE)
+                      searchres_save (slst,sl - slst,retval);
+                    fs_give ((void **) &slst);
+                  }
                 }
-                CRLF;
-                fs_give ((void **) &slst);
+                else if (slst = mail_sort (stream,cs,spg,pgm,
+                                           uid ? SE_UID : NIL)) {
+                  PSOUT ("* SORT");
+                  for (sl = slst; *sl; sl++) {
+                    PBOUT (' ');
+                    pnum (*sl);
+                  }
+                  CRLF;
+                  fs_give ((void **) &slst);
+                }
+                trace_phase (TRACE_SERVER);
               }
             }
             if (pgm) mail_free_sortpgm (&pgm);
             if (spg) mail_free_searchpgm (&spg);
             if (cs) fs_give ((void **) &cs);
           }
+                                /* failed sort empties saved result */
+          if ((retval > 0) && (retval & SR_SAVE) && (response != win))
+            searchres_save (NIL,0,retval);
         }
 
                                 /* thread mailbox */
@@ -811,6 +1094,8 @@ int main (int argc,char *argv[])
                                     uidmax (stream),0)) response = badatt;
           else if (arg && *arg) response = badarg;
           else {
+            trace_phase (TRACE_DRIVER);
+            if (curtrace) curtrace->msgs += nmsgs;
             if (thr = mail_thread (stream,s,cs,spg,uid ? SE_UID : NIL)) {
               PSOUT ("* THREAD ");
               pthread (thr);
@@ -818,6 +1103,7 @@ int main (int argc,char *argv[])
             }
             else PSOUT ("* THREAD");
             CRLF;
+            trace_phase (TRACE_SERVER);
           }
           if (spg) mail_free_searchpgm (&spg);
           if (cs) fs_give ((void **) &cs);
@@ -825,60 +1111,13 @@ int main (int argc,char *argv[])
 
                                 /* search mailbox */
         else if (!strcmp (cmd,"SEARCH") || !strcmp (cmd,"UID SEARCH")) {
-          int retval = NIL;
+          int retval;
           char *charset = NIL;
           SEARCHPGM *pgm;
           response = misarg;    /* assume failure */
           if (!arg) break;      /* one or more arguments required */
-          if (((arg[0] == 'R') || (arg[0] == 'r')) &&
-              ((arg[1] == 'E') || (arg[1] == 'e')) &&
-              ((arg[2] == 'T') || (arg[2] == 't')) &&
-              ((arg[3] == 'U') || (arg[3] == 'u')) &&
-              ((arg[4] == 'R') || (arg[4] == 'r')) &&
-              ((arg[5] == 'N') || (arg[5] == 'n')) &&
-              (arg[6] == ' ') && (arg[7] == '(')) {
-            retval = 0x4000;    /* return is specified */
-            for (arg += 8; *arg && (*arg != ')'); ) {
-              if (((arg[0] == 'M') || (arg[0] == 'm')) &&
-                  ((arg[1] == 'I') || (arg[1] == 'i')) &&
-                  ((arg[2] == 'N') || (arg[2] == 'n')) &&
-                  ((arg[3] == ' ') || (arg[3] == ')'))) {
-                retval |= 0x1;
-                arg += 3;
-              }
-              else if (((arg[0] == 'M') || (arg[0] == 'm')) &&
-                       ((arg[1] == 'A') || (arg[1] == 'a')) &&
-                       ((arg[2] == 'X') || (arg[2] == 'x')) &&
-                       ((arg[3] == ' ') || (arg[3] == ')'))) {
-                retval |= 0x2;
-                arg += 3;
-              }
-              else if (((arg[0] == 'A') || (arg[0] == 'a')) &&
-                       ((arg[1] == 'L') || (arg[1] == 'l')) &&
-                       ((arg[2] == 'L') || (arg[2] == 'l')) &&
-                       ((arg[3] == ' ') || (arg[3] == ')'))) {
-                retval |= 0x4;
-                arg += 3;
-              }
-              else if (((arg[0] == 'C') || (arg[0] == 'c')) &&
-                       ((arg[1] == 'O') || (arg[1] == 'o')) &&
-                       ((arg[2] == 'U') || (arg[2] == 'u')) &&
-                       ((arg[3] == 'N') || (arg[3] == 'n')) &&
-                       ((arg[4] == 'T') || (arg[4] == 't')) &&
-                       ((arg[5] == ' ') || (arg[5] == ')'))) {
-                retval |= 0x10;
-                arg += 5;
-              }
-              else break;       /* unknown return value */
-                                /* more return values to come */
-              if ((*arg == ' ') && (arg[1] != ')')) ++arg;
-            }
                                 /* RETURN list must be properly terminated */
-            if ((*arg++ != ')') || (*arg++ != ' ')) break;
-                                /* default return value is ALL */
-            if (!(retval &= 0x3fff)) retval = 0x4;
-          }
-
+          if ((retval = search_return (&arg)) < 0) break;
                                 /* character set specified? */
           if (((arg[0] == 'C') || (arg[0] == 'c')) &&
               ((arg[1] == 'H') || (arg[1] == 'h')) &&
@@ -894,100 +1133,34 @@ int main (int argc,char *argv[])
           }
                                 /* must have arguments here */
           if (!(arg && *arg)) break;
+          searchmodseq = NIL;   /* no MODSEQ criterion seen yet */
           if (parse_criteria (pgm = mail_newsearchpgm (),&arg,nmsgs,
                               uidmax (stream),0) && !*arg) {
             response = win;     /* looks good, try the search */
+            trace_phase (TRACE_DRIVER);
+            if (curtrace) curtrace->msgs += nmsgs;
             mail_search_full (stream,charset,pgm,SE_FREE);
+            trace_phase (TRACE_SERVER);
                                 /* output search results if success */
             if (response == win) {
+              unsigned long maxmod = 0;
+              if (searchmodseq) /* highest modseq of matching messages */
+                for (i = 1; i <= nmsgs; ++i)
+                  if (mail_elt (stream,i)->searched &&
+                      (mail_elt (stream,i)->private.mod > maxmod))
+                    maxmod = mail_elt (stream,i)->private.mod;
               if (retval) {     /* ESEARCH desired */
-                PSOUT ("* ESEARCH (TAG ");
-                pstring (tag);
-                PBOUT (')');
-                if (uid) PSOUT (" UID");
-                                /* wants MIN */
-                if (retval & 0x1) {
-                  for (i = 1; (i <= nmsgs) && !mail_elt (stream,i)->searched;
-                       ++i);
-                  if (i <= nmsgs) {
-                    PSOUT (" MIN ");
-                    pnum (uid ? mail_uid (stream,i) : i);
-                  }
-                }
-                                /* wants MAX */
-                if (retval & 0x2) {
-                  for (i = nmsgs; i && !mail_elt (stream,i)->searched; --i);
-                  if (i) {
-                    PSOUT (" MAX ");
-                    pnum (uid ? mail_uid (stream,i) : i);
-                  }
-                }
-
-                                /* wants ALL */
-                if (retval & 0x4) {
-                  unsigned long j,juid,iuid;
-                                /* find first match */
-                  for (i = 1; (i <= nmsgs) && !mail_elt (stream,i)->searched;
-                       ++i);
-                  if (i <= nmsgs) {
-                    juid= (uid ? mail_uid (stream,i) : i);
-                    PSOUT (" ALL ");
-                    pnum (juid);
-                    j = i;      /* last message index processed */
-                  }
-                  if (uid) {    /* doing UIDs, no MRC optimization */
-                    while (++i <= nmsgs) {
-                      if (mail_elt (stream,i)->searched) {      /* this message matches */
-                        iuid= mail_uid (stream,i);
-                        if (juid == (iuid - (i-j))) {   /* in sequence of UIDs */
-                          if ( i < nmsgs) continue;     /* may be more, check next */
-                          PBOUT (':'); pnum(iuid);      /* done with all, tie it off */
-                          j = i; juid= iuid;
-                        } else {        /* break in sequence of UIDs */
-                          if ((i-1) > j) {      /* prev sequence, tie it off */
-                            j= i-1; juid= mail_uid (stream,j);
-                            PBOUT (':'); pnum(juid);
-                          }
-                          PBOUT (','); pnum(iuid);
-                          j = i; juid= iuid;    /* record last done message/UID */
-                        }
-                      } else {  /* this message doesn't match, have a pending sequence? */
-                        /* if pending sequence, tie it off & reset flags */
-                        if ((i-1) > j) {        /* prev sequence, tie it off */
-                          j= i-1; juid= mail_uid (stream,j);
-                          PBOUT (':'); pnum(juid);
-                        }
-                        j= nmsgs+1; juid= ULONG_MAX;    /* flag that we're not in a sequence of matches */
-                      }
-                    }
-                  } else {      /* doing message-IDs, use MRC optimization */
-                    while (++i <= nmsgs) {
-                      if (mail_elt (stream,i)->searched) {
-                        while ((++i <= nmsgs) && mail_elt (stream,i)->searched);
-                                /* previous message is end of range */
-                        if (j != --i) {
-                          PBOUT (':');
-                          pnum (i);
-                        }
-                    }
-                                /* search for next match */
-                      while ((++i <= nmsgs) && !mail_elt (stream,i)->searched);
-                      if (i <= nmsgs) {
-                        PBOUT (',');
-                        pnum (i);
-                        j = i;  /* last message output */
-                      }
-                    }
-                  }
-                }
-                                /* wants COUNT */
-                if (retval & 0x10) {
-                  unsigned long j;
-                  for (i = 1, j = 0; i <= nmsgs; ++i)
-                    if (mail_elt (stream,i)->searched) ++j;
-                  PSOUT (" COUNT ");
-                  pnum (j);
-                }
+                unsigned long j,*lst;
+                for (i = 1, j = 0; i <= nmsgs; ++i)
+                  if (mail_elt (stream,i)->searched) ++j;
+                lst = (unsigned long *)
+                  fs_get ((j + 1) * sizeof (unsigned long));
+                for (i = 1, j = 0; i <= nmsgs; ++i)
+                  if (mail_elt (stream,i)->searched) lst[j++] = i;
+                                /* no ESEARCH if only saving */
+                if (retval != SR_SAVE) pesearch (lst,j,uid,retval,maxmod);
+                if (retval & SR_SAVE) searchres_save (lst,j,retval);
+                fs_give ((void **) &lst);
               }
               else {            /* standard search */
                 PSOUT ("* SEARCH");
@@ -996,12 +1169,20 @@ int main (int argc,char *argv[])
                     PBOUT (' ');
                     pnum (uid ? mail_uid (stream,i) : i);
                   }
+                if (maxmod) {   /* MODSEQ criterion used */
+                  PSOUT (" (MODSEQ ");
+                  pnum (maxmod);
+                  PBOUT (')');
+                }
+                CRLF;
               }
-              CRLF;
             }
           }
           else mail_free_searchpgm (&pgm);
           if (charset) fs_give ((void **) &charset);
+                                /* failed search empties saved result */
+          if ((retval & SR_SAVE) && (response != win))
+            searchres_save (NIL,0,retval);
         }
 
         else                    /* fall into select case */
@@ -1009,9 +1190,13 @@ int main (int argc,char *argv[])
                                 /* select new mailbox */
           if (!(strcmp (cmd,"SELECT") && strcmp (cmd,"EXAMINE") &&
                 strcmp (cmd,"BBOARD"))) {
-                                /* single argument */
+          QRESYNCDATA qr;
+          MESSAGECACHE *elt;
+          memset (&qr,0,sizeof (QRESYNCDATA));
+                                /* mailbox name and optional parameters */
           if (!(s = snarf (&arg))) response = misarg;
-          else if (arg) response = badarg;
+          else if (arg && ((*cmd == 'B') || !parse_select (&arg,&qr)))
+            response = badarg;
           else if (nameok (NIL,s = bboardname (cmd,s))) {
             DRIVER *factory = mail_valid (NIL,s,NIL);
             f = anonymous ? OP_ANONYMOUS | OP_READONLY :
@@ -1023,6 +1208,11 @@ int main (int argc,char *argv[])
             if (lastst.data) fs_give ((void **) &lastst.data);
             nflags = 0;         /* force update */
             nmsgs = recent = 0xffffffff;
+            ndirty = 0;         /* no pending flag changes */
+            unseen_save ();     /* first unseen not known */
+                                /* QRESYNC client wants to know */
+            if ((state == OPEN) && qresync)
+              PSOUT ("* OK [CLOSED] Previous mailbox closed\015\012");
             if (factory && !strcmp (factory->name,"phile") &&
                 (stream = mail_open (stream,s,f | OP_SILENT)) &&
                 (response == win)) {
@@ -1070,6 +1260,22 @@ int main (int argc,char *argv[])
                 syslog (LOG_INFO,"Anonymous select of %.80s host=%.80s",
                         stream->mailbox,tcp_clienthost ());
               lastcheck = 0;    /* no last check */
+              unseen_restore ();/* unless unchanged since last selected */
+              if (qr.uidvalidity) {
+                ping_mailbox (NIL);
+                                /* resynchronize if client cache valid */
+                if ((qr.uidvalidity == stream->uid_validity) &&
+                    mail_highestmodseq (stream)) {
+                  if (qr.uids ? mail_uid_sequence (stream,qr.uids) :
+                      (nmsgs && mail_sequence (stream,"1:*")))
+                    for (i = 1; i <= nmsgs; i++)
+                      if ((elt = mail_elt (stream,i))->sequence &&
+                          (elt->private.mod > qr.modseq))
+                        flags_changed (stream,i);
+                  pvanished (qr.uids,qr.modseq);
+                  ping_mailbox (LONGT);
+                }
+              }
             }
             else {              /* failed, nuke old selection */
               if (stream) stream = mail_close (stream);
@@ -1078,6 +1284,7 @@ int main (int argc,char *argv[])
               response = lose;  /* open failed */
             }
           }
+          if (qr.uids) fs_give ((void **) &qr.uids);
         }
 
                                 /* APPEND message to mailbox */
@@ -1089,6 +1296,7 @@ int main (int argc,char *argv[])
             ad.arg = arg;       /* command arguments */
                                 /* no message yet */
             ad.flags = ad.date = ad.msg = NIL;
+            ad.spool = NIL;
             ad.message = &st;   /* pointer to stringstruct to use */
             trycreate = NIL;    /* no trycreate status */
             if (!mail_append_multiple (NIL,s,append_msg,(void *) &ad)) {
@@ -1100,6 +1308,7 @@ int main (int argc,char *argv[])
             if (ad.flags) fs_give ((void **) &ad.flags);
             if (ad.date) fs_give ((void **) &ad.date);
             if (ad.msg) fs_give ((void **) &ad.msg);
+            if (ad.spool) fclose (ad.spool);
           }
           else response = misarg;
           if (stream)           /* allow untagged EXPUNGE */
@@ -1110,15 +1319,33 @@ int main (int argc,char *argv[])
                                 /* get reference and mailbox argument */
           if (!((s = snarf (&arg)) && (t = snarf_list (&arg))))
             response = misarg;
-          else if (arg) response = badarg;
+                                /* LIST return options */
+          else if (arg && !((cmd[0] == 'L') && ((f = list_return (arg)) >= 0)))
+            response = badarg;
                                 /* make sure anonymous can't do bad things */
           else if (nameok (s,t)) {
+            if (arg && f) {     /* collect names for STATUS after LIST */
+              liststatus = f;
+              statustail = &statuslist;
+            }
             if (newsproxypattern (s,t,tmp,LONGT)) {
               proxylist = T;
               mail_list (NIL,"",tmp);
               proxylist = NIL;
             }
             else mail_list (NIL,s,t);
+            liststatus = NIL;   /* no more collecting */
+                                /* skip selected and non-mailbox names, but
+                                   INBOX always exists even if empty */
+            for (sl = statuslist; sl; sl = sl->next)
+              if (!(lastsel && (!strcmp (sl->text.data,lastsel) ||
+                                (stream && !strcmp (sl->text.data,
+                                                    stream->mailbox)))) &&
+                  (!compare_cstring (sl->text.data,"INBOX") ||
+                   ((d = mail_valid (NIL,sl->text.data,NIL)) &&
+                    strcmp (d->name,"dummy"))))
+                mail_status (NIL,sl->text.data,f);
+            if (statuslist) mail_free_stringlist (&statuslist);
           }
           if (stream)           /* allow untagged EXPUNGE */
             mail_parameters (stream,SET_ONETIMEEXPUNGEATPING,(void *) stream);
@@ -1187,22 +1414,8 @@ int main (int argc,char *argv[])
                 (t = strchr (arg,')')) && (t - arg) && !t[1]))
             response = misarg;
           else {
-            f = NIL;            /* initially no flags */
             *t = '\0';          /* tie off flag string */
-                                /* read flags */
-            t = strtok_r (ucase (arg)," ",&sstate);
-            do {                /* parse each one; unknown generate warning */
-              if (!strcmp (t,"MESSAGES")) f |= SA_MESSAGES;
-              else if (!strcmp (t,"RECENT")) f |= SA_RECENT;
-              else if (!strcmp (t,"UNSEEN")) f |= SA_UNSEEN;
-              else if (!strcmp (t,"UIDNEXT")) f |= SA_UIDNEXT;
-              else if (!strcmp (t,"UIDVALIDITY")) f |= SA_UIDVALIDITY;
-              else {
-                PSOUT ("* NO Unknown status flag ");
-                PSOUT (t);
-                CRLF;
-              }
-            } while (t = strtok_r (NIL," ",&sstate));
+            f = status_flags (arg);
             ping_mailbox (uid); /* in case the fool did STATUS on open mbx */
             PFLUSH ();          /* make sure stdout is dumped in case slave */
             if (!compare_cstring (s,"INBOX")) s = "INBOX";
@@ -1231,6 +1444,9 @@ int main (int argc,char *argv[])
               if (f & SA_UIDVALIDITY)
                 sprintf (tmp + strlen(tmp)," UIDVALIDITY %lu",
                          stream->uid_validity);
+              if (f & SA_HIGHESTMODSEQ)
+                sprintf (tmp + strlen(tmp)," HIGHESTMODSEQ %lu",
+                         mail_highestmodseq (stream));
               tmp[1] = '(';
               strcat (tmp,")\015\012");
               PSOUT ("* STATUS ");
@@ -1278,6 +1494,32 @@ int main (int argc,char *argv[])
             mail_parameters (stream,SET_ONETIMEEXPUNGEATPING,(void *) stream);
         }
 
+                                /* start compression */
+        else if (!strcmp (cmd,"COMPRESS")) {
+          if (!((s = snarf (&arg)) && !arg && !compare_cstring (s,"DEFLATE")))
+            response = misarg;
+          else if (lsterr = ssl_start_compress (s)) response = losecompress;
+        }
+                                /* enable extensions */
+        else if (!strcmp (cmd,"ENABLE")) {
+          if (!arg) response = misarg;
+          else {                /* report only those newly enabled */
+            PSOUT ("* ENABLED");
+            for (s = strtok_r (ucase (arg)," ",&sstate); s;
+                 s = strtok_r (NIL," ",&sstate)) {
+              if (!strcmp (s,"CONDSTORE")) {
+                if (!condstore) PSOUT (" CONDSTORE");
+                condstore = T;
+              }
+              else if (!strcmp (s,"QRESYNC")) {
+                if (!qresync) PSOUT (" QRESYNC");
+                qresync = condstore = T;
+              }
+            }
+            CRLF;
+          }
+        }
+
         else if (!strcmp (cmd,"NAMESPACE")) {
           if (arg) response = badarg;
           else {
@@ -1371,15 +1613,21 @@ int main (int argc,char *argv[])
           if (arg) response = badarg;
           else {                /* tell client ready for argument */
             unsigned long donefake = 0;
+            int wfd = -1;
+            long parked = NIL;
             PSOUT ("+ Waiting for DONE\015\012");
             PFLUSH ();          /* dump output buffer */
                                 /* inactivity countdown */
             i = ((TIMEOUT) / (IDLETIMER)) + 1;
             do {                /* main idle loop */
               if (!donefake) {  /* don't ping mailbox if faking */
-                mail_parameters (stream,SET_ONETIMEEXPUNGEATPING,
-                                 (void *) stream);
-                ping_mailbox (uid);
+                if (wfd < 0) {  /* or if driver tells us of changes */
+                                /* start watching before first ping */
+                  if (state == OPEN) wfd = mail_watch (stream);
+                  mail_parameters (stream,SET_ONETIMEEXPUNGEATPING,
+                                   (void *) stream);
+                  ping_mailbox (uid);
+                }
                                 /* maybe do a checkpoint if not anonymous */
                 if (!anonymous && stream &&
                     (time (0) > (lastcheck + CHECKTIMER))) {
@@ -1391,6 +1639,9 @@ int main (int argc,char *argv[])
                   lastcheck = time (0);
                 }
               }
+                                /* idle for a while, shed memory */
+              if (!parked && (i <= ((TIMEOUT) / (IDLETIMER))))
+                parked = idle_park ();
               if (lstwrn) {     /* have a warning? */
                 PSOUT ("* NO ");
                 PSOUT (lstwrn);
@@ -1409,7 +1660,8 @@ int main (int argc,char *argv[])
                 PSOUT (tmp);    /* prod client to wake up */
               }
               PFLUSH ();        /* dump output buffer */
-            } while ((state != LOGOUT) && !INWAIT (IDLETIMER) && --i);
+            } while ((state != LOGOUT) &&
+                     !idle_wait (IDLETIMER,uid,donefake ? -1 : wfd) && --i);
 
                                 /* time to exit idle loop */
             if (state != LOGOUT) {
@@ -1522,6 +1774,16 @@ int main (int argc,char *argv[])
           pset (&caset);
           PSOUT ("] ");
         }
+        else if (modified) {    /* conditional STORE failed for some? */
+          PSOUT ("[MODIFIED ");
+          pset (&modified);
+          PSOUT ("] ");
+        }
+        else if (okmodseq) {    /* highest modseq after expunge? */
+          PSOUT ("[HIGHESTMODSEQ ");
+          pnum (okmodseq);
+          PSOUT ("] ");
+        }
         else if (lstref) {      /* have a referral? */
           PSOUT ("[REFERRAL ");
           PSOUT (lstref);
@@ -1547,7 +1809,9 @@ int main (int argc,char *argv[])
         PSOUT (tmp);            /* output response */
       }
     }
-    PFLUSH ();                  /* make sure output blatted */
+                                /* coalesce output of pipelined commands */
+    if ((state == LOGOUT) || !INPENDING ()) PFLUSH ();
+    trace_end ();               /* done tracing this command */
 
     if (autologouttime) {       /* have an autologout in effect? */
                                 /* cancel if no longer waiting for login */
@@ -1581,10 +1845,14 @@ int main (int argc,char *argv[])
 
 void ping_mailbox (unsigned long uid)
 {
-  unsigned long i;
+  unsigned long i,j;
+  int phase;
   char tmp[MAILTMPLEN];
   if (state == OPEN) {
-    if (!mail_ping (stream)) {  /* make sure stream still alive */
+    phase = trace_phase (TRACE_DRIVER);
+    i = mail_ping (stream);     /* make sure stream still alive */
+    trace_phase (phase);
+    if (!i) {
       PSOUT ("* BYE ");
       PSOUT (mylocalhost ());
       PSOUT (" Fatal mailbox error: ");
@@ -1631,17 +1899,24 @@ void ping_mailbox (unsigned long uid)
                                 /* first report any new flags */
       if ((nflags < NUSERFLAGS) && stream->user_flags[nflags])
         new_flags (stream);
-      for (i = 1; i <= nmsgs; i++) if (mail_elt (stream,i)->spare2) {
-        PSOUT ("* ");
-        pnum (i);
-        PSOUT (" FETCH (");
-        fetch_flags (i,NIL);    /* output changed flags */
-        if (uid) {              /* need to include UIDs in response? */
-          PBOUT (' ');
-          fetch_uid (i,NIL);
+                                /* then any changed flags */
+      for (j = 0; j < ndirty; j++)
+        if (((i = dirty[j]) <= nmsgs) && mail_elt (stream,i)->spare2) {
+          PSOUT ("* ");
+          pnum (i);
+          PSOUT (" FETCH (");
+          fetch_flags (i,NIL);  /* output changed flags */
+          if (uid) {            /* need to include UIDs in response? */
+            PBOUT (' ');
+            fetch_uid (i,NIL);
+          }
+          if (condstore && mail_highestmodseq (stream)) {
+            PBOUT (' ');        /* CONDSTORE clients want MODSEQ too */
+            fetch_modseq (i,NIL);
+          }
+          PSOUT (")\015\012");
         }
-        PSOUT (")\015\012");
-      }
+      ndirty = 0;               /* dirty list drained */
     }
     else {                      /* driver changed */
       new_flags (stream);       /* send mailbox flags */
@@ -1651,14 +1926,20 @@ void ping_mailbox (unsigned long uid)
         PSOUT ("] Mailbox status\015\012");
       }
       curdriver = stream->dtb;
+      if (i = mail_highestmodseq (stream)) {
+        PSOUT ("* OK [HIGHESTMODSEQ ");
+        pnum (i);
+        PSOUT ("] Highest\015\012");
+      }
+      else PSOUT ("* OK [NOMODSEQ] Sorry, this mailbox format doesn't support"
+                  " modsequences\015\012");
       if (nmsgs) {              /* get flags for all messages */
         sprintf (tmp,"1:%lu",nmsgs);
         mail_fetch_flags (stream,tmp,NIL);
                                 /* don't do this if newsrc already did */
         if (!(curdriver->flags & DR_NEWS)) {
                                 /* find first unseen message */
-          for (i = 1; i <= nmsgs && mail_elt (stream,i)->seen; i++);
-          if (i <= nmsgs) {
+          if ((i = first_unseen ()) <= nmsgs) {
             PSOUT ("* OK [UNSEEN ");
             pnum (i);
             PSOUT ("] first unseen message in ");
@@ -1688,6 +1969,325 @@ void ping_mailbox (unsigned long uid)
                              useralerttime);
   }
 }
+
+
+/* Note message flags changed
+ * Accepts: MAIL stream
+ *          message number
+ *
+ * The message is queued once on the dirty list for ping_mailbox() to report,
+ * so the end of each command costs O(changes) rather than O(messages).
+ */
+
+void flags_changed (MAILSTREAM *s,unsigned long msgno)
+{
+  MESSAGECACHE *elt = mail_elt (s,msgno);
+  if (!elt->spare2) {           /* not already queued? */
+    elt->spare2 = T;
+    if (ndirty >= dirtysize) {  /* grow list if needed */
+      if (dirty) fs_resize ((void **) &dirty,
+                            (dirtysize += 1024) * sizeof (unsigned long));
+      else dirty = (unsigned long *)
+             fs_get ((dirtysize = 1024) * sizeof (unsigned long));
+    }
+    dirty[ndirty++] = msgno;
+  }
+                                /* lower first unseen mark if now unseen */
+  if (!elt->seen && (msgno < unseenlow)) unseenlow = msgno;
+}
+
+
+/* Return first unseen message
+ * Returns: message number, or greater than nmsgs if all seen
+ */
+
+unsigned long first_unseen (void)
+{
+                                /* advance low mark past seen messages */
+  while ((unseenlow <= stream->nmsgs) && mail_elt (stream,unseenlow)->seen)
+    unseenlow++;
+  return unseenlow;
+}
+
+
+/* Save first unseen mark of the selected mailbox, and forget it
+ *
+ * The mark can only be trusted again if the mailbox is unchanged when next
+ * selected, which only a modseq can tell.
+ */
+
+void unseen_save (void)
+{
+  unsigned long m;
+  if (unseenmbx) fs_give ((void **) &unseenmbx);
+  if ((state == OPEN) && lastsel && (m = mail_highestmodseq (stream))) {
+    unseenmbx = cpystr (lastsel);
+    unseenvalidity = stream->uid_validity;
+    unseenmodseq = m;
+    unseensaved = unseenlow;
+  }
+  unseenlow = 1;                /* first unseen not known */
+}
+
+
+/* Restore first unseen mark saved for the newly selected mailbox
+ *
+ * Otherwise the first UNSEEN would scan from message 1 on every SELECT.
+ */
+
+void unseen_restore (void)
+{
+  if (unseenmbx && !strcmp (unseenmbx,lastsel) &&
+      (unseenvalidity == stream->uid_validity) &&
+      (unseenmodseq == mail_highestmodseq (stream)) &&
+      (unseensaved <= stream->nmsgs + 1)) unseenlow = unseensaved;
+  if (unseenmbx) fs_give ((void **) &unseenmbx);
+}
+
+/* Parse STATUS item names
+ * Accepts: space-delimited item names
+ * Returns: status flags
+ */
+
+long status_flags (char *s)
+{
+  char *t,*sstate;
+  long f = NIL;                 /* initially no flags */
+                                /* parse each one; unknown generate warning */
+  for (t = strtok_r (ucase (s)," ",&sstate); t; t = strtok_r (NIL," ",&sstate))
+    if (!strcmp (t,"MESSAGES")) f |= SA_MESSAGES;
+    else if (!strcmp (t,"RECENT")) f |= SA_RECENT;
+    else if (!strcmp (t,"UNSEEN")) f |= SA_UNSEEN;
+    else if (!strcmp (t,"UIDNEXT")) f |= SA_UIDNEXT;
+    else if (!strcmp (t,"UIDVALIDITY")) f |= SA_UIDVALIDITY;
+    else if (!strcmp (t,"HIGHESTMODSEQ")) {
+      f |= SA_HIGHESTMODSEQ;
+      condstore = T;            /* implicitly enables CONDSTORE */
+    }
+    else {
+      PSOUT ("* NO Unknown status flag ");
+      PSOUT (t);
+      CRLF;
+    }
+  return f;
+}
+
+/* Parse LIST RETURN options
+ * Accepts: argument text after the mailbox pattern
+ * Returns: STATUS flags, 0 if none requested, -1 if syntax error
+ *
+ * CHILDREN is accepted and ignored since children are always reported.
+ */
+
+long list_return (unsigned char *s)
+{
+  long ret = 0;
+  unsigned char *t;
+  for (t = "RETURN ("; *t && (toupper (*s) == *t); s++,t++);
+  if (*t || !*s) return -1;     /* not a RETURN list */
+                                /* option list must end the command */
+  if (*(t = s + strlen (s) - 1) != ')') return -1;
+  *t = '\0';                    /* tie off option list */
+  for (ucase (s); *s; s++) {
+    if (!strncmp (s,"CHILDREN",8) && (!s[8] || (s[8] == ' '))) s += 8;
+    else if (!strncmp (s,"STATUS (",8) && !ret &&
+             (t = strchr (s += 8,')'))) {
+      *t = '\0';                /* tie off item list */
+      if (!(ret = status_flags (s))) return -1;
+      s = t + 1;
+    }
+    else return -1;             /* unknown option */
+    if (*s && ((*s != ' ') || !s[1])) return -1;
+    if (!*s) break;
+  }
+  return ret;
+}
+
+/* Start tracing a command
+ */
+
+void trace_begin (void)
+{
+  curtrace = trace + (ntrace % TRACESIZE);
+  memset (curtrace,0,sizeof (TRACE));
+  gettimeofday (&tracemark,NIL);
+  curtrace->when = tracemark.tv_sec;
+  tracephase = TRACE_SERVER;    /* forget any unbalanced blocking */
+  tracesp = 0;
+}
+
+
+/* Finish tracing a command
+ *
+ * The trace ring is logged if the command did more than TRACESLOW msec of
+ * work, that is, not counting time spent waiting for the client.
+ */
+
+void trace_end (void)
+{
+  unsigned long in,out;
+  unsigned long work = 0;
+  int i;
+  if (curtrace) {
+    trace_phase (TRACE_SERVER); /* charge final phase */
+    strncpy (curtrace->cmd,cmd ? (char *) cmd : "*",
+             sizeof (curtrace->cmd) - 1);
+    if (stream && stream->mailbox)
+      strncpy (curtrace->mailbox,stream->mailbox,
+               sizeof (curtrace->mailbox) - 1);
+    PBYTES (&in,&out);          /* I/O since previous command */
+    curtrace->in = in - tracein;
+    curtrace->out = out - traceout;
+    tracein = in;
+    traceout = out;
+    for (i = 0; i < NTRACEPHASES; i++)
+      if (i != TRACE_INPUT) work += curtrace->usec[i];
+    curtrace = NIL;             /* entry is now complete */
+    ntrace++;
+    if (work >= TRACESLOW * 1000) trace_log ();
+  }
+}
+
+
+/* Switch trace phase
+ * Accepts: new phase
+ * Returns: previous phase
+ */
+
+int trace_phase (int phase)
+{
+  struct timeval now;
+  long usec;
+  int ret = tracephase;
+  if (curtrace) {               /* charge elapsed time to old phase */
+    gettimeofday (&now,NIL);
+    usec = (now.tv_sec - tracemark.tv_sec) * 1000000 +
+      (now.tv_usec - tracemark.tv_usec);
+    if (usec > 0) curtrace->usec[tracephase] += usec;
+    tracemark = now;
+  }
+  tracephase = phase;
+  return ret;
+}
+
+
+/* Block notification for command trace
+ * Accepts: reason for calling
+ *          data
+ * Returns: data
+ */
+
+void *trace_blocknotify (int reason,void *data)
+{
+  switch (reason) {
+  case BLOCK_SENSITIVE:         /* not a blocking operation */
+  case BLOCK_NONSENSITIVE:
+    break;
+  case BLOCK_NONE:              /* blocking done, resume interrupted phase */
+    if (tracesp) trace_phase (tracestack[--tracesp]);
+    break;
+  default:                      /* entering a blocking operation */
+    if (tracesp < TRACEDEPTH) tracestack[tracesp++] =
+      trace_phase ((reason == BLOCK_FILELOCK) ? TRACE_LOCK :
+                   (reason == BLOCK_TCPWRITE) ? TRACE_FLUSH :
+                   (reason == BLOCK_TCPREAD) ? TRACE_INPUT : tracephase);
+    break;
+  }
+  return mm_blocknotify (reason,data);
+}
+
+/* Log the command trace ring
+ */
+
+void trace_log (void)
+{
+  char *s,tmp[MAILTMPLEN];
+  unsigned long i = (ntrace > TRACESIZE) ? ntrace - TRACESIZE : 0;
+  syslog (LOG_INFO,"Slow command trace user=%.80s host=%.80s",
+          user ? (char *) user : "???",tcp_clienthost ());
+                                /* log commands not already logged */
+  for (i = max (i,tracelogged); i < ntrace; i++) {
+    s = trace_out (tmp,trace + (i % TRACESIZE));
+    *s = '\0';                  /* tie off entry */
+    syslog (LOG_INFO,"%s",tmp);
+  }
+  tracelogged = ntrace;
+}
+
+
+/* Write command trace entry
+ * Accepts: destination string pointer
+ *          trace entry
+ * Returns: updated string pointer
+ *
+ * Uses only sout() and nout() so that it is safe in staint().
+ */
+
+char *trace_out (char *s,TRACE *t)
+{
+  s = nout (sout (s,"time="),(unsigned long) t->when,10);
+  s = sout (sout (s," cmd="),t->cmd);
+  if (t->mailbox[0]) s = sout (sout (s," mailbox="),t->mailbox);
+  s = nout (sout (s," msgs="),t->msgs,10);
+  s = nout (sout (s," in="),t->in,10);
+  s = nout (sout (s," out="),t->out,10);
+  s = nout (sout (s," usec server="),t->usec[TRACE_SERVER],10);
+  s = nout (sout (s," driver="),t->usec[TRACE_DRIVER],10);
+  s = nout (sout (s," flush="),t->usec[TRACE_FLUSH],10);
+  s = nout (sout (s," lock="),t->usec[TRACE_LOCK],10);
+  return nout (sout (s," input="),t->usec[TRACE_INPUT],10);
+}
+
+/* Wait for client input during IDLE
+ * Accepts: timeout in seconds
+ *          UID flag for ping
+ *          mailbox change notification descriptor, or -1 if none
+ * Returns: T if client input available, NIL if timeout or logout
+ *
+ * Mailbox changes are reported as they happen, without waiting for timeout.
+ */
+
+long idle_wait (long seconds,unsigned long uid,int fd)
+{
+  long ret;
+  time_t now = time (0);
+  time_t limit = now + seconds;
+  if (fd < 0) return INWAIT (seconds);
+                                /* until input, timeout, or watch goes away */
+  while ((ret = INWAITFD (limit - now,fd)) < 0) {
+                                /* discard notifications before ping */
+    fd = (state == OPEN) ? mail_watch (stream) : -1;
+    mail_parameters (stream,SET_ONETIMEEXPUNGEATPING,(void *) stream);
+    ping_mailbox (uid);
+    PFLUSH ();                  /* announce changes right away */
+    if (state != OPEN) return NIL;
+    if ((now = time (0)) >= limit) return NIL;
+    if (fd < 0) return INWAIT (limit - now);
+  }
+  return ret;
+}
+
+
+/* Release memory not needed while idle
+ * Returns: T, always
+ *
+ * Cached envelopes and texts are rebuilt on demand if the client fetches them
+ * again after IDLE.
+ *
+ * This only shrinks the session in place; it does not hand the client off to
+ * a shared parker process.  That would mean moving a live TLS session and
+ * the open MAILSTREAM between processes, which neither OpenSSL nor c-client
+ * can do, so the per-process baseline (stack, cmdbuf, SSL buffers) stays.
+ */
+
+long idle_park (void)
+{
+  if (stream) mail_gc (stream,GC_ENV | GC_TEXTS);
+#ifdef HAVE_MALLOC_TRIM
+  malloc_trim (0);              /* give freed memory back to the system */
+#endif
+  return LONGT;
+}
 
 /* Print an alert file
  * Accepts: path of alert file
@@ -1917,6 +2517,7 @@ void staint (void)
 #if unix
   int fd;
   char *s,buf[8*MAILTMPLEN];
+  unsigned long i;
   unsigned long pid = getpid ();
                                 /* build file name */
   s = nout (sout (buf,"/tmp/imapd-status."),pid,10);
@@ -1955,6 +2556,12 @@ void staint (void)
     else s = sout (s,"UNKNOWN STATE");
     *s++ = '\n';
     write (fd,buf,s-buf);
+                                /* recent command trace, oldest first */
+    for (i = (ntrace > TRACESIZE) ? ntrace - TRACESIZE : 0; i < ntrace; i++) {
+      s = trace_out (buf,trace + (i % TRACESIZE));
+      *s++ = '\n';
+      write (fd,buf,s-buf);
+    }
     close (fd);
   }
 #endif
@@ -2000,7 +2607,7 @@ char *nout (char *s,unsigned long n,unsigned long base)
 
 void slurp (char *s,int n,unsigned long timeout)
 {
-  memset (s,'\0',n);            /* zap buffer */
+  *s = '\0';                    /* empty line in case of logout */
   if (state != LOGOUT) {        /* get a command under timeout */
     settimeout (timeout);
     clearerr (stdin);           /* clear stdin errors */
@@ -2020,17 +2627,7 @@ void slurp (char *s,int n,unsigned long timeout)
 void inliteral (char *s,unsigned long n)
 {
   unsigned long i;
-  if (litplus.ok) {             /* no more LITERAL+ to worry about */
-    litplus.ok = NIL;
-    litplus.size = 0;
-  }
-  else {                        /* otherwise tell client ready for argument */
-    PSOUT ("+ Ready for argument\015\012");
-    PFLUSH ();                  /* dump output buffer */
-  }
-  clearerr (stdin);             /* clear stdin errors */
-  memset (s,'\0',n+1);          /* zap buffer */
-  status = "reading literal";
+  readyliteral ();              /* get client to send it */
   while (n) {                   /* get data under timeout */
     if (state == LOGOUT) n = 0;
     else {
@@ -2047,6 +2644,57 @@ void inliteral (char *s,unsigned long n)
       settimeout (0);           /* stop timeout */
     }
   }
+  *s = '\0';                    /* tie off literal */
+}
+
+
+/* Read a literal into a scratch file
+ * Accepts: scratch file
+ *          size of literal
+ * Returns: T if literal written to file, NIL if write error
+ */
+
+long inliteralspool (FILE *f,unsigned long n)
+{
+  unsigned long i;
+  char tmp[8193];               /* PSINR() ties off with a NUL */
+  long ret = LONGT;
+  readyliteral ();              /* get client to send it */
+  while (n) {                   /* get data under timeout */
+    if (state == LOGOUT) n = 0;
+    else {
+      settimeout (INPUTTIMEOUT);
+      i = min (n,8192);         /* must read at least 8K within timeout */
+      if (PSINR (tmp,i)) {      /* keep reading literal even if write fails */
+        if (ret && (fwrite (tmp,1,i,f) != i)) ret = NIL;
+        n -= i;
+      }
+      else {
+        ioerror (stdin,status);
+        n = 0;                  /* in case it continues */
+      }
+      settimeout (0);           /* stop timeout */
+    }
+  }
+  return (fflush (f) || ferror (f)) ? NIL : ret;
+}
+
+
+/* Prepare to read a literal
+ */
+
+void readyliteral (void)
+{
+  if (litplus.ok) {             /* no more LITERAL+ to worry about */
+    litplus.ok = NIL;
+    litplus.size = 0;
+  }
+  else {                        /* otherwise tell client ready for argument */
+    PSOUT ("+ Ready for argument\015\012");
+    PFLUSH ();                  /* dump output buffer */
+  }
+  clearerr (stdin);             /* clear stdin errors */
+  status = "reading literal";
 }
 
 /* Flush until newline seen
@@ -2386,6 +3034,7 @@ long parse_criterion (SEARCHPGM *pgm,unsigned char **arg,unsigned long maxmsg,
     c = *(del = tail);          /* remember the delimiter */
     *del = '\0';                /* tie off criterion */
     switch (*ucase (s)) {       /* dispatch based on character */
+    case '$':                   /* saved search result */
     case '*':                   /* sequence */
     case '0': case '1': case '2': case '3': case '4':
     case '5': case '6': case '7': case '8': case '9':
@@ -2395,7 +3044,8 @@ long parse_criterion (SEARCHPGM *pgm,unsigned char **arg,unsigned long maxmsg,
         *not = mail_newsearchpgmlist ();
         set = &((*not)->pgm->not = mail_newsearchpgmlist ())->pgm->msgno;
       }
-      ret = crit_set (set,&s,maxmsg) && (tail == s);
+      ret = ((*s == '$') ? crit_saved (set,&s,NIL) :
+             crit_set (set,&s,maxmsg)) && (tail == s);
       break;
     case 'A':                   /* possible ALL, ANSWERED */
       if (!strcmp (s+1,"LL")) ret = T;
@@ -2442,6 +3092,18 @@ long parse_criterion (SEARCHPGM *pgm,unsigned char **arg,unsigned long maxmsg,
       if (!strcmp (s+1,"ARGER") && c == ' ' && *++tail)
         ret = crit_number (&pgm->larger,&tail);
       break;
+    case 'M':                   /* possible MODSEQ */
+      if (!strcmp (s+1,"ODSEQ") && c == ' ' && *++tail &&
+          mail_highestmodseq (stream)) {
+        unsigned char d;
+                                /* skip metadata entry name and type */
+        if (!isdigit (*tail) &&
+            !(parse_astring (&tail,&i,&d) && (d == ' ') && tail &&
+              (tail = strchr (tail,' ')) && *++tail)) break;
+        if (ret = crit_number (&pgm->modseq,&tail))
+          searchmodseq = condstore = T;
+      }
+      break;
     case 'N':                   /* possible NEW, NOT */
       if (!strcmp (s+1,"EW")) ret = pgm->recent = pgm->unseen = T;
       else if (!strcmp (s+1,"OT") && c == ' ' && *++tail) {
@@ -2499,7 +3161,8 @@ long parse_criterion (SEARCHPGM *pgm,unsigned char **arg,unsigned long maxmsg,
           *not = mail_newsearchpgmlist ();
           set = &((*not)->pgm->not = mail_newsearchpgmlist ())->pgm->uid;
         }
-        ret = crit_set (set,&tail,maxuid);
+        ret = (*tail == '$') ? crit_saved (set,&tail,T) :
+          crit_set (set,&tail,maxuid);
       }
       else if (!strcmp (s+1,"NANSWERED")) ret = pgm->unanswered = T;
       else if (!strcmp (s+1,"NDELETED")) ret = pgm->undeleted = T;
@@ -2644,6 +3307,26 @@ long crit_set (SEARCHSET **set,unsigned char **arg,unsigned long maxima)
   return T;                     /* return success */
 }
 
+/* Parse a saved search result criterion
+ * Accepts: set to write into
+ *          pointer to argument text pointer
+ *          UID set flag
+ * Returns: T if success, NIL if error
+ */
+
+long crit_saved (SEARCHSET **set,unsigned char **arg,long uid)
+{
+  unsigned long i;
+  SEARCHSET *tail;
+  if (*set) return NIL;         /* can't double this value */
+  (*arg)++;                     /* skip past $ */
+                                /* empty set matches nothing */
+  for (i = 1, tail = *set = mail_newsearchset (); i <= nmsgs; i++)
+    if (mail_elt (stream,i)->spare3)
+      tail = mail_append_set (tail,uid ? mail_uid (stream,i) : i);
+  return T;
+}
+
 /* Parse a search number criterion
  * Accepts: number to write into
  *          pointer to argument text pointer
@@ -2688,21 +3371,51 @@ long crit_string (STRINGLIST **string,unsigned char **arg)
   return T;
 }
 
+/* Parse fetch modifiers
+ * Accepts: string of data items to be fetched (must be writeable)
+ *          pointer to return CHANGEDSINCE modseq
+ *          pointer to return VANISHED flag
+ * Returns: T if success, NIL if syntax error
+ */
+
+long fetch_modifiers (char *t,unsigned long *changedsince,long *vanished)
+{
+  char *s;
+  size_t i = strlen (t);
+  *changedsince = 0;            /* default to no modifiers */
+  *vanished = NIL;
+                                /* modifiers are a trailing flat list */
+  if (!i || (t[i-1] != ')')) return T;
+  for (s = t + i - 2; (s > t) && (*s != '(') && (*s != ')'); s--);
+  if ((s <= t) || (*s != '(') || (s[-1] != ' ') ||
+      strncmp (ucase (s+1),"CHANGEDSINCE ",13)) return T;
+  s[-1] = '\0';                 /* tie off data items */
+  if (!(isdigit (s[14]) && (*changedsince = strtoul (s+14,&s,10))))
+    return NIL;                 /* CHANGEDSINCE 0 is invalid */
+  if (!strcmp (s," VANISHED)")) *vanished = T;
+  else if (strcmp (s,")")) return NIL;
+  return T;
+}
+
 /* Fetch message data
  * Accepts: string of data items to be fetched (must be writeable)
+ *          set of messages to fetch
  *          UID fetch flag
+ *          CHANGEDSINCE modseq or 0
  */
 
 #define MAXFETCH 100
 
-void fetch (char *t,unsigned long uid)
+void fetch (char *t,SEARCHSET *set,unsigned long uid,
+            unsigned long changedsince)
 {
   fetchfn_t f[MAXFETCH +2];
   void *fa[MAXFETCH + 2];
   int k;
   memset ((void *) f,NIL,sizeof (f));
   memset ((void *) fa,NIL,sizeof (fa));
-  fetch_work (t,uid,f,fa);      /* do the work */
+                                /* do the work */
+  fetch_work (t,set,uid,changedsince,f,fa);
                                 /* clean up arguments */
   for (k = 1; f[k]; k++) if (fa[k]) (*f[k]) (0,fa[k]);
 }
@@ -2710,12 +3423,15 @@ void fetch (char *t,unsigned long uid)
 
 /* Fetch message data worker routine
  * Accepts: string of data items to be fetched (must be writeable)
+ *          set of messages to fetch
  *          UID fetch flag
+ *          CHANGEDSINCE modseq or 0
  *          function dispatch vector
  *          function argument vector
  */
 
-void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[])
+void fetch_work (char *t,SEARCHSET *set,unsigned long uid,
+                 unsigned long changedsince,fetchfn_t f[],void *fa[])
 {
   unsigned char *s,*v;
   unsigned long i;
@@ -2728,6 +3444,10 @@ void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[])
     fa[k] = NIL;                /* no argument */
     f[k++] = fetch_uid;         /* push a UID fetch on the stack */
   }
+  if (changedsince) {           /* CHANGEDSINCE implies MODSEQ */
+    fa[k] = NIL;
+    f[k++] = fetch_modseq;
+  }
 
                                 /* process macros */
   if (!strcmp (ucase (t),"ALL"))
@@ -2746,6 +3466,14 @@ void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[])
     if (!strcmp (s,"UID")) {    /* no-op if implicit */
       if (!uid) f[k++] = fetch_uid;
     }
+    else if (!strcmp (s,"MODSEQ")) {
+      if (!mail_highestmodseq (stream)) {
+        response = badmodseq;
+        return;
+      }
+      condstore = T;            /* implicitly enables CONDSTORE */
+      if (!changedsince) f[k++] = fetch_modseq;
+    }
     else if (!strcmp (s,"FLAGS")) f[k++] = fetch_flags;
     else if (!strcmp (s,"INTERNALDATE")) f[k++] = fetch_internaldate;
     else if (!strcmp (s,"RFC822.SIZE")) f[k++] = fetch_rfc822_size;
@@ -2921,14 +3649,14 @@ void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[])
     return;
   }
   f[k] = NIL;                   /* tie off attribute list */
-                                /* c-client clobbers sequence, use spare */
-  for (i = 1; i <= nmsgs; i++)
-    mail_elt (stream,i)->spare = mail_elt (stream,i)->sequence;
+  trace_phase (TRACE_DRIVER);   /* output is mostly driver data */
                                 /* for each requested message */
-  for (i = 1; (i <= nmsgs) && (response != loseunknowncte); i++) {
+  for (i = 0; (i = mail_next_set (&set,i)) && (i <= nmsgs) &&
+         (response != loseunknowncte);) {
                                 /* kill if dying */
     if (state == LOGOUT) longjmp (jmpenv,1);
-    if (mail_elt (stream,i)->spare) {
+    if (!changedsince || (mail_elt (stream,i)->private.mod > changedsince)) {
+      if (curtrace) curtrace->msgs++;
                                 /* parse envelope, set body, do warnings */
       if (parse_envs) mail_fetchstructure (stream,i,parse_bodies ? &b : NIL);
       quell_events = T;         /* can't do any events now */
@@ -2945,6 +3673,7 @@ void fetch_work (char *t,unsigned long uid,fetchfn_t f[],void *fa[])
       quell_events = NIL;       /* events alright now */
     }
   }
+  trace_phase (TRACE_SERVER);
 }
 
 /* Fetch message body structure (extensible)
@@ -3015,8 +3744,17 @@ void fetch_body_part_contents (unsigned long i,void *args)
   TEXTARGS *ta = (TEXTARGS *) args;
   if (i) {                      /* do work? */
     SIZEDTEXT st;
-    char *tmp = (char *) fs_get (100+(ta->section ? strlen (ta->section) : 0));
-    unsigned long uid = mail_uid (stream,i);
+    char *tmp;
+    unsigned long uid;
+                                /* whole message, avoid building a copy */
+    if (!(ta->section || ta->first || ta->last)) {
+      int f = mail_elt (stream,i)->seen;
+      pmessage (i,"BODY[]",ta->flags);
+      changed_flags (i,f);      /* output changed flags */
+      return;
+    }
+    tmp = (char *) fs_get (100+(ta->section ? strlen (ta->section) : 0));
+    uid = mail_uid (stream,i);
     sprintf (tmp,"BODY[%s]",ta->section ? ta->section : "");
                                 /* try to use remembered text */
     if (lastuid && (uid == lastuid) && !strcmp (tmp,lastid)) st = lastst;
@@ -3037,89 +3775,99 @@ void fetch_body_part_contents (unsigned long i,void *args)
 /* Fetch body part binary
  * Accepts: message number
  *          extra argument
- * Someday fix this to use stringstruct instead of memory
  */
 
 void fetch_body_part_binary (unsigned long i,void *args)
 {
   TEXTARGS *ta = (TEXTARGS *) args;
   if (i) {                      /* do work? */
-    SIZEDTEXT st,cst;
+    SIZEDTEXT st;
+    RFC822DECODE dc;
+    BINARYWINDOW bw;
+    unsigned long pos,size;
+    int cached = NIL;
+    STRING *bs = &stream->private.string;
     BODY *body = mail_body (stream,i,ta->section);
     char *tmp = (char *) fs_get (100+(ta->section ? strlen (ta->section) : 0));
-    unsigned long uid = mail_uid (stream,i);
-                                /* try to use remembered text */
-    if (lastuid && (uid == lastuid) && !strcmp (tmp,lastid)) st = lastst;
-    else {                      /* get data */
-      st.data = (unsigned char *)
-        mail_fetch_body (stream,i,ta->section,&st.size,ta->flags);
-      if (ta->first || ta->last) remember (uid,tmp,&st);
-    }
+    char *err = NIL;
                                 /* what encoding was used? */
     if (body) switch (body->encoding) {
-    case ENCBASE64:
-      if (cst.data = rfc822_base64 (st.data,st.size,&cst.size)) break;
-      fetch_uid (i,NIL);        /* wrote a space, so must do something */
-      if (lsterr) fs_give ((void **) &lsterr);
-      lsterr = cpystr ("Undecodable BASE64 contents");
-      response = loseunknowncte;
-      fs_give ((void **) &tmp);
-      return;
+    case ENCBASE64:             /* decoded size may already be known */
     case ENCQUOTEDPRINTABLE:
-      if (cst.data = rfc822_qprint (st.data,st.size,&cst.size)) break;
-      fetch_uid (i,NIL);        /* wrote a space, so must do something */
-      if (lsterr) fs_give ((void **) &lsterr);
-      lsterr = cpystr ("Undecodable QUOTED-PRINTABLE contents");
-      response = loseunknowncte;
-      fs_give ((void **) &tmp);
-      return;
+      cached = mail_binary_size (stream,i,ta->section,&size);
+      break;
     case ENC7BIT:               /* no need to convert any of these */
     case ENC8BIT:
     case ENCBINARY:
-      cst.data = NIL;           /* no converted data to free */
       break;
     default:                    /* unknown encoding, oops */
-      fetch_uid (i,NIL);        /* wrote a space, so must do something */
+      err = "Unknown Content-Transfer-Encoding";
+      break;
+    }
+    else {
       if (lsterr) fs_give ((void **) &lsterr);
-      lsterr = cpystr ("Unknown Content-Transfer-Encoding");
+      lsterr = cpystr ("Invalid body part");
       response = loseunknowncte;
       fs_give ((void **) &tmp);
       return;
     }
-    else {
+                                /* size alone never needs the data */
+    if (!err && !(cached && (ta->binary & FTB_SIZE))) {
+      st.data = (unsigned char *)
+        mail_fetch_body (stream,i,ta->section,&st.size,ta->flags |
+                         ((ta->binary & FTB_SIZE) ? FT_PEEK : NIL) |
+                         FT_RETURNSTRINGSTRUCT);
+      pos = (st.data || !bs->curpos) ? 0 : GETPOS (bs);
+      if (cached);              /* already know decoded size */
+      else if ((body->encoding != ENCBASE64) &&
+               (body->encoding != ENCQUOTEDPRINTABLE)) size = st.size;
+      else {                    /* count the decoded octets */
+        rfc822_decode_init (&dc,body->encoding,NIL,NIL);
+        if (binary_decode (&dc,&st,bs,pos)) size = dc.size;
+        else err = (body->encoding == ENCBASE64) ?
+          "Undecodable BASE64 contents" :
+            "Undecodable QUOTED-PRINTABLE contents";
+      }
+    }
+    if (err) {
+      fetch_uid (i,NIL);        /* wrote a space, so must do something */
       if (lsterr) fs_give ((void **) &lsterr);
-      lsterr = cpystr ("Invalid body part");
+      lsterr = cpystr (err);
       response = loseunknowncte;
       fs_give ((void **) &tmp);
       return;
     }
-
-                                /* use decoded version if exists */
-    if (cst.data) memcpy ((void *) &st,(void *) &cst,sizeof (SIZEDTEXT));
     if (ta->binary & FTB_SIZE) {/* just want size? */
       sprintf (tmp,"BINARY.SIZE[%s] %lu",ta->section ? ta->section : "",
-               st.size);
+               size);
       PSOUT (tmp);
     }
     else {                      /* no, blat binary data */
       int f = mail_elt (stream,i)->seen;
-      if (st.data) {            /* only if have useful data */
+      if (st.data || !st.size || bs->curpos) {
                                 /* partial specifier */
         if (ta->first || ta->last)
           sprintf (tmp,"BINARY[%s]<%lu> ",
                    ta->section ? ta->section : "",ta->first);
         else sprintf (tmp,"BINARY[%s] ",ta->section ? ta->section : "");
                                 /* in case first byte beyond end of text */
-        if (st.size <= ta->first) st.size = ta->first = 0;
+        if (size <= ta->first) bw.size = ta->first = 0;
         else {                  /* offset and truncate */
-          st.data += ta->first; /* move to desired position */
-          st.size -= ta->first; /* reduced size */
-          if (ta->last && (st.size > ta->last)) st.size = ta->last;
+          bw.size = size - ta->first;
+          if (ta->last && (bw.size > ta->last)) bw.size = ta->last;
         }
-        if (st.size) sprintf (tmp + strlen (tmp),"{%lu}\015\012",st.size);
+        if (bw.size) sprintf (tmp + strlen (tmp),"{%lu}\015\012",bw.size);
         else strcat (tmp,"\"\"");
         PSOUT (tmp);            /* write binary output */
-        if (st.size && (PSOUTR (&st) == EOF)) ioerror(stdout,"writing binary");
+        if (bw.size) {          /* decode straight to output */
+          bw.skip = ta->first;
+          bw.error = NIL;
+          rfc822_decode_init (&dc,body->encoding,binary_out,(void *) &bw);
+          binary_decode (&dc,&st,bs,pos);
+                                /* pad if data changed under us */
+          while (bw.size && !bw.error && (PBOUT ('\0') != EOF)) --bw.size;
+          if (bw.error || bw.size) ioerror (stdout,"writing binary");
+        }
       }
       else {
         sprintf (tmp,"BINARY[%s] NIL",ta->section ? ta->section : "");
@@ -3127,8 +3875,10 @@ void fetch_body_part_binary (unsigned long i,void *args)
       }
       changed_flags (i,f);      /* write changed flags */
     }
-                                /* free converted data */
-    if (cst.data) fs_give ((void **) &cst.data);
+                                /* remember decoded size for next time */
+    if (!cached && ((body->encoding == ENCBASE64) ||
+                    (body->encoding == ENCQUOTEDPRINTABLE)))
+      mail_binary_size_set (stream,i,ta->section,size);
     fs_give ((void **) &tmp);   /* and temporary string */
   }
   else {                        /* clean up the arguments */
@@ -3136,6 +3886,54 @@ void fetch_body_part_binary (unsigned long i,void *args)
     fs_give ((void **) &args);
   }
 }
+
+
+/* Decode body part contents
+ * Accepts: decoder
+ *          contents in memory, or size of contents in stringstruct
+ *          stringstruct
+ *          position of contents in stringstruct
+ * Returns: T if success, NIL if undecodable or decoder output stopped
+ */
+
+long binary_decode (RFC822DECODE *dc,SIZEDTEXT *st,STRING *bs,
+                    unsigned long pos)
+{
+  unsigned long i,j;
+  char tmp[RFC822DECODEBUF];
+  if (st->data) return rfc822_decode (dc,st->data,st->size) &&
+    rfc822_decode_done (dc);
+  if (st->size) SETPOS (bs,pos);/* read stringstruct a piece at a time */
+  for (i = st->size; i; i -= j) {
+    mail_read ((void *) bs,j = min (i,RFC822DECODEBUF),tmp);
+    if (!rfc822_decode (dc,(unsigned char *) tmp,j)) return NIL;
+  }
+  return rfc822_decode_done (dc);
+}
+
+
+/* Output window of decoded body part contents
+ * Accepts: binary window
+ *          decoded data
+ *          size of decoded data
+ * Returns: T to continue, NIL to stop decoding
+ */
+
+long binary_out (void *arg,unsigned char *s,unsigned long n)
+{
+  SIZEDTEXT st;
+  BINARYWINDOW *bw = (BINARYWINDOW *) arg;
+  if (bw->skip >= n) {          /* still before the window? */
+    bw->skip -= n;
+    return LONGT;
+  }
+  st.data = s + bw->skip;       /* write what falls inside the window */
+  st.size = min (n - bw->skip,bw->size);
+  bw->skip = 0;
+  if (PSOUTR (&st) == EOF) bw->error = T;
+  else bw->size -= st.size;
+  return (bw->size && !bw->error) ? LONGT : NIL;
+}
 
 /* Fetch MESSAGE/RFC822 body part header
  * Accepts: message number
@@ -3295,6 +4093,10 @@ void changed_flags (unsigned long i,int f)
   if (!f && mail_elt (stream,i)->seen) {
     PBOUT (' ');                /* yes, delimit with space */
     fetch_flags (i,NIL);        /* output flags */
+    if (condstore && mail_highestmodseq (stream)) {
+      PBOUT (' ');              /* flag change also changed modseq */
+      fetch_modseq (i,NIL);
+    }
   }
 }
 
@@ -3327,6 +4129,19 @@ void fetch_uid (unsigned long i,void *args)
   PSOUT ("UID ");
   pnum (mail_uid (stream,i));
 }
+
+
+/* Fetch message modseq
+ * Accepts: message number
+ *          extra argument
+ */
+
+void fetch_modseq (unsigned long i,void *args)
+{
+  PSOUT ("MODSEQ (");
+  pnum (mail_elt (stream,i)->private.mod);
+  PBOUT (')');
+}
 
 /* Fetch complete RFC-822 format message
  * Accepts: message number
@@ -3345,18 +4160,7 @@ void fetch_rfc822 (unsigned long i,void *args)
 #else
     /* Yes, this version is bletcherous, but mail_fetch_message() requires
        too much memory */
-    SIZEDTEXT txt,hdr;
-    char *s = mail_fetch_header (stream,i,NIL,NIL,&hdr.size,FT_PEEK);
-    hdr.data = (unsigned char *) memcpy (fs_get (hdr.size),s,hdr.size);
-    txt.data = (unsigned char *)
-      mail_fetch_text (stream,i,NIL,&txt.size,
-                       ((long) args) | FT_RETURNSTRINGSTRUCT);
-    PSOUT ("RFC822 {");
-    pnum (hdr.size + txt.size);
-    PSOUT ("}\015\012");
-    ptext (&hdr,NIL);
-    ptext (&txt,&stream->private.string);
-    fs_give ((void **) &hdr.data);
+    pmessage (i,"RFC822",(long) args);
 #endif
     changed_flags (i,f);        /* output changed flags */
   }
@@ -3646,6 +4450,251 @@ void pset (SEARCHSET **set)
 }
 
 
+/* Print VANISHED (EARLIER) response
+ * Accepts: UID sequence, or NIL for all UIDs
+ *          client's modseq
+ *
+ * If the driver keeps a history of expunged UIDs, only those expunged after
+ * the client's modseq are reported.  Otherwise every gap between existing
+ * UIDs is, which may include UIDs the client never knew.
+ */
+
+void pvanished (char *sequence,unsigned long modseq)
+{
+  unsigned long i,j,k,lo,hi;
+  unsigned char *s = (unsigned char *) sequence;
+  SEARCHSET *cur,*exp,*set = NIL,*van = NIL,*tail = NIL,*hist = NIL;
+  vanished_t vf = (vanished_t) mail_parameters (stream,GET_VANISHED,NIL);
+  if (!stream->uid_last) return;/* no UIDs ever assigned */
+  if (!s) {                     /* all UIDs */
+    (set = mail_newsearchset ())->first = 1;
+    set->last = stream->uid_last;
+  }
+  else if (!(crit_set (&set,&s,stream->uid_last) && !*s)) {
+    if (set) mail_free_searchset (&set);
+    return;                     /* bogus sequence */
+  }
+                                /* no history, fall back to gaps */
+  if (vf && !(*vf) (stream,modseq,&hist)) vf = NIL;
+  for (cur = set; cur; cur = cur->next) {
+    lo = cur->first;            /* get range */
+    if ((hi = cur->last ? cur->last : cur->first) < lo) {
+      hi = lo;
+      lo = cur->last;
+    }
+    if (hi > stream->uid_last) hi = stream->uid_last;
+    if (vf) for (exp = hist; exp; exp = exp->next) {
+                                /* part of range expunged since modseq */
+      i = (exp->first > lo) ? exp->first : lo;
+      j = exp->last ? exp->last : exp->first;
+      if (j > hi) j = hi;
+      if (i <= j) {
+        if (!van) van = tail = mail_newsearchset ();
+        tail = mail_append_set (tail,i);
+        if (j > i) tail->last = j;
+      }
+    }
+    else {                      /* find first message with UID >= lo */
+      for (i = 1, j = stream->nmsgs + 1; i < j; )
+        if (mail_uid (stream,k = (i + j) / 2) < lo) i = k + 1;
+        else j = k;
+                                /* gaps between existing UIDs vanished */
+      for (; lo <= hi; lo = k + 1, i++) {
+        k = (i <= stream->nmsgs) ? mail_uid (stream,i) : hi + 1;
+        if (k > lo) {
+          if (!van) van = tail = mail_newsearchset ();
+          tail = mail_append_set (tail,lo);
+          if (((k > hi) ? hi : k - 1) > lo)
+            tail->last = (k > hi) ? hi : k - 1;
+        }
+      }
+    }
+  }
+  mail_free_searchset (&set);
+  if (hist) mail_free_searchset (&hist);
+  if (van) {                    /* output any vanished UIDs */
+    PSOUT ("* VANISHED (EARLIER) ");
+    pset (&van);
+    CRLF;
+  }
+}
+
+/* Make sequence string from messages with sequence bit set
+ * Accepts: UID sequence flag
+ * Returns: sequence string, or NIL if no messages
+ */
+
+char *sequence_string (long uid)
+{
+  unsigned long i,j;
+  size_t len = 0;
+  size_t size = MAILTMPLEN;
+  char *ret = (char *) fs_get (size);
+  for (i = 1; i <= nmsgs; i++) if (mail_elt (stream,i)->sequence) {
+    for (j = i; (j < nmsgs) && mail_elt (stream,j + 1)->sequence; j++);
+                                /* make sure room for another range */
+    if ((len + 50) >= size)
+      fs_resize ((void **) &ret,size += MAILTMPLEN);
+    len += sprintf (ret + len,len ? ",%lu" : "%lu",
+                    uid ? mail_uid (stream,i) : i);
+    if (j > i) len += sprintf (ret + len,":%lu",
+                               uid ? mail_uid (stream,j) : j);
+    i = j;                      /* skip past range */
+  }
+  if (!len) fs_give ((void **) &ret);
+  return ret;
+}
+
+/* Parse search RETURN options
+ * Accepts: pointer to argument text pointer
+ * Returns: return options, 0 if none specified, -1 if syntax error
+ */
+
+int search_return (unsigned char **arg)
+{
+  int ret = 0;
+  unsigned char *s = *arg,*t;
+  char *r;
+  for (t = "RETURN ("; *t && (toupper (*s) == *t); s++,t++);
+  if (*t) return 0;             /* not a RETURN list */
+                                /* RETURN list must be properly terminated */
+  if (!((t = strchr (s,')')) && (t[1] == ' '))) return -1;
+  *t = '\0';                    /* tie off option list */
+  for (s = strtok_r (ucase (s)," ",&r); s; s = strtok_r (NIL," ",&r)) {
+    if (!strcmp (s,"MIN")) ret |= SR_MIN;
+    else if (!strcmp (s,"MAX")) ret |= SR_MAX;
+    else if (!strcmp (s,"ALL")) ret |= SR_ALL;
+    else if (!strcmp (s,"COUNT")) ret |= SR_COUNT;
+    else if (!strcmp (s,"SAVE")) ret |= SR_SAVE;
+    else return -1;             /* unknown return option */
+  }
+  *arg = t + 2;                 /* skip past list and delimiter */
+                                /* default return value is ALL */
+  return ret ? ret : SR_ALL;
+}
+
+
+/* Print ESEARCH response
+ * Accepts: message number list, in search or sort order
+ *          number of messages in list
+ *          UID flag
+ *          return options
+ *          highest modseq of matching messages, or 0 if none wanted
+ */
+
+void pesearch (unsigned long *lst,unsigned long n,long uid,int retval,
+               unsigned long maxmod)
+{
+  unsigned long i;
+  SEARCHSET *set,*tail;
+  PSOUT ("* ESEARCH (TAG ");
+  pstring (tag);
+  PBOUT (')');
+  if (uid) PSOUT (" UID");
+  if (n && (retval & SR_MIN)) { /* wants MIN */
+    PSOUT (" MIN ");
+    pnum (uid ? mail_uid (stream,lst[0]) : lst[0]);
+  }
+  if (n && (retval & SR_MAX)) { /* wants MAX */
+    PSOUT (" MAX ");
+    pnum (uid ? mail_uid (stream,lst[n - 1]) : lst[n - 1]);
+  }
+  if (n && (retval & SR_ALL)) { /* wants ALL, as compact sequence set */
+    for (i = 0, tail = set = mail_newsearchset (); i < n; i++)
+      tail = mail_append_set (tail,uid ? mail_uid (stream,lst[i]) : lst[i]);
+    PSOUT (" ALL ");
+    pset (&set);
+  }
+  if (retval & SR_COUNT) {      /* wants COUNT */
+    PSOUT (" COUNT ");
+    pnum (n);
+  }
+  if (maxmod) {                 /* MODSEQ criterion used */
+    PSOUT (" MODSEQ ");
+    pnum (maxmod);
+  }
+  CRLF;
+}
+
+/* Save search result for reference as $
+ * Accepts: message number list, in search or sort order
+ *          number of messages in list
+ *          return options
+ */
+
+void searchres_save (unsigned long *lst,unsigned long n,int retval)
+{
+  unsigned long i;
+  for (i = 1; i <= nmsgs; i++) mail_elt (stream,i)->spare3 = NIL;
+                                /* only MIN and/or MAX saved if no others */
+  if ((retval & (SR_MIN | SR_MAX)) && !(retval & (SR_ALL | SR_COUNT))) {
+    if (n && (retval & SR_MIN)) mail_elt (stream,lst[0])->spare3 = T;
+    if (n && (retval & SR_MAX)) mail_elt (stream,lst[n - 1])->spare3 = T;
+  }
+  else for (i = 0; i < n; i++) mail_elt (stream,lst[i])->spare3 = T;
+}
+
+
+/* Resolve saved search result reference
+ * Accepts: sequence
+ *          UID sequence flag
+ *          pointer to return resolved sequence string, must be freed
+ * Returns: sequence to use, or NIL if saved result is empty
+ */
+
+char *searchres_sequence (char *sequence,long uid,char **tmp)
+{
+  unsigned long i;
+  MESSAGECACHE *elt;
+  if (strcmp (sequence,"$")) return sequence;
+  for (i = 1; i <= nmsgs; i++)
+    (elt = mail_elt (stream,i))->sequence = elt->spare3;
+  return *tmp = sequence_string (uid);
+}
+
+/* Parse SELECT/EXAMINE parameters
+ * Accepts: pointer to argument text pointer
+ *          QRESYNC data to return
+ * Returns: T if success, NIL if syntax error
+ */
+
+long parse_select (unsigned char **arg,QRESYNCDATA *qr)
+{
+  unsigned char *s = *arg,*t;
+  long cs = NIL;
+  if (*s++ != '(') return NIL;  /* parameters are a list */
+  ucase (s);
+  do {
+    if (!strncmp (s,"CONDSTORE",9) && ((s[9] == ' ') || (s[9] == ')'))) {
+      s += 9;                   /* skip CONDSTORE */
+      cs = T;
+    }
+    else if (qresync && !qr->uidvalidity && !strncmp (s,"QRESYNC (",9)) {
+      s += 9;                   /* get UID validity and modseq */
+      if (!(isdigit (*s) &&
+            (qr->uidvalidity = strtoul (s,(char **) &s,10)) &&
+            (*s++ == ' ') && isdigit (*s))) return NIL;
+      qr->modseq = strtoul (s,(char **) &s,10);
+      if ((*s == ' ') && (*++s != '(')) {
+                                /* known UIDs */
+        for (t = s; *s && (isdigit (*s) || strchr (":,*",*s)); s++);
+        if (s == t) return NIL;
+        strncpy (qr->uids = (char *) fs_get (s - t + 1),t,s - t)[s - t] = '\0';
+        if (*s == ' ') s++;     /* skip past delimiter */
+      }
+                                /* ignore sequence match data */
+      if ((*s == '(') && (s = strchr (s,')'))) s++;
+      if (!s || (*s++ != ')')) return NIL;
+    }
+    else return NIL;            /* unknown parameter */
+  } while ((*s == ' ') && *++s);
+  if ((*s++ != ')') || *s) return NIL;
+  if (cs) condstore = T;        /* CONDSTORE parameter enables it */
+  *arg = s;
+  return T;
+}
+
+
 /* Print number
  * Accepts: number
  */
@@ -3856,10 +4905,61 @@ void ptext (SIZEDTEXT *txt,STRING *st)
   unsigned char c,*s;
   unsigned long i = txt->size;
   if (s = txt->data) while (i && ((PBOUT ((c = *s++) ? c : 0x80) != EOF))) --i;
+                                /* large file-backed text goes direct */
+  else if (st && (i >= MINSENDFILE) && ptextfd (st,i)) i = 0;
   else if (st) while (i && (PBOUT ((c = SNX (st)) ? c : 0x80) != EOF)) --i;
                                 /* failed to complete? */
   if (i) ioerror (stdout,"writing text");
 }
+
+
+/* Print raw text directly from stringstruct's file
+ * Accepts: stringstruct
+ *          size of text
+ * Returns: T if text output, NIL if caller must do it
+ */
+
+long ptextfd (STRING *st,unsigned long size)
+{
+  int fd;
+  unsigned long offset,base;
+  void *map;
+  char *s;
+  if (!st->dtb->fd || ((fd = (*st->dtb->fd) (st,&offset)) < 0)) return NIL;
+                                /* map enough pages to check for NULs */
+  base = offset - (offset % (unsigned long) getpagesize ());
+  if ((map = mmap (NIL,size + offset - base,PROT_READ,MAP_SHARED,fd,
+                   (off_t) base)) == MAP_FAILED) return NIL;
+  s = memchr ((char *) map + (offset - base),'\0',size);
+  munmap (map,size + offset - base);
+  if (s) return NIL;            /* have NULs, must do it the slow way */
+  if (PSOUTFD (fd,offset,size)) ioerror (stdout,"writing text");
+  return T;
+}
+
+
+/* Print message as header and text literal
+ * Accepts: message number
+ *          response identifier
+ *          fetch flags
+ */
+
+void pmessage (unsigned long i,char *id,long flags)
+{
+  SIZEDTEXT txt,hdr;
+  char *s = mail_fetch_header (stream,i,NIL,NIL,&hdr.size,FT_PEEK);
+                                /* copy in case text stomps on it */
+  hdr.data = (unsigned char *) memcpy (fs_get (hdr.size),s,hdr.size);
+  txt.data = (unsigned char *)
+    mail_fetch_text (stream,i,NIL,&txt.size,flags | FT_RETURNSTRINGSTRUCT);
+  PSOUT (id);
+  PSOUT (" {");
+  pnum (hdr.size + txt.size);
+  PSOUT ("}\015\012");
+  ptext (&hdr,NIL);
+  ptext (&txt,&stream->private.string);
+  fs_give ((void **) &hdr.data);
+}
 
 /* Print thread
  * Accepts: thread
@@ -3908,16 +5008,16 @@ void pcapability (long flag)
   PSOUT ("CAPABILITY IMAP4REV1 I18NLEVEL=1 LITERAL+");
   if (flag >= 0) {              /* want post-authentication capabilities? */
     PSOUT (" IDLE UIDPLUS NAMESPACE CHILDREN MAILBOX-REFERRALS BINARY UNSELECT");
-#ifdef ESEARCH
-    PSOUT (" ESEARCH");
-#endif
-    PSOUT (" WITHIN SORT");
+    PSOUT (" ESEARCH SEARCHRES WITHIN SORT ESORT LIST-STATUS");
     while (thr) {               /* threaders */
       PSOUT (" THREAD=");
       PSOUT (thr->name);
       thr = thr->next;
     }
-    if (!anonymous) PSOUT (" MULTIAPPEND");
+    if (!anonymous) PSOUT (" MULTIAPPEND MOVE");
+    PSOUT (" ENABLE CONDSTORE QRESYNC");
+    if (s = ssl_start_compress (NIL)) fs_give ((void **) &s);
+    else PSOUT (" COMPRESS=DEFLATE");
     PSOUT (" SCAN");            /* private extension */
   }
   if (flag <= 0) {              /* want pre-authentication capabilities? */
@@ -4103,13 +5203,13 @@ long proxycopy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   STRING st;
   MSGDATA md;
   SEARCHSET *set;
-  char tmp[MAILTMPLEN];
+  char *s,tmp[MAILTMPLEN];
   unsigned long i,j;
   md.stream = stream;
   md.msgno = 0;
   md.flags = md.date = NIL;
   md.message = &st;
-  /* Currently ignores CP_MOVE and CP_DEBUG */
+  /* Currently ignores CP_DEBUG */
   if (!((options & CP_UID) ?    /* validate sequence */
         mail_uid_sequence (stream,sequence) : mail_sequence (stream,sequence)))
     return NIL;
@@ -4129,6 +5229,15 @@ long proxycopy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   }
   if (caset) csset = set;       /* set for return value now */
   else if (set) mail_free_searchset (&set);
+  if (moving && cauidvalidity) pcopyuid ();
+  if (options & CP_MOVE) {      /* delete copied messages if moving */
+    for (i = 1; i <= nmsgs; i++)
+      mail_elt (stream,i)->sequence = mail_elt (stream,i)->spare;
+    if (s = sequence_string (NIL)) {
+      mail_flag (stream,s,"\\Deleted",ST_SET);
+      fs_give ((void **) &s);
+    }
+  }
   response = win;               /* stomp any previous babble */
   if (md.msgno) {               /* get new driver name if was dummy */
     sprintf (tmp,"Cross-format (%.80s -> %.80s) COPY completed",
@@ -4201,12 +5310,20 @@ long append_msg (MAILSTREAM *stream,void *data,char **flags,char **date,
 {
   unsigned long i,j;
   char *t;
+  FDDATA d;
+  static char chunk[SPOOLCHUNK];
   APPENDDATA *ad = (APPENDDATA *) data;
   unsigned char *arg = ad->arg;
+  long spooled = LONGT;
                                 /* flush text of previous message */
   if (t = ad->flags) fs_give ((void **) &ad->flags);
   if (t = ad->date) fs_give ((void **) &ad->date);
   if (t = ad->msg) fs_give ((void **) &ad->msg);
+  else if (ad->spool) {         /* previous message was spooled */
+    fclose (ad->spool);
+    ad->spool = NIL;
+    t = chunk;                  /* note have previous message */
+  }
   *flags = *date = NIL;         /* assume no flags or date */
   if (t) {                      /* have previous message? */
     if (!*arg) {                /* if least one message, and no more coming */
@@ -4237,8 +5354,11 @@ long append_msg (MAILSTREAM *stream,void *data,char **flags,char **date,
   else if (i > MAXAPPENDTXT)    /* maybe relax this a little */
     response = "%.80s NO Excessively large message to %.80s\015\012";
   else if (((*t == '+') && (t[1] == '}') && !t[2]) || ((*t == '}') && !t[1])) {
-                                /* get a literal buffer */
-    inliteral (ad->msg = (char *) fs_get (i+1),i);
+                                /* spool large literal to scratch file */
+    if ((i > APPENDSPOOL) && (ad->spool = tmpfile ()))
+      spooled = inliteralspool (ad->spool,i);
+                                /* else get a literal buffer */
+    else inliteral (ad->msg = (char *) fs_get (i+1),i);
                                 /* get new command tail */
     slurp (ad->arg,CMDLEN - (ad->arg - cmdbuf),INPUTTIMEOUT);
     if (strchr (ad->arg,'\012')) {
@@ -4254,12 +5374,26 @@ long append_msg (MAILSTREAM *stream,void *data,char **flags,char **date,
           litplus.size = strtoul (ad->arg + j + 1,NIL,10);
         }
       }
-                                /* initialize stringstruct */
-      INIT (ad->message,mail_string,(void *) ad->msg,i);
-      return LONGT;             /* ready to go */
+      if (ad->msg) {            /* initialize stringstruct */
+        INIT (ad->message,mail_string,(void *) ad->msg,i);
+        return LONGT;           /* ready to go */
+      }
+      if (spooled) {            /* read spooled text from its file */
+        d.fd = fileno (ad->spool);
+        d.pos = 0;
+        d.chunk = chunk;
+        d.chunksize = SPOOLCHUNK;
+        INIT (ad->message,fd_string,&d,i);
+        return LONGT;
+      }
+      response = "%.80s NO Can't spool message to %.80s\015\012";
+    }
+    else flush ();              /* didn't find end of line? */
+    if (ad->msg) fs_give ((void **) &ad->msg);
+    if (ad->spool) {
+      fclose (ad->spool);
+      ad->spool = NIL;
     }
-    flush ();                   /* didn't find end of line? */
-    fs_give ((void **) &ad->msg);
   }
   else response = badarg;       /* not a literal */
   return NIL;                   /* error */
@@ -4280,6 +5414,27 @@ void copyuid (MAILSTREAM *stream,char *mailbox,unsigned long uidvalidity,
   cauidvalidity = uidvalidity;
   csset = sourceset;
   caset = destset;
+                                /* MOVE reports it before any expunge */
+  if (moving && sourceset) pcopyuid ();
+}
+
+
+/* Print COPYUID data as untagged response for MOVE
+ */
+
+void pcopyuid (void)
+{
+  if (csset) {                  /* have both sets? */
+    PSOUT ("* OK [COPYUID ");
+    pnum (cauidvalidity);
+    PBOUT (' ');
+    pset (&csset);
+    PBOUT (' ');
+    pset (&caset);
+    PSOUT ("] Moved\015\012");
+  }
+  else mail_free_searchset (&caset);
+  cauidvalidity = 0;            /* cancel response for future */
 }
 
 
@@ -4355,9 +5510,24 @@ void mm_expunged (MAILSTREAM *s,unsigned long number)
 {
   if (quell_events) fatal ("Impossible EXPUNGE event");
   if (s != tstream) {
-    PSOUT ("* ");
-    pnum (number);
-    PSOUT (" EXPUNGE\015\012");
+    if (qresync) {              /* QRESYNC clients get UIDs */
+      PSOUT ("* VANISHED ");
+      pnum (mail_uid (s,number));
+    }
+    else {
+      PSOUT ("* ");
+      pnum (number);
+      PSOUT (" EXPUNGE");
+    }
+    CRLF;
+  }
+  if (s != tstream) {           /* renumber dirty list */
+    unsigned long i,j;
+    for (i = j = 0; i < ndirty; i++) if (dirty[i] != number)
+      dirty[j++] = (dirty[i] > number) ? dirty[i] - 1 : dirty[i];
+    ndirty = j;
+                                /* messages below low mark still seen */
+    if (number < unseenlow) unseenlow--;
   }
   nmsgs--;
   existsquelled = T;            /* do EXISTS when command done */
@@ -4371,7 +5541,7 @@ void mm_expunged (MAILSTREAM *s,unsigned long number)
 
 void mm_flags (MAILSTREAM *s,unsigned long number)
 {
-  if (s != tstream) mail_elt (s,number)->spare2 = T;
+  if (s != tstream) flags_changed (s,number);
 }
 
 /* Mailbox found
@@ -4419,6 +5589,8 @@ void mm_status (MAILSTREAM *stream,char *mailbox,MAILSTATUS *status)
       sprintf (tmp + strlen (tmp)," UIDNEXT %lu",status->uidnext);
     if (status->flags & SA_UIDVALIDITY)
       sprintf (tmp + strlen(tmp)," UIDVALIDITY %lu",status->uidvalidity);
+    if (status->flags & SA_HIGHESTMODSEQ)
+      sprintf (tmp + strlen(tmp)," HIGHESTMODSEQ %lu",status->highestmodseq);
     PSOUT ("* STATUS ");
     pastring (mailbox);
     PSOUT (" (");
@@ -4477,6 +5649,13 @@ void mm_list_work (char *what,int delimiter,char *name,long attributes)
                                 /* output mailbox name */
       if (proxylist && (s = strchr (name,'}'))) pastring (s+1);
       else pastring (name);
+                                /* remember selectable name for LIST-STATUS */
+      if (liststatus && !(attributes & LATT_NOSELECT)) {
+        *statustail = mail_newstringlist ();
+        (*statustail)->text.data = (unsigned char *) cpystr (name);
+        (*statustail)->text.size = strlen (name);
+        statustail = &(*statustail)->next;
+      }
     }
     CRLF;
   }
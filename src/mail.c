@@ -29,6 +29,7 @@
 #include <time.h>
 #include "c-client.h"
 #include "mail.h"
+#include "sidecar.h"
 
 char *Panda_copyright = "Copyright 2008-2010 Mark Crispin\n";
 
@@ -153,6 +154,10 @@ void *mm_cache (MAILSTREAM *stream,unsigned long msgno,long op)
       fs_give ((void **) &stream->sc);
       stream->nmsgs = 0;	/* can't have any messages now */
     }
+    mm_cache (stream,(long) 0,CH_FREESTRUCTCACHE);
+    mm_cache (stream,(long) 0,CH_FREETEXTINDEX);
+    mm_cache (stream,(long) 0,CH_FREEHEADERINDEX);
+    mm_cache (stream,(long) 0,CH_FREESORTFILE);
     break;
   case CH_SIZE:			/* (re-)size the cache */
     if (!stream->cache)	{	/* have a cache already? */
@@ -186,6 +191,23 @@ void *mm_cache (MAILSTREAM *stream,unsigned long msgno,long op)
       (SORTCACHE *) memset (fs_get (sizeof (SORTCACHE)),0,sizeof (SORTCACHE));
     ret = (void *) stream->sc[msgno - 1];
     break;
+  case CH_STRUCTCACHE:		/* return structure cache, load if needed */
+    if (!stream->stc) stream->stc = structcache_load (stream);
+    ret = (void *) stream->stc;
+    break;
+  case CH_TEXTINDEX:		/* return text index, load if needed */
+    if (!stream->txi) stream->txi = textindex_load (stream,GET_TEXTINDEXFILE);
+    ret = (void *) stream->txi;
+    break;
+  case CH_HEADERINDEX:		/* return header index, load if needed */
+    if (!stream->hxi)
+      stream->hxi = textindex_load (stream,GET_HEADERINDEXFILE);
+    ret = (void *) stream->hxi;
+    break;
+  case CH_SORTFILE:		/* return sidecar sortcache, load if needed */
+    if (!stream->srt) stream->srt = sortcache_load (stream);
+    ret = (void *) stream->srt;
+    break;
   case CH_FREE:			/* free elt */
     mail_free_elt (&stream->cache[msgno - 1]);
     break;
@@ -206,9 +228,23 @@ void *mm_cache (MAILSTREAM *stream,unsigned long msgno,long op)
 	fs_give ((void **) &stream->sc[msgno - 1]->message_id);
       if (stream->sc[msgno - 1]->references)
 	mail_free_stringlist (&stream->sc[msgno - 1]->references);
+      if (stream->sc[msgno - 1]->binsize)
+	mail_free_binarysize (&stream->sc[msgno - 1]->binsize);
       fs_give ((void **) &stream->sc[msgno - 1]);
     }
     break;
+  case CH_FREESTRUCTCACHE:
+    if (stream->stc) mail_free_structcache (&stream->stc);
+    break;
+  case CH_FREETEXTINDEX:
+    if (stream->txi) mail_free_textindex (&stream->txi);
+    break;
+  case CH_FREEHEADERINDEX:
+    if (stream->hxi) mail_free_textindex (&stream->hxi);
+    break;
+  case CH_FREESORTFILE:
+    if (stream->srt) mail_free_sortfile (&stream->srt);
+    break;
   case CH_EXPUNGE:		/* expunge cache slot */
     for (i = msgno - 1; msgno < stream->nmsgs; i++,msgno++) {
       if (stream->cache[i] = stream->cache[msgno])
@@ -234,7 +270,8 @@ static void mail_string_setpos (STRING *s,unsigned long i);
 STRINGDRIVER mail_string = {
   mail_string_init,		/* initialize string structure */
   mail_string_next,		/* get next byte in string structure */
-  mail_string_setpos		/* set position in string structure */
+  mail_string_setpos,		/* set position in string structure */
+  NIL				/* not file-backed */
 };
 
 
@@ -1165,20 +1202,38 @@ long mail_status (MAILSTREAM *stream,char *mbx,long flags)
 long mail_status_default (MAILSTREAM *stream,char *mbx,long flags)
 {
   MAILSTATUS status;
+  if (!mail_status_fill (stream,mbx,flags,&status)) return NIL;
+  MM_STATUS(stream,mbx,&status);/* pass status to main program */
+  return T;			/* success */
+}
+
+
+/* Mail compute status of mailbox
+ * Accepts: mail stream
+ *	    mailbox name
+ *	    status flags
+ *	    status to return
+ * Returns: T on success, NIL on failure
+ */
+
+long mail_status_fill (MAILSTREAM *stream,char *mbx,long flags,
+		       MAILSTATUS *status)
+{
   unsigned long i;
   MAILSTREAM *tstream = NIL;
 				/* make temporary stream (unless this mbx) */
   if (!stream && !(stream = tstream =
 		   mail_open (NIL,mbx,OP_READONLY|OP_SILENT))) return NIL;
-  status.flags = flags;		/* return status values */
-  status.messages = stream->nmsgs;
-  status.recent = stream->recent;
+  status->flags = flags;	/* return status values */
+  status->messages = stream->nmsgs;
+  status->recent = stream->recent;
+  status->unseen = 0;
   if (flags & SA_UNSEEN)	/* must search to get unseen messages */
-    for (i = 1,status.unseen = 0; i <= stream->nmsgs; i++)
-      if (!mail_elt (stream,i)->seen) status.unseen++;
-  status.uidnext = stream->uid_last + 1;
-  status.uidvalidity = stream->uid_validity;
-  MM_STATUS(stream,mbx,&status);/* pass status to main program */
+    for (i = 1; i <= stream->nmsgs; i++)
+      if (!mail_elt (stream,i)->seen) status->unseen++;
+  status->uidnext = stream->uid_last + 1;
+  status->uidvalidity = stream->uid_validity;
+  status->highestmodseq = mail_highestmodseq (stream);
   if (tstream) mail_close (tstream);
   return T;			/* success */
 }
@@ -1355,6 +1410,9 @@ MAILSTREAM *mail_close_full (MAILSTREAM *stream,long options)
 {
   int i;
   if (stream) {			/* make sure argument given */
+    structcache_save (stream);	/* save structure cache additions */
+    textindex_save (stream);	/* save text and header index additions */
+    sortcache_save (stream);	/* save sortcache additions */
 				/* do the driver's close action */
     if (stream->dtb) (*stream->dtb->close) (stream,options);
     stream->dtb = NIL;		/* resign driver */
@@ -1567,16 +1625,20 @@ ENVELOPE *mail_fetch_structure (MAILSTREAM *stream,unsigned long msgno,
   if (stream->dtb && ((body && !*b) || !*env || (*env)->incomplete)) {
     mail_free_envelope (env);	/* flush old envelope and body */
     mail_free_body (b);
+				/* try structure cache first */
+    if (structcache_fetch (stream,elt,env,b));
 				/* see if need to fetch the whole thing */
-    if (body || !elt->rfc822_size) {
+    else if (body || !elt->rfc822_size) {
       s = (*stream->dtb->header) (stream,msgno,&hdrsize,flags & ~FT_INTERNAL);
 				/* make copy in case body fetch smashes it */
       hdr = (char *) memcpy (fs_get ((size_t) hdrsize+1),s,(size_t) hdrsize);
       hdr[hdrsize] = '\0';	/* tie off header */
       (*stream->dtb->text) (stream,msgno,&bs,(flags & ~FT_INTERNAL) | FT_PEEK);
       if (!elt->rfc822_size) elt->rfc822_size = hdrsize + SIZE (&bs);
-      if (body)			/* only parse body if requested */
+      if (body) {		/* only parse body if requested */
 	rfc822_parse_msg (env,b,hdr,hdrsize,&bs,BADHOST,stream->dtb->flags);
+	structcache_store (stream,elt,*env,*b);
+      }
       else
 	rfc822_parse_msg (env,NIL,hdr,hdrsize,NIL,BADHOST,stream->dtb->flags);
       fs_give ((void **) &hdr);	/* flush header */
@@ -2307,16 +2369,16 @@ void mail_fetchsubject (char *s,MAILSTREAM *stream,unsigned long msgno,
 void mail_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 {
   MESSAGECACHE *elt;
+  SEARCHSET *set,*s;
   unsigned long i,uf;
   long f;
   short nf;
   if (!stream->dtb) return;	/* no-op if no stream */
   if ((stream->dtb->flagmsg || !stream->dtb->flag) &&
-      ((flags & ST_UID) ? mail_uid_sequence (stream,sequence) :
-       mail_sequence (stream,sequence)) &&
-      ((f = mail_parse_flags (stream,flag,&uf)) || uf))
-    for (i = 1,nf = (flags & ST_SET) ? T : NIL; i <= stream->nmsgs; i++)
-      if ((elt = mail_elt (stream,i))->sequence) {
+      mail_sequence_set (stream,sequence,flags & ST_UID,&set)) {
+    if ((f = mail_parse_flags (stream,flag,&uf)) || uf)
+      for (s = set,i = 0,nf = (flags & ST_SET) ? T : NIL;
+	   i = mail_next_set (&s,i);) {
 	struct {		/* old flags */
 	  unsigned int valid : 1;
 	  unsigned int seen : 1;
@@ -2326,6 +2388,7 @@ void mail_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 	  unsigned int draft : 1;
 	  unsigned long user_flags;
 	} old;
+	elt = mail_elt (stream,i);
 	old.valid = elt->valid; old.seen = elt->seen;
 	old.deleted = elt->deleted; old.flagged = elt->flagged;
 	old.answered = elt->answered; old.draft = elt->draft;
@@ -2348,6 +2411,8 @@ void mail_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 	  MM_FLAGS (stream,elt->msgno);
 	if (stream->dtb->flagmsg) (*stream->dtb->flagmsg) (stream,elt);
       }
+    mail_free_searchset (&set);
+  }
 				/* call driver once */
   if (stream->dtb->flag) (*stream->dtb->flag) (stream,sequence,flag,flags);
 }
@@ -2389,6 +2454,7 @@ long mail_search_default (MAILSTREAM *stream,char *charset,SEARCHPGM *pgm,
 {
   unsigned long i;
   char *msg;
+  unsigned char *hits = NIL;
 				/* make sure that charset is good */
   if (msg = utf8_badcharset (charset)) {
     MM_LOG (msg,ERROR);		/* output error */
@@ -2396,7 +2462,23 @@ long mail_search_default (MAILSTREAM *stream,char *charset,SEARCHPGM *pgm,
     return NIL;
   }
   utf8_searchpgm (pgm,charset);
-  for (i = 1; i <= stream->nmsgs; ++i)
+  if (mail_search_costly (pgm)) {/* worth splitting among processes? */
+    textindex_refresh (stream);	/* workers share the indexes */
+				/* pick up workers' index additions */
+    if (hits = search_workers (stream,pgm)) textindex_refresh (stream);
+  }
+  if (hits) {			/* report workers' results */
+    for (i = 1; i <= stream->nmsgs; ++i)
+      if (hits[(i - 1) >> 3] & (1 << ((i - 1) & 7))) {
+	if (flags & SE_UID) mm_searched (stream,mail_uid (stream,i));
+	else {			/* mark as searched, notify mail program */
+	  mail_elt (stream,i)->searched = T;
+	  if (!stream->silent) mm_searched (stream,i);
+	}
+      }
+    fs_give ((void **) &hits);
+  }
+  else for (i = 1; i <= stream->nmsgs; ++i)
     if (mail_search_msg (stream,i,NIL,pgm)) {
       if (flags & SE_UID) mm_searched (stream,mail_uid (stream,i));
       else {			/* mark as searched, notify mail program */
@@ -2490,6 +2572,37 @@ long mail_ping (MAILSTREAM *stream)
   return ret;
 }
 
+/* Mail watch mailbox for changes
+ * Accepts: mail stream
+ * Returns: descriptor which becomes readable when the mailbox changes, or -1
+ *
+ * Each call discards any pending change notifications, so it should be called
+ * again just before the mail_ping() which acts upon a notification.
+ */
+
+int mail_watch (MAILSTREAM *stream)
+{
+				/* can't watch a snarf source */
+  return (stream && stream->dtb && stream->dtb->watch &&
+	  !stream->snarf.name) ? (*stream->dtb->watch) (stream) : -1;
+}
+
+
+/* Mail get highest modseq
+ * Accepts: mail stream
+ * Returns: highest modseq in mailbox, or 0 if driver has no modseqs
+ *
+ * DR_MODSEQ says whether a driver keeps persistent per-message modseqs in
+ * the elt's private.mod; drivers without it opt out of CONDSTORE.  The
+ * modseq method only supplies the value.
+ */
+
+unsigned long mail_highestmodseq (MAILSTREAM *stream)
+{
+  return (stream && stream->dtb && (stream->dtb->flags & DR_MODSEQ) &&
+	  stream->dtb->modseq) ? (*stream->dtb->modseq) (stream) : 0;
+}
+
 /* Mail check mailbox
  * Accepts: mail stream
  */
@@ -2498,6 +2611,9 @@ void mail_check (MAILSTREAM *stream)
 {
   				/* do the driver's action */
   if (stream->dtb) (*stream->dtb->check) (stream);
+  structcache_save (stream);	/* save structure cache additions */
+  textindex_save (stream);	/* save text and header index additions */
+  sortcache_save (stream);	/* save sortcache additions */
 }
 
 
@@ -2528,6 +2644,29 @@ long mail_copy_full (MAILSTREAM *stream,char *sequence,char *mailbox,
   return stream->dtb ?
     SAFE_COPY (stream->dtb,stream,sequence,mailbox,options) : NIL;
 }
+
+
+/* Mail move message(s)
+ * Accepts: mail stream
+ *	    sequence
+ *	    destination mailbox
+ *	    flags
+ * Returns: T if success, else NIL
+ */
+
+long mail_move_full (MAILSTREAM *stream,char *sequence,char *mailbox,
+		     long options)
+{
+  if (!stream->dtb) return NIL;	/* driver does it natively? */
+  if (stream->dtb->move)
+    return (*stream->dtb->move) (stream,sequence,mailbox,options);
+				/* else copy, delete, and expunge just those */
+  if (!SAFE_COPY (stream->dtb,stream,sequence,mailbox,options & ~CP_MOVE))
+    return NIL;
+  mail_flag (stream,sequence,"\\Deleted",
+	     ST_SET | ((options & CP_UID) ? ST_UID : NIL));
+  return mail_expunge_full (stream,sequence,(options & CP_UID) ? EX_UID : NIL);
+}
 
 /* Append data package to use for old single-message mail_append() interface */
 
@@ -3171,6 +3310,13 @@ void mail_expunged (MAILSTREAM *stream,unsigned long msgno)
 				/* notify main program of change */
     if (!stream->silent) MM_EXPUNGED (stream,msgno);
     if (elt) {			/* if an element is there */
+				/* prune its index records on save */
+      if (stream->txi && stream->txi->file && elt->private.uid &&
+	  textindex_lookup (stream->txi,elt->private.uid))
+	stream->txi->dirty = T;
+      if (stream->hxi && stream->hxi->file && elt->private.uid &&
+	  textindex_lookup (stream->hxi,elt->private.uid))
+	stream->hxi->dirty = T;
       elt->msgno = 0;		/* invalidate its message number and free */
       (*mailcache) (stream,msgno,CH_FREE);
       (*mailcache) (stream,msgno,CH_FREESORTCACHE);
@@ -3409,6 +3555,28 @@ unsigned long mail_filter (char *text,unsigned long len,STRINGLIST *lines,
   return dst - text;
 }
 
+/* Mail search program needs message data
+ * Accepts: search program
+ * Returns: T if any criterion needs the message header or text, else NIL
+ */
+
+long mail_search_costly (SEARCHPGM *pgm)
+{
+  SEARCHOR *or;
+  SEARCHPGMLIST *not;
+  if (pgm->header || pgm->bcc || pgm->body || pgm->cc || pgm->from ||
+      pgm->subject || pgm->text || pgm->to || pgm->sentbefore ||
+      pgm->senton || pgm->sentsince || pgm->return_path || pgm->sender ||
+      pgm->reply_to || pgm->in_reply_to || pgm->message_id ||
+      pgm->newsgroups || pgm->followup_to || pgm->references) return LONGT;
+  for (or = pgm->or; or; or = or->next)
+    if (mail_search_costly (or->first) || mail_search_costly (or->second))
+      return LONGT;
+  for (not = pgm->not; not; not = not->next)
+    if (mail_search_costly (not->pgm)) return LONGT;
+  return NIL;
+}
+
 /* Local mail search message
  * Accepts: MAIL stream
  *	    message number
@@ -3495,6 +3663,8 @@ long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
       (pgm->old && elt->recent) ||
       (pgm->seen && !elt->seen) ||
       (pgm->unseen && elt->seen)) return NIL;
+				/* modification sequence */
+  if (pgm->modseq && (elt->private.mod < pgm->modseq)) return NIL;
 				/* keywords */
   if ((pgm->keyword && !mail_search_keyword (stream,elt,pgm->keyword,LONGT)) ||
       (pgm->unkeyword && !mail_search_keyword (stream,elt,pgm->unkeyword,NIL)))
@@ -3512,6 +3682,8 @@ long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
     if (pgm->younger && msgd < (now - pgm->younger)) return NIL;
   }
 
+				/* header searches, unless index rules out */
+  if (!headerindex_search (stream,elt,section,pgm)) return NIL;
 				/* envelope searches */
   if (pgm->sentbefore || pgm->senton || pgm->sentsince ||
       pgm->bcc || pgm->cc || pgm->from || pgm->to || pgm->subject ||
@@ -3565,7 +3737,7 @@ long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
 
 				/* search header lines */
   for (hdr = pgm->header; hdr; hdr = hdr->next) {
-    char *t,*e,*v;
+    char *t;
     SIZEDTEXT s;
     STRINGLIST sth,stc;
     sth.next = stc.next = NIL;	/* only one at a time */
@@ -3578,20 +3750,7 @@ long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
 	strchr (t,':')) {
       if (hdr->text.size) {	/* anything matches empty search string */
 				/* non-empty, copy field data */
-	s.data = (unsigned char *) fs_get (s.size + 1);
-				/* for each line */
-	for (v = (char *) s.data, e = t + s.size; t < e;) switch (*t) {
-	default:		/* non-continuation, skip leading field name */
-	  while ((t < e) && (*t++ != ':'));
-	  if ((t < e) && (*t == ':')) t++;
-	case '\t': case ' ':	/* copy field data  */
-	  while ((t < e) && (*t != '\015') && (*t != '\012')) *v++ = *t++;
-	  *v++ = '\n';		/* tie off line */
-	  while (((*t == '\015') || (*t == '\012')) && (t < e)) t++;
-	}
-				/* calculate true size */
-	s.size = v - (char *) s.data;
-	*v = '\0';		/* tie off results */
+	mail_search_fields (t,s.size,&s);
 	stc.text.data = hdr->text.data;
 	stc.text.size = hdr->text.size;
 				/* search header */
@@ -3604,9 +3763,11 @@ long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
     }
     else return NIL;		/* no matching header text */
   }
-				/* search strings */
-  if ((pgm->text && !mail_search_text (stream,msgno,section,pgm->text,LONGT))||
-      (pgm->body && !mail_search_text (stream,msgno,section,pgm->body,NIL)))
+				/* search strings, unless index rules out */
+  if ((pgm->text && !(textindex_search (stream,elt,section,pgm->text) &&
+		      mail_search_text (stream,msgno,section,pgm->text,LONGT)))||
+      (pgm->body && !(textindex_search (stream,elt,section,pgm->body) &&
+		      mail_search_text (stream,msgno,section,pgm->body,NIL))))
     return NIL;
 				/* logical conditions */
   for (or = pgm->or; or; or = or->next)
@@ -3644,19 +3805,51 @@ long mail_search_header_text (char *s,STRINGLIST *st)
 long mail_search_header (SIZEDTEXT *hdr,STRINGLIST *st)
 {
   SIZEDTEXT h;
+  STRINGLIST *s;
+  unsigned long i;
+  unsigned char tmp[MSEARCHPATS],*found = tmp;
   long ret = LONGT;
 				/* make UTF-8 version of header */
   utf8_mime2text (hdr,&h,U8T_CANONICAL);
   while (h.size && ((h.data[h.size-1]=='\015') || (h.data[h.size-1]=='\012')))
     --h.size;			/* slice off trailing newlines */
-  do if (h.size ?		/* search non-empty string */
-	 !ssearch (h.data,h.size,st->text.data,st->text.size) : st->text.size)
-    ret = NIL;
-  while (ret && (st = st->next));
+  if (h.size) {			/* search non-empty string for all keys */
+    for (i = 0, s = st; s; s = s->next) ++i;
+    if (i > MSEARCHPATS) found = (unsigned char *) fs_get (i);
+    ret = msearch (h.data,h.size,st,memset (found,0,i));
+    if (found != tmp) fs_give ((void **) &found);
+  }
+				/* empty string only has empty keys */
+  else for (s = st; ret && s; s = s->next) if (s->text.size) ret = NIL;
   if (h.data != hdr->data) fs_give ((void **) &h.data);
   return ret;
 }
 
+/* Mail search header field data
+ * Accepts: header lines text
+ *	    size of header lines text
+ *	    returned field data, to be freed by caller
+ */
+
+void mail_search_fields (char *t,unsigned long size,SIZEDTEXT *s)
+{
+  char *e,*v;
+  s->data = (unsigned char *) fs_get (size + 1);
+				/* for each line */
+  for (v = (char *) s->data, e = t + size; t < e;) switch (*t) {
+  default:			/* non-continuation, skip leading field name */
+    while ((t < e) && (*t++ != ':'));
+    if ((t < e) && (*t == ':')) t++;
+  case '\t': case ' ':		/* copy field data  */
+    while ((t < e) && (*t != '\015') && (*t != '\012')) *v++ = *t++;
+    *v++ = '\n';		/* tie off line */
+    while (((*t == '\015') || (*t == '\012')) && (t < e)) t++;
+  }
+				/* calculate true size */
+  s->size = v - (char *) s->data;
+  *v = '\0';			/* tie off results */
+}
+
 /* Mail search message body
  * Accepts: MAIL stream
  *	    message number
@@ -3831,15 +4024,22 @@ long mail_search_string (SIZEDTEXT *s,char *charset,STRINGLIST **st)
 long mail_search_string_work (SIZEDTEXT *s,STRINGLIST **st)
 {
   void *t;
+  unsigned long i;
+  unsigned char tmp[MSEARCHPATS],*found = tmp;
   STRINGLIST **sc = st;
-  while (*sc) {			/* run down criteria list */
-    if (ssearch (s->data,s->size,(*sc)->text.data,(*sc)->text.size)) {
+  for (i = 0; *sc; sc = &(*sc)->next) ++i;
+  if (i > MSEARCHPATS) found = (unsigned char *) fs_get (i);
+				/* look for all keys in one pass */
+  msearch (s->data,s->size,*st,memset (found,0,i));
+  for (i = 0, sc = st; *sc; ++i) {
+    if (found[i]) {		/* run down criteria list */
       t = (void *) (*sc);	/* found one, need to flush this */
       *sc = (*sc)->next;	/* remove it from the list */
       fs_give (&t);		/* flush the buffer */
     }
     else sc = &(*sc)->next;	/* move to next in list */
   }
+  if (found != tmp) fs_give ((void **) &found);
   return *st ? NIL : LONGT;
 }
 
@@ -3881,41 +4081,52 @@ long mail_search_keyword (MAILSTREAM *stream,MESSAGECACHE *elt,STRINGLIST *st,
 
 long mail_search_addr (ADDRESS *adr,STRINGLIST *st)
 {
-  ADDRESS *a,tadr;
   SIZEDTEXT txt;
+  long ret = NIL;
+  if (adr) {
+    mail_search_addrtext (adr,&txt);
+    ret = mail_search_header (&txt,st);
+    fs_give ((void **) &txt.data);
+  }
+  return ret;
+}
+
+
+/* Mail search address list text
+ * Accepts: address list
+ *	    returned address list text, to be freed by caller
+ */
+
+void mail_search_addrtext (ADDRESS *adr,SIZEDTEXT *txt)
+{
+  ADDRESS *a,tadr;
   char tmp[SENDBUFLEN + 1];
   size_t i = SEARCHBUFLEN;
   size_t k;
-  long ret = NIL;
-  if (adr) {
-    txt.data = (unsigned char *) fs_get (i + SEARCHBUFSLOP);
+  txt->data = (unsigned char *) fs_get (i + SEARCHBUFSLOP);
 				/* never an error or next */
-    tadr.error = NIL,tadr.next = NIL;
+  tadr.error = NIL,tadr.next = NIL;
 				/* write address list */
-    for (txt.size = 0,a = adr; a; a = a->next) {
-      k = (tadr.mailbox = a->mailbox) ? 4 + 2*strlen (a->mailbox) : 3;
-      if (tadr.personal = a->personal) k += 3 + 2*strlen (a->personal);
-      if (tadr.adl = a->adl) k += 3 + 2*strlen (a->adl);
-      if (tadr.host = a->host) k += 3 + 2*strlen (a->host);
-      if (tadr.personal || tadr.adl) k += 2;
-      if (k < (SENDBUFLEN-10)) {/* ignore ridiculous addresses */
-	tmp[0] = '\0';
-	rfc822_write_address (tmp,&tadr);
+  for (txt->size = 0,a = adr; a; a = a->next) {
+    k = (tadr.mailbox = a->mailbox) ? 4 + 2*strlen (a->mailbox) : 3;
+    if (tadr.personal = a->personal) k += 3 + 2*strlen (a->personal);
+    if (tadr.adl = a->adl) k += 3 + 2*strlen (a->adl);
+    if (tadr.host = a->host) k += 3 + 2*strlen (a->host);
+    if (tadr.personal || tadr.adl) k += 2;
+    if (k < (SENDBUFLEN-10)) {	/* ignore ridiculous addresses */
+      tmp[0] = '\0';
+      rfc822_write_address (tmp,&tadr);
 				/* resize buffer if necessary */
-	if (((k = strlen (tmp)) + txt.size) > i)
-	  fs_resize ((void **) &txt.data,SEARCHBUFSLOP + (i += SEARCHBUFLEN));
+      if (((k = strlen (tmp)) + txt->size) > i)
+	fs_resize ((void **) &txt->data,SEARCHBUFSLOP + (i += SEARCHBUFLEN));
 				/* add new address */
-	memcpy (txt.data + txt.size,tmp,k);
-	txt.size += k;
+      memcpy (txt->data + txt->size,tmp,k);
+      txt->size += k;
 				/* another address follows */
-	if (a->next) txt.data[txt.size++] = ',';
-      }
+      if (a->next) txt->data[txt->size++] = ',';
     }
-    txt.data[txt.size] = '\0';	/* tie off string */
-    ret = mail_search_header (&txt,st);
-    fs_give ((void **) &txt.data);
   }
-  return ret;
+  txt->data[txt->size] = '\0';	/* tie off string */
 }
 
 /* Get string for low-memory searching
@@ -4190,6 +4401,72 @@ SEARCHSET *mail_append_set (SEARCHSET *set,unsigned long msgno)
   return set;
 }
 
+/* Mail look up decoded size of body part
+ * Accepts: mail stream
+ *	    message number
+ *	    body section, or NIL for whole message
+ *	    pointer to return size
+ * Returns: T if size known, NIL otherwise
+ */
+
+long mail_binary_size (MAILSTREAM *stream,unsigned long msgno,char *section,
+		       unsigned long *size)
+{
+  BINARYSIZE *b;
+  if (!section) section = "";
+  for (;;) {
+    for (b = ((SORTCACHE *) (*mailcache) (stream,msgno,CH_SORTCACHE))->binsize;
+	 b; b = b->next) if (!strcmp (b->section,section)) {
+      *size = b->size;		/* found it */
+      return LONGT;
+    }
+				/* persistent sortcache only tried once */
+    if (stream->binsizeload) return NIL;
+    stream->binsizeload = T;
+    if (!(sortcache_refresh (stream) ||
+	  mail_parameters (stream,GET_SORTCACHE,(void *) stream))) return NIL;
+  }
+}
+
+
+/* Mail remember decoded size of body part
+ * Accepts: mail stream
+ *	    message number
+ *	    body section, or NIL for whole message
+ *	    decoded size
+ */
+
+void mail_binary_size_set (MAILSTREAM *stream,unsigned long msgno,
+			   char *section,unsigned long size)
+{
+  SORTCACHE *sc = (SORTCACHE *) (*mailcache) (stream,msgno,CH_SORTCACHE);
+  if (mail_binary_size_cache (sc,section ? section : "",size)) {
+    sc->dirty = T;		/* tell driver there is something to save */
+    mail_parameters (stream,SET_SORTCACHE,(void *) stream);
+  }
+}
+
+
+/* Mail add decoded size to sortcache entry
+ * Accepts: sortcache entry
+ *	    body section
+ *	    decoded size
+ * Returns: new entry, or NIL if section already cached
+ */
+
+BINARYSIZE *mail_binary_size_cache (SORTCACHE *sc,char *section,
+				    unsigned long size)
+{
+  BINARYSIZE *b;
+  for (b = sc->binsize; b; b = b->next)
+    if (!strcmp (b->section,section)) return NIL;
+  b = (BINARYSIZE *) fs_get (sizeof (BINARYSIZE));
+  b->section = cpystr (section);
+  b->size = size;
+  b->next = sc->binsize;	/* push on list */
+  return sc->binsize = b;
+}
+
 /* Mail sort messages
  * Accepts: mail stream
  *	    character set
@@ -4265,8 +4542,7 @@ unsigned long *mail_sort_cache (MAILSTREAM *stream,SORTPGM *pgm,SORTCACHE **sc,
 				long flags)
 {
   unsigned long i,*ret;
-				/* pass 3: sort messages */
-  qsort ((void *) sc,pgm->nmsgs,sizeof (SORTCACHE *),mail_sort_compare);
+  mail_sort_vector (pgm,sc);	/* pass 3: sort messages */
 				/* optional post sorting */
   if (pgm->postsort) (*pgm->postsort) ((void *) sc);
 				/* pass 4: return results */
@@ -4278,6 +4554,98 @@ unsigned long *mail_sort_cache (MAILSTREAM *stream,SORTPGM *pgm,SORTCACHE **sc,
   return ret;
 }
 
+/* Mail sort sortcache vector by collation key
+ * Accepts: sort program
+ *	    sortcache vector of pgm->nmsgs entries
+ *
+ * Each message gets a fixed-width key from its first sort criterion, which
+ * orders messages as mail_sort_compare() does wherever their keys differ.
+ * The keys are radix sorted, and only runs of messages with equal keys are
+ * sorted with mail_sort_compare().
+ */
+
+void mail_sort_vector (SORTPGM *pgm,SORTCACHE **sc)
+{
+  unsigned long i,j,n,shift;
+  unsigned long count[256];
+  SORTKEY *k,*t,*x;
+  if ((n = pgm->nmsgs) < 2) return;
+  k = (SORTKEY *) fs_get (2 * n * sizeof (SORTKEY));
+  for (i = 0,t = k + n; i < n; ++i) {
+    k[i].key = mail_sort_key (pgm,sc[i]);
+    k[i].sc = sc[i];
+    if (!sc[i]->sorted) {	/* this one sorted yet? */
+      sc[i]->sorted = T;
+      pgm->progress.sorted++;	/* another sorted message */
+    }
+  }
+				/* least significant octet first */
+  for (shift = 0; shift < 8 * sizeof (unsigned long); shift += 8) {
+    memset (count,0,sizeof (count));
+    for (i = 0; i < n; ++i) ++count[(k[i].key >> shift) & 0xff];
+    if (count[(k[0].key >> shift) & 0xff] == n) continue;
+    for (i = j = 0; i < 256; ++i) {
+      unsigned long c = count[i];
+      count[i] = j;		/* first slot for this octet */
+      j += c;
+    }
+    for (i = 0; i < n; ++i) t[count[(k[i].key >> shift) & 0xff]++] = k[i];
+    x = k;			/* sorted copy becomes the keys */
+    k = t;
+    t = x;
+  }
+  for (i = 0; i < n; i = j) {	/* sort runs of equal keys */
+    for (j = i + 1; (j < n) && (k[j].key == k[i].key); ++j);
+    for (x = k + i; x < k + j; ++x) sc[x - k] = x->sc;
+    if ((j - i) > 1)
+      qsort ((void *) (sc + i),j - i,sizeof (SORTCACHE *),mail_sort_compare);
+  }
+  fs_give ((void **) ((k < t) ? &k : &t));
+}
+
+
+/* Mail sort collation key
+ * Accepts: sort program
+ *	    sortcache entry
+ * Returns: key of first sort criterion
+ *
+ * A string's key is its leading octets, so strings which differ there
+ * compare as their keys do.
+ */
+
+unsigned long mail_sort_key (SORTPGM *pgm,SORTCACHE *s)
+{
+  size_t i;
+  unsigned char *t = NIL;
+  unsigned long ret = 0;
+  switch (pgm->function) {
+  case SORTDATE:		/* sort by date */
+    ret = s->date;
+    break;
+  case SORTARRIVAL:		/* sort by arrival date */
+    ret = s->arrival;
+    break;
+  case SORTSIZE:		/* sort by message size */
+    ret = s->size;
+    break;
+  case SORTFROM:		/* sort by first from */
+    t = (unsigned char *) s->from;
+    break;
+  case SORTTO:			/* sort by first to */
+    t = (unsigned char *) s->to;
+    break;
+  case SORTCC:			/* sort by first cc */
+    t = (unsigned char *) s->cc;
+    break;
+  case SORTSUBJECT:		/* sort by subject */
+    t = (unsigned char *) s->subject;
+    break;
+  }
+  if (t) for (i = 0; i < sizeof (unsigned long); ++i)
+    ret = (ret << 8) | (*t ? *t++ : 0);
+  return pgm->reverse ? ~ret : ret;
+}
+
 /* Mail load sortcache
  * Accepts: mail stream, already searched
  *	    sort program
@@ -4294,213 +4662,266 @@ static STRINGLIST mailsubline = {{(unsigned char *) "subject",7},NIL};
 
 SORTCACHE **mail_sort_loadcache (MAILSTREAM *stream,SORTPGM *pgm)
 {
-  char *t,*v,*x,tmp[MAILTMPLEN];
-  SORTPGM *pg;
   SORTCACHE *s,**sc;
-  MESSAGECACHE *elt,telt;
-  ENVELOPE *env;
-  ADDRESS *adr = NIL;
+  unsigned long n;
   unsigned long i = (pgm->nmsgs) * sizeof (SORTCACHE *);
   sc = (SORTCACHE **) memset (fs_get ((size_t) i),0,(size_t) i);
-				/* see what needs to be loaded */
-  for (i = 1; !pgm->abort && (i <= stream->nmsgs); i++)
-    if ((elt = mail_elt (stream,i))->searched) {
-      sc[pgm->progress.cached++] =
-	s = (SORTCACHE *) (*mailcache) (stream,i,CH_SORTCACHE);
+				/* note messages to sort */
+  for (i = 1,n = 0; i <= stream->nmsgs; i++)
+    if (mail_elt (stream,i)->searched) {
+      sc[n++] = s = (SORTCACHE *) (*mailcache) (stream,i,CH_SORTCACHE);
       s->pgm = pgm;		/* note sort program */
       s->num = i;
+    }
+  sortcache_refresh (stream);	/* get keys saved by earlier sessions */
+				/* workers load many uncached keys */
+  if (stream->dtb && (stream->dtb->flags & DR_LOCAL)) sort_workers (stream,sc);
+				/* see what still needs to be loaded */
+  while (!pgm->abort && (pgm->progress.cached < n))
+    mail_sort_loadmsg (stream,sc[pgm->progress.cached++]);
+  sortcache_save (stream);	/* keep keys for later sessions */
+  return sc;
+}
+
+
+/* Mail sortcache entry loaded test
+ * Accepts: sortcache entry, with sort program
+ * Returns: T if entry has every key of the sort program, else NIL
+ */
+
+long mail_sort_loaded (SORTCACHE *s)
+{
+  SORTPGM *pg;
+  for (pg = s->pgm; pg; pg = pg->next) switch (pg->function) {
+  case SORTARRIVAL:
+    if (!s->arrival) return NIL;
+    break;
+  case SORTSIZE:
+    if (!s->size) return NIL;
+    break;
+  case SORTDATE:
+    if (!s->date) return NIL;
+    break;
+  case SORTFROM:
+    if (!s->from) return NIL;
+    break;
+  case SORTTO:
+    if (!s->to) return NIL;
+    break;
+  case SORTCC:
+    if (!s->cc) return NIL;
+    break;
+  case SORTSUBJECT:
+    if (!s->subject) return NIL;
+    break;
+  }
+  return LONGT;
+}
+
+/* Mail load sortcache entry
+ * Accepts: mail stream
+ *	    sortcache entry, with sort program and message number
+ */
+
+void mail_sort_loadmsg (MAILSTREAM *stream,SORTCACHE *s)
+{
+  char *t,*v,*x,tmp[MAILTMPLEN];
+  SORTPGM *pg;
+  MESSAGECACHE *elt,telt;
+  ENVELOPE *env;
+  ADDRESS *adr = NIL;
+  unsigned long i = s->num;
+  elt = mail_elt (stream,i);
 				/* get envelope if cached */
-      if (stream->scache) env = (i == stream->msgno) ? stream->env : NIL;
-      else env = elt->private.msg.env;
-      for (pg = pgm; pg; pg = pg->next) switch (pg->function) {
-      case SORTARRIVAL:		/* sort by arrival date */
-	if (!s->arrival) {
+  if (stream->scache) env = (i == stream->msgno) ? stream->env : NIL;
+  else env = elt->private.msg.env;
+  for (pg = s->pgm; pg; pg = pg->next) switch (pg->function) {
+  case SORTARRIVAL:		/* sort by arrival date */
+    if (!s->arrival) {
 				/* internal date unknown but can get? */
-	  if (!elt->day && !(stream->dtb->flags & DR_NOINTDATE)) {
-	    sprintf (tmp,"%lu",i);
-	    mail_fetch_fast (stream,tmp,NIL);
-	  }
+      if (!elt->day && !(stream->dtb->flags & DR_NOINTDATE)) {
+	sprintf (tmp,"%lu",i);
+	mail_fetch_fast (stream,tmp,NIL);
+      }
 				/* wrong thing before 3-Jan-1970 */
-	  s->arrival = elt->day ? mail_longdate (elt) : 1;
-	  s->dirty = T;
-	}
-	break;
-      case SORTSIZE:		/* sort by message size */
-	if (!s->size) {
-	  if (!elt->rfc822_size) {
-	    sprintf (tmp,"%lu",i);
-	    mail_fetch_fast (stream,tmp,NIL);
-	  }
-	  s->size = elt->rfc822_size ? elt->rfc822_size : 1;
-	  s->dirty = T;
-	}
-	break;
+      s->arrival = elt->day ? mail_longdate (elt) : 1;
+      s->dirty = T;
+    }
+    break;
+  case SORTSIZE:		/* sort by message size */
+    if (!s->size) {
+      if (!elt->rfc822_size) {
+	sprintf (tmp,"%lu",i);
+	mail_fetch_fast (stream,tmp,NIL);
+      }
+      s->size = elt->rfc822_size ? elt->rfc822_size : 1;
+      s->dirty = T;
+    }
+    break;
 
-      case SORTDATE:		/* sort by date */
-	if (!s->date) {
-	  if (env) t = env->date;
-	  else if ((t = mail_fetch_header (stream,i,NIL,&maildateline,NIL,
-					   FT_INTERNAL | FT_PEEK)) &&
-		   (t = strchr (t,':')))
-	    for (x = ++t; x = strpbrk (x,"\012\015"); x++)
-	      switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
-	      case ' ':		/* erase continuation newlines */
-	      case '\t':
-		memmove (x,v,strlen (v));
-		break;
-	      default:		/* tie off extraneous text */
-		*x = x[1] = '\0';
-	      }
+  case SORTDATE:		/* sort by date */
+    if (!s->date) {
+      if (env) t = env->date;
+      else if ((t = mail_fetch_header (stream,i,NIL,&maildateline,NIL,
+				       FT_INTERNAL | FT_PEEK)) &&
+	       (t = strchr (t,':')))
+	for (x = ++t; x = strpbrk (x,"\012\015"); x++)
+	  switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
+	  case ' ':		/* erase continuation newlines */
+	  case '\t':
+	    memmove (x,v,strlen (v));
+	    break;
+	  default:		/* tie off extraneous text */
+	    *x = x[1] = '\0';
+	  }
 				/* skip leading whitespace */
-	  if (t) while ((*t == ' ') || (*t == '\t')) t++;
+      if (t) while ((*t == ' ') || (*t == '\t')) t++;
 				/* parse date from Date: header */
-	  if (!(t && mail_parse_date (&telt,t) && 
-		(s->date = mail_longdate (&telt)))) {
+      if (!(t && mail_parse_date (&telt,t) && 
+	    (s->date = mail_longdate (&telt)))) {
 				/* failed, use internal date */
-	    if (!(s->date = s->arrival)) {
+	if (!(s->date = s->arrival)) {
 				/* internal date unknown but can get? */
-	      if (!elt->day && !(stream->dtb->flags & DR_NOINTDATE)) {
-		sprintf (tmp,"%lu",i);
-		mail_fetch_fast (stream,tmp,NIL);
-	      }
-				/* wrong thing before 3-Jan-1970 */
-	      s->date = (s->arrival = elt->day ? mail_longdate (elt) : 1);
-	    }
+	  if (!elt->day && !(stream->dtb->flags & DR_NOINTDATE)) {
+	    sprintf (tmp,"%lu",i);
+	    mail_fetch_fast (stream,tmp,NIL);
 	  }
-	  s->dirty = T;
+				/* wrong thing before 3-Jan-1970 */
+	  s->date = (s->arrival = elt->day ? mail_longdate (elt) : 1);
 	}
-	break;
+      }
+      s->dirty = T;
+    }
+    break;
 
-      case SORTFROM:		/* sort by first from */
-	if (!s->from) {
-	  if (env) s->from = env->from && env->from->mailbox ?
-	    cpystr (env->from->mailbox) : NIL;
-	  else if ((t = mail_fetch_header (stream,i,NIL,&mailfromline,NIL,
-					   FT_INTERNAL | FT_PEEK)) &&
-		   (t = strchr (t,':'))) {
-	    for (x = ++t; x = strpbrk (x,"\012\015"); x++)
-	      switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
-	      case ' ':		/* erase continuation newlines */
-	      case '\t':
-		memmove (x,v,strlen (v));
-		break;
-	      case 'f':		/* continuation but with extra "From:" */
-	      case 'F':
-		if (v = strchr (v,':')) {
-		  memmove (x,v+1,strlen (v+1));
-		  break;
-		}
-	      default:		/* tie off extraneous text */
-		*x = x[1] = '\0';
-	      }
-	    rfc822_parse_adrlist (&adr,t,BADHOST);
-	    if (adr) {
-	      s->from = adr->mailbox;
-	      adr->mailbox = NIL;
-	      mail_free_address (&adr);
+  case SORTFROM:		/* sort by first from */
+    if (!s->from) {
+      if (env) s->from = env->from && env->from->mailbox ?
+	cpystr (env->from->mailbox) : NIL;
+      else if ((t = mail_fetch_header (stream,i,NIL,&mailfromline,NIL,
+				       FT_INTERNAL | FT_PEEK)) &&
+	       (t = strchr (t,':'))) {
+	for (x = ++t; x = strpbrk (x,"\012\015"); x++)
+	  switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
+	  case ' ':		/* erase continuation newlines */
+	  case '\t':
+	    memmove (x,v,strlen (v));
+	    break;
+	  case 'f':		/* continuation but with extra "From:" */
+	  case 'F':
+	    if (v = strchr (v,':')) {
+	      memmove (x,v+1,strlen (v+1));
+	      break;
 	    }
+	  default:		/* tie off extraneous text */
+	    *x = x[1] = '\0';
 	  }
-	  if (!s->from) s->from = cpystr ("");
-	  s->dirty = T;
+	rfc822_parse_adrlist (&adr,t,BADHOST);
+	if (adr) {
+	  s->from = adr->mailbox;
+	  adr->mailbox = NIL;
+	  mail_free_address (&adr);
 	}
-	break;
+      }
+      if (!s->from) s->from = cpystr ("");
+      s->dirty = T;
+    }
+    break;
 
-      case SORTTO:		/* sort by first to */
-	if (!s->to) {
-	  if (env) s->to = env->to && env->to->mailbox ?
-	    cpystr (env->to->mailbox) : NIL;
-	  else if ((t = mail_fetch_header (stream,i,NIL,&mailtonline,NIL,
-					   FT_INTERNAL | FT_PEEK)) &&
-		   (t = strchr (t,':'))) {
-	    for (x = ++t; x = strpbrk (x,"\012\015"); x++)
-	      switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
-	      case ' ':		/* erase continuation newlines */
-	      case '\t':
-		memmove (x,v,strlen (v));
-		break;
-	      case 't':		/* continuation but with extra "To:" */
-	      case 'T':
-		if (v = strchr (v,':')) {
-		  memmove (x,v+1,strlen (v+1));
-		  break;
-		}
-	      default:		/* tie off extraneous text */
-		*x = x[1] = '\0';
-	      }
-	    rfc822_parse_adrlist (&adr,t,BADHOST);
-	    if (adr) {
-	      s->to = adr->mailbox;
-	      adr->mailbox = NIL;
-	      mail_free_address (&adr);
+  case SORTTO:			/* sort by first to */
+    if (!s->to) {
+      if (env) s->to = env->to && env->to->mailbox ?
+	cpystr (env->to->mailbox) : NIL;
+      else if ((t = mail_fetch_header (stream,i,NIL,&mailtonline,NIL,
+				       FT_INTERNAL | FT_PEEK)) &&
+	       (t = strchr (t,':'))) {
+	for (x = ++t; x = strpbrk (x,"\012\015"); x++)
+	  switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
+	  case ' ':		/* erase continuation newlines */
+	  case '\t':
+	    memmove (x,v,strlen (v));
+	    break;
+	  case 't':		/* continuation but with extra "To:" */
+	  case 'T':
+	    if (v = strchr (v,':')) {
+	      memmove (x,v+1,strlen (v+1));
+	      break;
 	    }
+	  default:		/* tie off extraneous text */
+	    *x = x[1] = '\0';
 	  }
-	  if (!s->to) s->to = cpystr ("");
-	  s->dirty = T;
+	rfc822_parse_adrlist (&adr,t,BADHOST);
+	if (adr) {
+	  s->to = adr->mailbox;
+	  adr->mailbox = NIL;
+	  mail_free_address (&adr);
 	}
-	break;
+      }
+      if (!s->to) s->to = cpystr ("");
+      s->dirty = T;
+    }
+    break;
 
-      case SORTCC:		/* sort by first cc */
-	if (!s->cc) {
-	  if (env) s->cc = env->cc && env->cc->mailbox ?
-	    cpystr (env->cc->mailbox) : NIL;
-	  else if ((t = mail_fetch_header (stream,i,NIL,&mailccline,NIL,
-					   FT_INTERNAL | FT_PEEK)) &&
-		   (t = strchr (t,':'))) {
-	    for (x = ++t; x = strpbrk (x,"\012\015"); x++)
-	      switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
-	      case ' ':		/* erase continuation newlines */
-	      case '\t':
-		memmove (x,v,strlen (v));
-		break;
-	      case 'c':		/* continuation but with extra "cc:" */
-	      case 'C':
-		if (v = strchr (v,':')) {
-		  memmove (x,v+1,strlen (v+1));
-		  break;
-		}
-	      default:		/* tie off extraneous text */
-		*x = x[1] = '\0';
-	      }
-	    rfc822_parse_adrlist (&adr,t,BADHOST);
-	    if (adr) {
-	      s->cc = adr->mailbox;
-	      adr->mailbox = NIL;
-	      mail_free_address (&adr);
+  case SORTCC:			/* sort by first cc */
+    if (!s->cc) {
+      if (env) s->cc = env->cc && env->cc->mailbox ?
+	cpystr (env->cc->mailbox) : NIL;
+      else if ((t = mail_fetch_header (stream,i,NIL,&mailccline,NIL,
+				       FT_INTERNAL | FT_PEEK)) &&
+	       (t = strchr (t,':'))) {
+	for (x = ++t; x = strpbrk (x,"\012\015"); x++)
+	  switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
+	  case ' ':		/* erase continuation newlines */
+	  case '\t':
+	    memmove (x,v,strlen (v));
+	    break;
+	  case 'c':		/* continuation but with extra "cc:" */
+	  case 'C':
+	    if (v = strchr (v,':')) {
+	      memmove (x,v+1,strlen (v+1));
+	      break;
 	    }
+	  default:		/* tie off extraneous text */
+	    *x = x[1] = '\0';
 	  }
-	  if (!s->cc) s->cc = cpystr ("");
-	  s->dirty = T;
+	rfc822_parse_adrlist (&adr,t,BADHOST);
+	if (adr) {
+	  s->cc = adr->mailbox;
+	  adr->mailbox = NIL;
+	  mail_free_address (&adr);
 	}
-	break;
+      }
+      if (!s->cc) s->cc = cpystr ("");
+      s->dirty = T;
+    }
+    break;
 
-      case SORTSUBJECT:		/* sort by subject */
-	if (!s->subject) {
+  case SORTSUBJECT:		/* sort by subject */
+    if (!s->subject) {
 				/* get subject from envelope if have one */
-	  if (env) t = env->subject ? env->subject : "";
+      if (env) t = env->subject ? env->subject : "";
 				/* otherwise snarf from header text */
-	  else if ((t = mail_fetch_header (stream,i,NIL,&mailsubline,
-					   NIL,FT_INTERNAL | FT_PEEK)) &&
-		   (t = strchr (t,':')))
-	    for (x = ++t; x = strpbrk (x,"\012\015"); x++)
-	      switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
-	      case ' ':		/* erase continuation newlines */
-	      case '\t':
-		memmove (x,v,strlen (v));
-		break;
-	      default:		/* tie off extraneous text */
-		*x = x[1] = '\0';
-	      }
-	  else t = "";		/* empty subject */
+      else if ((t = mail_fetch_header (stream,i,NIL,&mailsubline,
+				       NIL,FT_INTERNAL | FT_PEEK)) &&
+	       (t = strchr (t,':')))
+	for (x = ++t; x = strpbrk (x,"\012\015"); x++)
+	  switch (*(v = ((*x == '\015') && (x[1] == '\012')) ? x+2 : x+1)){
+	  case ' ':		/* erase continuation newlines */
+	  case '\t':
+	    memmove (x,v,strlen (v));
+	    break;
+	  default:		/* tie off extraneous text */
+	    *x = x[1] = '\0';
+	  }
+      else t = "";		/* empty subject */
 				/* strip and cache subject */
-	  s->refwd = mail_strip_subject (t,&s->subject);
-	  s->dirty = T;
-	}
-	break;
-      default:
-	fatal ("Unknown sort function");
-      }
+      s->refwd = mail_strip_subject (t,&s->subject);
+      s->dirty = T;
     }
-  return sc;
+    break;
+  default:
+    fatal ("Unknown sort function");
+  }
 }
 
 /* Strip subjects of extra spaces and leading and trailing cruft for sorting
@@ -4528,7 +4949,7 @@ unsigned int mail_strip_subject (char *t,char **ret)
     }
     *x = '\0';			/* tie off string */
 			/* Step 2 */
-    for (slen = dst.size; s; slen = strlen (s))  {
+    for (slen = strlen (s); s; slen = strlen (s)) {
       for (t = s + slen; t > s; ) switch (t[-1]) {
       case ' ': case '\t':	/* WSP */
 	*--t = '\0';		/* just remove it */
@@ -4895,6 +5316,7 @@ THREADNODE *mail_thread_references (MAILSTREAM *stream,char *charset,
   for (i = 1, nmsgs = 0; i <= stream->nmsgs; ++i)
     if (mail_elt (stream,i)->searched)
       (sc[nmsgs++] = (SORTCACHE *)(*mailcache)(stream,i,CH_SORTCACHE))->num =i;
+  sortcache_refresh (stream);	/* get keys saved by earlier sessions */
 	/* separate pass so can do overview fetch lookahead */
   for (i = 0; i < nmsgs; ++i) {	/* for each requested message */
 				/* is anything missing in its SORTCACHE? */
@@ -4955,6 +5377,7 @@ THREADNODE *mail_thread_references (MAILSTREAM *stream,char *charset,
 				/* add unique string to hash table */
     hash_add (ht,s->unique,s,THREADLINKS);
   }
+  sortcache_save (stream);	/* keep keys for later sessions */
 			/* Step 1 */
   for (i = 0; i < nmsgs; ++i) {	/* for each message in sortcache */
 			/* Step 1A */
@@ -5424,6 +5847,172 @@ long mail_sequence (MAILSTREAM *stream,unsigned char *sequence)
   return T;			/* successfully parsed sequence */
 }
 
+/* Mail parse sequence into message number set
+ * Accepts: mail stream
+ *	    sequence to parse
+ *	    option flags (ST_UID if a UID sequence)
+ *	    pointer to return set
+ * Returns: T if parse successful, else NIL
+ *
+ * Unlike mail_sequence() and mail_uid_sequence(), the message cache is left
+ * alone.  The returned set is in ascending order with no overlapping ranges,
+ * and may be walked with mail_next_set() in time proportional to its size.
+ * An empty set is returned as NIL.
+ */
+
+long mail_sequence_set (MAILSTREAM *stream,unsigned char *sequence,long flags,
+			SEARCHSET **ret)
+{
+  unsigned long i,j,x;
+  char *err = NIL;
+  SEARCHSET *tail = NIL;
+  *ret = NIL;			/* initially empty set */
+  while (sequence && *sequence){/* while there is something to parse */
+    if (*sequence == '*') {	/* maximum message */
+      if (flags & ST_UID)
+	i = stream->nmsgs ? mail_uid (stream,stream->nmsgs) : stream->uid_last;
+      else if (!(i = stream->nmsgs)) {
+	err = "No messages, so no maximum message number";
+	break;
+      }
+      sequence++;		/* skip past * */
+    }
+				/* parse and validate message number */
+    else if (!isdigit (*sequence)) {
+      err = "Syntax error in sequence";
+      break;
+    }
+    else if (!(i = strtoul (sequence,(char **) &sequence,10)) ||
+	     (!(flags & ST_UID) && (i > stream->nmsgs))) {
+      err = (flags & ST_UID) ? "UID may not be zero" : "Sequence out of range";
+      break;
+    }
+    if (*sequence == ':') {	/* sequence range */
+      if (*++sequence == '*') {	/* maximum message */
+	if (flags & ST_UID) j = stream->nmsgs ?
+	  mail_uid (stream,stream->nmsgs) : stream->uid_last;
+	else if (!(j = stream->nmsgs)) {
+	  err = "No messages, so no maximum message number";
+	  break;
+	}
+	sequence++;		/* skip past * */
+      }
+				/* parse end of range */
+      else if (!(j = strtoul (sequence,(char **) &sequence,10)) ||
+	       (!(flags & ST_UID) && (j > stream->nmsgs))) {
+	err = "Sequence range invalid";
+	break;
+      }
+      if (i > j) {		/* swap the range if backwards */
+	x = i; i = j; j = x;
+      }
+    }
+    else j = i;			/* single message */
+    if (*sequence && *sequence++ != ',') {
+      err = "Sequence syntax error";
+      break;
+    }
+    if (flags & ST_UID) {	/* map UID range to message numbers */
+      i = mail_uid_msgno (stream,i);
+      j = mail_uid_msgno (stream,j + 1) - 1;
+    }
+    if (i > j);			/* no messages in this range */
+				/* usual case, past end of set */
+    else if (!tail || (i > (x = tail->last ? tail->last : tail->first) + 1)) {
+      if (tail) tail = tail->next = mail_newsearchset ();
+      else tail = *ret = mail_newsearchset ();
+      tail->first = i;
+      if (j > i) tail->last = j;
+    }
+    else if (i >= tail->first) {/* abuts or overlaps end of set */
+      if (j > x) tail->last = j;
+    }
+    else {			/* out of order, merge into set */
+      mail_insert_set (ret,i,j);
+      for (tail = *ret; tail->next; tail = tail->next);
+    }
+  }
+  if (!err) return T;		/* successfully parsed sequence */
+  MM_LOG (err,ERROR);
+  mail_free_searchset (ret);	/* failure, punt partial set */
+  return NIL;
+}
+
+
+/* Mail insert range into ordered set
+ * Accepts: pointer to ascending non-overlapping set
+ *	    first message in range
+ *	    last message in range
+ */
+
+void mail_insert_set (SEARCHSET **set,unsigned long first,unsigned long last)
+{
+  SEARCHSET *s,*t;
+  unsigned long end;
+				/* skip ranges entirely below this one */
+  while (*set && (((*set)->last ? (*set)->last : (*set)->first) + 1 < first))
+    set = &(*set)->next;
+  if (!*set || (last + 1 < (*set)->first)) {
+    s = mail_newsearchset ();	/* disjoint, insert new range here */
+    s->first = first;
+    if (last > first) s->last = last;
+    s->next = *set;
+    *set = s;
+  }
+  else {			/* overlaps or abuts, widen this range */
+    s = *set;
+    if (first < s->first) s->first = first;
+    if ((end = s->last ? s->last : s->first) < last) end = last;
+				/* absorb any ranges now covered */
+    while ((t = s->next) && (t->first <= end + 1)) {
+      if ((t->last ? t->last : t->first) > end)
+	end = t->last ? t->last : t->first;
+      s->next = t->next;
+      t->next = NIL;
+      mail_free_searchset (&t);
+    }
+    s->last = (end > s->first) ? end : 0;
+  }
+}
+
+/* Mail return next member of ordered set
+ * Accepts: pointer to current position in ascending non-overlapping set
+ *	    previous member, or 0 to start
+ * Returns: next member, or 0 if set exhausted
+ *
+ * Typical usage is:
+ *   for (s = set, i = 0; i = mail_next_set (&s,i);) ...
+ */
+
+unsigned long mail_next_set (SEARCHSET **set,unsigned long msgno)
+{
+  for (; *set; *set = (*set)->next) {
+    if (msgno < (*set)->first) return (*set)->first;
+    if (msgno < (*set)->last) return msgno + 1;
+  }
+  return 0;
+}
+
+
+/* Mail find message number for UID
+ * Accepts: mail stream
+ *	    UID
+ * Returns: first message number with UID at or above the given UID, or
+ *	    nmsgs + 1 if none
+ */
+
+unsigned long mail_uid_msgno (MAILSTREAM *stream,unsigned long uid)
+{
+  unsigned long middle;
+  unsigned long first = 1;
+  unsigned long last = stream->nmsgs + 1;
+  while (first < last)		/* UIDs ascend, so binary search */
+    if (mail_uid (stream,middle = first + (last - first) / 2) < uid)
+      first = middle + 1;
+    else last = middle;
+  return first;
+}
+
 /* Parse flag list
  * Accepts: MAIL stream
  *	    flag list as a character string
@@ -6011,6 +6600,82 @@ void mail_free_namespace (NAMESPACE **n)
   }
 }
 
+/* Mail garbage collect decoded size list
+ * Accepts: pointer to decoded size list pointer
+ */
+
+void mail_free_binarysize (BINARYSIZE **bs)
+{
+  if (*bs) {			/* only free if exists */
+    mail_free_binarysize (&(*bs)->next);
+    fs_give ((void **) &(*bs)->section);
+    fs_give ((void **) bs);	/* return list entry to free storage */
+  }
+}
+
+
+/* Mail garbage collect structure cache
+ * Accepts: pointer to structure cache pointer
+ */
+
+void mail_free_structcache (STRUCTCACHE **stc)
+{
+  unsigned long i;
+  if (*stc) {			/* only free if exists */
+    for (i = 0; i < (*stc)->nrecs; ++i)
+      fs_give ((void **) &(*stc)->rec[i].data.data);
+    if ((*stc)->rec) fs_give ((void **) &(*stc)->rec);
+    if ((*stc)->file) fs_give ((void **) &(*stc)->file);
+    fs_give ((void **) stc);	/* return structure cache to free storage */
+  }
+}
+
+
+/* Mail garbage collect text index
+ * Accepts: pointer to text index pointer
+ */
+
+void mail_free_textindex (TEXTINDEX **txi)
+{
+  unsigned long i;
+  TEXTQUERY *q;
+  if (*txi) {			/* only free if exists */
+    for (i = 0; i < (*txi)->nrecs; ++i)
+      fs_give ((void **) &(*txi)->rec[i].tokens.data);
+    if ((*txi)->rec) fs_give ((void **) &(*txi)->rec);
+    for (i = 0; i < (*txi)->ntokens; ++i) {
+      fs_give ((void **) &(*txi)->token[i]->name.data);
+      if ((*txi)->token[i]->uid) fs_give ((void **) &(*txi)->token[i]->uid);
+      fs_give ((void **) &(*txi)->token[i]);
+    }
+    if ((*txi)->token) fs_give ((void **) &(*txi)->token);
+    if ((*txi)->vocab) hash_destroy (&(*txi)->vocab);
+    while (q = (*txi)->query) {	/* flush cached queries */
+      (*txi)->query = q->next;
+      fs_give ((void **) &q->tag);
+      fs_give ((void **) &q->text.data);
+      if (q->uid) fs_give ((void **) &q->uid);
+      fs_give ((void **) &q);
+    }
+    if ((*txi)->file) fs_give ((void **) &(*txi)->file);
+    fs_give ((void **) txi);	/* return text index to free storage */
+  }
+}
+
+
+/* Mail garbage collect sidecar sortcache
+ * Accepts: pointer to sidecar sortcache pointer
+ */
+
+void mail_free_sortfile (SORTFILE **srt)
+{
+  if (*srt) {			/* only free if exists */
+    if ((*srt)->file) fs_give ((void **) &(*srt)->file);
+    fs_give ((void **) srt);	/* return sortcache to free storage */
+  }
+}
+
+
 /* Mail garbage collect sort program
  * Accepts: pointer to sortpgm pointer
  */
@@ -358,6 +358,24 @@
 #define SET_SCANCONTENTS (long) 573
 #define GET_MHALLOWINBOX (long) 574
 #define SET_MHALLOWINBOX (long) 575
+#define GET_STATUSCACHE (long) 576
+#define SET_STATUSCACHE (long) 577
+	/* KLUDGE ALERT: SORTCACHE, STRUCTCACHEFILE, TEXTINDEXFILE, and
+	 * HEADERINDEXFILE are per stream, but mail_parameters() doesn't pass the
+	 * stream to the driver, so the value must be the stream again, e.g.
+	 * mail_parameters (stream,GET_STRUCTCACHEFILE,stream)
+	 */
+#define GET_SORTCACHE (long) 578
+#define SET_SORTCACHE (long) 579
+#define GET_STRUCTCACHEFILE (long) 580
+#define GET_SEARCHWORKER (long) 581
+#define GET_SEARCHPROCS (long) 582
+#define SET_SEARCHPROCS (long) 583
+#define GET_TEXTINDEXFILE (long) 584
+#define GET_HEADERINDEXFILE (long) 585
+#define GET_INDEXHEADERS (long) 586
+#define SET_INDEXHEADERS (long) 587
+#define GET_VANISHED (long) 588
 
 /* Driver flags */
 
@@ -384,6 +402,8 @@
 #define DR_HALFOPEN (long) 0x10000
 #define DR_DIRFMT (long) 0x20000/* driver is a directory-format */
 #define DR_MODSEQ (long) 0x40000/* driver supports modseqs */
+				/* driver wants a sidecar sortcache */
+#define DR_SORTCACHE (long) 0x80000
 
 
 /* Cache management function codes */
@@ -393,10 +413,26 @@
 #define CH_MAKEELT (long) 30	/* return elt, make if needed */
 #define CH_ELT (long) 31	/* return elt if exists */
 #define CH_SORTCACHE (long) 35	/* return sortcache entry, make if needed */
+				/* return structure cache, load if needed */
+#define CH_STRUCTCACHE (long) 36
+				/* return text index, load if needed */
+#define CH_TEXTINDEX (long) 37
+				/* return header index, load if needed */
+#define CH_HEADERINDEX (long) 38
+				/* return sidecar sortcache, load if needed */
+#define CH_SORTFILE (long) 39
 #define CH_FREE (long) 40	/* free space used by elt */
 				/* free space used by sortcache */
 #define CH_FREESORTCACHE (long) 43
+				/* free space used by structure cache */
+#define CH_FREESTRUCTCACHE (long) 44
 #define CH_EXPUNGE (long) 45	/* delete elt pointer from list */
+				/* free space used by text index */
+#define CH_FREETEXTINDEX (long) 46
+				/* free space used by header index */
+#define CH_FREEHEADERINDEX (long) 47
+				/* free space used by sidecar sortcache */
+#define CH_FREESORTFILE (long) 48
 
 
 /* Mailbox open options
@@ -504,6 +540,8 @@
 #define SA_UIDNEXT (long) 0x8	/* next UID to be assigned */
 				/* UID validity value */
 #define SA_UIDVALIDITY (long) 0x10
+				/* highest modseq */
+#define SA_HIGHESTMODSEQ (long) 0x20
 				/* set OP_DEBUG on any created stream */
 #define SA_DEBUG (long) 0x10000000
 				/* use multiple newsrcs */
@@ -827,6 +865,10 @@ typedef struct message_cache {
       unsigned long data;
       void *ptr;
     } spare;
+    union {			/* driver internal use */
+      unsigned long data;
+      void *ptr;
+    } spare2;
     unsigned int sequence : 1;	/* saved sequence bit */
     unsigned int dirty : 1;	/* driver internal use */
     unsigned int filter : 1;	/* driver internal use */
@@ -892,6 +934,8 @@ STRINGDRIVER {
   char (*next) (STRING *s);
 				/* set position in string */
   void (*setpos) (STRING *s,unsigned long i);
+				/* file descriptor of string, NIL if none */
+  int (*fd) (STRING *s,unsigned long *offset);
 };
 
 
@@ -958,6 +1002,7 @@ SEARCHPGM {			/* search program */
   unsigned long smaller;	/* smaller than this size */
   unsigned long older;		/* older than this interval */
   unsigned long younger;	/* younger than this interval */
+  unsigned long modseq;		/* modified at or after this modseq */
   unsigned short sentbefore;	/* sent before this date */
   unsigned short senton;	/* sent on this date */
   unsigned short sentsince;	/* sent since this date */
@@ -997,6 +1042,7 @@ typedef struct mbx_status {
   unsigned long unseen;		/* number of unseen messages */
   unsigned long uidnext;	/* next UID to be assigned */
   unsigned long uidvalidity;	/* UID validity value */
+  unsigned long highestmodseq;	/* highest modseq, 0 if no modseqs */
 } MAILSTATUS;
 
 /* Sort program */
@@ -1020,6 +1066,17 @@ SORTPGM {
 };
 
 
+/* Decoded size of a body part */
+
+#define BINARYSIZE struct binary_size
+
+BINARYSIZE {
+  char *section;		/* body section, empty for whole message */
+  unsigned long size;		/* size after content decoding */
+  BINARYSIZE *next;		/* next section */
+};
+
+
 /* Sort cache */
 
 #define SORTCACHE struct sort_cache
@@ -1041,6 +1098,103 @@ SORTCACHE {
   char *message_id;		/* message-id string */
   char *unique;			/* unique string, normally message-id */
   STRINGLIST *references;	/* references string */
+  BINARYSIZE *binsize;		/* decoded body part sizes */
+};
+
+
+/* Sort collation key */
+
+#define SORTKEY struct sort_key
+
+SORTKEY {
+  unsigned long key;		/* leading key of first sort criterion */
+  SORTCACHE *sc;		/* message's sortcache entry */
+};
+
+
+/* Structure cache, serialized envelopes and bodies keyed by UID */
+
+#define STRUCTRECORD struct struct_record
+
+STRUCTRECORD {
+  unsigned long uid;		/* message UID */
+  unsigned long size;		/* message RFC822 size */
+  SIZEDTEXT data;		/* serialized envelope and body */
+};
+
+#define STRUCTCACHE struct struct_cache
+
+STRUCTCACHE {
+  char *file;			/* cache file name, NIL if not cached */
+  unsigned long uid_validity;	/* UID validity of cached records */
+  unsigned long nrecs;		/* number of records */
+  unsigned long size;		/* size of record array */
+  STRUCTRECORD *rec;		/* records, sorted by UID */
+  unsigned int dirty : 1;	/* has records not written to file */
+};
+
+
+/* Sidecar sortcache, SORTCACHE entries saved by UID */
+
+#define SORTFILE struct sort_file
+
+SORTFILE {
+  char *file;			/* sortcache file name, NIL if not cached */
+  unsigned long uid_validity;	/* UID validity of cached entries */
+  unsigned long filesize;	/* file size when last read or written */
+  unsigned long filetime;	/* file mtime when last read or written */
+};
+
+
+/* Text index, tokens of message text keyed by UID
+ * A header index is also a text index, with each token tagged by its field
+ */
+
+#define TEXTRECORD struct text_record
+
+TEXTRECORD {
+  unsigned long uid;		/* message UID */
+  unsigned long size;		/* message RFC822 size */
+  SIZEDTEXT tokens;		/* sorted tokens, space separated */
+};
+
+#define TEXTTOKEN struct text_token
+
+TEXTTOKEN {
+  SIZEDTEXT name;		/* token text */
+  unsigned long nuids;		/* number of UIDs in posting list */
+  unsigned long size;		/* size of posting list */
+  unsigned long *uid;		/* UIDs of messages with token, unsorted */
+};
+
+#define TEXTQUERY struct text_query
+
+TEXTQUERY {
+  char *tag;			/* field tag of tokens searched */
+  SIZEDTEXT text;		/* search string */
+  unsigned long nuids;		/* number of candidate UIDs */
+  unsigned long size;		/* size of candidate list */
+  unsigned long *uid;		/* candidate UIDs, sorted */
+  unsigned int all : 1;		/* string has no tokens, all are candidates */
+  TEXTQUERY *next;		/* next cached query */
+};
+
+#define TEXTINDEX struct text_index
+
+TEXTINDEX {
+  char *file;			/* index file name, NIL if not indexed */
+  unsigned long uid_validity;	/* UID validity of indexed records */
+  unsigned long nrecs;		/* number of records */
+  unsigned long size;		/* size of record array */
+  TEXTRECORD *rec;		/* records, sorted by UID */
+  struct hash_table *vocab;	/* token lookup */
+  unsigned long ntokens;	/* number of distinct tokens */
+  unsigned long tokensize;	/* size of token array */
+  TEXTTOKEN **token;		/* distinct tokens */
+  TEXTQUERY *query;		/* cached query results */
+  unsigned long filesize;	/* file size when last read or written */
+  unsigned long filetime;	/* file mtime when last read or written */
+  unsigned int dirty : 1;	/* has records not written to file */
 };
 
 /* ACL list */
@@ -1102,6 +1256,8 @@ typedef struct mail_stream {
   unsigned int unhealthy : 1;	/* unhealthy protocol negotiations */
   unsigned int nokod : 1;	/* suppress kiss-of-death */
   unsigned int sniff : 1;	/* metadata only */
+				/* persistent decoded sizes already loaded */
+  unsigned int binsizeload : 1;
   unsigned long perm_user_flags;/* mask of permanent user flags */
   unsigned long gensym;		/* generated tag */
   unsigned long nmsgs;		/* # of associated msgs */
@@ -1112,6 +1268,10 @@ typedef struct mail_stream {
   unsigned long cachesize;	/* size of message cache */
   MESSAGECACHE **cache;		/* message cache array */
   SORTCACHE **sc;		/* sort cache array */
+  STRUCTCACHE *stc;		/* structure cache */
+  TEXTINDEX *txi;		/* text index */
+  TEXTINDEX *hxi;		/* header index */
+  SORTFILE *srt;		/* sidecar sortcache */
   unsigned long msgno;		/* message number of `current' message */
   ENVELOPE *env;		/* scratch buffer for envelope */
   BODY *body;			/* scratch buffer for body */
@@ -1352,6 +1512,9 @@ typedef void (*appenduid_t) (char *mailbox,unsigned long uidvalidity,
 typedef long (*dirfmttest_t) (char *name);
 typedef long (*scancontents_t) (char *name,char *contents,unsigned long csiz,
 				unsigned long fsiz);
+typedef long (*searchworker_t) (MAILSTREAM *stream);
+typedef long (*vanished_t) (MAILSTREAM *stream,unsigned long modseq,
+			    SEARCHSET **set);
 
 typedef void (*freeeltsparep_t) (void **sparep);
 typedef void (*freeenvelopesparep_t) (void **sparep);
@@ -1497,12 +1660,18 @@ DRIVER {
 			 SEARCHPGM *spg,long flag);
 				/* ping mailbox to see if still alive */
   long (*ping) (MAILSTREAM *stream);
+				/* descriptor readable on mailbox change */
+  int (*watch) (MAILSTREAM *stream);
+				/* highest modseq, if DR_MODSEQ */
+  unsigned long (*modseq) (MAILSTREAM *stream);
 				/* check for new messages */
   void (*check) (MAILSTREAM *stream);
 				/* expunge deleted messages */
   long (*expunge) (MAILSTREAM *stream,char *sequence,long options);
 				/* copy messages to another mailbox */
   long (*copy) (MAILSTREAM *stream,char *sequence,char *mailbox,long options);
+				/* move messages to another mailbox */
+  long (*move) (MAILSTREAM *stream,char *sequence,char *mailbox,long options);
 				/* append string message to mailbox */
   long (*append) (MAILSTREAM *stream,char *mailbox,append_t af,void *data);
 				/* garbage collect stream */
@@ -1647,6 +1816,8 @@ long mail_rename (MAILSTREAM *stream,char *old,char *newname);
 char *mail_utf7_valid (char *mailbox);
 long mail_status (MAILSTREAM *stream,char *mbx,long flags);
 long mail_status_default (MAILSTREAM *stream,char *mbx,long flags);
+long mail_status_fill (MAILSTREAM *stream,char *mbx,long flags,
+		       MAILSTATUS *status);
 MAILSTREAM *mail_open (MAILSTREAM *stream,char *name,long options);
 MAILSTREAM *mail_open_work (DRIVER *d,MAILSTREAM *stream,char *name,
 			    long options);
@@ -1694,10 +1865,14 @@ long mail_search_full (MAILSTREAM *stream,char *charset,SEARCHPGM *pgm,
 long mail_search_default (MAILSTREAM *stream,char *charset,SEARCHPGM *pgm,
 			  long flags);
 long mail_ping (MAILSTREAM *stream);
+int mail_watch (MAILSTREAM *stream);
+unsigned long mail_highestmodseq (MAILSTREAM *stream);
 void mail_check (MAILSTREAM *stream);
 long mail_expunge_full (MAILSTREAM *stream,char *sequence,long options);
 long mail_copy_full (MAILSTREAM *stream,char *sequence,char *mailbox,
 		     long options);
+long mail_move_full (MAILSTREAM *stream,char *sequence,char *mailbox,
+		     long options);
 long mail_append_full (MAILSTREAM *stream,char *mailbox,char *flags,char *date,
 		       STRING *message);
 long mail_append_multiple (MAILSTREAM *stream,char *mailbox,append_t af,
@@ -1724,8 +1899,10 @@ unsigned long mail_filter (char *text,unsigned long len,STRINGLIST *lines,
 			   long flags);
 long mail_search_msg (MAILSTREAM *stream,unsigned long msgno,char *section,
 		      SEARCHPGM *pgm);
+long mail_search_costly (SEARCHPGM *pgm);
 long mail_search_header_text (char *s,STRINGLIST *st);
 long mail_search_header (SIZEDTEXT *hdr,STRINGLIST *st);
+void mail_search_fields (char *t,unsigned long size,SIZEDTEXT *s);
 long mail_search_text (MAILSTREAM *stream,unsigned long msgno,char *section,
 		       STRINGLIST *st,long flags);
 long mail_search_body (MAILSTREAM *stream,unsigned long msgno,BODY *body,
@@ -1735,6 +1912,7 @@ long mail_search_string_work (SIZEDTEXT *s,STRINGLIST **st);
 long mail_search_keyword (MAILSTREAM *stream,MESSAGECACHE *elt,STRINGLIST *st,
 			  long flag);
 long mail_search_addr (ADDRESS *adr,STRINGLIST *st);
+void mail_search_addrtext (ADDRESS *adr,SIZEDTEXT *txt);
 char *mail_search_gets (readfn_t f,void *stream,unsigned long size,
 			GETS_DATA *md);
 SEARCHPGM *mail_criteria (char *criteria);
@@ -1744,6 +1922,11 @@ unsigned short mail_shortdate (unsigned int year,unsigned int month,
 			       unsigned int day);
 SEARCHSET *mail_parse_set (char *s,char **ret);
 SEARCHSET *mail_append_set (SEARCHSET *set,unsigned long msgno);
+long mail_sequence_set (MAILSTREAM *stream,unsigned char *sequence,long flags,
+			SEARCHSET **ret);
+void mail_insert_set (SEARCHSET **set,unsigned long first,unsigned long last);
+unsigned long mail_next_set (SEARCHSET **set,unsigned long msgno);
+unsigned long mail_uid_msgno (MAILSTREAM *stream,unsigned long uid);
 unsigned long *mail_sort (MAILSTREAM *stream,char *charset,SEARCHPGM *spg,
 			  SORTPGM *pgm,long flags);
 unsigned long *mail_sort_cache (MAILSTREAM *stream,SORTPGM *pgm,SORTCACHE **sc,
@@ -1751,11 +1934,21 @@ unsigned long *mail_sort_cache (MAILSTREAM *stream,SORTPGM *pgm,SORTCACHE **sc,
 unsigned long *mail_sort_msgs (MAILSTREAM *stream,char *charset,SEARCHPGM *spg,
 			       SORTPGM *pgm,long flags);
 SORTCACHE **mail_sort_loadcache (MAILSTREAM *stream,SORTPGM *pgm);
+long mail_sort_loaded (SORTCACHE *s);
+void mail_sort_loadmsg (MAILSTREAM *stream,SORTCACHE *s);
+void mail_sort_vector (SORTPGM *pgm,SORTCACHE **sc);
+unsigned long mail_sort_key (SORTPGM *pgm,SORTCACHE *s);
 unsigned int mail_strip_subject (char *t,char **ret);
 char *mail_strip_subject_wsp (char *s);
 char *mail_strip_subject_blob (char *s);
 int mail_sort_compare (const void *a1,const void *a2);
 unsigned long mail_longdate (MESSAGECACHE *elt);
+long mail_binary_size (MAILSTREAM *stream,unsigned long msgno,char *section,
+		       unsigned long *size);
+void mail_binary_size_set (MAILSTREAM *stream,unsigned long msgno,
+			   char *section,unsigned long size);
+BINARYSIZE *mail_binary_size_cache (SORTCACHE *sc,char *section,
+				    unsigned long size);
 THREADNODE *mail_thread (MAILSTREAM *stream,char *type,char *charset,
 			 SEARCHPGM *spg,long flags);
 THREADNODE *mail_thread_msgs (MAILSTREAM *stream,char *type,char *charset,
@@ -1815,6 +2008,10 @@ void mail_free_searchor (SEARCHOR **orl);
 void mail_free_searchpgmlist (SEARCHPGMLIST **pgl);
 void mail_free_namespace (NAMESPACE **n);
 void mail_free_sortpgm (SORTPGM **pgm);
+void mail_free_binarysize (BINARYSIZE **bs);
+void mail_free_structcache (STRUCTCACHE **stc);
+void mail_free_textindex (TEXTINDEX **txi);
+void mail_free_sortfile (SORTFILE **srt);
 void mail_free_threadnode (THREADNODE **thr);
 void mail_free_acllist (ACLLIST **al);
 void mail_free_quotalist (QUOTALIST **ql);
@@ -1846,7 +2043,9 @@ char *sm_read (char *sbname,void **sdb);
 
 void ssl_onceonlyinit (void);
 char *ssl_start_tls (char *s);
+char *ssl_start_compress (char *mechanism);
 void ssl_server_init (char *server);
+void ssl_server_preinit (char *server);
 
 
 /* Server I/O functions */
@@ -1856,8 +2055,12 @@ char *PSIN (char *s,int n);
 long PSINR (char *s,unsigned long n);
 int PBOUT (int c);
 long INWAIT (long seconds);
+long INWAITFD (long seconds,int fd);
+long INPENDING (void);
 int PSOUT (char *s);
 int PSOUTR (SIZEDTEXT *s);
+int PSOUTFD (int fd,unsigned long offset,unsigned long size);
 int PFLUSH (void);
+void PBYTES (unsigned long *in,unsigned long *out);
 
 #endif /* #ifndef _MAIL_H_ */
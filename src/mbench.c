@@ -0,0 +1,669 @@
+/*
+ * Program:	Mail library microbenchmarks
+ *
+ * Date:	17 October 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+
+/* Times the library primitives that dominate FETCH, SEARCH and SORT against
+ * generated corpora.  Corpora come from a fixed-seed generator and every
+ * benchmark has a fixed iteration count, so runs are comparable between
+ * builds.  Output is one tab-separated line per benchmark:
+ *
+ *	name	iterations	ns/op	MB/s
+ *
+ * and may be saved and given back with -b to fail on regressions.
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include "c-client.h"
+#include "utf8aux.h"
+
+#define MBENCHLINE 256		/* maximum result line */
+
+typedef struct mbench_case {
+  char *name;			/* benchmark name */
+  void (*work) (struct mbench_case *mc,unsigned long n);
+  unsigned long iterations;	/* default iteration count */
+  unsigned long bytes;		/* bytes processed per iteration */
+  char *charset;		/* charset for utf8_text() */
+  SIZEDTEXT text;		/* corpus */
+  void *data;			/* other corpus data */
+} MBENCH;
+
+int main (int argc,char *argv[]);
+int mbench_baseline (char *file,char *name,double *ns);
+double mbench_now (void);
+unsigned long mbench_random (void);
+void mbench_fill (SIZEDTEXT *txt,unsigned long size,char *alphabet);
+void mbench_setup (void);
+void mbench_setup_charset (MBENCH *mc);
+void mbench_parsemsg (MBENCH *mc,unsigned long n);
+void mbench_adrlist (MBENCH *mc,unsigned long n);
+void mbench_base64 (MBENCH *mc,unsigned long n);
+void mbench_qprint (MBENCH *mc,unsigned long n);
+void mbench_text (MBENCH *mc,unsigned long n);
+void mbench_mime2text (MBENCH *mc,unsigned long n);
+void mbench_ssearch (MBENCH *mc,unsigned long n);
+void mbench_msearch (MBENCH *mc,unsigned long n);
+void mbench_date (MBENCH *mc,unsigned long n);
+void mbench_sort (MBENCH *mc,unsigned long n);
+void mbench_sortvec (MBENCH *mc,unsigned long n);
+void mbench_strip (MBENCH *mc,unsigned long n);
+
+static MBENCH benchmarks[] = {
+  {"rfc822_parse_msg",mbench_parsemsg,1000},
+  {"rfc822_parse_adrlist",mbench_adrlist,2000},
+  {"rfc822_base64",mbench_base64,1000},
+  {"rfc822_qprint",mbench_qprint,1000},
+  {"utf8_text/ISO-8859-1",mbench_text,20,0,"ISO-8859-1"},
+  {"utf8_text/KOI8-R",mbench_text,100,0,"KOI8-R"},
+  {"utf8_text/WINDOWS-1252",mbench_text,20,0,"WINDOWS-1252"},
+  {"utf8_text/EUC-JP",mbench_text,400,0,"EUC-JP"},
+  {"utf8_text/GB2312",mbench_text,400,0,"GB2312"},
+  {"utf8_text/EUC-KR",mbench_text,400,0,"EUC-KR"},
+  {"utf8_text/BIG5",mbench_text,400,0,"BIG5"},
+  {"utf8_text/SHIFT_JIS",mbench_text,400,0,"SHIFT_JIS"},
+  {"utf8_text/ISO-2022-JP",mbench_text,400,0,"ISO-2022-JP"},
+  {"utf8_text/UTF-7",mbench_text,50,0,"UTF-7"},
+  {"utf8_text/UTF-16",mbench_text,400,0,"UTF-16"},
+  {"utf8_text/UTF-8",mbench_text,400,0,"UTF-8"},
+  {"utf8_mime2text",mbench_mime2text,20000},
+  {"ssearch/miss",mbench_ssearch,5000},
+  {"ssearch/hit",mbench_ssearch,5000},
+  {"msearch/1key",mbench_msearch,5000},
+  {"msearch/3keys",mbench_msearch,5000},
+  {"mail_parse_date",mbench_date,1000000},
+  {"mail_sort_compare",mbench_sort,500},
+  {"mail_sort_vector",mbench_sortvec,500},
+  {"mail_strip_subject",mbench_strip,200000},
+  NIL
+};
+
+static unsigned long seed = 1;	/* corpus generator state */
+static unsigned long sink = 0;	/* defeats dead code elimination */
+
+				/* date corpus */
+static char *dates[] = {
+  "Mon, 7 Feb 1994 21:52:25 -0800 (PST)",
+  "Tue, 15 Oct 2024 09:01:02 +0000",
+  "7 Feb 94 21:52 PST",
+  "Thu, 01 Jan 1970 00:00:00 GMT",
+  "Wed, 31 Dec 2025 23:59:59 +1345",
+  "Sat, 29 Feb 2020 12:00:00 -0330 (NST)",
+  "Fri, 3 Mar 2000 1:02:03 EST",
+  "Sun, 16 Jun 2013 18:41:07 +0200",
+  NIL
+};
+				/* subject corpus, made writable */
+static char *subjects[] = {
+  "Re: [dev-list] Fwd: Re: patch review (fwd)",
+  "Re[2]: meeting moved to Thursday",
+  "  FW:  [announce]   release notes for 4.23  ",
+  "plain subject without decoration",
+  "Re: Re: Re: Re: long thread",
+  "[Fwd: quarterly numbers]",
+  "=?UTF-8?Q?Re:_caf=C3=A9_au_lait?=",
+  "Fwd: RE: [ext] =?ISO-8859-1?Q?R=E9sum=E9?= attached",
+  NIL
+};
+
+/* Main program
+ * Accepts: argument count
+ *	    argument vector
+ * Returns: 0 if success, 1 if regression, 2 if usage error
+ */
+
+int main (int argc,char *argv[])
+{
+  MBENCH *mc;
+  unsigned long n,scale = 100,repeat = 3;
+  double t,best,base,tolerance = 25;
+  char *s,*baseline = NIL;
+  int c,i,ret = 0;
+  while ((c = getopt (argc,argv,"s:r:b:t:")) != -1) switch (c) {
+  case 's': scale = strtoul (optarg,NIL,10); break;
+  case 'r': if (!(repeat = strtoul (optarg,NIL,10))) repeat = 1; break;
+  case 'b': baseline = optarg; break;
+  case 't': tolerance = atof (optarg); break;
+  default:
+    fprintf (stderr,"usage: %s [-s scale%%] [-r repeat] [-b baseline]"
+	     " [-t tolerance%%] [name...]\n",argv[0]);
+    return 2;
+  }
+  mbench_setup ();		/* generate corpora */
+  printf ("# name\titerations\tns/op\tMB/s\n");
+  for (mc = benchmarks; mc->name; mc++) {
+    if (optind < argc) {	/* restricted to named benchmarks? */
+      for (i = optind; (i < argc) && !strstr (mc->name,argv[i]); i++);
+      if (i == argc) continue;
+    }
+    if (!(n = mc->iterations * scale / 100)) n = 1;
+    (*mc->work) (mc,1);		/* warm up caches */
+				/* best of several runs */
+    for (i = 0, best = 0; i < repeat; i++) {
+      t = mbench_now ();
+      (*mc->work) (mc,n);
+      t = mbench_now () - t;
+      if (!i || (t < best)) best = t;
+    }
+    best = best * 1e9 / n;	/* nanoseconds per operation */
+    printf ("%s\t%lu\t%.1f\t",mc->name,n,best);
+    if (mc->bytes) printf ("%.2f",(mc->bytes * 1e9 / best) / (1024 * 1024));
+    else putchar ('-');		/* not a bulk operation */
+    if (baseline && mbench_baseline (baseline,mc->name,&base)) {
+      s = "";			/* compare with baseline */
+      if (best > base * (100 + tolerance) / 100) {
+	s = "\tREGRESSION";
+	ret = 1;
+      }
+      printf ("\t%+.1f%%%s",(best - base) * 100 / base,s);
+    }
+    putchar ('\n');
+    fflush (stdout);
+  }
+  return ret;
+}
+
+/* Look up benchmark in baseline file
+ * Accepts: file name
+ *	    benchmark name
+ *	    pointer to return ns/op
+ * Returns: T if found, NIL otherwise
+ */
+
+int mbench_baseline (char *file,char *name,double *ns)
+{
+  FILE *f;
+  char *s,tmp[MBENCHLINE];
+  size_t i = strlen (name);
+  int ret = NIL;
+  if (f = fopen (file,"r")) {
+    while (!ret && fgets (tmp,MBENCHLINE,f))
+      if (!strncmp (tmp,name,i) && (tmp[i] == '\t') &&
+	  (s = strchr (tmp + i + 1,'\t')) && ((*ns = atof (s + 1)) > 0))
+	ret = T;
+    fclose (f);
+  }
+  return ret;
+}
+
+
+/* Return monotonic time
+ * Returns: seconds
+ */
+
+double mbench_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Corpus random number generator
+ * Returns: pseudo-random number
+ */
+
+unsigned long mbench_random (void)
+{
+  seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+  return seed >> 8;
+}
+
+
+/* Fill text with words
+ * Accepts: text to fill
+ *	    size
+ *	    alphabet
+ */
+
+void mbench_fill (SIZEDTEXT *txt,unsigned long size,char *alphabet)
+{
+  unsigned long i,j = strlen (alphabet);
+  txt->data = (unsigned char *) fs_get (size + 1);
+  for (i = 0; i < size; i++) txt->data[i] = (i % 72) == 71 ? '\n' :
+    ((mbench_random () % 7) ? alphabet[mbench_random () % j] : ' ');
+  txt->data[txt->size = size] = '\0';
+}
+
+/* Generate corpora
+ */
+
+#define MBENCHWORDS \
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+#define MBENCHSIZE 65536	/* size of bulk corpora */
+#define MBENCHTEXT 16384	/* size of charset corpora */
+
+void mbench_setup (void)
+{
+  MBENCH *mc;
+  SIZEDTEXT txt,bin;
+  SORTCACHE **sc;
+  SORTPGM *pgm;
+  unsigned long i;
+  char *s,tmp[MAILTMPLEN];
+  mbench_fill (&txt,MBENCHSIZE,MBENCHWORDS);
+				/* binary data */
+  bin.data = (unsigned char *) fs_get (bin.size = 3 * MBENCHSIZE / 4);
+  for (i = 0; i < bin.size; i++) bin.data[i] = (unsigned char) mbench_random ();
+  for (mc = benchmarks; mc->name; mc++) {
+    if (mc->work == mbench_parsemsg) {
+      s = (char *) fs_get (16 * MAILTMPLEN + MBENCHSIZE);
+      for (*s = '\0', i = 0; i < 6; i++)
+	sprintf (s + strlen (s),"Received: from relay%lu.example.org "
+		 "(relay%lu.example.org [192.0.2.%lu])\r\n\tby mx.example.com "
+		 "with ESMTPS id %08lx\r\n\tfor <user@example.com>; %s\r\n",
+		 i,i,i + 1,mbench_random (),dates[i]);
+      strcat (s,"Date: Tue, 15 Oct 2024 09:01:02 +0000\r\n"
+	      "From: \"Doe, Jane\" <jane.doe@example.org>\r\n"
+	      "Sender: list-bounces@lists.example.org\r\n"
+	      "Reply-To: dev-list@lists.example.org\r\n"
+	      "To: dev-list@lists.example.org, John Smith <john@example.com>,"
+	      "\r\n\t=?UTF-8?Q?Ren=C3=A9_Dupont?= <rene@example.fr>\r\n"
+	      "Cc: team: alice@example.com, bob@example.com;, "
+	      "carol@example.net (Carol)\r\n"
+	      "Subject: Re: [dev-list] Fwd: Re: patch review (fwd)\r\n"
+	      "Message-ID: <20241015090102.12345@example.org>\r\n"
+	      "In-Reply-To: <20241014181500.6789@example.com>\r\n"
+	      "References: <20241013101010.1111@example.net>\r\n"
+	      "\t<20241014181500.6789@example.com>\r\n"
+	      "MIME-Version: 1.0\r\n"
+	      "Content-Type: multipart/mixed; boundary=\"=_outer\"\r\n\r\n");
+      mc->data = (void *) strlen (s);
+      strcat (s,"--=_outer\r\n"
+	      "Content-Type: multipart/alternative; boundary=\"=_inner\"\r\n"
+	      "\r\n--=_inner\r\nContent-Type: text/plain; charset=UTF-8\r\n"
+	      "Content-Transfer-Encoding: quoted-printable\r\n\r\n");
+      strncat (s,(char *) txt.data,4096);
+      strcat (s,"\r\n--=_inner\r\nContent-Type: text/html; charset=UTF-8\r\n"
+	      "Content-Transfer-Encoding: 8bit\r\n\r\n<html><body><p>");
+      strncat (s,(char *) txt.data + 4096,8192);
+      strcat (s,"</p></body></html>\r\n--=_inner--\r\n--=_outer\r\n"
+	      "Content-Type: message/rfc822\r\n\r\n"
+	      "From: bob@example.com\r\nSubject: forwarded\r\n"
+	      "Content-Type: text/plain\r\n\r\nforwarded text\r\n"
+	      "--=_outer\r\nContent-Type: application/pdf; name=\"a.pdf\"\r\n"
+	      "Content-Disposition: attachment; filename=\"a.pdf\"\r\n"
+	      "Content-Transfer-Encoding: base64\r\n\r\n"
+	      "JVBERi0xLjQKJcfsj6IKNSAwIG9iago8PC9MZW5ndGggNiAwIFI+PgpzdHJl\r\n"
+	      "--=_outer--\r\n");
+      mc->bytes = (mc->text.size = strlen (s));
+      mc->text.data = (unsigned char *) s;
+    }
+    else if (mc->work == mbench_adrlist) {
+      s = (char *) fs_get (64 * MAILTMPLEN);
+      for (*s = '\0', i = 0; i < 40; i++) switch (i % 5) {
+      case 0: sprintf (s + strlen (s),"user%lu@example.com, ",i); break;
+      case 1: sprintf (s + strlen (s),"\"Last%lu, First\" <u%lu@example.org>, ",
+		       i,i); break;
+      case 2: sprintf (s + strlen (s),"First Last%lu <f.l%lu@mail.example.net>"
+		       " (work), ",i,i); break;
+      case 3: sprintf (s + strlen (s),"grp%lu: a%lu@example.com, "
+		       "b%lu@example.com;, ",i,i,i); break;
+      case 4: sprintf (s + strlen (s),"=?UTF-8?Q?J=C3=BCrgen_M=C3=BCller?= "
+		       "<jm%lu@example.de>, ",i); break;
+      }
+      s[strlen (s) - 2] = '\0';
+      mc->bytes = (mc->text.size = strlen (s));
+      mc->text.data = (unsigned char *) s;
+    }
+    else if (mc->work == mbench_base64)
+      mc->bytes = strlen ((char *) (mc->text.data =
+			  rfc822_binary (bin.data,bin.size,&mc->text.size)));
+    else if (mc->work == mbench_qprint) {
+				/* mostly text with some 8-bit */
+      for (i = 0; i < txt.size; i += 37) txt.data[i] |= 0x80;
+      mc->text.data = rfc822_8bit (txt.data,txt.size,&mc->text.size);
+      mc->bytes = mc->text.size;
+      for (i = 0; i < txt.size; i += 37) txt.data[i] &= 0x7f;
+    }
+    else if (mc->work == mbench_text) mbench_setup_charset (mc);
+    else if (mc->work == mbench_mime2text) {
+      mc->text.data = (unsigned char *)
+	cpystr ("Re: =?ISO-8859-1?Q?Caf=E9_cr=E8me?= and "
+		"=?UTF-8?B?0JfQtNGA0LDQstGB0YLQstGD0LnRgtC1?= "
+		"=?ISO-2022-JP?B?GyRCRnxLXDhsGyhC?= "
+		"=?KOI8-R?Q?=F0=D2=C9=D7=C5=D4?= plain words follow");
+      mc->bytes = mc->text.size = strlen ((char *) mc->text.data);
+    }
+    else if (mc->work == mbench_ssearch) {
+      mc->text = txt;		/* share the text corpus */
+      mc->bytes = txt.size;
+      mc->data = (void *) (strstr (mc->name,"hit") ?
+			   "xYzZy Found" : "xYzZy Missing");
+      if (strstr (mc->name,"hit"))
+	memcpy (txt.data + 3 * txt.size / 4,"XyZzY fOUND",11);
+    }
+    else if (mc->work == mbench_msearch) {
+      STRINGLIST *stl = mail_newstringlist ();
+      mc->text = txt;		/* share the text corpus */
+      mc->bytes = txt.size;
+      mc->data = (void *) stl;	/* keys which aren't in the corpus */
+      stl->text.size = strlen ((char *) (stl->text.data = (unsigned char *)
+					 cpystr ("xYzZy Missing")));
+      if (strstr (mc->name,"3keys")) {
+	stl = stl->next = mail_newstringlist ();
+	stl->text.size = strlen ((char *) (stl->text.data = (unsigned char *)
+					   cpystr ("qUUx Absent")));
+	stl = stl->next = mail_newstringlist ();
+	stl->text.size = strlen ((char *) (stl->text.data = (unsigned char *)
+					   cpystr ("Zzyzx Gone")));
+      }
+    }
+    else if (mc->work == mbench_strip)
+      for (i = 0; subjects[i]; i++) subjects[i] = cpystr (subjects[i]);
+    else if ((mc->work == mbench_sort) || (mc->work == mbench_sortvec)) {
+				/* subject then date */
+      pgm = mail_newsortpgm ();
+      pgm->function = SORTSUBJECT;
+      (pgm->next = mail_newsortpgm ())->function = SORTDATE;
+				/* number of messages */
+      pgm->nmsgs = mc->text.size = 2000;
+      sc = (SORTCACHE **) fs_get (2 * mc->text.size * sizeof (SORTCACHE *));
+      for (i = 0; i < mc->text.size; i++) {
+	sc[i] = (SORTCACHE *) memset (fs_get (sizeof (SORTCACHE)),0,
+				      sizeof (SORTCACHE));
+	sc[i]->pgm = pgm;
+	sc[i]->num = i + 1;
+	sc[i]->date = mbench_random ();
+	sprintf (tmp,"subject %lu",mbench_random () % 200);
+	mail_strip_subject (tmp,&sc[i]->subject);
+      }
+      mc->data = (void *) sc;
+    }
+  }
+  fs_give ((void **) &bin.data);
+}
+
+/* Generate corpus for a charset
+ * Accepts: benchmark
+ */
+
+void mbench_setup_charset (MBENCH *mc)
+{
+  unsigned long c;
+  unsigned char *s,*end;
+  mc->text.data = s = (unsigned char *) fs_get (MBENCHTEXT + 16);
+  end = s + MBENCHTEXT;
+  if (!strcmp (mc->charset,"ISO-2022-JP")) {
+    memcpy (s,"\033$B",3);	/* JIS X 0208 kanji rows 16-47 */
+    for (s += 3; s < end;) {
+      *s++ = (unsigned char) (0x30 + mbench_random () % 0x20);
+      *s++ = (unsigned char) (0x21 + mbench_random () % 0x5e);
+    }
+    memcpy (s,"\033(B",3);
+    s += 3;
+  }
+  else if (!strcmp (mc->charset,"UTF-7")) while (s < end)
+    s += strlen (strcpy ((char *) s,(mbench_random () % 3) ? "plain text " :
+			  "+AOkA6ADqAOs- "));
+  else if (!strcmp (mc->charset,"UTF-16")) {
+    *s++ = 0xfe; *s++ = 0xff;	/* big-endian BOM */
+    while (s < end) {
+      c = (mbench_random () % 3) ? 0x20 + mbench_random () % 0x5f :
+	0x4e00 + mbench_random () % 0x5000;
+      *s++ = (unsigned char) (c >> 8);
+      *s++ = (unsigned char) c;
+    }
+  }
+				/* two thirds ASCII, rest non-ASCII */
+  else while (s < end) if (mbench_random () % 3)
+    *s++ = (unsigned char) (0x20 + mbench_random () % 0x5f);
+  else switch (mc->charset[0]) {
+  case 'I': case 'K': case 'W':	/* single-octet */
+    *s++ = (unsigned char) (0xc0 + mbench_random () % 0x40);
+    break;
+  case 'U':			/* three-octet UTF-8 CJK */
+    c = 0x4e00 + mbench_random () % 0x5000;
+    *s++ = (unsigned char) (0xe0 | (c >> 12));
+    *s++ = (unsigned char) (0x80 | ((c >> 6) & 0x3f));
+    *s++ = (unsigned char) (0x80 | (c & 0x3f));
+    break;
+  case 'S':			/* Shift-JIS kanji */
+    *s++ = (unsigned char) (0x89 + mbench_random () % 0x16);
+    *s++ = (unsigned char) (0x40 + mbench_random () % 0x3f);
+    break;
+  case 'B':			/* Big5 hanzi */
+    *s++ = (unsigned char) (0xa4 + mbench_random () % 0x22);
+    *s++ = (unsigned char) (0x40 + mbench_random () % 0x3f);
+    break;
+  default:			/* EUC */
+    *s++ = (unsigned char) (0xb0 + mbench_random () % 0x18);
+    *s++ = (unsigned char) (0xa1 + mbench_random () % 0x5e);
+    break;
+  }
+  mc->bytes = mc->text.size = s - mc->text.data;
+}
+
+/* Benchmarks
+ * Accepts: benchmark
+ *	    number of iterations
+ */
+
+void mbench_parsemsg (MBENCH *mc,unsigned long n)
+{
+  ENVELOPE *env;
+  BODY *body;
+  STRING bs;
+  unsigned long i = (unsigned long) mc->data;
+  while (n--) {
+    INIT (&bs,mail_string,mc->text.data + i,mc->text.size - i);
+    rfc822_parse_msg (&env,&body,(char *) mc->text.data,i,&bs,BADHOST,NIL);
+    sink += (unsigned long) body->nested.part;
+    mail_free_envelope (&env);
+    mail_free_body (&body);
+  }
+}
+
+
+void mbench_adrlist (MBENCH *mc,unsigned long n)
+{
+  ADDRESS *adr;
+  char *s;
+  while (n--) {
+    adr = NIL;			/* parser writes into its argument */
+    rfc822_parse_adrlist (&adr,s = cpystr ((char *) mc->text.data),BADHOST);
+    sink += (unsigned long) adr;
+    mail_free_address (&adr);
+    fs_give ((void **) &s);
+  }
+}
+
+
+void mbench_base64 (MBENCH *mc,unsigned long n)
+{
+  unsigned long len;
+  void *s;
+  while (n--) {
+    s = rfc822_base64 (mc->text.data,mc->text.size,&len);
+    sink += len;
+    fs_give (&s);
+  }
+}
+
+
+void mbench_qprint (MBENCH *mc,unsigned long n)
+{
+  unsigned long len;
+  unsigned char *s;
+  while (n--) {
+    s = rfc822_qprint (mc->text.data,mc->text.size,&len);
+    sink += len;
+    fs_give ((void **) &s);
+  }
+}
+
+
+void mbench_text (MBENCH *mc,unsigned long n)
+{
+  SIZEDTEXT ret;
+  while (n--) {
+    utf8_text (&mc->text,mc->charset,&ret,U8T_CANONICAL);
+    sink += ret.size;
+    if (ret.data != mc->text.data) fs_give ((void **) &ret.data);
+  }
+}
+
+
+void mbench_mime2text (MBENCH *mc,unsigned long n)
+{
+  SIZEDTEXT ret;
+  while (n--) {
+    utf8_mime2text (&mc->text,&ret,U8T_CANONICAL);
+    sink += ret.size;
+    if (ret.data != mc->text.data) fs_give ((void **) &ret.data);
+  }
+}
+
+void mbench_ssearch (MBENCH *mc,unsigned long n)
+{
+  unsigned char *pat = (unsigned char *) mc->data;
+  long patc = strlen ((char *) pat);
+  while (n--) sink += ssearch (mc->text.data,mc->text.size,pat,patc);
+}
+
+
+void mbench_msearch (MBENCH *mc,unsigned long n)
+{
+  unsigned char found[3];
+  while (n--) {
+    memset (found,0,3);
+    sink += msearch (mc->text.data,mc->text.size,(STRINGLIST *) mc->data,
+		     found);
+  }
+}
+
+
+void mbench_date (MBENCH *mc,unsigned long n)
+{
+  MESSAGECACHE elt;
+  unsigned long i;
+  for (i = 0; n--; i = dates[i + 1] ? i + 1 : 0) {
+    memset (&elt,0,sizeof (MESSAGECACHE));
+    sink += mail_parse_date (&elt,(unsigned char *) dates[i]) + elt.day;
+  }
+}
+
+
+void mbench_sort (MBENCH *mc,unsigned long n)
+{
+  SORTCACHE **sc = (SORTCACHE **) mc->data;
+  size_t i = mc->text.size;
+  while (n--) {			/* sort a fresh copy each time */
+    memcpy (sc + i,sc,i * sizeof (SORTCACHE *));
+    qsort ((void *) (sc + i),i,sizeof (SORTCACHE *),mail_sort_compare);
+    sink += sc[i]->num;
+  }
+}
+
+
+void mbench_sortvec (MBENCH *mc,unsigned long n)
+{
+  SORTCACHE **sc = (SORTCACHE **) mc->data;
+  size_t i = mc->text.size;
+  while (n--) {			/* sort a fresh copy each time */
+    memcpy (sc + i,sc,i * sizeof (SORTCACHE *));
+    mail_sort_vector (sc[0]->pgm,sc + i);
+    sink += sc[i]->num;
+  }
+}
+
+
+void mbench_strip (MBENCH *mc,unsigned long n)
+{
+  char *s;
+  unsigned long i;
+  for (i = 0; n--; i = subjects[i + 1] ? i + 1 : 0) {
+    sink += mail_strip_subject (subjects[i],&s);
+    fs_give ((void **) &s);
+  }
+}
+
+/* Co-routines from MAIL library */
+
+void mm_searched (MAILSTREAM *stream,unsigned long number)
+{
+}
+
+
+void mm_exists (MAILSTREAM *stream,unsigned long number)
+{
+}
+
+
+void mm_expunged (MAILSTREAM *stream,unsigned long number)
+{
+}
+
+
+void mm_flags (MAILSTREAM *stream,unsigned long number)
+{
+}
+
+
+void mm_notify (MAILSTREAM *stream,char *string,long errflg)
+{
+}
+
+
+void mm_list (MAILSTREAM *stream,int delimiter,char *mailbox,long attributes)
+{
+}
+
+
+void mm_lsub (MAILSTREAM *stream,int delimiter,char *mailbox,long attributes)
+{
+}
+
+
+void mm_status (MAILSTREAM *stream,char *mailbox,MAILSTATUS *status)
+{
+}
+
+
+void mm_log (char *string,long errflg)
+{
+  if (errflg == ERROR) fprintf (stderr,"?%s\n",string);
+}
+
+
+void mm_dlog (char *string)
+{
+}
+
+
+void mm_login (NETMBX *mb,char *user,char *pwd,long trial)
+{
+  *user = *pwd = '\0';
+}
+
+
+void mm_critical (MAILSTREAM *stream)
+{
+}
+
+
+void mm_nocritical (MAILSTREAM *stream)
+{
+}
+
+
+long mm_diskerror (MAILSTREAM *stream,long errcode,long serious)
+{
+  return NIL;
+}
+
+
+void mm_fatal (char *string)
+{
+  fprintf (stderr,"?%s\n",string);
+}
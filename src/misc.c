@@ -275,6 +275,99 @@ long ssearch (unsigned char *base,long basec,unsigned char *pat,long patc)
   return NIL;			/* pattern not found */
 }
 
+/* Multiple pattern string search
+ * Accepts: base string
+ *	    length of base string
+ *	    list of pattern strings
+ *	    found flags, one per pattern, set for each pattern found
+ * Returns: T if all patterns have been found, else NIL
+ *
+ * All patterns are looked for in one pass over the base string.  When the
+ * patterns all start with the same octet, memchr() is used to skip to it,
+ * since the C library does that a word or vector at a time.  Otherwise this
+ * is a Horspool search for the set of patterns: a window as long as the
+ * shortest pattern is moved along the base, and is shifted by the distance
+ * from the last occurrence of its final octet in any pattern's window to the
+ * end of the window.  Patterns already flagged as found are not looked for.
+ *
+ * This is portable C only, with no SSE2/AVX2 code or run-time CPU dispatch;
+ * any vectorized scanning comes from the C library's memchr().
+ */
+
+long msearch (unsigned char *base,long basec,STRINGLIST *st,
+	      unsigned char *found)
+{
+  long i,j,m,n,pos;
+  int c;
+  long head[256];
+  unsigned char shift[256];
+  long tmp[MSEARCHPATS];
+  long *next = tmp;
+  STRINGLIST *tmpp[MSEARCHPATS];
+  STRINGLIST **pat = tmpp;
+  STRINGLIST *stl;
+  unsigned char *s,*end;
+  for (n = 0, stl = st; stl; stl = stl->next) ++n;
+  if (n > MSEARCHPATS) {	/* too many for stack? */
+    next = (long *) fs_get (n * sizeof (long));
+    pat = (STRINGLIST **) fs_get (n * sizeof (STRINGLIST *));
+  }
+  for (i = 0, stl = st; stl; stl = stl->next) pat[i++] = stl;
+				/* validate arguments */
+  if (base && (basec > 0)) {
+				/* list patterns still to be found */
+    for (i = n - 1, j = -1, n = 0, m = 255, c = -1; i >= 0; --i)
+      if (!found[i]) {		/* empty pattern always succeeds */
+	if (!pat[i]->text.size) found[i] = T;
+	else if (pat[i]->text.size <= (unsigned long) basec) {
+	  next[i] = j;
+	  j = i;
+	  m = min (m,pat[i]->text.size);
+				/* note if all have the same first octet */
+	  c = (!n++ || (c == pat[i]->text.data[0])) ?
+	    pat[i]->text.data[0] : -2;
+	}
+      }
+    if (c >= 0) {		/* skip to the common first octet */
+      for (s = base, end = base + basec;
+	   n && (s = (unsigned char *) memchr (s,c,end - s)); ++s)
+	for (i = j; i >= 0; i = next[i])
+	  if (!found[i] && (pat[i]->text.size <= (unsigned long) (end - s)) &&
+	      !memcmp (s,pat[i]->text.data,pat[i]->text.size)) {
+	    found[i] = T;	/* found a match! */
+	    --n;
+	  }
+    }
+    else if (n) {		/* set up Horspool shifts and chains */
+      memset (shift,(int) m,256);
+      memset (head,0xff,sizeof (head));
+      for (i = j; i >= 0; i = j) {
+	j = next[i];		/* chain by last octet of window */
+	next[i] = head[pat[i]->text.data[m - 1]];
+	head[pat[i]->text.data[m - 1]] = i;
+	for (c = 0; c < m - 1; ++c)
+	  shift[pat[i]->text.data[c]] =
+	    min (shift[pat[i]->text.data[c]],m - 1 - c);
+      }
+      for (pos = m - 1; n && (pos < basec); pos += shift[base[pos]])
+	for (i = head[base[pos]]; i >= 0; i = next[i])
+	  if (!found[i] && (pat[i]->text.size <=
+			    (unsigned long) (basec - (pos - (m - 1)))) &&
+	      !memcmp (base + pos - (m - 1),pat[i]->text.data,
+		       pat[i]->text.size)) {
+	    found[i] = T;	/* found a match! */
+	    --n;
+	  }
+    }
+  }
+  if (next != tmp) {		/* free any allocated lists */
+    fs_give ((void **) &next);
+    fs_give ((void **) &pat);
+  }
+  for (i = 0, stl = st; stl; stl = stl->next,++i) if (!found[i]) return NIL;
+  return T;
+}
+
 /* Create a hash table
  * Accepts: size of new table (note: should be a prime)
  * Returns: hash table
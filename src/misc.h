@@ -37,6 +37,7 @@
 #include "mail.h"
 
 #define HASHMULT 29		/* hash polynomial multiplier */
+#define MSEARCHPATS 16		/* msearch() patterns handled on stack */
 
 #define HASHENT struct hash_entry
 
@@ -74,6 +75,8 @@ long min (long i,long j);
 long max (long i,long j);
 long search (unsigned char *base,long basec,unsigned char *pat,long patc);
 long ssearch (unsigned char *base,long basec,unsigned char *pat,long patc);
+long msearch (unsigned char *base,long basec,STRINGLIST *st,
+	      unsigned char *found);
 HASHTAB *hash_create (size_t size);
 void hash_destroy (HASHTAB **hashtab);
 void hash_reset (HASHTAB *hashtab);
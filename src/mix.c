@@ -59,6 +59,10 @@
 #define MIXINDEX "index"	/* suffix for index */
 #define MIXSTATUS "status"	/* suffix for status */
 #define MIXSORTCACHE "sortcache"/* suffix for sortcache */
+#define MIXSTRUCTCACHE "structcache"
+#define MIXTEXTINDEX "textindex"
+#define MIXHEADERINDEX "headerindex"
+#define MIXVANISHED "vanished"
 #define METAMAX (MEGABYTE-1)	/* maximum metadata file size (sanity check) */
 
 
@@ -77,7 +81,12 @@
 #define MSGTOK ":msg:"
 #define MSGTSZ (sizeof(MSGTOK)-1)
 				/* sortcache file record format */
-#define SCRFMT ":%08lx:%08lx:%08lx:%08lx:%08lx:%c%08lx:%08lx:%08lx:\015\012"
+#define SCRFMT ":%08lx:%08lx:%08lx:%08lx:%08lx:%c%08lx:%08lx:%08lx:"
+				/* sortcache decoded size expansion value */
+#define SCBFMT "B%s=%08lx:"
+				/* vanished file record format */
+#define VNRFMT ":%08lx:%08lx:%08lx:\015\012"
+#define VNMAXFILE 0x4000	/* vanished file size at which to restart */
 
 /* MIX I/O stream local data */
 	
@@ -87,6 +96,7 @@ typedef struct mix_local {
   time_t lastsnarf;		/* last snarf time */
   int msgfd;			/* file description of current msg file */
   int mfd;			/* file descriptor of open metadata */
+  int wfd;			/* change notification descriptor */
   unsigned long metaseq;	/* metadata sequence */
   char *index;			/* mailbox index name */
   unsigned long indexseq;	/* index sequence */
@@ -94,9 +104,14 @@ typedef struct mix_local {
   unsigned long statusseq;	/* status sequence */
   char *sortcache;		/* mailbox sortcache name */
   unsigned long sortcacheseq;	/* sortcache sequence */
+  char *structcache;		/* mailbox structure cache name */
+  char *textindex;		/* mailbox text index name */
+  char *headerindex;		/* mailbox header index name */
+  char *vanished;		/* mailbox expunged UID history name */
   unsigned char *buf;		/* temporary buffer */
   unsigned long buflen;		/* current size of temporary buffer */
   unsigned int expok : 1;	/* non-zero if expunge reports OK */
+  unsigned int sortdirty : 1;	/* sortcache has entries to save */
   unsigned int internal : 1;	/* internally opened, do not validate */
 } MIXLOCAL;
 
@@ -121,6 +136,7 @@ MIXBURP {
 DRIVER *mix_valid (char *name);
 long mix_isvalid (char *name,char *meta);
 void *mix_parameters (long function,void *value);
+long mix_searchworker (MAILSTREAM *stream);
 long mix_dirfmttest (const char *name);
 void mix_scan (MAILSTREAM *stream,char *ref,char *pat,char *contents);
 long mix_scan_contents (char *name,char *contents,unsigned long csiz,
@@ -132,6 +148,7 @@ long mix_unsubscribe (MAILSTREAM *stream,char *mailbox);
 long mix_create (MAILSTREAM *stream,char *mailbox);
 long mix_delete (MAILSTREAM *stream,char *mailbox);
 long mix_rename (MAILSTREAM *stream,char *old,char *newname);
+long mix_status (MAILSTREAM *stream,char *mbx,long flags);
 int mix_rselect (const struct direct *name);
 MAILSTREAM *mix_open (MAILSTREAM *stream);
 void mix_close (MAILSTREAM *stream,long options);
@@ -145,6 +162,9 @@ unsigned long *mix_sort (MAILSTREAM *stream,char *charset,SEARCHPGM *spg,
 THREADNODE *mix_thread (MAILSTREAM *stream,char *type,char *charset,
 			SEARCHPGM *spg,long flags);
 long mix_ping (MAILSTREAM *stream);
+int mix_watch (MAILSTREAM *stream);
+unsigned long mix_highestmodseq (MAILSTREAM *stream);
+void mix_gc (MAILSTREAM *stream,long gcflags);
 void mix_check (MAILSTREAM *stream);
 long mix_expunge (MAILSTREAM *stream,char *sequence,long options);
 int mix_select (const struct direct *name);
@@ -167,6 +187,9 @@ FILE *mix_data_open (MAILSTREAM *stream,int *fd,long *size,
 		     unsigned long newsize);
 FILE *mix_sortcache_open (MAILSTREAM *stream);
 long mix_sortcache_update (MAILSTREAM *stream,FILE **sortcache);
+long mix_vanished (MAILSTREAM *stream,unsigned long modseq,SEARCHSET **set);
+void mix_vanished_update (MAILSTREAM *stream,SEARCHSET *set,
+			  unsigned long oldseq);
 char *mix_read_record (FILE *f,char *buf,unsigned long buflen,char *type);
 unsigned long mix_read_sequence (FILE *f);
 char *mix_dir (char *dst,char *name);
@@ -194,7 +217,7 @@ DRIVER mixdriver = {
   mix_create,			/* create mailbox */
   mix_delete,			/* delete mailbox */
   mix_rename,			/* rename mailbox */
-  mail_status_default,		/* status of mailbox */
+  mix_status,			/* status of mailbox */
   mix_open,			/* open mailbox */
   mix_close,			/* close mailbox */
   NIL,				/* fetch message "fast" attributes */
@@ -212,11 +235,14 @@ DRIVER mixdriver = {
   mix_sort,			/* sort messages */
   mix_thread,			/* thread messages */
   mix_ping,			/* ping mailbox to see if still alive */
+  mix_watch,			/* watch mailbox for changes */
+  mix_highestmodseq,		/* highest modseq */
   mix_check,			/* check for new messages */
   mix_expunge,			/* expunge deleted messages */
   mix_copy,			/* copy messages to another mailbox */
+  NIL,				/* move messages to another mailbox */
   mix_append,			/* append string message to mailbox */
-  NIL				/* garbage collect stream */
+  mix_gc			/* garbage collect stream */
 };
 
 				/* prototype stream */
@@ -264,6 +290,7 @@ long mix_isvalid (char *name,char *meta)
 
 void *mix_parameters (long function,void *value)
 {
+  FILE *f;
   void *ret = NIL;
   switch ((int) function) {
   case GET_INBOXPATH:
@@ -275,6 +302,35 @@ void *mix_parameters (long function,void *value)
   case GET_SCANCONTENTS:
     ret = (void *) mix_scan_contents;
     break;
+  case GET_SEARCHWORKER:
+    ret = (void *) mix_searchworker;
+    break;
+  case GET_VANISHED:
+    ret = (void *) mix_vanished;
+    break;
+  case GET_SORTCACHE:		/* load persistent sortcache */
+    if (value && ((MAILSTREAM *) value)->local &&
+	(f = mix_sortcache_open ((MAILSTREAM *) value))) {
+      fclose (f);		/* only wanted the reading */
+      ret = VOIDT;
+    }
+    break;
+  case GET_STRUCTCACHEFILE:	/* structure cache name */
+    if (value && ((MAILSTREAM *) value)->local)
+      ret = (void *) ((MIXLOCAL *) ((MAILSTREAM *) value)->local)->structcache;
+    break;
+  case GET_TEXTINDEXFILE:	/* text index name */
+    if (value && ((MAILSTREAM *) value)->local)
+      ret = (void *) ((MIXLOCAL *) ((MAILSTREAM *) value)->local)->textindex;
+    break;
+  case GET_HEADERINDEXFILE:	/* header index name */
+    if (value && ((MAILSTREAM *) value)->local)
+      ret = (void *) ((MIXLOCAL *) ((MAILSTREAM *) value)->local)->headerindex;
+    break;
+  case SET_SORTCACHE:		/* sortcache has entries to save */
+    if (value && ((MAILSTREAM *) value)->local)
+      ((MIXLOCAL *) ((MAILSTREAM *) value)->local)->sortdirty = T;
+    break;
   case SET_ONETIMEEXPUNGEATPING:
     if (value) ((MIXLOCAL *) ((MAILSTREAM *) value)->local)->expok = T;
   case GET_ONETIMEEXPUNGEATPING:
@@ -296,6 +352,20 @@ long mix_dirfmttest (const char *name)
 				/* belongs to MIX if starts with .mix */
   return strncmp (name,MIXNAME,sizeof (MIXNAME) - 1) ? NIL : LONGT;
 }
+
+
+/* MIX prepare stream for search worker process
+ * Accepts: MAIL stream
+ * Returns: T, always
+ */
+
+long mix_searchworker (MAILSTREAM *stream)
+{
+				/* don't share message file offset */
+  if (LOCAL->msgfd >= 0) close (LOCAL->msgfd);
+  LOCAL->msgfd = -1;		/* reopened on next fetch */
+  return LONGT;
+}
 
 /* MIX mail scan mailboxes
  * Accepts: mail stream
@@ -598,6 +668,115 @@ int mix_rselect (const struct direct *name)
   return mix_dirfmttest (name->d_name);
 }
 
+/* MIX mail status
+ * Accepts: mail stream
+ *	    mailbox name
+ *	    status flags
+ * Returns: T on success, NIL on failure
+ *
+ * Reads the metadata, index, and status files directly instead of opening
+ * a stream, since clients tend to poll STATUS on every mailbox.  Falls back
+ * to the default handler, which reports any errors, if anything is amiss.
+ */
+
+long mix_status (MAILSTREAM *stream,char *mbx,long flags)
+{
+  MAILSTATUS status;
+  int fd;
+  unsigned long j,uid,sf;
+  char *s,dir[MAILTMPLEN],tmp[MAILTMPLEN];
+  char *buf = NIL;
+  unsigned long *uids = NIL;
+  unsigned long nuids = 0;
+  unsigned long uidsize = 0;
+  FILE *idxf = NIL;
+  FILE *f = NIL;
+  long ret = NIL;
+				/* use open stream if one given */
+  if (stream) return mail_status_default (stream,mbx,flags);
+  memset (&status,0,sizeof (MAILSTATUS));
+  status.flags = flags;
+  mix_dir (dir,mbx);
+				/* index lock keeps files consistent */
+  if (((fd = open (mix_file (tmp,dir,MIXINDEX),O_RDONLY,NIL)) >= 0) &&
+      (flock (fd,LOCK_SH) || !(idxf = fdopen (fd,"rb")))) close (fd);
+  else if (idxf && (f = fopen (mix_file (tmp,dir,MIXMETA),"rb"))) {
+    buf = (char *) fs_get (CHUNKSIZE);
+				/* metadata sequence, then records */
+    if ((s = mix_read_record (f,buf,CHUNKSIZE,"metadata")) && (*s == 'S'))
+      for (ret = LONGT;
+	   ret && (s = mix_read_record (f,buf,CHUNKSIZE,"metadata")) && *s;)
+	switch (*s++) {
+	case 'V':		/* UIDVALIDITY */
+	  if (!(status.uidvalidity = strtoul (s,NIL,16))) ret = NIL;
+	  break;
+	case 'L':		/* UIDLAST */
+	  status.uidnext = strtoul (s,NIL,16) + 1;
+	  break;
+	}
+    fclose (f);
+    f = NIL;
+				/* index sequence, then message records */
+    if (ret && !mix_read_sequence (idxf)) ret = NIL;
+    if (ret) while ((s = mix_read_record (idxf,buf,CHUNKSIZE,"index")) && *s) {
+      if ((*s != ':') || !isxdigit (s[1]) || !(uid = strtoul (s+1,NIL,16))) {
+	ret = NIL;		/* bogus index record */
+	break;
+      }
+      if (nuids >= uidsize) {	/* grow list of UIDs if needed */
+	if (uids) fs_resize ((void **) &uids,
+			     (uidsize += 1024) * sizeof (unsigned long));
+	else uids = (unsigned long *)
+	       fs_get ((uidsize = 1024) * sizeof (unsigned long));
+      }
+      uids[nuids++] = uid;
+      if (uid >= status.uidnext) status.uidnext = uid + 1;
+    }
+    if (ret && !s) ret = NIL;	/* barfage from mix_read_record() */
+    if (ret && (((fd = open (mix_file (tmp,dir,MIXSTATUS),O_RDONLY,NIL)) < 0) ||
+		((flock (fd,LOCK_SH) || !(f = fdopen (fd,"rb"))) &&
+		 (close (fd),T))))
+      ret = NIL;		/* can't get status file */
+				/* status sequence is highest modseq */
+    else if (ret && !(status.highestmodseq = mix_read_sequence (f))) ret = NIL;
+				/* messages without status are recent */
+    else if (ret) for (j = 0; j < nuids;) {
+      if ((s = mix_read_record (f,buf,CHUNKSIZE,"status")) && *s) {
+	if ((*s != ':') || !isxdigit (s[1]) ||
+	    ((uid = strtoul (s+1,&s,16)), (*s++ != ':')) || !isxdigit (*s) ||
+	    (strtoul (s,&s,16), (*s++ != ':')) || !isxdigit (*s)) {
+	  ret = NIL;		/* bogus status record */
+	  break;
+	}
+	sf = strtoul (s,NIL,16);
+      }
+      else if (s) uid = 0;	/* no more status records */
+      else {			/* barfage from mix_read_record() */
+	ret = NIL;
+	break;
+      }
+				/* count messages with no status record */
+      for (; (j < nuids) && (!uid || (uids[j] < uid)); j++) {
+	status.recent++;
+	status.unseen++;
+      }
+      if ((j < nuids) && (uids[j] == uid)) {
+	if (!(sf & fOLD)) status.recent++;
+	if (!(sf & fSEEN)) status.unseen++;
+	j++;
+      }
+    }
+    status.messages = nuids;
+  }
+  if (f) fclose (f);		/* done with status file */
+  if (idxf) fclose (idxf);	/* releases index lock too */
+  if (buf) fs_give ((void **) &buf);
+  if (uids) fs_give ((void **) &uids);
+  if (!ret) return mail_status_default (NIL,mbx,flags);
+  MM_STATUS (NIL,mbx,&status);	/* pass status to main program */
+  return LONGT;
+}
+
 /* MIX mail open
  * Accepts: stream to open
  * Returns: stream on success, NIL on failure
@@ -620,6 +799,7 @@ MAILSTREAM *mix_open (MAILSTREAM *stream)
   fs_give ((void **) &stream->mailbox);
   stream->mailbox = cpystr (LOCAL->buf);
   LOCAL->msgfd = -1;		/* currently no file open */
+  LOCAL->wfd = -1;		/* not watching for changes yet */
   if (!(((!stream->rdonly &&	/* open metadata file */
 	  ((LOCAL->mfd = open (mix_file (LOCAL->buf,stream->mailbox,MIXMETA),
 			       O_RDWR,NIL)) >= 0)) ||
@@ -636,6 +816,14 @@ MAILSTREAM *mix_open (MAILSTREAM *stream)
     LOCAL->status = cpystr (mix_file (LOCAL->buf,stream->mailbox,MIXSTATUS));
     LOCAL->sortcache = cpystr (mix_file (LOCAL->buf,stream->mailbox,
 					 MIXSORTCACHE));
+    LOCAL->structcache = cpystr (mix_file (LOCAL->buf,stream->mailbox,
+					   MIXSTRUCTCACHE));
+    LOCAL->textindex = cpystr (mix_file (LOCAL->buf,stream->mailbox,
+					 MIXTEXTINDEX));
+    LOCAL->headerindex = cpystr (mix_file (LOCAL->buf,stream->mailbox,
+					   MIXHEADERINDEX));
+    LOCAL->vanished = cpystr (mix_file (LOCAL->buf,stream->mailbox,
+					MIXVANISHED));
     stream->sequence++;		/* bump sequence number */
 				/* parse mailbox */
     stream->nmsgs = stream->recent = 0;
@@ -672,6 +860,10 @@ void mix_close (MAILSTREAM *stream,long options)
   if (LOCAL) {			/* only if a file is open */
     int silent = stream->silent;
     stream->silent = T;		/* note this stream is dying */
+    if (LOCAL->sortdirty) {	/* save sortcache additions */
+      FILE *sortcache = mix_sortcache_open (stream);
+      mix_sortcache_update (stream,&sortcache);
+    }
 				/* burp-only or expunge */
     mix_expunge (stream,(options & CL_EXPUNGE) ? NIL : "",NIL);
     mix_abort (stream);
@@ -691,9 +883,15 @@ void mix_abort (MAILSTREAM *stream)
     if (LOCAL->msgfd >= 0) close (LOCAL->msgfd);
 				/* close current metadata file if open */
     if (LOCAL->mfd >= 0) close (LOCAL->mfd);
+				/* close change notification if open */
+    if (LOCAL->wfd >= 0) close (LOCAL->wfd);
     if (LOCAL->index) fs_give ((void **) &LOCAL->index);
     if (LOCAL->status) fs_give ((void **) &LOCAL->status);
     if (LOCAL->sortcache) fs_give ((void **) &LOCAL->sortcache);
+    if (LOCAL->structcache) fs_give ((void **) &LOCAL->structcache);
+    if (LOCAL->textindex) fs_give ((void **) &LOCAL->textindex);
+    if (LOCAL->headerindex) fs_give ((void **) &LOCAL->headerindex);
+    if (LOCAL->vanished) fs_give ((void **) &LOCAL->vanished);
 				/* free local scratch buffer */
     if (LOCAL->buf) fs_give ((void **) &LOCAL->buf);
 				/* nuke the local data */
@@ -826,6 +1024,7 @@ long mix_text (MAILSTREAM *stream,unsigned long msgno,STRING *bs,long flags)
 void mix_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 {
   MESSAGECACHE *elt;
+  SEARCHSET *set,*s;
   unsigned long i,uf,ffkey;
   long f;
   short nf;
@@ -835,12 +1034,11 @@ void mix_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 				/* find first free key */
   for (ffkey = 0; (ffkey < NUSERFLAGS) && stream->user_flags[ffkey]; ++ffkey);
 				/* parse sequence and flags */
-  if (((flags & ST_UID) ? mail_uid_sequence (stream,sequence) :
-       mail_sequence (stream,sequence)) &&
+  if (mail_sequence_set (stream,sequence,flags & ST_UID,&set) &&
       ((f = mail_parse_flags (stream,flag,&uf)) || uf)) {
 				/* alter flags */
-    for (i = 1,nf = (flags & ST_SET) ? T : NIL; i <= stream->nmsgs; i++)
-      if ((elt = mail_elt (stream,i))->sequence) {
+    for (s = set,i = 0,nf = (flags & ST_SET) ? T : NIL;
+	 i = mail_next_set (&s,i);) {
 	struct {		/* old flags */
 	  unsigned int seen : 1;
 	  unsigned int deleted : 1;
@@ -849,6 +1047,7 @@ void mix_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 	  unsigned int draft : 1;
 	  unsigned long user_flags;
 	} old;
+	elt = mail_elt (stream,i);
 	old.seen = elt->seen; old.deleted = elt->deleted;
 	old.flagged = elt->flagged; old.answered = elt->answered;
 	old.draft = elt->draft; old.user_flags = elt->user_flags;
@@ -876,6 +1075,7 @@ void mix_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags)
 	!mix_meta_update (stream))
       MM_LOG ("Error updating mix metadata after keyword creation",ERROR);
   }
+  mail_free_searchset (&set);
   if (statf) fclose (statf);	/* release status file if still open */
   if (idxf) fclose (idxf);	/* release index file */
 }
@@ -1005,6 +1205,53 @@ long mix_ping (MAILSTREAM *stream)
 }
 
 
+/* MIX mail watch mailbox for changes
+ * Accepts: MAIL stream
+ * Returns: descriptor readable on change, or -1 if can't watch
+ */
+
+int mix_watch (MAILSTREAM *stream)
+{
+  char *files[5];
+  int i = 0;
+  files[i++] = mix_file (LOCAL->buf,stream->mailbox,MIXMETA);
+  files[i++] = LOCAL->index;
+  files[i++] = LOCAL->status;
+				/* INBOX also depends upon system INBOX */
+  if (stream->inbox && !stream->rdonly) files[i++] = sysinbox ();
+  files[i] = NIL;
+				/* snarf promptly if anything changed */
+  if (notify_watch (&LOCAL->wfd,files,NIL)) LOCAL->lastsnarf = 0;
+  return LOCAL->wfd;
+}
+
+
+/* MIX mail get highest modseq
+ * Accepts: MAIL stream
+ * Returns: highest modseq in mailbox
+ */
+
+unsigned long mix_highestmodseq (MAILSTREAM *stream)
+{
+  return LOCAL->statusseq;
+}
+
+
+/* MIX mail garbage collect stream
+ * Accepts: MAIL stream
+ *	    garbage collection flags
+ */
+
+void mix_gc (MAILSTREAM *stream,long gcflags)
+{
+				/* shrink grown buffer back to initial size */
+  if (LOCAL && (gcflags & GC_TEXTS) && (LOCAL->buflen > CHUNKSIZE - 1)) {
+    fs_give ((void **) &LOCAL->buf);
+    LOCAL->buf = (char *) fs_get (CHUNKSIZE);
+    LOCAL->buflen = CHUNKSIZE - 1;
+  }
+}
+
 /* MIX mail checkpoint mailbox (burp only)
  * Accepts: MAIL stream
  */
@@ -1013,6 +1260,10 @@ void mix_check (MAILSTREAM *stream)
 {
   if (stream->rdonly)		/* won't do on readonly files! */
     MM_LOG ("Checkpoint ignored on readonly mailbox",NIL);
+  else if (LOCAL->sortdirty) {	/* save sortcache additions */
+    FILE *sortcache = mix_sortcache_open (stream);
+    mix_sortcache_update (stream,&sortcache);
+  }
 				/* do burp-only expunge action */
   if (mix_expunge (stream,"",NIL)) MM_LOG ("Check completed",(long) NIL);
 }
@@ -1035,6 +1286,7 @@ long mix_expunge (MAILSTREAM *stream,char *sequence,long options)
   unsigned long nexp = 0;
   unsigned long reclaimed = 0;
   int burponly = (sequence && !*sequence);
+  SEARCHSET *vanished = NIL,*tail = NIL;
   LOCAL->expok = T;		/* expunge during ping is OK */
   if (!(ret = burponly || !sequence ||
 	((options & EX_UID) ?
@@ -1048,6 +1300,8 @@ long mix_expunge (MAILSTREAM *stream,char *sequence,long options)
       elt = mail_elt (stream,i);/* need to expunge this message? */
       if (elt->deleted && (sequence ? elt->sequence : T)) {
 	++nexp;			/* yes, make it so */
+	if (!tail) tail = vanished = mail_newsearchset ();
+	tail = mail_append_set (tail,elt->private.uid);
 	mail_expunged (stream,i);
       }
       else ++i;		       /* otherwise advance to next message */
@@ -1129,12 +1383,15 @@ long mix_expunge (MAILSTREAM *stream,char *sequence,long options)
     if (nexp || reclaimed) {	/* rewrite index and status if changed */
       LOCAL->indexseq = mix_modseq (LOCAL->indexseq);
       if (ret = mix_index_update (stream,idxf,NIL)) {
+	i = LOCAL->statusseq;	/* remember modseq before expunge */
 	LOCAL->statusseq = mix_modseq (LOCAL->statusseq);
 				/* set failure if update fails */
-	ret = mix_status_update (stream,statf,NIL);
+	if ((ret = mix_status_update (stream,statf,NIL)) && vanished)
+	  mix_vanished_update (stream,vanished,i);
       }
     }
   }
+  if (vanished) mail_free_searchset (&vanished);
   if (statf) fclose (statf);	/* close status if still open */
   if (idxf) fclose (idxf);	/* close index if still open */
   LOCAL->expok = NIL;		/* cancel expok */
@@ -1371,6 +1628,8 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   mailproxycopy_t pc =
     (mailproxycopy_t) mail_parameters (stream,GET_MAILPROXYCOPY,NIL);
   MAILSTREAM *astream = NIL;
+  SEARCHSET *set = NIL;
+  SEARCHSET *s;
   FILE *idxf = NIL;
   FILE *msgf = NIL;
   FILE *statf = NIL;
@@ -1385,8 +1644,7 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
     break;
   }
 				/* get sequence to copy */
-  else if (!(ret = ((options & CP_UID) ? mail_uid_sequence (stream,sequence) :
-		    mail_sequence (stream,sequence))));
+  else if (!(ret = mail_sequence_set (stream,sequence,options & CP_UID,&set)));
 				/* acquire stream to append */
   else if (ret = ((astream = mail_open (NIL,mailbox,OP_SILENT)) &&
 		  !astream->rdonly &&
@@ -1410,9 +1668,8 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
     MM_CRITICAL (stream);	/* go critical */
     astream->silent = T;	/* no events here */
 				/* calculate size that will be added */
-    for (i = 1, newsize = 0; i <= stream->nmsgs; ++i)
-      if ((elt = mail_elt (stream,i))->sequence)
-	newsize += hdrsize + elt->rfc822_size;
+    for (s = set, i = 0, newsize = 0; i = mail_next_set (&s,i);)
+      newsize += hdrsize + mail_elt (stream,i)->rfc822_size;
 				/* open data file */
     if (msgf = mix_data_open (astream,&fd,&size,newsize)) {
       char *t;
@@ -1420,8 +1677,8 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
       copyuid_t cu = (copyuid_t) mail_parameters (NIL,GET_COPYUID,NIL);
       SEARCHSET *source = cu ? mail_newsearchset () : NIL;
       SEARCHSET *dest = cu ? mail_newsearchset () : NIL;
-      for (i = 1,uid = uidv = 0; ret && (i <= stream->nmsgs); ++i) 
-	if (((elt = mail_elt (stream,i))->sequence) && elt->rfc822_size) {
+      for (s = set,i = 0,uid = uidv = 0; ret && (i = mail_next_set (&s,i));)
+	if ((elt = mail_elt (stream,i))->rfc822_size) {
 				/* is message in current message file? */
 	  if ((LOCAL->msgfd < 0) ||
 	      (elt->private.spare.data != LOCAL->curmsg)) {
@@ -1470,12 +1727,11 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
 		   mix_index_update (astream,idxf,LONGT))) {
 				/* success, delete if doing a move */
 	  if (options & CP_MOVE)
-	    for (i = 1; i <= stream->nmsgs; i++)
-	      if ((elt = mail_elt (stream,i))->sequence) {
-		elt->deleted = T;
-		if (!stream->rdonly) elt->private.mod = LOCAL->statusseq = seq;
-		MM_FLAGS (stream,elt->msgno);
-	      }
+	    for (s = set,i = 0; i = mail_next_set (&s,i);) {
+	      (elt = mail_elt (stream,i))->deleted = T;
+	      if (!stream->rdonly) elt->private.mod = LOCAL->statusseq = seq;
+	      MM_FLAGS (stream,elt->msgno);
+	    }
 				/* done with status file now */
 	  mix_status_update (astream,statf,LONGT);
 				/* return sets if doing COPYUID */
@@ -1505,6 +1761,7 @@ long mix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
     MM_NOCRITICAL (stream);
   }
   else MM_LOG ("Can't open copy mailbox",ERROR);
+  mail_free_searchset (&set);
   if (statf) fclose (statf);	/* close status if still open */
   if (idxf) fclose (idxf);	/* close index if still open */
 				/* finished with append stream */
@@ -2478,8 +2735,8 @@ FILE *mix_data_open (MAILSTREAM *stream,int *fd,long *size,
 FILE *mix_sortcache_open (MAILSTREAM *stream)
 {
   int fd,refwd;
-  unsigned long i,uid,sentdate,fromlen,tolen,cclen,subjlen,msgidlen,reflen;
-  char *s,*t,*msg,tmp[MAILTMPLEN];
+  unsigned long i,j,uid,sentdate,fromlen,tolen,cclen,subjlen,msgidlen,reflen;
+  char *s,*t,*v,*msg,tmp[MAILTMPLEN];
   MESSAGECACHE *elt;
   SORTCACHE *sc;
   STRINGLIST *sl;
@@ -2525,11 +2782,20 @@ FILE *mix_sortcache_open (MAILSTREAM *stream)
 		  msgidlen = strtoul (s,&s,16);
 		  if ((*s++ == ':') && isxdigit (*s)) {
 		    reflen = strtoul (s,&s,16);
-				/* ignore expansion values */
+				/* ignore unknown expansion values */
 		    if (*s++ == ':') {
 
 		      if (i = mail_msgno (stream,uid)) {
 			sc = (SORTCACHE *) (*mc) (stream,i,CH_SORTCACHE);
+				/* decoded body part sizes */
+			while ((*s == 'B') && (v = strchr (++s,'=')) &&
+			       isxdigit (v[1])) {
+			  *v++ = '\0';
+			  j = strtoul (v,&v,16);
+			  if (*v++ != ':') break;
+			  mail_binary_size_cache (sc,s,j);
+			  s = v;
+			}
 			sc->size = (elt = mail_elt (stream,i))->rfc822_size;
 			sc->date = sentdate;
 			sc->arrival = elt->day ? mail_longdate (elt) : 1;
@@ -2693,8 +2959,9 @@ long mix_sortcache_update (MAILSTREAM *stream,FILE **sortcache)
 {
   FILE *f = *sortcache;
   long ret = LONGT;
+  LOCAL->sortdirty = NIL;	/* any dirty entries are written now */
   if (f) {			/* ignore if no file */
-    unsigned long i,j;
+    unsigned long i,j,k;
     mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
     for (i = 1; (i <= stream->nmsgs) &&
 	   !((SORTCACHE *) (*mc) (stream,i,CH_SORTCACHE))->dirty; ++i);
@@ -2706,7 +2973,11 @@ long mix_sortcache_update (MAILSTREAM *stream,FILE **sortcache)
 	MESSAGECACHE *elt = mail_elt (stream,i);
 	SORTCACHE *s = (SORTCACHE *) (*mc) (stream,i,CH_SORTCACHE);
 	STRINGLIST *sl;
+	BINARYSIZE *b;
 	s->dirty = NIL;		/* no longer dirty */
+				/* nothing to write if no keys */
+	if (!(s->date || s->from || s->to || s->cc || s->subject ||
+	      s->message_id || s->references || s->binsize)) continue;
 	if (sl = s->references)	/* count length of references */
 	  for (j = 1; sl && sl->text.data; sl = sl->next)
 	    j += 10 + sl->text.size;
@@ -2716,6 +2987,13 @@ long mix_sortcache_update (MAILSTREAM *stream,FILE **sortcache)
 		 s->to ? strlen (s->to) + 1 : 0,s->cc ? strlen (s->cc) + 1 : 0,
 		 s->refwd ? 'R' : ' ',s->subject ? strlen (s->subject) + 1: 0,
 		 s->message_id ? strlen (s->message_id) + 1 : 0,j);
+				/* decoded sizes, within reason */
+	for (b = s->binsize, k = 0; b && (k < MAILTMPLEN); b = b->next)
+	  if (strlen (b->section) == strspn (b->section,"0123456789.")) {
+	    fprintf (f,SCBFMT,b->section,b->size);
+	    k += strlen (b->section) + 11;
+	  }
+	fputs ("\015\012",f);
 	if (s->from) fprintf (f,"F%s\015\012",s->from);
 	if (s->to) fprintf (f,"T%s\015\012",s->to);
 	if (s->cc) fprintf (f,"C%s\015\012",s->cc);
@@ -2745,6 +3023,98 @@ long mix_sortcache_update (MAILSTREAM *stream,FILE **sortcache)
   }
   return ret;
 }
+
+/* MIX expunged UID history
+ *
+ * Each expunge appends the UIDs it removed, stamped with the modseq of the
+ * expunge, so that QRESYNC clients are told only of UIDs that really
+ * vanished since their modseq.  The file starts with a sequence record of
+ * the modseq from which the history is complete, and is started over from
+ * the current modseq when it grows too large.
+ */
+
+/* MIX mail UIDs expunged since modseq
+ * Accepts: MAIL stream
+ *	    modseq
+ *	    pointer to return UID set, NIL if none
+ * Returns: T if history goes back that far, else NIL
+ */
+
+long mix_vanished (MAILSTREAM *stream,unsigned long modseq,SEARCHSET **set)
+{
+  int fd;
+  FILE *f;
+  char *s;
+  struct stat sbuf;
+  unsigned long seq,first,last;
+  SEARCHSET *tail = NIL;
+  long ret = NIL;
+  *set = NIL;
+  if ((fd = open (LOCAL->vanished,O_RDONLY,NIL)) < 0);
+  else if (flock (fd,LOCK_SH) || fstat (fd,&sbuf) || !sbuf.st_size ||
+	   !(f = fdopen (fd,"rb"))) close (fd);
+  else {			/* history must cover requested modseq */
+    if ((seq = mix_read_sequence (f)) && (seq <= modseq))
+      for (ret = LONGT; (s = mix_read_record (f,LOCAL->buf,LOCAL->buflen,
+					      "vanished")) && *s; ) {
+	if ((*s++ == ':') && isxdigit (*s) && (seq = strtoul (s,&s,16)) &&
+	    (*s++ == ':') && isxdigit (*s) && (first = strtoul (s,&s,16)) &&
+	    (*s++ == ':') && isxdigit (*s) &&
+	    ((last = strtoul (s,&s,16)) >= first) && (*s++ == ':') && !*s) {
+	  if (seq > modseq) {	/* expunged after client's modseq? */
+	    if (!tail) tail = *set = mail_newsearchset ();
+	    tail = mail_append_set (tail,first);
+	    if (last > first) tail->last = last;
+	  }
+	}
+	else {			/* damaged, can't trust the history */
+	  MM_LOG ("Error in mix vanished record",WARN);
+	  if (*set) mail_free_searchset (set);
+	  ret = NIL;
+	  break;
+	}
+      }
+    fclose (f);			/* also releases the lock */
+  }
+  return ret;
+}
+
+
+/* MIX mail record expunged UIDs
+ * Accepts: MAIL stream
+ *	    expunged UIDs
+ *	    modseq before the expunge
+ *
+ * Called with the status file locked exclusive, so there is one writer.
+ */
+
+void mix_vanished_update (MAILSTREAM *stream,SEARCHSET *set,
+			  unsigned long oldseq)
+{
+  int fd;
+  FILE *f;
+  struct stat sbuf;
+  fstat (LOCAL->mfd,&sbuf);
+  if ((fd = open (LOCAL->vanished,O_RDWR|O_CREAT,sbuf.st_mode)) < 0)
+    MM_LOG ("Error opening mix vanished file",WARN);
+  else if (flock (fd,LOCK_EX) || fstat (fd,&sbuf) ||
+	   !(f = fdopen (fd,"r+b"))) {
+    MM_LOG ("Error obtaining stream on mix vanished file",WARN);
+    close (fd);
+  }
+  else {			/* new or too large, history starts now */
+    if (!sbuf.st_size || (sbuf.st_size > VNMAXFILE)) {
+      ftruncate (fd,0);
+      fprintf (f,SEQFMT,oldseq);
+    }
+    else fseek (f,0,SEEK_END);	/* else add to end */
+    for (; set; set = set->next)
+      fprintf (f,VNRFMT,LOCAL->statusseq,set->first,
+	       set->last ? set->last : set->first);
+    if (fclose (f)) MM_LOG ("Error writing mix vanished file",WARN);
+  }
+}
+
 
 /* MIX generic file routines */
 
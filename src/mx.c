@@ -44,6 +44,7 @@
 #include "fdstring.h"
 #include "bsdutime.h"
 #include "mail.h"
+#include "sidecar.h"
 #include "env_unix.h"
 #include "fs.h"
 #include "ftl.h"
@@ -53,6 +54,7 @@
 /* Index file */
 
 #define MXINDEXNAME "/.mxindex"
+#define MXSTRUCTCACHENAME "/.mxstructcache"
 #define MXINDEX(d,s) strcat (mx_file (d,s),MXINDEXNAME)
 
 
@@ -60,10 +62,12 @@
 	
 typedef struct mx_local {
   int fd;			/* file descriptor of open index */
+  int wfd;			/* change notification descriptor */
   unsigned char *buf;		/* temporary buffer */
   unsigned long buflen;		/* current size of temporary buffer */
   unsigned long cachedtexts;	/* total size of all cached texts */
   time_t scantime;		/* last time directory scanned */
+  char *structcache;		/* structure cache name */
 } MXLOCAL;
 
 
@@ -78,6 +82,7 @@ DRIVER *mx_valid (char *name);
 int mx_isvalid (char *name,char *tmp);
 int mx_namevalid (char *name);
 void *mx_parameters (long function,void *value);
+long mx_searchworker (MAILSTREAM *stream);
 long mx_dirfmttest (char *name);
 void mx_scan (MAILSTREAM *stream,char *ref,char *pat,char *contents);
 long mx_scan_contents (char *name,char *contents,unsigned long csiz,
@@ -90,6 +95,8 @@ long mx_create (MAILSTREAM *stream,char *mailbox);
 long mx_delete (MAILSTREAM *stream,char *mailbox);
 long mx_rename (MAILSTREAM *stream,char *old,char *newname);
 int mx_rename_work (char *src,size_t srcl,char *dst,size_t dstl,char *name);
+long mx_status (MAILSTREAM *stream,char *mbx,long flags);
+char *mx_statuskey (char *mbx,char *file,char *key);
 MAILSTREAM *mx_open (MAILSTREAM *stream);
 void mx_close (MAILSTREAM *stream,long options);
 void mx_fast (MAILSTREAM *stream,char *sequence,long flags);
@@ -100,13 +107,16 @@ long mx_text (MAILSTREAM *stream,unsigned long msgno,STRING *bs,long flags);
 void mx_flag (MAILSTREAM *stream,char *sequence,char *flag,long flags);
 void mx_flagmsg (MAILSTREAM *stream,MESSAGECACHE *elt);
 long mx_ping (MAILSTREAM *stream);
+int mx_watch (MAILSTREAM *stream);
 void mx_check (MAILSTREAM *stream);
 long mx_expunge (MAILSTREAM *stream,char *sequence,long options);
 long mx_copy (MAILSTREAM *stream,char *sequence,char *mailbox,
 	      long options);
+long mx_move (MAILSTREAM *stream,char *sequence,char *mailbox,
+	      long options);
 long mx_append (MAILSTREAM *stream,char *mailbox,append_t af,void *data);
 long mx_append_msg (MAILSTREAM *stream,char *flags,MESSAGECACHE *elt,
-		    STRING *st,SEARCHSET *set);
+		    STRING *st,SEARCHSET *set,char *file);
 
 int mx_select (const struct direct *name);
 int mx_numsort (const struct dirent **d1,const struct dirent **d2);
@@ -124,7 +134,8 @@ void mx_setdate (char *file,MESSAGECACHE *elt);
 DRIVER mxdriver = {
   "mx",				/* driver name */
 				/* driver flags */
-  DR_MAIL|DR_LOCAL|DR_NOFAST|DR_CRLF|DR_LOCKING|DR_DIRFMT,
+  DR_MAIL|DR_LOCAL|DR_NOFAST|DR_CRLF|DR_LOCKING|DR_DIRFMT|
+    DR_SORTCACHE,
   (DRIVER *) NIL,		/* next driver */
   mx_valid,			/* mailbox is valid for us */
   mx_parameters,		/* manipulate parameters */
@@ -136,7 +147,7 @@ DRIVER mxdriver = {
   mx_create,			/* create mailbox */
   mx_delete,			/* delete mailbox */
   mx_rename,			/* rename mailbox */
-  mail_status_default,		/* status of mailbox */
+  mx_status,			/* status of mailbox */
   mx_open,			/* open mailbox */
   mx_close,			/* close mailbox */
   mx_fast,			/* fetch message "fast" attributes */
@@ -154,9 +165,12 @@ DRIVER mxdriver = {
   NIL,				/* sort messages */
   NIL,				/* thread messages */
   mx_ping,			/* ping mailbox to see if still alive */
+  mx_watch,			/* watch mailbox for changes */
+  NIL,				/* highest modseq */
   mx_check,			/* check for new messages */
   mx_expunge,			/* expunge deleted messages */
   mx_copy,			/* copy messages to another mailbox */
+  mx_move,			/* move messages to another mailbox */
   mx_append,			/* append string message to mailbox */
   NIL				/* garbage collect stream */
 };
@@ -234,11 +248,29 @@ void *mx_parameters (long function,void *value)
   case GET_SCANCONTENTS:
     ret = (void *) mx_scan_contents;
     break;
+  case GET_SEARCHWORKER:
+    ret = (void *) mx_searchworker;
+    break;
+  case GET_STRUCTCACHEFILE:	/* value is the stream, see mail.h */
+    if (value && ((MAILSTREAM *) value)->local)
+      ret = (void *) ((MXLOCAL *) ((MAILSTREAM *) value)->local)->structcache;
+    break;
   }
   return ret;
 }
 
 
+/* MX prepare stream for search worker process
+ * Accepts: MAIL stream
+ * Returns: T, always
+ */
+
+long mx_searchworker (MAILSTREAM *stream)
+{
+  return LONGT;			/* message files are opened per fetch */
+}
+
+
 /* MX test for directory format internal node
  * Accepts: candidate node name
  * Returns: T if internal name, NIL otherwise
@@ -247,8 +279,8 @@ void *mx_parameters (long function,void *value)
 long mx_dirfmttest (char *name)
 {
   int c;
-				/* success if index name or all-numberic */
-  if (strcmp (name,MXINDEXNAME+1))
+				/* success if internal name or all-numeric */
+  if (strcmp (name,MXINDEXNAME+1) && strcmp (name,MXSTRUCTCACHENAME+1))
     while (c = *name++) if (!isdigit (c)) return NIL;
   return LONGT;
 }
@@ -404,6 +436,8 @@ long mx_delete (MAILSTREAM *stream,char *mailbox)
     *(s = strrchr (tmp,'/')) = '\0';
     if (dirp = opendir (tmp)) {	/* open directory */
       *s++ = '/';		/* restore delimiter */
+      strcpy (s,MXSTRUCTCACHENAME+1);
+      unlink (tmp);		/* structure cache goes too */
 				/* massacre messages */
       while (d = readdir (dirp)) if (mx_select (d)) {
 	strcpy (s,d->d_name);	/* make path */
@@ -411,6 +445,7 @@ long mx_delete (MAILSTREAM *stream,char *mailbox)
       }
       closedir (dirp);		/* flush directory */
       *(s = strrchr (tmp,'/')) = '\0';
+      sidecar_rename (tmp,NIL);	/* sidecars go too */
       if (rmdir (tmp)) {	/* try to remove the directory */
 	sprintf (tmp,"Can't delete name %.80s: %s",mailbox,strerror (errno));
 	MM_LOG (tmp,WARN);
@@ -457,7 +492,10 @@ long mx_rename (MAILSTREAM *stream,char *old,char *newname)
 	  return NIL;
 	*s = c;			/* restore full name */
       }
-      if (!rename (tmp,tmp1)) return LONGT;
+      if (!rename (tmp,tmp1)) {
+	sidecar_rename (tmp,tmp1);
+	return LONGT;
+      }
     }
 
 				/* RFC 3501 requires this */
@@ -477,6 +515,8 @@ long mx_rename (MAILSTREAM *stream,char *old,char *newname)
       }
 				/* free directory list */
       if (a = (void *) names) fs_give ((void **) &a);
+				/* structure cache is advisory */
+      mx_rename_work (tmp,srcl,tmp1,dstl,MXSTRUCTCACHENAME+1);
       if (lasterror || mx_rename_work (tmp,srcl,tmp1,dstl,MXINDEXNAME+1))
 	errno = lasterror;
       else return mx_create (NIL,"INBOX");
@@ -512,6 +552,49 @@ int mx_rename_work (char *src,size_t srcl,char *dst,size_t dstl,char *name)
   return ret;
 }
 
+/* MX mail status
+ * Accepts: mail stream
+ *	    mailbox name
+ *	    status flags
+ * Returns: T on success, NIL on failure
+ */
+
+long mx_status (MAILSTREAM *stream,char *mbx,long flags)
+{
+  char dir[MAILTMPLEN];
+				/* use open stream if one given */
+  if (stream || !*mx_file (dir,mbx))
+    return mail_status_default (stream,mbx,flags);
+  return statuscache_status (mbx,dir,mx_statuskey,flags);
+}
+
+
+/* MX mail status cache key
+ * Accepts: mailbox name
+ *	    mailbox directory name
+ *	    destination buffer
+ * Returns: key, or NIL if mailbox can't be cached
+ */
+
+char *mx_statuskey (char *mbx,char *file,char *key)
+{
+  struct stat dbuf,ibuf;
+  char tmp[MAILTMPLEN];
+  if (stat (file,&dbuf)) return NIL;
+				/* index not written until first open */
+  if (stat (MXINDEX (tmp,mbx),&ibuf))
+    ibuf.st_size = ibuf.st_mtime = ibuf.st_ctime = 0;
+				/* new messages change the directory, flag
+				   changes rewrite the index */
+  sprintf (key,"%lu:%lu:%lu:%lu:%lu",(unsigned long) dbuf.st_ino,
+	   (unsigned long) dbuf.st_ctime,(unsigned long) ibuf.st_size,
+	   (unsigned long) ibuf.st_mtime,(unsigned long) ibuf.st_ctime);
+				/* don't cache if may change this second */
+  return ((dbuf.st_ctime < time (0)) && (ibuf.st_ctime < time (0))) ?
+    key : NIL;
+}
+
+
 /* MX mail open
  * Accepts: stream to open
  * Returns: stream on success, NIL on failure
@@ -535,7 +618,11 @@ MAILSTREAM *mx_open (MAILSTREAM *stream)
   LOCAL->buflen = CHUNKSIZE - 1;
   LOCAL->scantime = 0;		/* not scanned yet */
   LOCAL->fd = -1;		/* no index yet */
+  LOCAL->wfd = -1;		/* not watching for changes yet */
   LOCAL->cachedtexts = 0;	/* no cached texts */
+  LOCAL->structcache = (char *) fs_get (strlen (stream->mailbox) +
+					sizeof (MXSTRUCTCACHENAME));
+  sprintf (LOCAL->structcache,"%s%s",stream->mailbox,MXSTRUCTCACHENAME);
   stream->sequence++;		/* bump sequence number */
 				/* parse mailbox */
   stream->nmsgs = stream->recent = 0;
@@ -560,8 +647,11 @@ void mx_close (MAILSTREAM *stream,long options)
     int silent = stream->silent;
     stream->silent = T;		/* note this stream is dying */
     if (options & CL_EXPUNGE) mx_expunge (stream,NIL,NIL);
+				/* close change notification if open */
+    if (LOCAL->wfd >= 0) close (LOCAL->wfd);
 				/* free local scratch buffer */
     if (LOCAL->buf) fs_give ((void **) &LOCAL->buf);
+    if (LOCAL->structcache) fs_give ((void **) &LOCAL->structcache);
 				/* nuke the local data */
     fs_give ((void **) &stream->local);
     stream->dtb = NIL;		/* log out the DTB */
@@ -829,6 +919,22 @@ long mx_ping (MAILSTREAM *stream)
   mail_recent (stream,recent);
   return T;			/* return that we are alive */
 }
+
+
+/* MX mail watch mailbox for changes
+ * Accepts: MAIL stream
+ * Returns: descriptor readable on change, or -1 if can't watch
+ */
+
+int mx_watch (MAILSTREAM *stream)
+{
+  char *files[2];
+  files[0] = stream->mailbox;	/* directory entries only, not index updates */
+  files[1] = NIL;
+				/* force rescan, ctime has 1 second grain */
+  if (notify_watch (&LOCAL->wfd,files,LONGT)) LOCAL->scantime = 0;
+  return LOCAL->wfd;
+}
 
 /* MX mail check mailbox
  * Accepts: MAIL stream
@@ -912,7 +1018,7 @@ long mx_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   struct stat sbuf;
   int fd;
   unsigned long i,j,uid,uidv;
-  char *t,tmp[MAILTMPLEN];
+  char *t,tmp[MAILTMPLEN],file[MAILTMPLEN];
   long ret;
   mailproxycopy_t pc =
     (mailproxycopy_t) mail_parameters (stream,GET_MAILPROXYCOPY,NIL);
@@ -946,8 +1052,8 @@ long mx_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
       SEARCHSET *dest = cu ? mail_newsearchset () : NIL;
       for (i = 1,uid = uidv = 0; ret && (i <= stream->nmsgs); i++) 
       if ((elt = mail_elt (stream,i))->sequence) {
-	if (ret = ((fd = open (mx_fast_work (stream,elt),O_RDONLY,NIL))
-		   >= 0)) {
+	if (ret = ((fd = open (strcpy (file,mx_fast_work (stream,elt)),
+			       O_RDONLY,NIL)) >= 0)) {
 	  fstat (fd,&sbuf);	/* get size of message */
 	  d.fd = fd;		/* set up file descriptor */
 	  d.pos = 0;		/* start of file */
@@ -967,7 +1073,9 @@ long mx_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
 	  if (elt->draft) strcat (tmp," \\Draft");
 	  tmp[0] = '(';		/* open list */
 	  strcat (tmp,")");	/* close list */
-	  if (ret = mx_append_msg (astream,tmp,elt,&st,dest)) {
+				/* a move can link the message file */
+	  if (ret = mx_append_msg (astream,tmp,elt,&st,dest,
+				   (options & CP_MOVE) ? file : NIL)) {
 				/* add to source set if needed */
 	    if (source) mail_append_set (source,mail_uid (stream,i));
 				/* delete if doing a move */
@@ -989,6 +1097,21 @@ long mx_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   return ret;			/* return success */
 }
 
+/* MX mail move message(s)
+ * Accepts: MAIL stream
+ *	    sequence
+ *	    destination mailbox
+ *	    copy options
+ * Returns: T if move successful, else NIL
+ */
+
+long mx_move (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
+{
+				/* copy links message files if it can */
+  return mx_copy (stream,sequence,mailbox,options | CP_MOVE) &&
+    mx_expunge (stream,sequence,(options & CP_UID) ? EX_UID : NIL);
+}
+
 /* MX mail append message from stringstruct
  * Accepts: MAIL stream
  *	    destination mailbox
@@ -1049,7 +1172,8 @@ long mx_append (MAILSTREAM *stream,char *mailbox,append_t af,void *data)
 	sprintf (tmp,"Bad date in append: %.80s",date);
 	MM_LOG (tmp,ERROR);
       }
-      else ret = mx_append_msg (astream,flags,date ? &elt : NIL,message,dst)&&
+      else ret = mx_append_msg (astream,flags,date ? &elt : NIL,message,dst,
+				NIL) &&
 	     MM_APPEND (af) (stream,data,&flags,&date,&message);
     } while (ret && message);
 				/* return sets if doing APPENDUID */
@@ -1068,11 +1192,12 @@ long mx_append (MAILSTREAM *stream,char *mailbox,append_t af,void *data)
  *	    elt with source date if non-NIL
  *	    stringstruct of message text
  *	    searchset to place UID
+ *	    source message file to link instead of copying, or NIL
  * Returns: T if success, NIL if failure
  */
 
 long mx_append_msg (MAILSTREAM *stream,char *flags,MESSAGECACHE *elt,
-		    STRING *st,SEARCHSET *set)
+		    STRING *st,SEARCHSET *set,char *file)
 {
   char tmp[MAILTMPLEN];
   int fd;
@@ -1080,24 +1205,27 @@ long mx_append_msg (MAILSTREAM *stream,char *flags,MESSAGECACHE *elt,
   long f = mail_parse_flags (stream,flags,&uf);
 				/* make message file name */
   sprintf (tmp,"%s/%lu",stream->mailbox,++stream->uid_last);
-  if ((fd = open (tmp,O_WRONLY|O_CREAT|O_EXCL,
-		  (long) mail_parameters (NIL,GET_MBXPROTECTION,NIL))) < 0) {
-    sprintf (tmp,"Can't create append message: %s",strerror (errno));
-    MM_LOG (tmp,ERROR);
-    return NIL;
-  }
-  while (SIZE (st)) {		/* copy the file */
-    if (st->cursize && (write (fd,st->curpos,st->cursize) < 0)) {
-      unlink (tmp);		/* delete file */
-      close (fd);		/* close the file */
-      sprintf (tmp,"Message append failed: %s",strerror (errno));
+				/* link if same file system, else copy */
+  if (!file || link (file,tmp)) {
+    if ((fd = open (tmp,O_WRONLY|O_CREAT|O_EXCL,
+		    (long) mail_parameters (NIL,GET_MBXPROTECTION,NIL))) < 0) {
+      sprintf (tmp,"Can't create append message: %s",strerror (errno));
       MM_LOG (tmp,ERROR);
       return NIL;
     }
-    SETPOS (st,GETPOS (st) + st->cursize);
+    while (SIZE (st)) {		/* copy the file */
+      if (st->cursize && (write (fd,st->curpos,st->cursize) < 0)) {
+	unlink (tmp);		/* delete file */
+	close (fd);		/* close the file */
+	sprintf (tmp,"Message append failed: %s",strerror (errno));
+	MM_LOG (tmp,ERROR);
+	return NIL;
+      }
+      SETPOS (st,GETPOS (st) + st->cursize);
+    }
+    close (fd);			/* close the file */
+    if (elt) mx_setdate (tmp,elt);/* set file date */
   }
-  close (fd);			/* close the file */
-  if (elt) mx_setdate (tmp,elt);/* set file date */
 				/* swell the cache */
   mail_exists (stream,++stream->nmsgs);
 				/* copy flags */
@@ -193,9 +193,12 @@ DRIVER nntpdriver = {
   nntp_sort,			/* sort messages */
   nntp_thread,			/* thread messages */
   nntp_ping,			/* ping mailbox to see if still alive */
+  NIL,				/* watch mailbox for changes */
+  NIL,				/* highest modseq */
   nntp_check,			/* check for new messages */
   nntp_expunge,			/* expunge deleted messages */
   nntp_copy,			/* copy messages to another mailbox */
+  NIL,				/* move messages to another mailbox */
   nntp_append,			/* append string message to mailbox */
   NIL				/* garbage collect stream */
 };
@@ -578,6 +581,7 @@ long nntp_status (MAILSTREAM *stream,char *mbx,long flags)
     else status.recent = status.unseen = status.messages;
 				/* UID validity is a constant */
     status.uidvalidity = stream->uid_validity;
+    status.highestmodseq = 0;	/* no modseqs in news */
 				/* pass status to main program */
     mm_status (stream,mbx,&status);
     ret = T;			/* succes */
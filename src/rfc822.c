@@ -1897,36 +1897,38 @@ long rfc822_output_text (RFC822BUFFER *buf,BODY *body)
 #define JNK 0177
 #define PAD 0100
 
+				/* BASE64 character classes */
+static char b64decode[256] = {
+  WSP,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,WSP,WSP,JNK,WSP,WSP,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  WSP,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,076,JNK,JNK,JNK,077,
+  064,065,066,067,070,071,072,073,074,075,JNK,JNK,JNK,PAD,JNK,JNK,
+  JNK,000,001,002,003,004,005,006,007,010,011,012,013,014,015,016,
+  017,020,021,022,023,024,025,026,027,030,031,JNK,JNK,JNK,JNK,JNK,
+  JNK,032,033,034,035,036,037,040,041,042,043,044,045,046,047,050,
+  051,052,053,054,055,056,057,060,061,062,063,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
+  JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK
+};
+
 void *rfc822_base64 (unsigned char *src,unsigned long srcl,unsigned long *len)
 {
   char c,*s,tmp[MAILTMPLEN];
   void *ret = fs_get ((size_t) ((*len = 4 + ((srcl * 3) / 4))) + 1);
   char *d = (char *) ret;
   int e;
-  static char decode[256] = {
-   WSP,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,WSP,WSP,JNK,WSP,WSP,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   WSP,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,076,JNK,JNK,JNK,077,
-   064,065,066,067,070,071,072,073,074,075,JNK,JNK,JNK,PAD,JNK,JNK,
-   JNK,000,001,002,003,004,005,006,007,010,011,012,013,014,015,016,
-   017,020,021,022,023,024,025,026,027,030,031,JNK,JNK,JNK,JNK,JNK,
-   JNK,032,033,034,035,036,037,040,041,042,043,044,045,046,047,050,
-   051,052,053,054,055,056,057,060,061,062,063,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,
-   JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK,JNK
-  };
 				/* initialize block */
   memset (ret,0,((size_t) *len) + 1);
   *len = 0;			/* in case we return an error */
 
 				/* simple-minded decode */
-  for (e = 0; srcl--; ) switch (c = decode[*src++]) {
+  for (e = 0; srcl--; ) switch (c = b64decode[*src++]) {
   default:			/* valid BASE64 data character */
     switch (e++) {		/* install based on quantum position */
     case 0:
@@ -1952,7 +1954,7 @@ void *rfc822_base64 (unsigned char *src,unsigned long srcl,unsigned long *len)
     switch (e++) {		/* check quantum position */
     case 3:			/* one = is good enough in quantum 3 */
 				/* make sure no data characters in remainder */
-      for (; srcl; --srcl) switch (decode[*src++]) {
+      for (; srcl; --srcl) switch (b64decode[*src++]) {
 				/* ignore space, junk and extraneous padding */
       case WSP: case JNK: case PAD:
 	break;
@@ -2110,6 +2112,235 @@ unsigned char *rfc822_qprint (unsigned char *src,unsigned long srcl,
   return ret;			/* return the string */
 }
 
+/* Initialize streaming content decoder
+ * Accepts: decoder
+ *	    content transfer encoding
+ *	    output routine, or NIL to only count decoded octets
+ *	    argument for output routine
+ */
+
+void rfc822_decode_init (RFC822DECODE *dc,unsigned short encoding,
+			 decodeout_t out,void *arg)
+{
+  memset ((void *) dc,0,sizeof (RFC822DECODE));
+  dc->encoding = encoding;
+  dc->out = out;
+  dc->arg = arg;
+}
+
+
+/* Streaming content decoder output octet
+ * Accepts: decoder
+ *	    octet
+ * Returns: T if success, NIL if output routine failed
+ */
+
+static long rfc822_decode_octet (RFC822DECODE *dc,unsigned char c)
+{
+  dc->size++;			/* count the octet */
+  if (!dc->out) return LONGT;	/* just counting? */
+  dc->buf[dc->len++] = c;	/* no, buffer it and flush when full */
+  return (dc->len < RFC822DECODEBUF) || rfc822_decode_flush (dc);
+}
+
+
+/* Streaming content decoder flush buffered output
+ * Accepts: decoder
+ * Returns: T if success, NIL if output routine failed
+ */
+
+long rfc822_decode_flush (RFC822DECODE *dc)
+{
+  long ret = LONGT;
+  if (dc->out && dc->len) ret = (*dc->out) (dc->arg,dc->buf,dc->len);
+  dc->len = 0;			/* buffer is empty now */
+  return ret;
+}
+
+/* Streaming content decoder note invalid quoted-printable
+ * Accepts: decoder
+ *	    pointer to text after quoting character
+ *	    size of text
+ */
+
+static void rfc822_decode_bogon (RFC822DECODE *dc,unsigned char *s,
+				 unsigned long i)
+{
+  char tmp[MAILTMPLEN];
+  if (!dc->bogon) {		/* only do this once */
+    dc->bogon = T;
+    sprintf (tmp,"Invalid quoted-printable sequence: =%.*s",(int) min (i,80),
+	     (char *) s);
+    mm_log (tmp,PARSE);
+  }
+}
+
+/* Streaming content decoder
+ * Accepts: decoder
+ *	    source
+ *	    length of source
+ * Returns: T if success, NIL if undecodable or output failed
+ *
+ * Decodes exactly as rfc822_base64() and rfc822_qprint() would if given all
+ * of the source at once, but the source may arrive in pieces of any size.
+ */
+
+long rfc822_decode (RFC822DECODE *dc,unsigned char *src,unsigned long srcl)
+{
+  char c,*s,tmp[MAILTMPLEN];
+  switch (dc->encoding) {
+  case ENCBASE64:
+    for (; srcl; --srcl) switch (c = b64decode[*src++]) {
+    default:			/* valid BASE64 data character */
+      switch (dc->state) {	/* install based on quantum position */
+      case 0:
+	dc->c = c << 2;		/* byte 1: high 6 bits */
+	break;
+      case 1:			/* byte 1: low 2 bits, byte 2: high 4 bits */
+	if (!rfc822_decode_octet (dc,dc->c | (c >> 4))) return NIL;
+	dc->c = c << 4;
+	break;
+      case 2:			/* byte 2: low 4 bits, byte 3: high 2 bits */
+	if (!rfc822_decode_octet (dc,dc->c | (c >> 2))) return NIL;
+	dc->c = c << 6;
+	break;
+      case 3:			/* byte 3: low 6 bits */
+	if (!rfc822_decode_octet (dc,dc->c | c)) return NIL;
+	dc->state = 0;		/* reinitialize mechanism */
+	continue;
+      case 4:			/* expected a second = */
+	return NIL;
+      case 5:			/* data after padding */
+	sprintf (tmp,"Possible data truncation in rfc822_decode(): %.*s",
+		 (int) min (srcl,80),(char *) src - 1);
+	if (s = strpbrk (tmp,"\015\012")) *s = NIL;
+	mm_log (tmp,PARSE);
+      case 6:			/* ignore remainder */
+	dc->state = 6;
+	continue;
+      }
+      dc->state++;
+      break;
+    case WSP:			/* whitespace */
+      if (dc->state == 4) return NIL;
+      break;
+    case PAD:			/* padding */
+      switch (dc->state) {	/* check quantum position */
+      case 2:			/* expect a second = in quantum 2 */
+	dc->state = 4;
+	break;
+      case 3:			/* one = is good enough in quantum 3 */
+      case 4:
+	dc->state = 5;		/* make sure no data characters in remainder */
+      case 5: case 6:		/* ignore extraneous padding */
+	break;
+      default:			/* impossible quantum position */
+	return NIL;
+      }
+      break;
+    case JNK:			/* junk character */
+      if (dc->state < 5) return NIL;
+      break;
+    }
+    break;
+
+  case ENCQUOTEDPRINTABLE:
+    while (srcl--) {
+      c = *src++;
+      switch (dc->state) {
+      case 1:			/* after quoting character */
+	switch (c) {
+	case '\0':		/* end of data, treat as ordinary */
+	  dc->state = 0;
+	  break;
+	case '\015':		/* non-significant line break */
+	  dc->state = 3;
+	  continue;
+	case '\012':		/* bare LF */
+	  dc->state = 0;
+	  continue;
+	default:
+	  if (isxdigit (c)) {	/* first hex digit */
+	    dc->c = c;
+	    dc->state = 2;
+	    continue;
+	  }
+	  dc->state = 0;	/* treat = as ordinary character */
+	  rfc822_decode_bogon (dc,src - 1,srcl + 1);
+	  if (!(rfc822_decode_octet (dc,'=') && rfc822_decode_octet (dc,c)))
+	    return NIL;
+	  continue;
+	}
+	break;
+      case 2:			/* after first hex digit */
+	dc->state = 0;
+	if (isxdigit (c)) {	/* merge the two hex digits */
+	  if (!rfc822_decode_octet (dc,hex2byte (dc->c,c))) return NIL;
+	  continue;
+	}
+	rfc822_decode_bogon (dc,src - 1,srcl + 1);
+	if (!(rfc822_decode_octet (dc,'=') && rfc822_decode_octet (dc,dc->c)))
+	  return NIL;
+	break;			/* and this character is ordinary */
+      case 3:			/* after soft line break CR */
+	dc->state = 0;
+	if (c == '\012') continue;
+	break;
+      }
+      switch (c) {		/* ordinary character */
+      case ' ':			/* space, possibly bogus */
+	dc->spaces++;		/* note but don't output yet */
+	continue;
+      case '\015':		/* end of line */
+      case '\012':		/* bare LF */
+	dc->spaces = 0;		/* drop trailing spaces */
+	break;
+      case '=':			/* quoting character */
+	dc->state = 1;
+      default:
+	break;
+      }
+      for (; dc->spaces; dc->spaces--)
+	if (!rfc822_decode_octet (dc,' ')) return NIL;
+      if ((c != '=') && !rfc822_decode_octet (dc,c)) return NIL;
+    }
+    break;
+
+  default:			/* identity encodings */
+    dc->size += srcl;
+    if (dc->out && srcl)	/* pass through */
+      return rfc822_decode_flush (dc) && (*dc->out) (dc->arg,src,srcl);
+    break;
+  }
+  return LONGT;
+}
+
+/* Streaming content decoder finish
+ * Accepts: decoder
+ * Returns: T if success, NIL if undecodable or output failed
+ */
+
+long rfc822_decode_done (RFC822DECODE *dc)
+{
+  switch (dc->encoding) {
+  case ENCBASE64:		/* incomplete quantum is ignored */
+    if (dc->state == 4) return NIL;
+    break;
+  case ENCQUOTEDPRINTABLE:
+    if (dc->state == 2) {	/* hex digit at end of data */
+      rfc822_decode_bogon (dc,&dc->c,1);
+      if (!(rfc822_decode_octet (dc,'=') && rfc822_decode_octet (dc,dc->c)))
+	return NIL;
+    }
+				/* trailing spaces at end of data are kept */
+    for (; dc->spaces; dc->spaces--)
+      if (!rfc822_decode_octet (dc,' ')) return NIL;
+    break;
+  }
+  dc->state = 0;
+  return rfc822_decode_flush (dc);
+}
+
 /* Convert 8BIT contents to QUOTED-PRINTABLE
  * Accepts: source
  *	    length of source
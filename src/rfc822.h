@@ -52,6 +52,25 @@ typedef struct rfc822buffer {
 
 typedef long (*rfc822outfull_t) (RFC822BUFFER *buf,ENVELOPE *env,BODY *body,
 				 long ok8bit);
+
+/* Streaming content decoder */
+
+#define RFC822DECODEBUF 8192	/* size of decoder output buffer */
+
+typedef long (*decodeout_t) (void *arg,unsigned char *s,unsigned long n);
+
+typedef struct rfc822_decode {
+  unsigned short encoding;	/* content transfer encoding */
+  unsigned int state;		/* decoder state */
+  unsigned int bogon : 1;	/* invalid quoted-printable seen */
+  unsigned char c;		/* pending bits or hex digit */
+  unsigned long spaces;		/* pending quoted-printable spaces */
+  unsigned long size;		/* number of octets decoded so far */
+  decodeout_t out;		/* output routine */
+  void *arg;			/* argument for output routine */
+  unsigned long len;		/* number of octets in buffer */
+  unsigned char buf[RFC822DECODEBUF];
+} RFC822DECODE;
 
 /* Function prototypes */
 
@@ -105,6 +124,11 @@ unsigned char *rfc822_qprint (unsigned char *src,unsigned long srcl,
 			      unsigned long *len);
 unsigned char *rfc822_8bit (unsigned char *src,unsigned long srcl,
 			    unsigned long *len);
+void rfc822_decode_init (RFC822DECODE *dc,unsigned short encoding,
+			 decodeout_t out,void *arg);
+long rfc822_decode (RFC822DECODE *dc,unsigned char *src,unsigned long srcl);
+long rfc822_decode_flush (RFC822DECODE *dc);
+long rfc822_decode_done (RFC822DECODE *dc);
 
 /* Legacy routines for compatibility with the past */
 
@@ -0,0 +1,2003 @@
+/*
+ * Program:	Mailbox sidecar file routines
+ *
+ * Date:	17 October 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+
+/* A sidecar is a file kept alongside a mailbox which holds data derived from
+ * the mailbox, so that every session need not derive it again.  Sidecars are
+ * advisory.  Their contents are checked against the mailbox UID validity and
+ * each message's UID and size, damaged data is discarded and derived anew,
+ * and a sidecar which can't be read or written is silently ignored.
+ *
+ * The structure cache holds each message's envelope and body structure, as
+ * produced by rfc822_parse_msg(), keyed by UID.  The file is
+ *
+ *	STC1 <uidvalidity>CRLF
+ *	:<uid>:<rfc822 size>:<length>:CRLF
+ *	<length octets of serialized structure>CRLF
+ *	...
+ *
+ * with numbers in the record lines in hexadecimal.
+ *
+ * The text index holds the distinct tokens of each message's searchable
+ * text, keyed by UID, in a file of the same form with header "TXI1" and
+ * space separated tokens as the record data.  The header index is a text
+ * index file whose tokens are tagged with the field they came from.
+ *
+ * The sortcache holds each message's SORT and THREAD keys, keyed by UID, in
+ * a file of the same form with header "SRT1".  Any driver with stable UIDs
+ * and a mailbox name which is a file name can have one by setting the
+ * DR_SORTCACHE driver flag.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "c-client.h"
+#include "sidecar.h"
+
+				/* structure cache header format */
+#define STCHDRFMT "STC1 %08lx\015\012"
+				/* structure cache record format */
+#define STCRECFMT ":%08lx:%08lx:%08lx:\015\012"
+#define STCINCREMENT 256	/* record array growth */
+#define STCMAXFILE 0x4000000	/* largest file loaded (sanity check) */
+				/* text index header format */
+#define TXIHDRFMT "TXI1 %08lx\015\012"
+#define TXIMAXFILE 0x10000000	/* largest file loaded (sanity check) */
+#define TXIHASHSIZE 65521	/* size of token hash table */
+#define TXIINCREMENT 1024	/* token array growth */
+#define TXIQUERIES 8		/* number of cached queries */
+				/* token octet: letter, digit, or non-ASCII */
+#define TXITOKEN(c) ((((c) >= '0') && ((c) <= '9')) || \
+		     (((c) >= 'A') && ((c) <= 'Z')) || \
+		     (((c) >= 'a') && ((c) <= 'z')) || ((c) & 0x80))
+				/* sortcache header format */
+#define SRTHDRFMT "SRT1 %08lx\015\012"
+#define SRTMAXFILE 0x4000000	/* largest file loaded (sanity check) */
+
+
+/* Sidecar types, for hiding from listings */
+
+static char *sidecar_types[] = {
+  SIDECARSTRUCT,
+  SIDECARSORT,
+  SIDECARSTATUS,
+  NIL
+};
+
+/* Sidecar build file name
+ * Accepts: destination buffer
+ *	    mailbox file name
+ *	    sidecar type
+ * Returns: destination buffer, or NIL if name too long
+ *
+ * The sidecar of "dir/name" is "dir/.name.type".
+ */
+
+char *sidecar_file (char *dst,char *file,char *type)
+{
+  char *s = strrchr (file,'/');
+  if ((strlen (file) + strlen (type) + 3) >= MAILTMPLEN) return NIL;
+  if (s) sprintf (dst,"%.*s/.%s.%s",(int) (s - file),file,s + 1,type);
+  else sprintf (dst,".%s.%s",file,type);
+  return dst;
+}
+
+
+/* Sidecar test file name
+ * Accepts: file name, without directory
+ * Returns: T if the name of a sidecar, NIL otherwise
+ */
+
+long sidecar_test (char *name)
+{
+  int i;
+  char *s;
+  if ((*name == '.') && (s = strrchr (name,'.')) && (s != name))
+    for (i = 0; sidecar_types[i]; ++i)
+      if (!strcmp (s + 1,sidecar_types[i])) return LONGT;
+  return NIL;
+}
+
+/* Sidecar rename or delete
+ * Accepts: mailbox file name
+ *	    new mailbox file name, or NIL to delete
+ *
+ * Sidecars are advisory, so failure here is ignored.
+ */
+
+void sidecar_rename (char *file,char *newfile)
+{
+  int i;
+  char tmp[MAILTMPLEN],tmp1[MAILTMPLEN];
+  for (i = 0; sidecar_types[i]; ++i)
+    if (sidecar_file (tmp,file,sidecar_types[i])) {
+      if (!newfile) unlink (tmp);
+      else if (sidecar_file (tmp1,newfile,sidecar_types[i])) rename (tmp,tmp1);
+    }
+}
+
+
+/* Sidecar open file
+ * Accepts: sidecar file name
+ *	    open() flags
+ * Returns: file descriptor, or -1 if error
+ *
+ * A sidecar may be in a directory other users can write, such as a sticky
+ * spool directory next to a unix INBOX.  So that a planted file can't be
+ * clobbered or spoof the sidecar's data, a symlink is never followed and the
+ * file must be a regular file with a single link, owned by this user.
+ */
+
+int sidecar_open (char *file,int flags)
+{
+  int fd;
+  struct stat sbuf;
+				/* O_NONBLOCK so a planted FIFO can't hang */
+  if (((fd = open (file,flags | O_NOFOLLOW | O_NOCTTY | O_NONBLOCK,
+		   (int) (long) mail_parameters (NIL,GET_MBXPROTECTION,NIL)))
+       >= 0) && (fstat (fd,&sbuf) || ((sbuf.st_mode & S_IFMT) != S_IFREG) ||
+		 (sbuf.st_nlink != 1) || (sbuf.st_uid != geteuid ()))) {
+    close (fd);			/* not ours, don't touch it */
+    fd = -1;
+  }
+  return fd;
+}
+
+/* Structure cache load
+ * Accepts: mail stream
+ * Returns: structure cache, or NIL if stream not ready for one
+ *
+ * A cache with no file is returned for streams which don't have a
+ * structure cache, so that the driver isn't asked again.
+ */
+
+STRUCTCACHE *structcache_load (MAILSTREAM *stream)
+{
+  int fd;
+  char *s;
+  STRUCTCACHE *stc;
+				/* can't key records without UID validity */
+  if (!(stream->dtb && stream->uid_validity)) return NIL;
+  stc = (STRUCTCACHE *) memset (fs_get (sizeof (STRUCTCACHE)),0,
+				sizeof (STRUCTCACHE));
+  if (!stream->anonymous && !stream->uid_nosticky &&
+      (s = (char *) mail_parameters (stream,GET_STRUCTCACHEFILE,stream))) {
+    stc->file = cpystr (s);
+    stc->uid_validity = stream->uid_validity;
+    if ((fd = sidecar_open (stc->file,O_RDONLY)) >= 0) {
+      if (!flock (fd,LOCK_SH)) structcache_read (stc,fd);
+      close (fd);		/* also releases the lock */
+    }
+  }
+  return stc;
+}
+
+
+/* Structure cache read file
+ * Accepts: structure cache
+ *	    locked file descriptor
+ *
+ * Records already in the cache are kept in preference to those in the file.
+ */
+
+void structcache_read (STRUCTCACHE *stc,int fd)
+{
+  unsigned long uid,size,len;
+  unsigned char *buf,*s,*t,*end;
+  struct stat sbuf;
+  if (fstat (fd,&sbuf) || !sbuf.st_size || (sbuf.st_size > STCMAXFILE))
+    return;
+  buf = (unsigned char *) fs_get ((size_t) sbuf.st_size + 1);
+  if ((lseek (fd,0,L_SET) == 0) &&
+      (read (fd,buf,sbuf.st_size) == sbuf.st_size)) {
+    end = buf + sbuf.st_size;
+    *end = '\0';		/* guard for strtoul() */
+				/* validate header */
+    if (!strncmp ((char *) buf,"STC1 ",5) &&
+	(strtoul ((char *) buf + 5,(char **) &s,16) == stc->uid_validity) &&
+	(s[0] == '\015') && (s[1] == '\012'))
+      for (s += 2; (s < end) && (*s == ':'); s = t + len + 2) {
+	uid = strtoul ((char *) s + 1,(char **) &t,16);
+	if (*t != ':') break;
+	size = strtoul ((char *) t + 1,(char **) &t,16);
+	if (*t != ':') break;
+	len = strtoul ((char *) t + 1,(char **) &t,16);
+	if ((t[0] != ':') || (t[1] != '\015') || (t[2] != '\012') ||
+	    (len > (unsigned long) (end - (t += 3))) ||
+	    ((end - t) - len < 2) || (t[len] != '\015') ||
+	    (t[len + 1] != '\012')) break;
+	if (uid) structcache_add (stc,uid,size,t,len,NIL);
+      }
+  }
+  fs_give ((void **) &buf);
+}
+
+/* Structure cache save
+ * Accepts: mail stream
+ *
+ * Records of other sessions are merged in, and records of messages no longer
+ * in the mailbox are dropped.
+ */
+
+void structcache_save (MAILSTREAM *stream)
+{
+  int fd;
+  unsigned long i;
+  STRUCTRECORD *r;
+  STCBUFFER b;
+  char tmp[MAILTMPLEN];
+  STRUCTCACHE *stc = stream->stc;
+  if (!(stc && stc->file && stc->dirty)) return;
+  stc->dirty = NIL;		/* only try once */
+  if ((fd = sidecar_open (stc->file,O_RDWR|O_CREAT)) < 0) return;
+  if (!flock (fd,LOCK_EX)) {	/* merge records from other sessions */
+    structcache_read (stc,fd);
+    memset (&b,0,sizeof (STCBUFFER));
+    sprintf (tmp,STCHDRFMT,stc->uid_validity);
+    structcache_put (&b,tmp,strlen (tmp));
+    for (i = 1; i <= stream->nmsgs; ++i)
+      if (r = structcache_lookup (stc,mail_elt (stream,i)->private.uid)) {
+	sprintf (tmp,STCRECFMT,r->uid,r->size,r->data.size);
+	structcache_put (&b,tmp,strlen (tmp));
+	structcache_put (&b,(char *) r->data.data,r->data.size);
+	structcache_put (&b,"\015\012",2);
+      }
+    if ((lseek (fd,0,L_SET) == 0) &&
+	(write (fd,b.s,b.len) == (ssize_t) b.len)) ftruncate (fd,b.len);
+    else ftruncate (fd,0);	/* don't leave a partial file */
+    fs_give ((void **) &b.s);
+  }
+  close (fd);			/* also releases the lock */
+}
+
+/* Structure cache look up record
+ * Accepts: structure cache
+ *	    UID
+ * Returns: record, or NIL if none
+ */
+
+STRUCTRECORD *structcache_lookup (STRUCTCACHE *stc,unsigned long uid)
+{
+  unsigned long lo = 0,hi = stc->nrecs,i;
+  while (lo < hi) {		/* binary search */
+    if (stc->rec[i = (lo + hi) / 2].uid == uid) return &stc->rec[i];
+    if (stc->rec[i].uid < uid) lo = i + 1;
+    else hi = i;
+  }
+  return NIL;
+}
+
+
+/* Structure cache add record
+ * Accepts: structure cache
+ *	    UID
+ *	    message RFC822 size
+ *	    serialized structure
+ *	    length of serialized structure
+ *	    T to replace an existing record, NIL to keep it
+ * Returns: record
+ */
+
+STRUCTRECORD *structcache_add (STRUCTCACHE *stc,unsigned long uid,
+			       unsigned long size,unsigned char *data,
+			       unsigned long len,long replace)
+{
+  unsigned long lo = 0,hi = stc->nrecs,i;
+  STRUCTRECORD *r;
+  while (lo < hi) {		/* binary search for insertion point */
+    if (stc->rec[i = (lo + hi) / 2].uid < uid) lo = i + 1;
+    else hi = i;
+  }
+  if ((lo < stc->nrecs) && (stc->rec[lo].uid == uid)) {
+    if (!replace) return &stc->rec[lo];
+    fs_give ((void **) &stc->rec[lo].data.data);
+  }
+  else {			/* new record, make room for it */
+    if (stc->nrecs == stc->size) {
+      stc->size += STCINCREMENT;
+      if (stc->rec)
+	fs_resize ((void **) &stc->rec,stc->size * sizeof (STRUCTRECORD));
+      else stc->rec = (STRUCTRECORD *)
+	     fs_get (stc->size * sizeof (STRUCTRECORD));
+    }
+    memmove (&stc->rec[lo + 1],&stc->rec[lo],
+	     (stc->nrecs++ - lo) * sizeof (STRUCTRECORD));
+  }
+  r = &stc->rec[lo];
+  r->uid = uid;
+  r->size = size;
+  r->data.data = (unsigned char *) memcpy (fs_get (len + 1),data,len);
+  r->data.data[r->data.size = len] = '\0';
+  return r;
+}
+
+
+/* Structure cache remove record
+ * Accepts: structure cache
+ *	    record
+ */
+
+void structcache_remove (STRUCTCACHE *stc,STRUCTRECORD *r)
+{
+  fs_give ((void **) &r->data.data);
+  memmove (r,r + 1,(stc->rec + --stc->nrecs - r) * sizeof (STRUCTRECORD));
+}
+
+/* Structure cache fetch message structure
+ * Accepts: mail stream
+ *	    message cache element
+ *	    pointer to return envelope
+ *	    pointer to return body
+ * Returns: T if structure returned from cache, NIL otherwise
+ */
+
+long structcache_fetch (MAILSTREAM *stream,MESSAGECACHE *elt,ENVELOPE **env,
+			BODY **body)
+{
+  STCPARSE p;
+  STRUCTRECORD *r;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  STRUCTCACHE *stc = (STRUCTCACHE *) (*mc) (stream,elt->msgno,CH_STRUCTCACHE);
+  if (!(stc && stc->file && elt->private.uid &&
+	(r = structcache_lookup (stc,elt->private.uid)))) return NIL;
+  if (!elt->rfc822_size || (elt->rfc822_size == r->size)) {
+    p.s = r->data.data;
+    p.end = p.s + r->data.size;
+    p.error = NIL;
+    *env = structcache_get_envelope (&p);
+    structcache_get_body (&p,*body = mail_newbody ());
+    if (*env && !p.error && (p.s == p.end)) {
+      if (!elt->rfc822_size) elt->rfc822_size = r->size;
+      return LONGT;
+    }
+    mail_free_envelope (env);	/* damaged, discard */
+    mail_free_body (body);
+  }
+  structcache_remove (stc,r);	/* stale or damaged record */
+  stc->dirty = T;
+  return NIL;
+}
+
+
+/* Structure cache store message structure
+ * Accepts: mail stream
+ *	    message cache element
+ *	    envelope
+ *	    body
+ */
+
+void structcache_store (MAILSTREAM *stream,MESSAGECACHE *elt,ENVELOPE *env,
+			BODY *body)
+{
+  STCBUFFER b;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  STRUCTCACHE *stc = (STRUCTCACHE *) (*mc) (stream,elt->msgno,CH_STRUCTCACHE);
+  if (stc && stc->file && elt->private.uid && elt->rfc822_size && env &&
+      body && !env->incomplete) {
+    memset (&b,0,sizeof (STCBUFFER));
+    structcache_put_envelope (&b,env);
+				/* some structures can't be cached */
+    if (structcache_put_body (&b,body)) {
+      structcache_add (stc,elt->private.uid,elt->rfc822_size,b.s,b.len,T);
+      stc->dirty = T;
+    }
+    fs_give ((void **) &b.s);
+  }
+}
+
+/* Structure serialization
+ *
+ * Strings are NIL as "N" or "<decimal length>"<octets>, numbers are
+ * "<decimal>.", and lists are a sequence of tagged items ending in ".".
+ *
+ *  envelope	"N" | "E" remail return_path date from sender reply_to subject
+ *		to cc bcc in_reply_to message_id newsgroups followup_to
+ *		references
+ *  address	*("A" personal adl mailbox host error) "."
+ *  parameter	*("P" attribute value) "."
+ *  stringlist	*("L" string) "."
+ *  body	"B" type encoding subtype parameter id description
+ *		disposition.type disposition.parameter language location md5
+ *		mime.offset mime.size contents.offset contents.size lines
+ *		bytes contents
+ *  contents	multipart: *body "."
+ *		message: "N" | "M" full.offset full.size header.offset
+ *		header.size text.offset text.size envelope ("N" | body)
+ *		otherwise: empty
+ */
+
+
+/* Structure cache append to buffer
+ * Accepts: buffer
+ *	    data
+ *	    size of data
+ */
+
+void structcache_put (STCBUFFER *b,char *s,unsigned long n)
+{
+  if ((b->len + n) > b->size) {	/* grow buffer if needed */
+    b->size = b->len + n + MAILTMPLEN;
+    if (b->s) fs_resize ((void **) &b->s,b->size);
+    else b->s = (unsigned char *) fs_get (b->size);
+  }
+  memcpy (b->s + b->len,s,n);
+  b->len += n;
+}
+
+
+/* Structure cache append string
+ * Accepts: buffer
+ *	    string or NIL
+ */
+
+void structcache_put_string (STCBUFFER *b,char *s)
+{
+  char tmp[MAILTMPLEN];
+  if (s) {
+    sprintf (tmp,"%lu\"",(unsigned long) strlen (s));
+    structcache_put (b,tmp,strlen (tmp));
+    structcache_put (b,s,strlen (s));
+  }
+  else structcache_put (b,"N",1);
+}
+
+
+/* Structure cache append number
+ * Accepts: buffer
+ *	    number
+ */
+
+void structcache_put_number (STCBUFFER *b,unsigned long n)
+{
+  char tmp[MAILTMPLEN];
+  sprintf (tmp,"%lu.",n);
+  structcache_put (b,tmp,strlen (tmp));
+}
+
+/* Structure cache append address list
+ * Accepts: buffer
+ *	    address list
+ */
+
+void structcache_put_address (STCBUFFER *b,ADDRESS *adr)
+{
+  for (; adr; adr = adr->next) {
+    structcache_put (b,"A",1);
+    structcache_put_string (b,adr->personal);
+    structcache_put_string (b,adr->adl);
+    structcache_put_string (b,adr->mailbox);
+    structcache_put_string (b,adr->host);
+    structcache_put_string (b,adr->error);
+  }
+  structcache_put (b,".",1);
+}
+
+
+/* Structure cache append parameter list
+ * Accepts: buffer
+ *	    parameter list
+ */
+
+void structcache_put_parameter (STCBUFFER *b,PARAMETER *param)
+{
+  for (; param; param = param->next) {
+    structcache_put (b,"P",1);
+    structcache_put_string (b,param->attribute);
+    structcache_put_string (b,param->value);
+  }
+  structcache_put (b,".",1);
+}
+
+
+/* Structure cache append string list
+ * Accepts: buffer
+ *	    string list
+ */
+
+void structcache_put_stringlist (STCBUFFER *b,STRINGLIST *stl)
+{
+  for (; stl; stl = stl->next) {
+    structcache_put (b,"L",1);
+    structcache_put_string (b,(char *) stl->text.data);
+  }
+  structcache_put (b,".",1);
+}
+
+/* Structure cache append envelope
+ * Accepts: buffer
+ *	    envelope
+ */
+
+void structcache_put_envelope (STCBUFFER *b,ENVELOPE *env)
+{
+  if (env) {
+    structcache_put (b,"E",1);
+    structcache_put_string (b,env->remail);
+    structcache_put_address (b,env->return_path);
+    structcache_put_string (b,(char *) env->date);
+    structcache_put_address (b,env->from);
+    structcache_put_address (b,env->sender);
+    structcache_put_address (b,env->reply_to);
+    structcache_put_string (b,env->subject);
+    structcache_put_address (b,env->to);
+    structcache_put_address (b,env->cc);
+    structcache_put_address (b,env->bcc);
+    structcache_put_string (b,env->in_reply_to);
+    structcache_put_string (b,env->message_id);
+    structcache_put_string (b,env->newsgroups);
+    structcache_put_string (b,env->followup_to);
+    structcache_put_string (b,env->references);
+  }
+  else structcache_put (b,"N",1);
+}
+
+/* Structure cache append body
+ * Accepts: buffer
+ *	    body
+ * Returns: T if body serialized, NIL if it can't be
+ *
+ * Types and encodings beyond the built-in ones are numbered in the order
+ * that each process first sees them, so bodies using them aren't cached.
+ */
+
+long structcache_put_body (STCBUFFER *b,BODY *body)
+{
+  PART *part;
+  MESSAGE *msg;
+  if ((body->type > TYPEOTHER) || (body->encoding > ENCOTHER)) return NIL;
+  structcache_put (b,"B",1);
+  structcache_put_number (b,body->type);
+  structcache_put_number (b,body->encoding);
+  structcache_put_string (b,body->subtype);
+  structcache_put_parameter (b,body->parameter);
+  structcache_put_string (b,body->id);
+  structcache_put_string (b,body->description);
+  structcache_put_string (b,body->disposition.type);
+  structcache_put_parameter (b,body->disposition.parameter);
+  structcache_put_stringlist (b,body->language);
+  structcache_put_string (b,body->location);
+  structcache_put_string (b,body->md5);
+  structcache_put_number (b,body->mime.offset);
+  structcache_put_number (b,body->mime.text.size);
+  structcache_put_number (b,body->contents.offset);
+  structcache_put_number (b,body->contents.text.size);
+  structcache_put_number (b,body->size.lines);
+  structcache_put_number (b,body->size.bytes);
+  switch (body->type) {
+  case TYPEMULTIPART:		/* multiple part */
+    for (part = body->nested.part; part; part = part->next)
+      if (!structcache_put_body (b,&part->body)) return NIL;
+    structcache_put (b,".",1);
+    break;
+  case TYPEMESSAGE:		/* encapsulated message */
+    if (msg = body->nested.msg) {
+      structcache_put (b,"M",1);
+      structcache_put_number (b,msg->full.offset);
+      structcache_put_number (b,msg->full.text.size);
+      structcache_put_number (b,msg->header.offset);
+      structcache_put_number (b,msg->header.text.size);
+      structcache_put_number (b,msg->text.offset);
+      structcache_put_number (b,msg->text.text.size);
+      structcache_put_envelope (b,msg->env);
+      if (!msg->body) structcache_put (b,"N",1);
+      else if (!structcache_put_body (b,msg->body)) return NIL;
+    }
+    else structcache_put (b,"N",1);
+    break;
+  default:
+    break;
+  }
+  return LONGT;
+}
+
+/* Structure cache parse token
+ * Accepts: parse state
+ *	    token character
+ * Returns: T and skips token if present, NIL otherwise
+ */
+
+long structcache_get_token (STCPARSE *p,int c)
+{
+  if (p->error || (p->s >= p->end) || (*p->s != c)) return NIL;
+  p->s++;
+  return LONGT;
+}
+
+
+/* Structure cache parse decimal number
+ * Accepts: parse state
+ *	    delimiter which must follow number
+ * Returns: number
+ */
+
+unsigned long structcache_get_number (STCPARSE *p,int c)
+{
+  unsigned long ret = 0;
+  if (p->error || (p->s >= p->end) || !isdigit (*p->s)) p->error = T;
+  else {
+    while ((p->s < p->end) && isdigit (*p->s)) ret = ret*10 + (*p->s++ - '0');
+    if (!structcache_get_token (p,c)) p->error = T;
+  }
+  return ret;
+}
+
+
+/* Structure cache parse string
+ * Accepts: parse state
+ * Returns: string, or NIL if NIL or error
+ */
+
+char *structcache_get_string (STCPARSE *p)
+{
+  unsigned long i;
+  char *ret = NIL;
+  if (structcache_get_token (p,'N'));
+  else if (((i = structcache_get_number (p,'"')), p->error) ||
+	   (i > (unsigned long) (p->end - p->s))) p->error = T;
+  else {
+    ret = (char *) memcpy (fs_get (i + 1),p->s,i);
+    ret[i] = '\0';
+    p->s += i;
+  }
+  return ret;
+}
+
+/* Structure cache parse address list
+ * Accepts: parse state
+ * Returns: address list
+ */
+
+ADDRESS *structcache_get_address (STCPARSE *p)
+{
+  ADDRESS *ret = NIL;
+  ADDRESS *prev = NIL;
+  ADDRESS *adr;
+  while (structcache_get_token (p,'A')) {
+    adr = mail_newaddr ();
+    if (prev) prev->next = adr;
+    else ret = adr;
+    prev = adr;
+    adr->personal = structcache_get_string (p);
+    adr->adl = structcache_get_string (p);
+    adr->mailbox = structcache_get_string (p);
+    adr->host = structcache_get_string (p);
+    adr->error = structcache_get_string (p);
+  }
+  if (!structcache_get_token (p,'.')) p->error = T;
+  return ret;
+}
+
+
+/* Structure cache parse parameter list
+ * Accepts: parse state
+ * Returns: parameter list
+ */
+
+PARAMETER *structcache_get_parameter (STCPARSE *p)
+{
+  PARAMETER *ret = NIL;
+  PARAMETER *prev = NIL;
+  PARAMETER *param;
+  while (structcache_get_token (p,'P')) {
+    param = mail_newbody_parameter ();
+    if (prev) prev->next = param;
+    else ret = param;
+    prev = param;
+    param->attribute = structcache_get_string (p);
+    param->value = structcache_get_string (p);
+  }
+  if (!structcache_get_token (p,'.')) p->error = T;
+  return ret;
+}
+
+
+/* Structure cache parse string list
+ * Accepts: parse state
+ * Returns: string list
+ */
+
+STRINGLIST *structcache_get_stringlist (STCPARSE *p)
+{
+  STRINGLIST *ret = NIL;
+  STRINGLIST *prev = NIL;
+  STRINGLIST *stl;
+  char *s;
+  while (structcache_get_token (p,'L')) {
+    stl = mail_newstringlist ();
+    if (prev) prev->next = stl;
+    else ret = stl;
+    prev = stl;
+    if (s = structcache_get_string (p)) {
+      stl->text.data = (unsigned char *) s;
+      stl->text.size = strlen (s);
+    }
+  }
+  if (!structcache_get_token (p,'.')) p->error = T;
+  return ret;
+}
+
+/* Structure cache parse envelope
+ * Accepts: parse state
+ * Returns: envelope, or NIL if NIL or error
+ */
+
+ENVELOPE *structcache_get_envelope (STCPARSE *p)
+{
+  ENVELOPE *env = NIL;
+  if (structcache_get_token (p,'N'));
+  else if (structcache_get_token (p,'E')) {
+    env = mail_newenvelope ();
+    env->remail = structcache_get_string (p);
+    env->return_path = structcache_get_address (p);
+    env->date = (unsigned char *) structcache_get_string (p);
+    env->from = structcache_get_address (p);
+    env->sender = structcache_get_address (p);
+    env->reply_to = structcache_get_address (p);
+    env->subject = structcache_get_string (p);
+    env->to = structcache_get_address (p);
+    env->cc = structcache_get_address (p);
+    env->bcc = structcache_get_address (p);
+    env->in_reply_to = structcache_get_string (p);
+    env->message_id = structcache_get_string (p);
+    env->newsgroups = structcache_get_string (p);
+    env->followup_to = structcache_get_string (p);
+    env->references = structcache_get_string (p);
+  }
+  else p->error = T;
+  return env;
+}
+
+/* Structure cache parse body
+ * Accepts: parse state
+ *	    body to fill in
+ */
+
+void structcache_get_body (STCPARSE *p,BODY *body)
+{
+  PART *part;
+  PART *prev = NIL;
+  MESSAGE *msg;
+  if (!structcache_get_token (p,'B')) {
+    p->error = T;
+    return;
+  }
+  body->type = (unsigned short) structcache_get_number (p,'.');
+  body->encoding = (unsigned short) structcache_get_number (p,'.');
+  if ((body->type > TYPEOTHER) || (body->encoding > ENCOTHER)) {
+    body->type = TYPEOTHER;	/* make sure body can be freed */
+    p->error = T;
+    return;
+  }
+  body->subtype = structcache_get_string (p);
+				/* mail_free_body() wants this message */
+  if ((body->type == TYPEMESSAGE) && body->subtype &&
+      !strcmp (body->subtype,"RFC822")) body->nested.msg = mail_newmsg ();
+  body->parameter = structcache_get_parameter (p);
+  body->id = structcache_get_string (p);
+  body->description = structcache_get_string (p);
+  body->disposition.type = structcache_get_string (p);
+  body->disposition.parameter = structcache_get_parameter (p);
+  body->language = structcache_get_stringlist (p);
+  body->location = structcache_get_string (p);
+  body->md5 = structcache_get_string (p);
+  body->mime.offset = structcache_get_number (p,'.');
+  body->mime.text.size = structcache_get_number (p,'.');
+  body->contents.offset = structcache_get_number (p,'.');
+  body->contents.text.size = structcache_get_number (p,'.');
+  body->size.lines = structcache_get_number (p,'.');
+  body->size.bytes = structcache_get_number (p,'.');
+  switch (body->type) {
+  case TYPEMULTIPART:		/* multiple part */
+    while (!p->error && (p->s < p->end) && (*p->s == 'B')) {
+      part = mail_newbody_part ();
+      if (prev) prev->next = part;
+      else body->nested.part = part;
+      prev = part;
+      structcache_get_body (p,&part->body);
+    }
+    if (!structcache_get_token (p,'.')) p->error = T;
+    break;
+  case TYPEMESSAGE:		/* encapsulated message */
+    if (!(msg = body->nested.msg)) {
+      if (!structcache_get_token (p,'N')) p->error = T;
+    }
+    else if (!structcache_get_token (p,'M')) p->error = T;
+    else {
+      msg->full.offset = structcache_get_number (p,'.');
+      msg->full.text.size = structcache_get_number (p,'.');
+      msg->header.offset = structcache_get_number (p,'.');
+      msg->header.text.size = structcache_get_number (p,'.');
+      msg->text.offset = structcache_get_number (p,'.');
+      msg->text.text.size = structcache_get_number (p,'.');
+      msg->env = structcache_get_envelope (p);
+      if (!structcache_get_token (p,'N'))
+	structcache_get_body (p,msg->body = mail_newbody ());
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/* Text index
+ *
+ * A token is a maximal run of letters, digits, and non-ASCII octets in the
+ * canonical UTF-8 text which mail_search_text() searches: the message header,
+ * MIME and nested message headers, and decoded text body parts.  A search
+ * string can only be found in a message if each token run of the string is
+ * found within some token of the message, so the index narrows a TEXT or
+ * BODY search to candidate messages, which are then searched as before.
+ * Messages are indexed the first time a text search examines them.
+ *
+ * In memory, each distinct token has a posting list of the UIDs of messages
+ * which have it.  The candidates of a search string are found by matching
+ * each of its token runs against the distinct tokens and intersecting the
+ * unions of their posting lists.  Candidate lists of recent search strings
+ * are cached, and kept current as messages are indexed.
+ */
+
+
+/* Text index load
+ * Accepts: mail stream
+ *	    GET_TEXTINDEXFILE or GET_HEADERINDEXFILE
+ * Returns: text index, or NIL if stream not ready for one
+ *
+ * An index with no file is returned for streams which don't have that kind
+ * of index, so that the driver isn't asked again.
+ */
+
+TEXTINDEX *textindex_load (MAILSTREAM *stream,long op)
+{
+  int fd;
+  char *s;
+  TEXTINDEX *txi;
+				/* can't key records without UID validity */
+  if (!(stream->dtb && stream->uid_validity)) return NIL;
+  txi = (TEXTINDEX *) memset (fs_get (sizeof (TEXTINDEX)),0,
+			      sizeof (TEXTINDEX));
+  if (!stream->anonymous && !stream->uid_nosticky &&
+      !(stream->dtb->flags & DR_LOWMEM) &&
+      (s = (char *) mail_parameters (stream,op,stream))) {
+    txi->file = cpystr (s);
+    txi->uid_validity = stream->uid_validity;
+    txi->vocab = hash_create (TXIHASHSIZE);
+    if ((fd = sidecar_open (txi->file,O_RDONLY)) >= 0) {
+      if (!flock (fd,LOCK_SH)) textindex_read (txi,fd);
+      close (fd);		/* also releases the lock */
+    }
+  }
+  return txi;
+}
+
+
+/* Text index read file
+ * Accepts: text index
+ *	    locked file descriptor
+ *
+ * Records already in the index are kept in preference to those in the file.
+ */
+
+void textindex_read (TEXTINDEX *txi,int fd)
+{
+  unsigned long uid,size,len;
+  unsigned char *buf,*s,*t,*end;
+  struct stat sbuf;
+  if (fstat (fd,&sbuf)) return;
+  txi->filesize = (unsigned long) sbuf.st_size;
+  txi->filetime = (unsigned long) sbuf.st_mtime;
+  if (!sbuf.st_size || (sbuf.st_size > TXIMAXFILE)) return;
+  buf = (unsigned char *) fs_get ((size_t) sbuf.st_size + 1);
+  if ((lseek (fd,0,L_SET) == 0) &&
+      (read (fd,buf,sbuf.st_size) == sbuf.st_size)) {
+    end = buf + sbuf.st_size;
+    *end = '\0';		/* guard for strtoul() */
+				/* validate header */
+    if (!strncmp ((char *) buf,"TXI1 ",5) &&
+	(strtoul ((char *) buf + 5,(char **) &s,16) == txi->uid_validity) &&
+	(s[0] == '\015') && (s[1] == '\012'))
+      for (s += 2; (s < end) && (*s == ':'); s = t + len + 2) {
+	uid = strtoul ((char *) s + 1,(char **) &t,16);
+	if (*t != ':') break;
+	size = strtoul ((char *) t + 1,(char **) &t,16);
+	if (*t != ':') break;
+	len = strtoul ((char *) t + 1,(char **) &t,16);
+	if ((t[0] != ':') || (t[1] != '\015') || (t[2] != '\012') ||
+	    (len > (unsigned long) (end - (t += 3))) ||
+	    ((end - t) - len < 2) || (t[len] != '\015') ||
+	    (t[len + 1] != '\012')) break;
+	if (uid) textindex_add (txi,uid,size,t,len,NIL);
+      }
+  }
+  fs_give ((void **) &buf);
+}
+
+/* Text index save
+ * Accepts: mail stream
+ *
+ * Saves both the text index and the header index.
+ */
+
+void textindex_save (MAILSTREAM *stream)
+{
+  textindex_write (stream,stream->txi);
+  textindex_write (stream,stream->hxi);
+}
+
+
+/* Text index write file
+ * Accepts: mail stream
+ *	    text index
+ *
+ * Records of other sessions are merged in, and records of messages no longer
+ * in the mailbox are dropped.
+ */
+
+void textindex_write (MAILSTREAM *stream,TEXTINDEX *txi)
+{
+  int fd;
+  unsigned long i;
+  TEXTRECORD *r;
+  STCBUFFER b;
+  struct stat sbuf;
+  char tmp[MAILTMPLEN];
+  if (!(txi && txi->file && txi->dirty)) return;
+  txi->dirty = NIL;		/* only try once */
+  if ((fd = sidecar_open (txi->file,O_RDWR|O_CREAT)) < 0) return;
+  if (!flock (fd,LOCK_EX)) {	/* merge records from other sessions */
+    textindex_read (txi,fd);
+    memset (&b,0,sizeof (STCBUFFER));
+    sprintf (tmp,TXIHDRFMT,txi->uid_validity);
+    structcache_put (&b,tmp,strlen (tmp));
+    for (i = 1; i <= stream->nmsgs; ++i)
+      if (r = textindex_lookup (txi,mail_elt (stream,i)->private.uid)) {
+	sprintf (tmp,STCRECFMT,r->uid,r->size,r->tokens.size);
+	structcache_put (&b,tmp,strlen (tmp));
+	structcache_put (&b,(char *) r->tokens.data,r->tokens.size);
+	structcache_put (&b,"\015\012",2);
+      }
+    if ((lseek (fd,0,L_SET) == 0) &&
+	(write (fd,b.s,b.len) == (ssize_t) b.len)) ftruncate (fd,b.len);
+    else ftruncate (fd,0);	/* don't leave a partial file */
+    if (!fstat (fd,&sbuf)) {	/* note what we wrote */
+      txi->filesize = (unsigned long) sbuf.st_size;
+      txi->filetime = (unsigned long) sbuf.st_mtime;
+    }
+    fs_give ((void **) &b.s);
+  }
+  close (fd);			/* also releases the lock */
+}
+
+
+/* Text index refresh
+ * Accepts: mail stream
+ *
+ * Loads the text and header indexes if needed, and merges records written by
+ * other sessions or search workers since the files were last read or written.
+ */
+
+void textindex_refresh (MAILSTREAM *stream)
+{
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  textindex_reread ((TEXTINDEX *) (*mc) (stream,0,CH_TEXTINDEX));
+  textindex_reread ((TEXTINDEX *) (*mc) (stream,0,CH_HEADERINDEX));
+}
+
+
+/* Text index reread file if changed
+ * Accepts: text index
+ */
+
+void textindex_reread (TEXTINDEX *txi)
+{
+  int fd;
+  struct stat sbuf;
+  if (txi && txi->file && ((fd = sidecar_open (txi->file,O_RDONLY)) >= 0)) {
+    if (!flock (fd,LOCK_SH) && !fstat (fd,&sbuf) &&
+	(((unsigned long) sbuf.st_size != txi->filesize) ||
+	 ((unsigned long) sbuf.st_mtime != txi->filetime)))
+      textindex_read (txi,fd);
+    close (fd);			/* also releases the lock */
+  }
+}
+
+/* Text index look up record
+ * Accepts: text index
+ *	    UID
+ * Returns: record, or NIL if none
+ */
+
+TEXTRECORD *textindex_lookup (TEXTINDEX *txi,unsigned long uid)
+{
+  unsigned long lo = 0,hi = txi->nrecs,i;
+  while (lo < hi) {		/* binary search */
+    if (txi->rec[i = (lo + hi) / 2].uid == uid) return &txi->rec[i];
+    if (txi->rec[i].uid < uid) lo = i + 1;
+    else hi = i;
+  }
+  return NIL;
+}
+
+
+/* Text index add record
+ * Accepts: text index
+ *	    UID
+ *	    message RFC822 size
+ *	    space separated tokens
+ *	    length of tokens
+ *	    T to replace an existing record, NIL to keep it
+ * Returns: record
+ */
+
+TEXTRECORD *textindex_add (TEXTINDEX *txi,unsigned long uid,
+			   unsigned long size,unsigned char *data,
+			   unsigned long len,long replace)
+{
+  unsigned long lo = 0,hi = txi->nrecs,i;
+  TEXTRECORD *r;
+  while (lo < hi) {		/* binary search for insertion point */
+    if (txi->rec[i = (lo + hi) / 2].uid < uid) lo = i + 1;
+    else hi = i;
+  }
+  if ((lo < txi->nrecs) && (txi->rec[lo].uid == uid)) {
+    if (!replace) return &txi->rec[lo];
+    fs_give ((void **) &txi->rec[lo].tokens.data);
+  }
+  else {			/* new record, make room for it */
+    if (txi->nrecs == txi->size) {
+      txi->size += STCINCREMENT;
+      if (txi->rec)
+	fs_resize ((void **) &txi->rec,txi->size * sizeof (TEXTRECORD));
+      else txi->rec = (TEXTRECORD *) fs_get (txi->size * sizeof (TEXTRECORD));
+    }
+    memmove (&txi->rec[lo + 1],&txi->rec[lo],
+	     (txi->nrecs++ - lo) * sizeof (TEXTRECORD));
+  }
+  r = &txi->rec[lo];
+  r->uid = uid;
+  r->size = size;
+  r->tokens.data = (unsigned char *) fs_get (len + 1);
+  if (len) memcpy (r->tokens.data,data,len);
+  r->tokens.data[r->tokens.size = len] = '\0';
+  textindex_post (txi,r);	/* add to posting lists */
+  return r;
+}
+
+
+/* Text index remove record
+ * Accepts: text index
+ *	    record
+ *
+ * The UID stays in posting lists, which only makes it a needless candidate.
+ */
+
+void textindex_remove (TEXTINDEX *txi,TEXTRECORD *r)
+{
+  fs_give ((void **) &r->tokens.data);
+  memmove (r,r + 1,(txi->rec + --txi->nrecs - r) * sizeof (TEXTRECORD));
+}
+
+/* Text index post record tokens
+ * Accepts: text index
+ *	    record
+ */
+
+void textindex_post (TEXTINDEX *txi,TEXTRECORD *r)
+{
+  void **p;
+  TEXTTOKEN *tok;
+  TEXTQUERY *q;
+  unsigned char c,*s,*t;
+  unsigned char *end = r->tokens.data + r->tokens.size;
+  for (s = r->tokens.data; s < end; s = t + 1) {
+    for (t = s; (t < end) && (*t != ' '); ++t);
+    if (t == s) continue;	/* ignore empty token */
+    c = *t;			/* tie off token for lookup */
+    *t = '\0';
+    if (p = hash_lookup (txi->vocab,(char *) s)) tok = (TEXTTOKEN *) *p;
+    else {			/* new token */
+      tok = (TEXTTOKEN *) memset (fs_get (sizeof (TEXTTOKEN)),0,
+				  sizeof (TEXTTOKEN));
+      tok->name.data = (unsigned char *) cpystr ((char *) s);
+      tok->name.size = t - s;
+      hash_add (txi->vocab,(char *) tok->name.data,tok,0);
+      if (txi->ntokens == txi->tokensize) {
+	txi->tokensize += TXIINCREMENT;
+	if (txi->token) fs_resize ((void **) &txi->token,
+				   txi->tokensize * sizeof (TEXTTOKEN *));
+	else txi->token = (TEXTTOKEN **)
+	       fs_get (txi->tokensize * sizeof (TEXTTOKEN *));
+      }
+      txi->token[txi->ntokens++] = tok;
+    }
+    *t = c;			/* restore delimiter */
+    if (tok->nuids == tok->size) {
+      if (tok->uid) fs_resize ((void **) &tok->uid,
+			       (tok->size *= 2) * sizeof (unsigned long));
+      else tok->uid = (unsigned long *)
+	     fs_get ((tok->size = 4) * sizeof (unsigned long));
+    }
+    tok->uid[tok->nuids++] = r->uid;
+  }
+				/* keep cached queries current */
+  for (q = txi->query; q; q = q->next)
+    if (!q->all && textindex_match (r,q->tag,&q->text))
+      textindex_insert (q,r->uid);
+}
+
+
+/* Text index test record against search string
+ * Accepts: record
+ *	    field tag of tokens to search
+ *	    search string
+ * Returns: T if every token run of string is found within a record token
+ */
+
+long textindex_match (TEXTRECORD *r,char *tag,SIZEDTEXT *pat)
+{
+  unsigned char *s,*t,*u,*v;
+  unsigned char *end = pat->data + pat->size;
+  unsigned char *rend = r->tokens.data + r->tokens.size;
+  size_t i = strlen (tag);
+  for (s = pat->data; s < end; s = t) {
+    while ((s < end) && !TXITOKEN (*s)) ++s;
+    for (t = s; (t < end) && TXITOKEN (*t); ++t);
+    if (t == s) break;		/* no more token runs */
+    for (u = r->tokens.data; u < rend; u = v + 1) {
+      for (v = u; (v < rend) && (*v != ' '); ++v);
+      if (((size_t) (v - u) >= i) && !memcmp (u,tag,i) &&
+	  ssearch (u + i,(v - u) - i,s,t - s)) break;
+    }
+    if (u >= rend) return NIL;	/* token run not found */
+  }
+  return LONGT;
+}
+
+/* Text index insert candidate
+ * Accepts: query
+ *	    UID
+ */
+
+void textindex_insert (TEXTQUERY *q,unsigned long uid)
+{
+  unsigned long lo = 0,hi = q->nuids,i;
+  while (lo < hi) {		/* binary search for insertion point */
+    if (q->uid[i = (lo + hi) / 2] < uid) lo = i + 1;
+    else hi = i;
+  }
+  if ((lo < q->nuids) && (q->uid[lo] == uid)) return;
+  if (q->nuids == q->size) {	/* make room for it */
+    q->size += STCINCREMENT;
+    if (q->uid) fs_resize ((void **) &q->uid,q->size * sizeof (unsigned long));
+    else q->uid = (unsigned long *) fs_get (q->size * sizeof (unsigned long));
+  }
+  memmove (&q->uid[lo + 1],&q->uid[lo],
+	   (q->nuids++ - lo) * sizeof (unsigned long));
+  q->uid[lo] = uid;
+}
+
+
+/* Text index test candidate
+ * Accepts: query
+ *	    UID
+ * Returns: T if message with UID may contain the search string
+ */
+
+long textindex_candidate (TEXTQUERY *q,unsigned long uid)
+{
+  unsigned long lo = 0,hi = q->nuids,i;
+  if (q->all) return LONGT;
+  while (lo < hi) {		/* binary search */
+    if (q->uid[i = (lo + hi) / 2] == uid) return LONGT;
+    if (q->uid[i] < uid) lo = i + 1;
+    else hi = i;
+  }
+  return NIL;
+}
+
+/* Text index query search string
+ * Accepts: text index
+ *	    field tag of tokens to search, or NIL for untagged tokens
+ *	    canonical search string
+ * Returns: query with candidate UIDs
+ */
+
+TEXTQUERY *textindex_query (TEXTINDEX *txi,char *tag,SIZEDTEXT *pat)
+{
+  unsigned long i,j,k,n,size,l;
+  unsigned long *u;
+  unsigned char *s,*t;
+  unsigned char *end = pat->data + pat->size;
+  TEXTTOKEN *tok;
+  TEXTQUERY *q,**qp;
+  if (!tag) tag = "";		/* untagged tokens */
+				/* in query cache? */
+  for (q = txi->query; q; q = q->next)
+    if ((q->text.size == pat->size) && !strcmp (q->tag,tag) &&
+	!memcmp (q->text.data,pat->data,pat->size)) return q;
+  q = (TEXTQUERY *) memset (fs_get (sizeof (TEXTQUERY)),0,sizeof (TEXTQUERY));
+  q->tag = cpystr (tag);
+  l = strlen (tag);
+  q->text.data = (unsigned char *) fs_get (pat->size + 1);
+  memcpy (q->text.data,pat->data,q->text.size = pat->size);
+  q->text.data[q->text.size] = '\0';
+  q->all = T;			/* all candidates until a token run seen */
+  for (s = pat->data; s < end; s = t) {
+    while ((s < end) && !TXITOKEN (*s)) ++s;
+    for (t = s; (t < end) && TXITOKEN (*t); ++t);
+    if (t == s) break;		/* no more token runs */
+				/* union of postings of matching tokens */
+    for (i = n = size = 0, u = NIL; i < txi->ntokens; ++i)
+      if (((tok = txi->token[i])->name.size >= l + (t - s)) &&
+	  !memcmp (tok->name.data,tag,l) &&
+	  ssearch (tok->name.data + l,tok->name.size - l,s,t - s)) {
+	if ((n + tok->nuids) > size) {
+	  size = n + tok->nuids + STCINCREMENT;
+	  if (u) fs_resize ((void **) &u,size * sizeof (unsigned long));
+	  else u = (unsigned long *) fs_get (size * sizeof (unsigned long));
+	}
+	memcpy (u + n,tok->uid,tok->nuids * sizeof (unsigned long));
+	n += tok->nuids;
+      }
+    if (n) {			/* sort and eliminate duplicates */
+      qsort (u,n,sizeof (unsigned long),textindex_compare_uid);
+      for (i = j = 1; i < n; ++i) if (u[i] != u[j - 1]) u[j++] = u[i];
+      n = j;
+    }
+    if (q->all) {		/* first token run */
+      q->all = NIL;
+      q->uid = u;
+      q->nuids = n;
+      q->size = size;
+    }
+    else {			/* intersect with candidates so far */
+      for (i = j = k = 0; (i < q->nuids) && (j < n);)
+	if (q->uid[i] < u[j]) ++i;
+	else if (q->uid[i] > u[j]) ++j;
+	else {			/* in both, keep it */
+	  q->uid[k++] = u[j++];
+	  ++i;
+	}
+      q->nuids = k;
+      if (u) fs_give ((void **) &u);
+    }
+  }
+  q->next = txi->query;		/* cache the query */
+  txi->query = q;
+  for (i = 1, qp = &q->next; *qp && (i < TXIQUERIES); ++i) qp = &(*qp)->next;
+  while (q = *qp) {		/* flush excess queries */
+    *qp = q->next;
+    fs_give ((void **) &q->tag);
+    fs_give ((void **) &q->text.data);
+    if (q->uid) fs_give ((void **) &q->uid);
+    fs_give ((void **) &q);
+  }
+  return txi->query;
+}
+
+
+/* Text index compare UIDs
+ * Accepts: first UID
+ *	    second UID
+ * Returns: negative if first < second, 0 if equal, positive if first > second
+ */
+
+int textindex_compare_uid (const void *a1,const void *a2)
+{
+  unsigned long u1 = *(unsigned long *) a1;
+  unsigned long u2 = *(unsigned long *) a2;
+  return (u1 < u2) ? -1 : ((u1 > u2) ? 1 : 0);
+}
+
+
+/* Text index compare tokens
+ * Accepts: first token
+ *	    second token
+ * Returns: negative if first < second, 0 if equal, positive if first > second
+ */
+
+int textindex_compare_token (const void *a1,const void *a2)
+{
+  return strcmp (*(char **) a1,*(char **) a2);
+}
+
+/* Text index search message
+ * Accepts: mail stream
+ *	    message cache element
+ *	    section being searched, or NIL for the whole message
+ *	    canonical search strings
+ * Returns: T if the message may contain all the strings, NIL if it can't
+ */
+
+long textindex_search (MAILSTREAM *stream,MESSAGECACHE *elt,char *section,
+		       STRINGLIST *st)
+{
+  TEXTRECORD *r;
+  TEXTINDEX *txi;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  if (section || !elt->private.uid) return LONGT;
+  txi = (TEXTINDEX *) (*mc) (stream,elt->msgno,CH_TEXTINDEX);
+  if (!(txi && txi->file)) return LONGT;
+				/* discard stale record */
+  if ((r = textindex_lookup (txi,elt->private.uid)) && elt->rfc822_size &&
+      (r->size != elt->rfc822_size)) {
+    textindex_remove (txi,r);
+    r = NIL;
+  }
+				/* index message if not already */
+  if (!(r || (r = textindex_index (stream,elt,txi)))) return LONGT;
+  for (; st; st = st->next)
+    if (!textindex_candidate (textindex_query (txi,NIL,&st->text),r->uid))
+      return NIL;
+  return LONGT;
+}
+
+/* Text index index message
+ * Accepts: mail stream
+ *	    message cache element
+ *	    text index
+ * Returns: new record, or NIL if message can't be indexed
+ */
+
+TEXTRECORD *textindex_index (MAILSTREAM *stream,MESSAGECACHE *elt,
+			     TEXTINDEX *txi)
+{
+  BODY *body;
+  SIZEDTEXT s,t;
+  STCBUFFER b;
+  if (!elt->rfc822_size) return NIL;
+  memset (&b,0,sizeof (STCBUFFER));
+				/* message header */
+  s.data = (unsigned char *)
+    mail_fetch_header (stream,elt->msgno,NIL,NIL,&s.size,FT_INTERNAL|FT_PEEK);
+  utf8_mime2text (&s,&t,U8T_CANONICAL);
+  textindex_tokens (&b,NIL,&t);
+  if (t.data != s.data) fs_give ((void **) &t.data);
+				/* and the body parts */
+  mail_fetchstructure (stream,elt->msgno,&body);
+  if (body) textindex_index_body (stream,elt->msgno,body,NIL,1,&b);
+  return textindex_record (txi,elt,&b);
+}
+
+
+/* Text index make record from tokens
+ * Accepts: text index
+ *	    message cache element
+ *	    token buffer, freed by this routine
+ * Returns: new record
+ */
+
+TEXTRECORD *textindex_record (TEXTINDEX *txi,MESSAGECACHE *elt,STCBUFFER *b)
+{
+  unsigned long i,j,n;
+  char **tok;
+  STCBUFFER c;
+  TEXTRECORD *r;
+  memset (&c,0,sizeof (STCBUFFER));
+				/* sort the tokens */
+  for (i = n = 0; i < b->len; ++i) if (!b->s[i]) ++n;
+  tok = (char **) fs_get ((n + 1) * sizeof (char *));
+  for (i = j = 0; j < n; ++j) i += strlen (tok[j] = (char *) b->s + i) + 1;
+  qsort (tok,n,sizeof (char *),textindex_compare_token);
+  for (j = 0; j < n; ++j)	/* make record of distinct tokens */
+    if (!j || strcmp (tok[j],tok[j - 1])) {
+      if (j) structcache_put (&c," ",1);
+      structcache_put (&c,tok[j],strlen (tok[j]));
+    }
+  r = textindex_add (txi,elt->private.uid,elt->rfc822_size,c.s,c.len,T);
+  txi->dirty = T;		/* new record to save */
+  fs_give ((void **) &tok);
+  if (b->s) fs_give ((void **) &b->s);
+  if (c.s) fs_give ((void **) &c.s);
+  return r;
+}
+
+/* Text index index body part
+ * Accepts: mail stream
+ *	    message number
+ *	    current body pointer
+ *	    hierarchical level prefix
+ *	    position at current hierarchical level
+ *	    token buffer
+ *
+ * Examines the same text as mail_search_body() does for a TEXT search.
+ */
+
+void textindex_index_body (MAILSTREAM *stream,unsigned long msgno,BODY *body,
+			   char *prefix,unsigned long section,STCBUFFER *b)
+{
+  unsigned long i;
+  char *s,*t,sect[MAILTMPLEN];
+  SIZEDTEXT st,h;
+  PART *part;
+  PARAMETER *param;
+  if (prefix && (strlen (prefix) > (MAILTMPLEN - 20))) return;
+  sprintf (sect,"%s%lu",prefix ? prefix : "",section++);
+  if (prefix) {			/* MIME header */
+    st.data = (unsigned char *) mail_fetch_mime (stream,msgno,sect,&st.size,
+						 FT_INTERNAL | FT_PEEK);
+    utf8_mime2text (&st,&h,U8T_CANONICAL);
+    textindex_tokens (b,NIL,&h);
+    if (h.data != st.data) fs_give ((void **) &h.data);
+  }
+  switch (body->type) {
+  case TYPEMULTIPART:
+				/* extend prefix if not first time */
+    s = prefix ? strcat (sect,".") : "";
+    for (i = 1,part = body->nested.part; part; i++,part = part->next)
+      textindex_index_body (stream,msgno,&part->body,s,i,b);
+    break;
+  case TYPEMESSAGE:
+    if (!strcmp (body->subtype,"RFC822")) {
+      st.data = (unsigned char *)	/* nested message header */
+	mail_fetch_header (stream,msgno,sect,NIL,&st.size,FT_INTERNAL|FT_PEEK);
+      utf8_mime2text (&st,&h,U8T_CANONICAL);
+      textindex_tokens (b,NIL,&h);
+      if (h.data != st.data) fs_give ((void **) &h.data);
+      if (body = body->nested.msg->body) {
+	if (body->type == TYPEMULTIPART)
+	  textindex_index_body (stream,msgno,body,(prefix ? prefix : ""),
+				section - 1,b);
+	else textindex_index_body (stream,msgno,body,strcat (sect,"."),1,b);
+      }
+      break;
+    }
+				/* non-MESSAGE/RFC822 falls into text case */
+
+  case TYPETEXT:
+    s = mail_fetch_body (stream,msgno,sect,&i,FT_INTERNAL | FT_PEEK);
+    for (t = NIL,param = body->parameter; param && !t; param = param->next)
+      if (!strcmp (param->attribute,"CHARSET")) t = param->value;
+    switch (body->encoding) {	/* what encoding? */
+    case ENCBASE64:
+      st.data = (unsigned char *) rfc822_base64 ((unsigned char *) s,i,&st.size);
+      break;
+    case ENCQUOTEDPRINTABLE:
+      st.data = rfc822_qprint ((unsigned char *) s,i,&st.size);
+      break;
+    default:
+      st.data = (unsigned char *) s;
+      st.size = i;
+      break;
+    }
+    if (st.data) {		/* convert to UTF-8 as best we can */
+      if (!utf8_text (&st,t,&h,U8T_CANONICAL))
+	utf8_text (&st,NIL,&h,U8T_CANONICAL);
+      textindex_tokens (b,NIL,&h);
+      if (h.data != st.data) fs_give ((void **) &h.data);
+      if (st.data != (unsigned char *) s) fs_give ((void **) &st.data);
+    }
+    break;
+  }
+}
+
+
+/* Text index collect tokens
+ * Accepts: token buffer
+ *	    field tag to prefix each token with, or NIL
+ *	    canonical text
+ *
+ * Each token is appended to the buffer followed by a NUL.
+ */
+
+void textindex_tokens (STCBUFFER *b,char *tag,SIZEDTEXT *txt)
+{
+  unsigned char *s,*t;
+  unsigned char *end = txt->data + txt->size;
+  for (s = txt->data; s < end; s = t) {
+    while ((s < end) && !TXITOKEN (*s)) ++s;
+    for (t = s; (t < end) && TXITOKEN (*t); ++t);
+    if (t > s) {
+      if (tag) structcache_put (b,tag,strlen (tag));
+      structcache_put (b,(char *) s,t - s);
+      structcache_put (b,"",1);
+    }
+  }
+}
+
+/* Header index
+ *
+ * For FROM, TO, CC, BCC, and SUBJECT, and for HEADER searches of header names
+ * set by SET_INDEXHEADERS, the header index holds the tokens of the canonical
+ * text which mail_search_msg() searches, tagged with the lower case field
+ * name and a colon, e.g. "from:alice".  A search key rules out a message as
+ * it does in the text index, but only tokens with the tag of the searched
+ * field are considered.  Each record also has the bare tag of every header
+ * name it indexed, so that a record made before a name was added to the
+ * list is made anew rather than wrongly ruling out messages.
+ */
+
+
+/* Header index search message
+ * Accepts: mail stream
+ *	    message cache element
+ *	    section being searched, or NIL for the whole message
+ *	    search program
+ * Returns: T if the message may satisfy the header criteria, NIL if it can't
+ */
+
+long headerindex_search (MAILSTREAM *stream,MESSAGECACHE *elt,char *section,
+			 SEARCHPGM *pgm)
+{
+  char tag[MAILTMPLEN];
+  TEXTRECORD *r;
+  TEXTINDEX *hxi;
+  SEARCHHEADER *hdr;
+  char *names = (char *) mail_parameters (NIL,GET_INDEXHEADERS,NIL);
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  if (section || !elt->private.uid) return LONGT;
+				/* any indexed criteria? */
+  for (hdr = pgm->header; hdr && !(hdr->text.size &&
+				   headerindex_tag (tag,names,&hdr->line));
+       hdr = hdr->next);
+  if (!(pgm->from || pgm->to || pgm->cc || pgm->bcc || pgm->subject || hdr))
+    return LONGT;
+  hxi = (TEXTINDEX *) (*mc) (stream,elt->msgno,CH_HEADERINDEX);
+  if (!(hxi && hxi->file)) return LONGT;
+				/* discard stale record */
+  if ((r = textindex_lookup (hxi,elt->private.uid)) && elt->rfc822_size &&
+      (r->size != elt->rfc822_size)) {
+    textindex_remove (hxi,r);
+    r = NIL;
+  }
+				/* index message if not already */
+  if (!(r || (r = headerindex_index (stream,elt,hxi)))) return LONGT;
+  for (; hdr; hdr = hdr->next)	/* header names indexed by the record? */
+    if (hdr->text.size && headerindex_tag (tag,names,&hdr->line) &&
+	!textindex_has (r,tag) && !(r = headerindex_index (stream,elt,hxi)))
+      return LONGT;
+  if (!(headerindex_candidate (hxi,r,"from:",pgm->from) &&
+	headerindex_candidate (hxi,r,"to:",pgm->to) &&
+	headerindex_candidate (hxi,r,"cc:",pgm->cc) &&
+	headerindex_candidate (hxi,r,"bcc:",pgm->bcc) &&
+	headerindex_candidate (hxi,r,"subject:",pgm->subject))) return NIL;
+  for (hdr = pgm->header; hdr; hdr = hdr->next)
+    if (hdr->text.size && headerindex_tag (tag,names,&hdr->line) &&
+	!textindex_candidate (textindex_query (hxi,tag,&hdr->text),r->uid))
+      return NIL;
+  return LONGT;
+}
+
+
+/* Header index test candidate for field
+ * Accepts: header index
+ *	    record
+ *	    field tag
+ *	    canonical search strings, or NIL
+ * Returns: T if the field may contain all the strings, NIL if it can't
+ */
+
+long headerindex_candidate (TEXTINDEX *hxi,TEXTRECORD *r,char *tag,
+			    STRINGLIST *st)
+{
+  for (; st; st = st->next)
+    if (!textindex_candidate (textindex_query (hxi,tag,&st->text),r->uid))
+      return NIL;
+  return LONGT;
+}
+
+/* Header index index message
+ * Accepts: mail stream
+ *	    message cache element
+ *	    header index
+ * Returns: new record, or NIL if message can't be indexed
+ */
+
+TEXTRECORD *headerindex_index (MAILSTREAM *stream,MESSAGECACHE *elt,
+			       TEXTINDEX *hxi)
+{
+  unsigned long i;
+  char *s,*t,tag[MAILTMPLEN];
+  ENVELOPE *env;
+  SIZEDTEXT h;
+  STRINGLIST sth;
+  STCBUFFER b;
+  if (!(elt->rfc822_size && (env = mail_fetchenvelope (stream,elt->msgno))))
+    return NIL;
+  memset (&b,0,sizeof (STCBUFFER));
+  headerindex_addr (&b,"from:",env->from);
+  headerindex_addr (&b,"to:",env->to);
+  headerindex_addr (&b,"cc:",env->cc);
+  headerindex_addr (&b,"bcc:",env->bcc);
+  if (h.data = (unsigned char *) env->subject) {
+    h.size = strlen (env->subject);
+    headerindex_field (&b,"subject:",&h);
+  }
+				/* and the administrator's header names */
+  for (s = (char *) mail_parameters (NIL,GET_INDEXHEADERS,NIL);
+       s = headerindex_name (tag,s);) {
+				/* note header name indexed */
+    structcache_put (&b,tag,strlen (tag) + 1);
+    sth.next = NIL;		/* fetch its lines as mail_search_msg() does */
+    sth.text.data = (unsigned char *) tag;
+    sth.text.size = strlen (tag) - 1;
+    if ((t = mail_fetch_header (stream,elt->msgno,NIL,&sth,&i,
+				FT_INTERNAL | FT_PEEK)) && strchr (t,':')) {
+      mail_search_fields (t,i,&h);
+      headerindex_field (&b,tag,&h);
+      fs_give ((void **) &h.data);
+    }
+  }
+  return textindex_record (hxi,elt,&b);
+}
+
+
+/* Header index collect address list tokens
+ * Accepts: token buffer
+ *	    field tag
+ *	    address list
+ */
+
+void headerindex_addr (STCBUFFER *b,char *tag,ADDRESS *adr)
+{
+  SIZEDTEXT txt;
+  if (adr) {			/* same text as mail_search_addr() */
+    mail_search_addrtext (adr,&txt);
+    headerindex_field (b,tag,&txt);
+    fs_give ((void **) &txt.data);
+  }
+}
+
+
+/* Header index collect field tokens
+ * Accepts: token buffer
+ *	    field tag
+ *	    field text
+ */
+
+void headerindex_field (STCBUFFER *b,char *tag,SIZEDTEXT *txt)
+{
+  SIZEDTEXT h;
+				/* same text as mail_search_header() */
+  utf8_mime2text (txt,&h,U8T_CANONICAL);
+  textindex_tokens (b,tag,&h);
+  if (h.data != txt->data) fs_give ((void **) &h.data);
+}
+
+/* Header index get next header name
+ * Accepts: destination tag buffer
+ *	    header name list, or NIL
+ * Returns: rest of list after the name, or NIL if no more names
+ *
+ * Names are separated by spaces or commas, and returned as tags.
+ */
+
+char *headerindex_name (char *tag,char *s)
+{
+  size_t i;
+  if (s) {
+    while ((*s == ' ') || (*s == ',')) ++s;
+    for (i = 0; s[i] && (s[i] != ' ') && (s[i] != ','); ++i);
+    if (i && (i < MAILTMPLEN - 1)) {
+      memcpy (tag,s,i);		/* lower case name and a colon */
+      tag[i] = '\0';
+      lcase ((unsigned char *) tag);
+      strcpy (tag + i,":");
+      return s + i;
+    }
+  }
+  return NIL;
+}
+
+
+/* Header index get tag of header name
+ * Accepts: destination tag buffer
+ *	    header name list, or NIL
+ *	    header name searched
+ * Returns: T if header name is indexed, else NIL
+ */
+
+long headerindex_tag (char *tag,char *names,SIZEDTEXT *line)
+{
+  while (names = headerindex_name (tag,names)) {
+    tag[strlen (tag) - 1] = '\0';
+    if (!compare_csizedtext ((unsigned char *) tag,line)) {
+      strcat (tag,":");
+      return LONGT;
+    }
+  }
+  return NIL;
+}
+
+
+/* Text index test record for token
+ * Accepts: record
+ *	    token
+ * Returns: T if record has the token, else NIL
+ */
+
+long textindex_has (TEXTRECORD *r,char *token)
+{
+  unsigned char *s,*t;
+  unsigned char *end = r->tokens.data + r->tokens.size;
+  size_t i = strlen (token);
+  for (s = r->tokens.data; s < end; s = t + 1) {
+    for (t = s; (t < end) && (*t != ' '); ++t);
+    if (((size_t) (t - s) == i) && !memcmp (s,token,i)) return LONGT;
+  }
+  return NIL;
+}
+
+/* Sortcache load
+ * Accepts: mail stream
+ * Returns: sidecar sortcache, or NIL if stream not ready for one
+ *
+ * A sortcache with no file is returned for streams whose driver doesn't want
+ * one, so that it isn't looked for again.  Entries are read from the file by
+ * sortcache_refresh().
+ */
+
+SORTFILE *sortcache_load (MAILSTREAM *stream)
+{
+  char tmp[MAILTMPLEN];
+  SORTFILE *srt;
+				/* can't key entries without UID validity */
+  if (!(stream->dtb && stream->uid_validity)) return NIL;
+  srt = (SORTFILE *) memset (fs_get (sizeof (SORTFILE)),0,sizeof (SORTFILE));
+  if ((stream->dtb->flags & DR_SORTCACHE) && !stream->anonymous &&
+      !stream->uid_nosticky && stream->mailbox &&
+      sidecar_file (tmp,stream->mailbox,SIDECARSORT)) {
+    srt->file = cpystr (tmp);
+    srt->uid_validity = stream->uid_validity;
+  }
+  return srt;
+}
+
+
+/* Sortcache refresh
+ * Accepts: mail stream
+ * Returns: T if stream has a sortcache file, else NIL
+ *
+ * Loads the sortcache if needed, and merges entries written by other sessions
+ * since the file was last read or written.
+ */
+
+long sortcache_refresh (MAILSTREAM *stream)
+{
+  int fd;
+  struct stat sbuf;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  SORTFILE *srt = (SORTFILE *) (*mc) (stream,0,CH_SORTFILE);
+  if (!(srt && srt->file)) return NIL;
+  if ((fd = sidecar_open (srt->file,O_RDONLY)) >= 0) {
+    if (!flock (fd,LOCK_SH) && !fstat (fd,&sbuf) &&
+	(((unsigned long) sbuf.st_size != srt->filesize) ||
+	 ((unsigned long) sbuf.st_mtime != srt->filetime)))
+      sortcache_read (stream,srt,fd);
+    close (fd);			/* also releases the lock */
+  }
+  return LONGT;
+}
+
+/* Sortcache read file
+ * Accepts: mail stream
+ *	    sidecar sortcache
+ *	    locked file descriptor
+ *
+ * Keys already in a message's SORTCACHE are kept in preference to those in
+ * the file.
+ */
+
+void sortcache_read (MAILSTREAM *stream,SORTFILE *srt,int fd)
+{
+  unsigned long uid,size,len,msgno;
+  unsigned char *buf,*s,*t,*end;
+  MESSAGECACHE *elt;
+  STCPARSE p;
+  struct stat sbuf;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  if (fstat (fd,&sbuf)) return;
+  srt->filesize = (unsigned long) sbuf.st_size;
+  srt->filetime = (unsigned long) sbuf.st_mtime;
+  if (!sbuf.st_size || (sbuf.st_size > SRTMAXFILE)) return;
+  buf = (unsigned char *) fs_get ((size_t) sbuf.st_size + 1);
+  if ((lseek (fd,0,L_SET) == 0) &&
+      (read (fd,buf,sbuf.st_size) == sbuf.st_size)) {
+    end = buf + sbuf.st_size;
+    *end = '\0';		/* guard for strtoul() */
+				/* validate header */
+    if (!strncmp ((char *) buf,"SRT1 ",5) &&
+	(strtoul ((char *) buf + 5,(char **) &s,16) == srt->uid_validity) &&
+	(s[0] == '\015') && (s[1] == '\012'))
+      for (s += 2; (s < end) && (*s == ':'); s = t + len + 2) {
+	uid = strtoul ((char *) s + 1,(char **) &t,16);
+	if (*t != ':') break;
+	size = strtoul ((char *) t + 1,(char **) &t,16);
+	if (*t != ':') break;
+	len = strtoul ((char *) t + 1,(char **) &t,16);
+	if ((t[0] != ':') || (t[1] != '\015') || (t[2] != '\012') ||
+	    (len > (unsigned long) (end - (t += 3))) ||
+	    ((end - t) - len < 2) || (t[len] != '\015') ||
+	    (t[len + 1] != '\012')) break;
+				/* message still here and unchanged? */
+	if (uid && (msgno = mail_msgno (stream,uid)) &&
+	    (!size || !(elt = mail_elt (stream,msgno))->rfc822_size ||
+	     (elt->rfc822_size == size))) {
+	  p.s = t;
+	  p.end = t + len;
+	  p.error = NIL;
+	  sortcache_get_entry (&p,(SORTCACHE *)
+			       (*mc) (stream,msgno,CH_SORTCACHE));
+	}
+      }
+  }
+  fs_give ((void **) &buf);
+}
+
+/* Sortcache save
+ * Accepts: mail stream
+ *
+ * Does nothing unless some SORTCACHE entry has keys not yet written.  Entries
+ * of other sessions are merged in, and entries of messages no longer in the
+ * mailbox are dropped.
+ */
+
+void sortcache_save (MAILSTREAM *stream)
+{
+  int fd;
+  unsigned long i;
+  SORTCACHE *sc;
+  STCBUFFER b,e;
+  struct stat sbuf;
+  char tmp[MAILTMPLEN];
+  SORTFILE *srt = stream->srt;
+  mailcache_t mc = (mailcache_t) mail_parameters (NIL,GET_CACHE,NIL);
+  if (!(srt && srt->file)) return;
+  for (i = 1; (i <= stream->nmsgs) &&
+	 !((SORTCACHE *) (*mc) (stream,i,CH_SORTCACHE))->dirty; ++i);
+  if ((i > stream->nmsgs) ||
+      ((fd = sidecar_open (srt->file,O_RDWR|O_CREAT)) < 0)) return;
+  if (!flock (fd,LOCK_EX)) {	/* merge entries from other sessions */
+    if (!fstat (fd,&sbuf) &&
+	(((unsigned long) sbuf.st_size != srt->filesize) ||
+	 ((unsigned long) sbuf.st_mtime != srt->filetime)))
+      sortcache_read (stream,srt,fd);
+    memset (&b,0,sizeof (STCBUFFER));
+    memset (&e,0,sizeof (STCBUFFER));
+    sprintf (tmp,SRTHDRFMT,srt->uid_validity);
+    structcache_put (&b,tmp,strlen (tmp));
+    for (i = 1; i <= stream->nmsgs; ++i) {
+      (sc = (SORTCACHE *) (*mc) (stream,i,CH_SORTCACHE))->dirty = NIL;
+      e.len = 0;		/* serialize entry */
+      if (sortcache_put_entry (&e,sc)) {
+	sprintf (tmp,STCRECFMT,mail_uid (stream,i),
+		 mail_elt (stream,i)->rfc822_size,e.len);
+	structcache_put (&b,tmp,strlen (tmp));
+	structcache_put (&b,(char *) e.s,e.len);
+	structcache_put (&b,"\015\012",2);
+      }
+    }
+    if ((lseek (fd,0,L_SET) == 0) &&
+	(write (fd,b.s,b.len) == (ssize_t) b.len)) ftruncate (fd,b.len);
+    else ftruncate (fd,0);	/* don't leave a partial file */
+    if (!fstat (fd,&sbuf)) {	/* note what we wrote */
+      srt->filesize = (unsigned long) sbuf.st_size;
+      srt->filetime = (unsigned long) sbuf.st_mtime;
+    }
+    fs_give ((void **) &b.s);
+    if (e.s) fs_give ((void **) &e.s);
+  }
+  close (fd);			/* also releases the lock */
+}
+
+/* Sortcache serialize entry
+ * Accepts: buffer
+ *	    SORTCACHE entry
+ * Returns: T if entry serialized, NIL if it has no keys
+ *
+ *  entry	date arrival size refwd from to cc subject message_id
+ *		references *("B" section size) "."
+ *
+ * A NIL references list is not loaded, while a list of one NIL string is
+ * loaded and empty.
+ */
+
+long sortcache_put_entry (STCBUFFER *b,SORTCACHE *sc)
+{
+  BINARYSIZE *bs;
+  if (!(sc->date || sc->arrival || sc->size || sc->from || sc->to || sc->cc ||
+	sc->subject || sc->message_id || sc->references || sc->binsize))
+    return NIL;
+  structcache_put_number (b,sc->date);
+  structcache_put_number (b,sc->arrival);
+  structcache_put_number (b,sc->size);
+  structcache_put_number (b,sc->refwd ? 1 : 0);
+  structcache_put_string (b,sc->from);
+  structcache_put_string (b,sc->to);
+  structcache_put_string (b,sc->cc);
+  structcache_put_string (b,sc->subject);
+  structcache_put_string (b,sc->message_id);
+  structcache_put_stringlist (b,sc->references);
+  for (bs = sc->binsize; bs; bs = bs->next) {
+    structcache_put (b,"B",1);
+    structcache_put_string (b,bs->section);
+    structcache_put_number (b,bs->size);
+  }
+  structcache_put (b,".",1);
+  return LONGT;
+}
+
+
+/* Sortcache parse entry
+ * Accepts: parse state
+ *	    SORTCACHE entry to fill in
+ *
+ * Only keys missing from the entry are taken, and a damaged entry is ignored.
+ */
+
+void sortcache_get_entry (STCPARSE *p,SORTCACHE *sc)
+{
+  char *s;
+  unsigned long i;
+  BINARYSIZE *bs;
+  SORTCACHE t;
+  memset (&t,0,sizeof (SORTCACHE));
+  t.date = structcache_get_number (p,'.');
+  t.arrival = structcache_get_number (p,'.');
+  t.size = structcache_get_number (p,'.');
+  t.refwd = structcache_get_number (p,'.') ? T : NIL;
+  t.from = structcache_get_string (p);
+  t.to = structcache_get_string (p);
+  t.cc = structcache_get_string (p);
+  t.subject = structcache_get_string (p);
+  t.message_id = structcache_get_string (p);
+  t.references = structcache_get_stringlist (p);
+  while (structcache_get_token (p,'B')) {
+    s = structcache_get_string (p);
+    i = structcache_get_number (p,'.');
+    if (s) {
+      if (!p->error) mail_binary_size_cache (&t,s,i);
+      fs_give ((void **) &s);
+    }
+  }
+  if (structcache_get_token (p,'.') && (p->s == p->end)) {
+    if (!sc->date) sc->date = t.date;
+    if (!sc->arrival) sc->arrival = t.arrival;
+    if (!sc->size) sc->size = t.size;
+    if (!sc->subject && t.subject) sc->refwd = t.refwd;
+    sortcache_take (&sc->from,&t.from);
+    sortcache_take (&sc->to,&t.to);
+    sortcache_take (&sc->cc,&t.cc);
+    sortcache_take (&sc->subject,&t.subject);
+    sortcache_take (&sc->message_id,&t.message_id);
+    if (!sc->references) {
+      sc->references = t.references;
+      t.references = NIL;
+    }
+    for (bs = t.binsize; bs; bs = bs->next)
+      mail_binary_size_cache (sc,bs->section,bs->size);
+  }
+  sortcache_take (NIL,&t.from);	/* free what wasn't taken */
+  sortcache_take (NIL,&t.to);
+  sortcache_take (NIL,&t.cc);
+  sortcache_take (NIL,&t.subject);
+  sortcache_take (NIL,&t.message_id);
+  if (t.references) mail_free_stringlist (&t.references);
+  if (t.binsize) mail_free_binarysize (&t.binsize);
+}
+
+
+/* Sortcache take string key
+ * Accepts: pointer to entry's key, or NIL to only free
+ *	    pointer to parsed key, NIL on return
+ */
+
+void sortcache_take (char **dst,char **src)
+{
+  if (dst && !*dst) *dst = *src;
+  else if (*src) fs_give ((void **) src);
+  *src = NIL;
+}
@@ -0,0 +1,116 @@
+/*
+ * Program:	Mailbox sidecar file routines
+ *
+ * Date:	17 October 2026
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ */
+
+/* Sidecar types */
+
+#define SIDECARSTRUCT "structcache"
+#define SIDECARSORT "sortcache"
+#define SIDECARSTATUS "status"
+
+
+/* Structure cache serialization buffer */
+
+typedef struct structcache_buffer {
+  unsigned char *s;		/* buffer */
+  unsigned long size;		/* allocated size */
+  unsigned long len;		/* current length */
+} STCBUFFER;
+
+
+/* Structure cache record parse state */
+
+typedef struct structcache_parse {
+  unsigned char *s;		/* current position */
+  unsigned char *end;		/* end of record */
+  long error;			/* record is damaged */
+} STCPARSE;
+
+
+/* Function prototypes */
+
+char *sidecar_file (char *dst,char *file,char *type);
+long sidecar_test (char *name);
+void sidecar_rename (char *file,char *newfile);
+int sidecar_open (char *file,int flags);
+STRUCTCACHE *structcache_load (MAILSTREAM *stream);
+void structcache_read (STRUCTCACHE *stc,int fd);
+void structcache_save (MAILSTREAM *stream);
+STRUCTRECORD *structcache_lookup (STRUCTCACHE *stc,unsigned long uid);
+STRUCTRECORD *structcache_add (STRUCTCACHE *stc,unsigned long uid,
+			       unsigned long size,unsigned char *data,
+			       unsigned long len,long replace);
+void structcache_remove (STRUCTCACHE *stc,STRUCTRECORD *r);
+long structcache_fetch (MAILSTREAM *stream,MESSAGECACHE *elt,ENVELOPE **env,
+			BODY **body);
+void structcache_store (MAILSTREAM *stream,MESSAGECACHE *elt,ENVELOPE *env,
+			BODY *body);
+void structcache_put (STCBUFFER *b,char *s,unsigned long n);
+void structcache_put_string (STCBUFFER *b,char *s);
+void structcache_put_number (STCBUFFER *b,unsigned long n);
+void structcache_put_address (STCBUFFER *b,ADDRESS *adr);
+void structcache_put_parameter (STCBUFFER *b,PARAMETER *param);
+void structcache_put_stringlist (STCBUFFER *b,STRINGLIST *stl);
+void structcache_put_envelope (STCBUFFER *b,ENVELOPE *env);
+long structcache_put_body (STCBUFFER *b,BODY *body);
+char *structcache_get_string (STCPARSE *p);
+unsigned long structcache_get_number (STCPARSE *p,int c);
+long structcache_get_token (STCPARSE *p,int c);
+ADDRESS *structcache_get_address (STCPARSE *p);
+PARAMETER *structcache_get_parameter (STCPARSE *p);
+STRINGLIST *structcache_get_stringlist (STCPARSE *p);
+ENVELOPE *structcache_get_envelope (STCPARSE *p);
+void structcache_get_body (STCPARSE *p,BODY *body);
+TEXTINDEX *textindex_load (MAILSTREAM *stream,long op);
+void textindex_read (TEXTINDEX *txi,int fd);
+void textindex_save (MAILSTREAM *stream);
+void textindex_write (MAILSTREAM *stream,TEXTINDEX *txi);
+void textindex_refresh (MAILSTREAM *stream);
+void textindex_reread (TEXTINDEX *txi);
+TEXTRECORD *textindex_lookup (TEXTINDEX *txi,unsigned long uid);
+TEXTRECORD *textindex_add (TEXTINDEX *txi,unsigned long uid,
+			   unsigned long size,unsigned char *data,
+			   unsigned long len,long replace);
+void textindex_remove (TEXTINDEX *txi,TEXTRECORD *r);
+void textindex_post (TEXTINDEX *txi,TEXTRECORD *r);
+long textindex_match (TEXTRECORD *r,char *tag,SIZEDTEXT *pat);
+void textindex_insert (TEXTQUERY *q,unsigned long uid);
+long textindex_candidate (TEXTQUERY *q,unsigned long uid);
+TEXTQUERY *textindex_query (TEXTINDEX *txi,char *tag,SIZEDTEXT *pat);
+int textindex_compare_uid (const void *a1,const void *a2);
+int textindex_compare_token (const void *a1,const void *a2);
+long textindex_search (MAILSTREAM *stream,MESSAGECACHE *elt,char *section,
+		       STRINGLIST *st);
+TEXTRECORD *textindex_index (MAILSTREAM *stream,MESSAGECACHE *elt,
+			     TEXTINDEX *txi);
+TEXTRECORD *textindex_record (TEXTINDEX *txi,MESSAGECACHE *elt,STCBUFFER *b);
+void textindex_index_body (MAILSTREAM *stream,unsigned long msgno,BODY *body,
+			   char *prefix,unsigned long section,STCBUFFER *b);
+void textindex_tokens (STCBUFFER *b,char *tag,SIZEDTEXT *txt);
+long textindex_has (TEXTRECORD *r,char *token);
+long headerindex_search (MAILSTREAM *stream,MESSAGECACHE *elt,char *section,
+			 SEARCHPGM *pgm);
+long headerindex_candidate (TEXTINDEX *hxi,TEXTRECORD *r,char *tag,
+			    STRINGLIST *st);
+TEXTRECORD *headerindex_index (MAILSTREAM *stream,MESSAGECACHE *elt,
+			       TEXTINDEX *hxi);
+void headerindex_addr (STCBUFFER *b,char *tag,ADDRESS *adr);
+void headerindex_field (STCBUFFER *b,char *tag,SIZEDTEXT *txt);
+char *headerindex_name (char *tag,char *s);
+long headerindex_tag (char *tag,char *names,SIZEDTEXT *line);
+SORTFILE *sortcache_load (MAILSTREAM *stream);
+long sortcache_refresh (MAILSTREAM *stream);
+void sortcache_read (MAILSTREAM *stream,SORTFILE *srt,int fd);
+void sortcache_save (MAILSTREAM *stream);
+long sortcache_put_entry (STCBUFFER *b,SORTCACHE *sc);
+void sortcache_get_entry (STCPARSE *p,SORTCACHE *sc);
+void sortcache_take (char **dst,char **src);
@@ -37,6 +37,9 @@
 #include <unistd.h>
 #include <syslog.h>
 #include <sys/stat.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "tcp_unix.h"
 #include "env_unix.h"
 #include "fs.h"
@@ -92,6 +95,12 @@ static char *ssl_getline_work(SSLSTREAM *stream,
                               long *contd);
 static long ssl_abort(SSLSTREAM *stream);
 static RSA *ssl_genkey(SSL *con, int export, int keylength);
+static long stdin_getdata (void);
+static void ssl_server_compress (void);
+static long zstdio_fill (void);
+static long zstdio_inflate (void);
+static long zstdio_getdata (void);
+static int zstdio_deflate (int flush);
 
 /* Secure Sockets Layer network driver dispatch */
 
@@ -111,6 +120,12 @@ static struct ssl_driver ssldriver = {
 /* non-NIL if doing SSL primary I/O */
 static SSLSTDIOSTREAM *sslstdio = NIL;
 static char *start_tls = NIL;	/* non-NIL if start TLS requested */
+				/* non-NIL if compressing primary I/O */
+static ZSTDIOSTREAM *zstdio = NIL;
+static long start_compress = NIL;/* non-NIL if compression requested */
+static STDINSTREAM stdinstream;	/* plain stdin buffer */
+static unsigned long pinbytes = 0;
+static unsigned long poutbytes = 0;
 
 /* One-time SSL initialization */
 
@@ -671,6 +686,126 @@ char *ssl_start_tls (char *server)
      return NIL;
 }
 
+
+/* Start compression
+ * Accepts: compression mechanism name, or NIL to test availability
+ * Returns: cpystr'd error string if compression failed, else NIL for success
+ */
+
+char *ssl_start_compress (char *mechanism)
+{
+     if (zstdio || start_compress) return cpystr ("Compression already active");
+     if (mechanism) {
+          if (compare_cstring (mechanism,"DEFLATE"))
+               return cpystr ("Unknown compression mechanism");
+          start_compress = T;	/* compress once response is out */
+     }
+     return NIL;
+}
+
+/* Build server certificate and key file names
+ * Accepts: destination certificate file name
+ *	    destination private key file name
+ *	    server name
+ *	    local address for address-specific files, or NIL
+ */
+
+static void
+ssl_server_files(char *cert, char *key, char *server, char *addr) {
+     struct stat sbuf;
+     if (addr) {		/* build specific certificate/key file names */
+          sprintf(cert, "%s/%s-%s.pem", TLS_CA_PATH, server, addr);
+          sprintf(key, "%s/%s-%s.pem", TLS_PRIVATE_KEY_PATH, server, addr);
+     }
+     /* use non-specific name if no specific cert */
+     if (!addr || stat(cert, &sbuf))
+          sprintf(cert, "%s/%s.pem", TLS_CA_PATH, server);
+     /* use non-specific name if no specific key */
+     if (!addr || stat(key, &sbuf)) {
+          sprintf(key, "%s/%s.pem", TLS_PRIVATE_KEY_PATH, server);
+          /* use cert file as fallback for key */
+          if (stat(key, &sbuf))
+               strcpy(key, cert);
+     }
+}
+
+/* Create server SSL context
+ * Accepts: certificate file name
+ *	    private key file name
+ *	    client host name for logging
+ * Returns: context if success, NIL if failure
+ */
+
+static SSL_CTX*
+ssl_server_context(char *cert, char *key, char *host) {
+     SSL_CTX *context;
+     /* create context */
+     if (!(context = SSL_CTX_new(TLS_server_method()))) {
+          syslog(LOG_ALERT, "Unable to create SSL context, host=%.80s", host);
+          return NIL;
+     }
+     /* set context options */
+     SSL_CTX_set_options(context, SSL_OP_ALL);
+#ifdef SSL_OP_ENABLE_KTLS
+     /* use kernel TLS when available, permits SSL_sendfile() */
+     SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+#endif
+     /* don't hold buffers while connection is idle */
+     SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS);
+     /* set cipher list */
+     if (!SSL_CTX_set_cipher_list(context, SSLCIPHERLIST))
+          syslog(LOG_ALERT,
+                 "Unable to set cipher list %.80s, host=%.80s",
+                 SSLCIPHERLIST,
+                 host);
+     /* load certificate */
+     else if (!SSL_CTX_use_certificate_chain_file(context, cert))
+          syslog(LOG_ALERT,
+                 "Unable to load certificate from %.80s, host=%.80s",
+                 cert,
+                 host);
+     /* load key */
+     else if (!(SSL_CTX_use_RSAPrivateKey_file(context,
+                                               key,
+                                               SSL_FILETYPE_PEM)))
+          syslog(LOG_ALERT,
+                 "Unable to load private key from %.80s, host=%.80s",
+                 key,
+                 host);
+     else { /* generate key if needed */
+          if (SSL_CTX_need_tmp_RSA(context))
+               SSL_CTX_set_tmp_rsa_callback(context, ssl_genkey);
+          return context;
+     }
+     SSL_CTX_free(context);
+     return NIL;
+}
+
+/* preloaded server context and its file names */
+static SSL_CTX *ssl_server_ctx = NIL;
+static char *ssl_server_cert = NIL;
+static char *ssl_server_key = NIL;
+
+/* Preload server SSL context
+ * Accepts: server name
+ *
+ * Only the non-specific certificate can be preloaded, since the local
+ * address isn't known until a connection arrives.
+ */
+
+void
+ssl_server_preinit(char *server) {
+     char cert[MAILTMPLEN], key[MAILTMPLEN];
+     ssl_onceonlyinit();		/* make sure algorithms added */
+     ERR_load_crypto_strings();
+     SSL_load_error_strings();
+     ssl_server_files(cert, key, server, NIL);
+     if ((ssl_server_ctx = ssl_server_context(cert, key, "(preload)"))) {
+          ssl_server_cert = cpystr(cert);
+          ssl_server_key = cpystr(key);
+     }
+}
+
 /* Init server for SSL
  * Accepts: server name
  */
@@ -679,96 +814,54 @@ void
 ssl_server_init(char *server) {
      char cert[MAILTMPLEN], key[MAILTMPLEN];
      unsigned long i;
-     struct stat sbuf;
      SSLSTREAM *stream = (SSLSTREAM *) memset(fs_get(sizeof(SSLSTREAM)),
                                               0,
                                               sizeof(SSLSTREAM));
      ssl_onceonlyinit();		/* make sure algorithms added */
      ERR_load_crypto_strings();
      SSL_load_error_strings();
-     /* build specific certificate/key file names */
-     sprintf(cert,
-             "%s/%s-%s.pem",
-             TLS_CA_PATH,
-             server,
-             tcp_serveraddr());
-     sprintf(key,
-             "%s/%s-%s.pem",
-             TLS_PRIVATE_KEY_PATH,
-             server,
-             tcp_serveraddr());
-     /* use non-specific name if no specific cert */
-     if (stat(cert, &sbuf))
-          sprintf(cert, "%s/%s.pem", TLS_CA_PATH, server);
-     if (stat(key, &sbuf)) {	/* use non-specific name if no specific key */
-          sprintf(key, "%s/%s.pem", TLS_PRIVATE_KEY_PATH, server);
-          /* use cert file as fallback for key */
-          if (stat(key, &sbuf))
-               strcpy(key, cert);
-     }
-     /* create context */
-     if (!(stream->context = SSL_CTX_new(TLS_server_method())))
-          syslog(LOG_ALERT, "Unable to create SSL context, host=%.80s",
-                 tcp_clienthost());
-     else { /* set context options */
-          SSL_CTX_set_options(stream->context, SSL_OP_ALL);
-          /* set cipher list */
-          if (!SSL_CTX_set_cipher_list(stream->context, SSLCIPHERLIST))
-               syslog(LOG_ALERT,
-                      "Unable to set cipher list %.80s, host=%.80s",
-                      SSLCIPHERLIST,
-                      tcp_clienthost());
-          /* load certificate */
-          else if (!SSL_CTX_use_certificate_chain_file(stream->context, cert))
+     ssl_server_files(cert, key, server, tcp_serveraddr());
+     /* use preloaded context if same files */
+     if (ssl_server_ctx && !strcmp(cert, ssl_server_cert) &&
+         !strcmp(key, ssl_server_key) && SSL_CTX_up_ref(ssl_server_ctx))
+          stream->context = ssl_server_ctx;
+     else stream->context = ssl_server_context(cert, key, tcp_clienthost());
+     if (stream->context) {
+          /* create new SSL connection */
+          if (!(stream->con = SSL_new(stream->context)))
                syslog(LOG_ALERT,
-                      "Unable to load certificate from %.80s, host=%.80s",
-                      cert,
+                      "Unable to create SSL connection, host=%.80s",
                       tcp_clienthost());
-          /* load key */
-          else if (!(SSL_CTX_use_RSAPrivateKey_file(stream->context,
-                                                    key,
-                                                    SSL_FILETYPE_PEM)))
-               syslog(LOG_ALERT,
-                      "Unable to load private key from %.80s, host=%.80s",
-                      key,
-                      tcp_clienthost());
-          else { /* generate key if needed */
-               if (SSL_CTX_need_tmp_RSA(stream->context))
-                    SSL_CTX_set_tmp_rsa_callback(stream->context, ssl_genkey);
-               /* create new SSL connection */
-               if (!(stream->con = SSL_new(stream->context)))
-                    syslog(LOG_ALERT,
-                           "Unable to create SSL connection, host=%.80s",
+          else {			/* set file descriptor */
+               SSL_set_fd(stream->con, 0);
+               /* discard plaintext pipelined after STARTTLS */
+               stdinstream.ictr = 0;
+               /* all OK if accepted */
+               if (SSL_accept(stream->con) <= 0)
+                    syslog(LOG_INFO,
+                           "Unable to accept SSL connection, host=%.80s",
                            tcp_clienthost());
-               else {			/* set file descriptor */
-                    SSL_set_fd(stream->con, 0);
-                    /* all OK if accepted */
-                    if (SSL_accept(stream->con) <= 0)
-                         syslog(LOG_INFO,
-                                "Unable to accept SSL connection, host=%.80s",
-                                tcp_clienthost());
-                    else {  /* server set up */
-                         sslstdio = (SSLSTDIOSTREAM *)
-                              memset(fs_get(sizeof(SSLSTDIOSTREAM)),
-                                     0,
-                                     sizeof(SSLSTDIOSTREAM));
-                         sslstdio->sslstream = stream;
-                         /* available space in output buffer */
-                         sslstdio->octr = SSLBUFLEN;
-                         /* current output buffer pointer */
-                         sslstdio->optr = sslstdio->obuf;
-                         /* allow plaintext if disable value was 2 */
-                         if ((long)mail_parameters(NIL,
-                                                   GET_DISABLEPLAINTEXT,
-                                                   NIL) > 1)
-                              mail_parameters(NIL,SET_DISABLEPLAINTEXT,NIL);
-                         /* unhide PLAIN SASL authenticator */
-                         mail_parameters(NIL, UNHIDE_AUTHENTICATOR, "PLAIN");
-                         mail_parameters(NIL, UNHIDE_AUTHENTICATOR, "LOGIN");
-                         return;
-                    }
+               else {  /* server set up */
+                    sslstdio = (SSLSTDIOSTREAM *)
+                         memset(fs_get(sizeof(SSLSTDIOSTREAM)),
+                                0,
+                                sizeof(SSLSTDIOSTREAM));
+                    sslstdio->sslstream = stream;
+                    /* available space in output buffer */
+                    sslstdio->octr = SSLBUFLEN;
+                    /* current output buffer pointer */
+                    sslstdio->optr = sslstdio->obuf;
+                    /* allow plaintext if disable value was 2 */
+                    if ((long)mail_parameters(NIL,
+                                              GET_DISABLEPLAINTEXT,
+                                              NIL) > 1)
+                         mail_parameters(NIL,SET_DISABLEPLAINTEXT,NIL);
+                    /* unhide PLAIN SASL authenticator */
+                    mail_parameters(NIL, UNHIDE_AUTHENTICATOR, "PLAIN");
+                    mail_parameters(NIL, UNHIDE_AUTHENTICATOR, "LOGIN");
+                    return;
                }
-          }  
+          }
      }
      while (i = ERR_get_error())  /* SSL failure */
           syslog(LOG_ERR, "SSL error status: %.80s", ERR_error_string(i, NIL));
@@ -816,12 +909,24 @@ ssl_genkey (SSL *con, int export, int keylength) {
  */
 
 long ssl_server_input_wait (long seconds)
+{
+     return ssl_server_input_wait_fd (seconds,-1);
+}
+
+
+/* Wait for stdin input or activity on another descriptor
+ * Accepts: timeout in seconds
+ *	    additional descriptor to wait for, or -1 if none
+ * Returns: T if have input on stdin, -1 if descriptor readable, else NIL
+ */
+
+long ssl_server_input_wait_fd (long seconds,int fd)
 {
      int i,sock;
      fd_set fds,efd;
      struct timeval tmo;
      SSLSTREAM *stream;
-     if (!sslstdio) return server_input_wait (seconds);
+     if (!sslstdio) return server_input_wait_fd (seconds,fd);
      /* input available in buffer */
      if (((stream = sslstdio->sslstream)->ictr > 0) ||
          !stream->con || ((sock = SSL_get_fd (stream->con)) < 0)) return LONGT;
@@ -838,9 +943,12 @@ long ssl_server_input_wait (long seconds)
      FD_ZERO (&efd);		/* initialize selection vector */
      FD_SET (sock,&fds);		/* set bit in selection vector */
      FD_SET (sock,&efd);		/* set bit in selection vector */
+     if (fd >= 0) FD_SET (fd,&fds);
      tmo.tv_sec = seconds; tmo.tv_usec = 0;
      /* see if input available from the socket */
-     return select (sock+1,&fds,0,&efd,&tmo) ? LONGT : NIL;
+     if (select (((fd > sock) ? fd : sock) + 1,&fds,0,&efd,&tmo) <= 0)
+          return NIL;
+     return (FD_ISSET (sock,&fds) || FD_ISSET (sock,&efd)) ? LONGT : -1;
 }
 
 #include "sslstdio.c"
@@ -27,6 +27,7 @@
  */
 
 #include "mail.h"
+#include <zlib.h>
 
 /* SSL driver */
 
@@ -55,6 +56,34 @@ typedef struct ssl_stdiostream {
 } SSLSTDIOSTREAM;
 
 
+/* Plain stdin stream, read straight from the descriptor so that buffered
+ * input stays visible to the server
+ */
+
+typedef struct stdin_stream {
+  int ictr;			/* input counter */
+  char *iptr;			/* input pointer */
+  char ibuf[SSLBUFLEN];		/* input buffer */
+} STDINSTREAM;
+
+
+/* Compressed stdio stream, layered over SSL or plain stdio */
+
+typedef struct z_stdiostream {
+  z_stream zin;			/* inflate state */
+  z_stream zout;		/* deflate state */
+  unsigned int eof : 1;		/* input stream ended or corrupt */
+  unsigned int pending : 1;	/* deflate may be holding output */
+  int ictr;			/* input counter */
+  char *iptr;			/* input pointer */
+  char ibuf[SSLBUFLEN];		/* inflated input buffer */
+  int octr;			/* output counter */
+  char *optr;			/* output pointer */
+  char obuf[SSLBUFLEN];		/* output buffer */
+  char zobuf[SSLBUFLEN];	/* compressed output buffer */
+} ZSTDIOSTREAM;
+
+
 /* Function prototypes */
 
 SSLSTREAM *ssl_open (char *host,char *service,unsigned long port);
@@ -70,3 +99,4 @@ char *ssl_remotehost (SSLSTREAM *stream);
 unsigned long ssl_port (SSLSTREAM *stream);
 char *ssl_localhost (SSLSTREAM *stream);
 long ssl_server_input_wait (long seconds);
+long ssl_server_input_wait_fd (long seconds,int fd);
@@ -29,14 +29,17 @@
 
 int PBIN (void)
 {
-  if (!sslstdio) {
-    int ret;
-    do {
-      clearerr (stdin);
-      ret = getchar ();
-    } while ((ret == EOF) && !feof (stdin) && ferror (stdin) &&
-	     (errno == EINTR));
-    return ret;
+  if (start_compress) ssl_server_compress ();
+  pinbytes++;			/* count one byte */
+  if (zstdio) {			/* compressed case */
+    if (!zstdio_getdata ()) return EOF;
+    zstdio->ictr--;		/* one last byte available */
+    return (int) (unsigned char) *zstdio->iptr++;
+  }
+  if (!sslstdio) {		/* non-SSL case */
+    if (!stdin_getdata ()) return EOF;
+    stdinstream.ictr--;		/* one last byte available */
+    return (int) (unsigned char) *stdinstream.iptr++;
   }
   if (!ssl_getdata (sslstdio->sslstream)) return EOF;
 				/* one last byte available */
@@ -58,13 +61,24 @@ char *PSIN (char *s,int n)
     ssl_server_init (start_tls);/* enter the mode */
     start_tls = NIL;		/* don't do this again */
   }
-  if (!sslstdio) {
-    char *ret;
-    do {
-      clearerr (stdin);
-      ret = fgets (s,n,stdin);
-    } while (!ret && !feof (stdin) && ferror (stdin) && (errno == EINTR));
-    return ret;
+  if (start_compress) ssl_server_compress ();
+  if (zstdio) {			/* compressed case */
+    for (i = c = 0, n-- ; (c != '\n') && (i < n); zstdio->ictr--) {
+      if ((zstdio->ictr <= 0) && !zstdio_getdata ()) return NIL;
+      c = s[i++] = *zstdio->iptr++;
+    }
+    s[i] = '\0';		/* tie off string */
+    pinbytes += i;
+    return s;
+  }
+  if (!sslstdio) {		/* non-SSL case */
+    for (i = c = 0, n-- ; (c != '\n') && (i < n); stdinstream.ictr--) {
+      if ((stdinstream.ictr <= 0) && !stdin_getdata ()) return NIL;
+      c = s[i++] = *stdinstream.iptr++;
+    }
+    s[i] = '\0';		/* tie off string */
+    pinbytes += i;
+    return s;
   }
   for (i = c = 0, n-- ; (c != '\n') && (i < n); sslstdio->sslstream->ictr--) {
     if ((sslstdio->sslstream->ictr <= 0) && !ssl_getdata (sslstdio->sslstream))
@@ -72,6 +86,7 @@ char *PSIN (char *s,int n)
     c = s[i++] = *(sslstdio->sslstream->iptr)++;
   }
   s[i] = '\0';			/* tie off string */
+  pinbytes += i;
   return s;
 }
 
@@ -89,10 +104,31 @@ long PSINR (char *s,unsigned long n)
     ssl_server_init (start_tls);/* enter the mode */
     start_tls = NIL;		/* don't do this again */
   }
+  if (start_compress) ssl_server_compress ();
+  pinbytes += n;		/* count record */
+  if (zstdio) {			/* compressed case */
+    while (n) {			/* until request satisfied */
+      if (!zstdio_getdata ()) return NIL;
+      memcpy (s,zstdio->iptr,i = min (n,zstdio->ictr));
+      zstdio->iptr += i;	/* account for chunk */
+      zstdio->ictr -= i;
+      s += i;
+      n -= i;
+    }
+    *s = '\0';			/* tie off string */
+    return LONGT;
+  }
   if (sslstdio) return ssl_getbuffer (sslstdio->sslstream,n,s);
-				/* non-SSL case */
-  while (n && ((i = fread (s,1,n,stdin)) || (errno == EINTR))) s += i,n -= i;
-  return n ? NIL : LONGT;
+  while (n) {			/* non-SSL case */
+    if (!stdin_getdata ()) return NIL;
+    memcpy (s,stdinstream.iptr,i = min (n,stdinstream.ictr));
+    stdinstream.iptr += i;	/* account for chunk */
+    stdinstream.ictr -= i;
+    s += i;
+    n -= i;
+  }
+  *s = '\0';			/* tie off string */
+  return LONGT;
 }
 
 
@@ -103,9 +139,52 @@ long PSINR (char *s,unsigned long n)
 
 long INWAIT (long seconds)
 {
-  return (sslstdio ? ssl_server_input_wait : server_input_wait) (seconds);
+  return INWAITFD (seconds,-1);
 }
-
+
+
+/* Wait for stdin input or activity on another descriptor
+ * Accepts: timeout in seconds
+ *	    additional descriptor to wait for, or -1 if none
+ * Returns: T if have input on stdin, -1 if descriptor readable, else NIL
+ */
+
+long INWAITFD (long seconds,int fd)
+{
+  long ret = LONGT;
+  blocknotify_t bn = (blocknotify_t) mail_parameters (NIL,GET_BLOCKNOTIFY,NIL);
+  if (start_compress) ssl_server_compress ();
+  (*bn) (BLOCK_TCPREAD,NIL);
+  if (!zstdio) ret = sslstdio ? ssl_server_input_wait_fd (seconds,fd) :
+    ((stdinstream.ictr > 0) ? LONGT : server_input_wait_fd (seconds,fd));
+				/* until have inflated input */
+  else while ((zstdio->ictr <= 0) && !zstdio->eof) {
+				/* inflate whatever is already here */
+    if (zstdio->zin.avail_in || !zstdio->zin.avail_out) zstdio_inflate ();
+    else if ((ret = (sslstdio ? ssl_server_input_wait_fd :
+		     server_input_wait_fd) (seconds,fd)) != LONGT) break;
+				/* let reader see the error */
+    else if (!zstdio_fill ()) break;
+  }
+  (*bn) (BLOCK_NONE,NIL);
+  return ret;
+}
+
+
+/* Test for input already buffered
+ * Returns: T if input can be read without waiting, else NIL
+ */
+
+long INPENDING (void)
+{
+				/* mode switch must see what came before */
+  if (start_tls || start_compress) return NIL;
+  if (zstdio) return (zstdio->ictr > 0) || zstdio->zin.avail_in;
+  if (sslstdio) return (sslstdio->sslstream->ictr > 0) ||
+		  SSL_pending (sslstdio->sslstream->con);
+  return stdinstream.ictr > 0;
+}
+
 /* Put character
  * Accepts: character
  * Returns: character written or EOF
@@ -113,6 +192,13 @@ long INWAIT (long seconds)
 
 int PBOUT (int c)
 {
+  poutbytes++;			/* count one byte */
+  if (zstdio) {			/* compressed case */
+    if (!zstdio->octr && zstdio_deflate (Z_NO_FLUSH)) return EOF;
+    zstdio->octr--;		/* count down one character */
+    *zstdio->optr++ = c;	/* write character */
+    return c;
+  }
   if (!sslstdio) return putchar (c);
 				/* flush buffer if full */
   if (!sslstdio->octr && PFLUSH ()) return EOF;
@@ -129,15 +215,21 @@ int PBOUT (int c)
 
 int PSOUT (char *s)
 {
-  if (!sslstdio) return fputs (s,stdout);
-  while (*s) {			/* flush buffer if full */
+  poutbytes += strlen (s);	/* count string */
+  if (zstdio) while (*s) {	/* compressed case */
+    if (!zstdio->octr && zstdio_deflate (Z_NO_FLUSH)) return EOF;
+    *zstdio->optr++ = *s++;	/* write one more character */
+    zstdio->octr--;		/* count down one character */
+  }
+  else if (!sslstdio) return fputs (s,stdout);
+  else while (*s) {		/* flush buffer if full */
     if (!sslstdio->octr && PFLUSH ()) return EOF;
     *sslstdio->optr++ = *s++;	/* write one more character */
     sslstdio->octr--;		/* count down one character */
   }
   return 0;			/* success */
 }
-
+
 /* Put record
  * Accepts: source sized text
  * Returns: 0 or EOF if error
@@ -148,7 +240,16 @@ int PSOUTR (SIZEDTEXT *s)
   unsigned char *t = s->data;
   unsigned long i = s->size;
   unsigned long j;
-  if (sslstdio) while (i) {	/* until request satisfied */
+  poutbytes += i;		/* count record */
+  if (zstdio) while (i) {	/* compressed case */
+    if (!zstdio->octr && zstdio_deflate (Z_NO_FLUSH)) break;
+    memcpy (zstdio->optr,t,j = min (i,zstdio->octr));
+    zstdio->optr += j;		/* account for chunk */
+    zstdio->octr -= j;
+    t += j;
+    i -= j;
+  }
+  else if (sslstdio) while (i) {/* until request satisfied */
 				/* flush buffer if full */
     if (!sslstdio->octr && PFLUSH ()) break;
 				/* blat as big a chucnk as we can */
@@ -164,18 +265,221 @@ int PSOUTR (SIZEDTEXT *s)
 }
 
 
+/* Put file data, without copying through user space if possible
+ * Accepts: file descriptor
+ *	    file offset
+ *	    number of bytes
+ * Returns: 0 or EOF if error
+ */
+
+int PSOUTFD (int fd,unsigned long offset,unsigned long size)
+{
+  off_t off = (off_t) offset;
+  ssize_t i;
+  SIZEDTEXT st;
+  char tmp[SSLBUFLEN];
+  if (!zstdio) {		/* compression needs the data in user space */
+    if (PFLUSH ()) return EOF;	/* previous output must go first */
+#ifdef HAVE_SYS_SENDFILE_H
+    if (!sslstdio) while (size &&
+			  (((i = sendfile (fileno (stdout),fd,&off,size)) > 0) ||
+			   ((i < 0) && (errno == EINTR))))
+      if (i > 0) size -= i;	/* account for what was sent */
+#endif
+#ifdef SSL_OP_ENABLE_KTLS
+				/* kernel TLS can send straight from file */
+    if (sslstdio && BIO_get_ktls_send (SSL_get_wbio (sslstdio->sslstream->con)))
+      while (size && ((i = SSL_sendfile (sslstdio->sslstream->con,fd,off,size,
+					 0)) > 0)) {
+	off += i;		/* account for what was sent */
+	size -= i;
+      }
+#endif
+  }
+				/* count what was sent from the file */
+  poutbytes += (unsigned long) off - offset;
+				/* copy anything left the hard way */
+  st.data = (unsigned char *) tmp;
+  while (size) {
+    if ((i = pread (fd,tmp,min (size,SSLBUFLEN),off)) <= 0) return EOF;
+    st.size = i;		/* output this chunk */
+    if (PSOUTR (&st)) return EOF;
+    off += i;
+    size -= i;
+  }
+  return 0;			/* success */
+}
+
+
 /* Flush output
  * Returns: 0 or EOF if error
  */
 
 int PFLUSH (void)
 {
-  if (!sslstdio) return fflush (stdout);
-				/* force out buffer */
-  if (!ssl_sout (sslstdio->sslstream,sslstdio->obuf,
-		 SSLBUFLEN - sslstdio->octr)) return EOF;
+  int ret;
+  blocknotify_t bn;
+  if (zstdio) {			/* compressed case, sync the deflate stream */
+    if (((zstdio->octr < SSLBUFLEN) || zstdio->pending) &&
+	zstdio_deflate (Z_SYNC_FLUSH)) return EOF;
+    if (sslstdio) return 0;
+  }
+  else if (sslstdio) {		/* force out buffer */
+    if (!ssl_sout (sslstdio->sslstream,sslstdio->obuf,
+		   SSLBUFLEN - sslstdio->octr)) return EOF;
 				/* renew output buffer */
-  sslstdio->optr = sslstdio->obuf;
-  sslstdio->octr = SSLBUFLEN;
-  return 0;			/* success */
+    sslstdio->optr = sslstdio->obuf;
+    sslstdio->octr = SSLBUFLEN;
+    return 0;			/* success */
+  }
+				/* non-SSL case, flush stdio */
+  bn = (blocknotify_t) mail_parameters (NIL,GET_BLOCKNOTIFY,NIL);
+  (*bn) (BLOCK_TCPWRITE,NIL);
+  ret = fflush (stdout);
+  (*bn) (BLOCK_NONE,NIL);
+  return ret;
+}
+
+
+/* Return primary I/O byte counts
+ * Accepts: where to return bytes read
+ *	    where to return bytes written
+ */
+
+void PBYTES (unsigned long *in,unsigned long *out)
+{
+  *in = pinbytes;
+  *out = poutbytes;
+}
+
+/* Get data into plain stdin buffer
+ * Returns: T if have data, NIL if end of file or error
+ */
+
+static long stdin_getdata (void)
+{
+  int i;
+  blocknotify_t bn;
+  if (stdinstream.ictr > 0) return LONGT;
+  bn = (blocknotify_t) mail_parameters (NIL,GET_BLOCKNOTIFY,NIL);
+  (*bn) (BLOCK_TCPREAD,NIL);
+  while (((i = read (fileno (stdin),stdinstream.ibuf,SSLBUFLEN)) < 0) &&
+	 (errno == EINTR));
+  (*bn) (BLOCK_NONE,NIL);
+  if (i <= 0) return NIL;	/* end of file or error */
+  stdinstream.iptr = stdinstream.ibuf;
+  stdinstream.ictr = i;
+  return LONGT;
+}
+
+/* Compressed I/O routines, RFC 4978 COMPRESS=DEFLATE */
+
+
+/* Begin compressing primary I/O
+ */
+
+static void ssl_server_compress (void)
+{
+  start_compress = NIL;		/* don't do this again */
+  zstdio = (ZSTDIOSTREAM *) memset (fs_get (sizeof (ZSTDIOSTREAM)),0,
+				    sizeof (ZSTDIOSTREAM));
+  zstdio->optr = zstdio->obuf;	/* initialize output buffer */
+  zstdio->octr = SSLBUFLEN;
+				/* raw deflate with no zlib header */
+  if ((inflateInit2 (&zstdio->zin,-MAX_WBITS) != Z_OK) ||
+      (deflateInit2 (&zstdio->zout,Z_DEFAULT_COMPRESSION,Z_DEFLATED,
+		     -MAX_WBITS,8,Z_DEFAULT_STRATEGY) != Z_OK))
+    fatal ("Can't initialize compression");
+}
+
+
+/* Read compressed data from the underlying stream
+ * Returns: T if success, NIL otherwise
+ */
+
+static long zstdio_fill (void)
+{
+  if (sslstdio) {		/* SSL case, inflate straight from its buffer */
+    if (!ssl_getdata (sslstdio->sslstream)) return NIL;
+    zstdio->zin.next_in = (Bytef *) sslstdio->sslstream->iptr;
+    zstdio->zin.avail_in = sslstdio->sslstream->ictr;
+    sslstdio->sslstream->ictr = 0;
+  }
+  else {			/* non-SSL case, likewise from stdin buffer */
+    if (!stdin_getdata ()) return NIL;
+    zstdio->zin.next_in = (Bytef *) stdinstream.iptr;
+    zstdio->zin.avail_in = stdinstream.ictr;
+    stdinstream.ictr = 0;
+  }
+  return LONGT;
+}
+
+
+/* Inflate buffered compressed input
+ * Returns: T if success, NIL if stream ended or is corrupt
+ */
+
+static long zstdio_inflate (void)
+{
+  zstdio->zin.next_out = (Bytef *) (zstdio->iptr = zstdio->ibuf);
+  zstdio->zin.avail_out = SSLBUFLEN;
+  switch (inflate (&zstdio->zin,Z_SYNC_FLUSH)) {
+  case Z_OK:
+  case Z_BUF_ERROR:		/* no progress possible is not an error */
+    zstdio->ictr = SSLBUFLEN - zstdio->zin.avail_out;
+    return LONGT;
+  }
+  zstdio->ictr = 0;		/* stream end or data error */
+  zstdio->eof = T;
+  return NIL;
+}
+
+
+/* Get inflated input
+ * Returns: T if have input, NIL if end of file or error
+ */
+
+static long zstdio_getdata (void)
+{
+  while (zstdio->ictr <= 0) {	/* until have inflated data */
+    if (zstdio->eof) return NIL;
+				/* need more input if inflate not stalled */
+    if (!zstdio->zin.avail_in && zstdio->zin.avail_out && !zstdio_fill ())
+      return NIL;
+    if (!zstdio_inflate ()) return NIL;
+  }
+  return LONGT;
+}
+
+/* Deflate and write buffered output
+ * Accepts: deflate flush mode
+ * Returns: 0 or EOF if error
+ */
+
+static int zstdio_deflate (int flush)
+{
+  unsigned long i,j;
+  char *s;
+  zstdio->zout.next_in = (Bytef *) zstdio->obuf;
+  zstdio->zout.avail_in = SSLBUFLEN - zstdio->octr;
+  zstdio->optr = zstdio->obuf;	/* renew output buffer */
+  zstdio->octr = SSLBUFLEN;
+  do {				/* until deflate has no more to say */
+    zstdio->zout.next_out = (Bytef *) (s = zstdio->zobuf);
+    zstdio->zout.avail_out = SSLBUFLEN;
+    if (deflate (&zstdio->zout,flush) == Z_STREAM_ERROR) return EOF;
+    if (i = SSLBUFLEN - zstdio->zout.avail_out) {
+      if (sslstdio) {		/* SSL case */
+	if (!ssl_sout (sslstdio->sslstream,s,i)) return EOF;
+      }
+      else {			/* non-SSL case */
+	while (i && ((j = fwrite (s,1,i,stdout)) || (errno == EINTR)))
+	  s += j,i -= j;
+	if (i) return EOF;
+      }
+    }
+  } while (!zstdio->zout.avail_out);
+				/* deflate may be holding back output */
+  zstdio->pending = (flush == Z_NO_FLUSH);
+  return 0;
 }
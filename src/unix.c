@@ -57,6 +57,7 @@
 #include "dummy.h"
 #include "env_unix.h"
 #include "mail.h"
+#include "sidecar.h"
 #include "tcp_unix.h"
 #include "bsdutime.h"
 #include "ftl.h"
@@ -72,15 +73,23 @@ typedef struct unix_local {
   unsigned int appending : 1;	/* don't mark new messages as old */
   int fd;			/* mailbox file descriptor */
   int ld;			/* lock file descriptor */
+  int wfd;			/* change notification descriptor */
   char *lname;			/* lock file name */
+  char *structcache;		/* structure cache name */
   off_t filesize;		/* file size parsed */
   time_t filetime;		/* last file time */
   time_t lastsnarf;		/* last snarf time (for mbox driver) */
   unsigned char *buf;		/* temporary buffer */
   unsigned long buflen;		/* current size of temporary buffer */
-  unsigned long uid;		/* current text uid */
-  SIZEDTEXT text;		/* current text */
-  unsigned long textlen;	/* current text length */
+  unsigned long uid;		/* current text map uid */
+  off_t textpos;		/* file offset of mapped text */
+  unsigned long textraw;	/* on-disk size of mapped text */
+  unsigned long *map;		/* text chunk checkpoints */
+  unsigned long mapsize;	/* allocated size of checkpoint map */
+  unsigned long maplen;		/* number of known checkpoints */
+  unsigned char *text;		/* current text chunk */
+  long textchunk;		/* index of current text chunk, -1 if none */
+  unsigned long textlen;	/* current text chunk length */
   char *line;			/* returned line */
   char *linebuf;		/* line readin buffer */
   unsigned long linebuflen;	/* current line readin buffer length */
@@ -109,28 +118,37 @@ typedef struct unix_file {
 DRIVER *unix_valid (char *name);
 long unix_isvalid_fd (int fd);
 void *unix_parameters (long function,void *value);
+long unix_searchworker (MAILSTREAM *stream);
 void unix_scan (MAILSTREAM *stream,char *ref,char *pat,char *contents);
 void unix_list (MAILSTREAM *stream,char *ref,char *pat);
 void unix_lsub (MAILSTREAM *stream,char *ref,char *pat);
 long unix_create (MAILSTREAM *stream,char *mailbox);
 long unix_delete (MAILSTREAM *stream,char *mailbox);
 long unix_rename (MAILSTREAM *stream,char *old,char *newname);
+long unix_status (MAILSTREAM *stream,char *mbx,long flags);
+char *unix_statuskey (char *mbx,char *file,char *key);
 MAILSTREAM *unix_open (MAILSTREAM *stream);
 void unix_close (MAILSTREAM *stream,long options);
 char *unix_header (MAILSTREAM *stream,unsigned long msgno,
 		   unsigned long *length,long flags);
 long unix_text (MAILSTREAM *stream,unsigned long msgno,STRING *bs,long flags);
 char *unix_text_work (MAILSTREAM *stream,MESSAGECACHE *elt,
-		      unsigned long *length,long flags);
+		      unsigned long *length);
+void unix_text_map (MAILSTREAM *stream,MESSAGECACHE *elt);
+unsigned long unix_text_chunk (MAILSTREAM *stream,unsigned long k,
+			       unsigned char *dst);
 void unix_flagmsg (MAILSTREAM *stream,MESSAGECACHE *elt);
 long unix_ping (MAILSTREAM *stream);
+int unix_watch (MAILSTREAM *stream);
 void unix_check (MAILSTREAM *stream);
 long unix_expunge (MAILSTREAM *stream,char *sequence,long options);
 long unix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options);
+long unix_move (MAILSTREAM *stream,char *sequence,char *mailbox,long options);
 long unix_append (MAILSTREAM *stream,char *mailbox,append_t af,void *data);
 int unix_collect_msg (MAILSTREAM *stream,FILE *sf,char *flags,char *date,
 		     STRING *msg);
 int unix_append_msgs (MAILSTREAM *stream,FILE *sf,FILE *df,SEARCHSET *set);
+void unix_gc (MAILSTREAM *stream,long gcflags);
 
 void unix_abort (MAILSTREAM *stream);
 char *unix_file (char *dst,char *name);
@@ -171,7 +189,8 @@ long mbox_append (MAILSTREAM *stream,char *mailbox,append_t af,void *data);
 DRIVER unixdriver = {
   "unix",			/* driver name */
 				/* driver flags */
-  DR_LOCAL|DR_MAIL|DR_LOCKING|DR_NONEWMAILRONLY|DR_XPOINT,
+  DR_LOCAL|DR_MAIL|DR_LOCKING|DR_NONEWMAILRONLY|DR_XPOINT|
+    DR_SORTCACHE,
   (DRIVER *) NIL,		/* next driver */
   unix_valid,			/* mailbox is valid for us */
   unix_parameters,		/* manipulate parameters */
@@ -183,7 +202,7 @@ DRIVER unixdriver = {
   unix_create,			/* create mailbox */
   unix_delete,			/* delete mailbox */
   unix_rename,			/* rename mailbox */
-  mail_status_default,		/* status of mailbox */
+  unix_status,			/* status of mailbox */
   unix_open,			/* open mailbox */
   unix_close,			/* close mailbox */
   NIL,				/* fetch message "fast" attributes */
@@ -201,11 +220,14 @@ DRIVER unixdriver = {
   NIL,				/* sort messages */
   NIL,				/* thread messages */
   unix_ping,			/* ping mailbox to see if still alive */
+  unix_watch,			/* watch mailbox for changes */
+  NIL,				/* highest modseq */
   unix_check,			/* check for new messages */
   unix_expunge,			/* expunge deleted messages */
   unix_copy,			/* copy messages to another mailbox */
+  unix_move,			/* move messages to another mailbox */
   unix_append,			/* append string message to mailbox */
-  NIL				/* garbage collect stream */
+  unix_gc			/* garbage collect stream */
 };
 
 				/* prototype stream */
@@ -213,6 +235,19 @@ MAILSTREAM unixproto = {&unixdriver};
 
 				/* driver parameters */
 static long unix_fromwidget = T;
+
+/* String driver for UNIX text stringstructs */
+
+static void unix_string_init (STRING *s,void *data,unsigned long size);
+static char unix_string_next (STRING *s);
+static void unix_string_setpos (STRING *s,unsigned long i);
+
+STRINGDRIVER unix_string = {
+  unix_string_init,		/* initialize string structure */
+  unix_string_next,		/* get next byte in string structure */
+  unix_string_setpos,		/* set position in string structure */
+  NIL				/* no file descriptor for converted text */
+};
 
 /* UNIX mail validate mailbox
  * Accepts: mailbox name
@@ -285,9 +320,33 @@ void *unix_parameters (long function,void *value)
   case GET_FROMWIDGET:
     ret = (void *) unix_fromwidget;
     break;
+  case GET_SEARCHWORKER:
+    ret = (void *) unix_searchworker;
+    break;
+  case GET_STRUCTCACHEFILE:	/* value is the stream, see mail.h */
+    if (value && ((MAILSTREAM *) value)->local)
+      ret = (void *) ((UNIXLOCAL *) ((MAILSTREAM *) value)->local)->structcache;
+    break;
   }
   return ret;
 }
+
+
+/* UNIX prepare stream for search worker process
+ * Accepts: MAIL stream
+ * Returns: T if stream has its own mailbox descriptor, NIL if failure
+ */
+
+long unix_searchworker (MAILSTREAM *stream)
+{
+  int fd;
+				/* don't share mailbox file offset */
+  if ((LOCAL->fd < 0) || ((fd = open (stream->mailbox,O_RDONLY,NIL)) < 0))
+    return NIL;
+  close (LOCAL->fd);
+  LOCAL->fd = fd;
+  return LONGT;
+}
 
 /* UNIX mail scan mailboxes
  * Accepts: mail stream
@@ -443,11 +502,17 @@ long unix_rename (MAILSTREAM *stream,char *old,char *newname)
 	if (rename (file,tmp))
 	  sprintf (tmp,"Can't rename mailbox %.80s to %.80s: %s",old,newname,
 		   strerror (errno));
-	else ret = T;		/* set success */
+	else {			/* set success */
+	  sidecar_rename (file,tmp);
+	  ret = T;
+	}
       }
       else if (unlink (file))
 	sprintf (tmp,"Can't delete mailbox %.80s: %s",old,strerror (errno));
-      else ret = T;		/* set success */
+      else {			/* set success */
+	sidecar_rename (file,NIL);
+	ret = T;
+      }
       unix_unlock (fd,NIL,&lockx);
     }
     unix_unlock (ld,NIL,NIL);	/* flush the lock */
@@ -458,6 +523,43 @@ long unix_rename (MAILSTREAM *stream,char *old,char *newname)
   return ret;			/* return success or failure */
 }
 
+/* UNIX mail status
+ * Accepts: mail stream
+ *	    mailbox name
+ *	    status flags
+ * Returns: T on success, NIL on failure
+ */
+
+long unix_status (MAILSTREAM *stream,char *mbx,long flags)
+{
+  char file[MAILTMPLEN];
+				/* use open stream if one given */
+  if (stream || !dummy_file (file,mbx))
+    return mail_status_default (stream,mbx,flags);
+  return statuscache_status (mbx,file,unix_statuskey,flags);
+}
+
+
+/* UNIX mail status cache key
+ * Accepts: mailbox name
+ *	    mailbox file name
+ *	    destination buffer
+ * Returns: key, or NIL if mailbox can't be cached
+ */
+
+char *unix_statuskey (char *mbx,char *file,char *key)
+{
+  struct stat sbuf;
+  if (stat (file,&sbuf)) return NIL;
+				/* any change rewrites the file, and even a
+				   restored mtime leaves the ctime moved */
+  sprintf (key,"%lu:%lu:%lu:%lu",(unsigned long) sbuf.st_ino,
+	   (unsigned long) sbuf.st_size,(unsigned long) sbuf.st_mtime,
+	   (unsigned long) sbuf.st_ctime);
+				/* don't cache if may change this second */
+  return (sbuf.st_ctime < time (0)) ? key : NIL;
+}
+
 /* UNIX mail open
  * Accepts: Stream to open
  * Returns: Stream on success, NIL on failure
@@ -487,11 +589,13 @@ MAILSTREAM *unix_open (MAILSTREAM *stream)
   fs_give ((void **) &stream->mailbox);
 				/* save canonical name */
   stream->mailbox = cpystr (tmp);
+  if (sidecar_file (tmp,stream->mailbox,SIDECARSTRUCT))
+    LOCAL->structcache = cpystr (tmp);
   LOCAL->fd = LOCAL->ld = -1;	/* no file or state locking yet */
+  LOCAL->wfd = -1;		/* not watching for changes yet */
   LOCAL->buf = (char *) fs_get (CHUNKSIZE);
   LOCAL->buflen = CHUNKSIZE - 1;
-  LOCAL->text.data = (unsigned char *) fs_get (CHUNKSIZE);
-  LOCAL->text.size = CHUNKSIZE - 1;
+  LOCAL->text = (unsigned char *) fs_get (CHUNKSIZE);
   LOCAL->linebuf = (char *) fs_get (CHUNKSIZE);
   LOCAL->linebuflen = CHUNKSIZE - 1;
   stream->sequence++;		/* bump sequence number */
@@ -687,77 +791,198 @@ long unix_text (MAILSTREAM *stream,unsigned long msgno,STRING *bs,long flags)
     elt->seen = elt->private.dirty = LOCAL->dirty = T;
     MM_FLAGS (stream,msgno);
   }
-  s = unix_text_work (stream,elt,&i,flags);
-  INIT (bs,mail_string,s,i);	/* set up stringstruct */
+  if (flags & FT_INTERNAL) {	/* initial data OK? */
+    s = unix_text_work (stream,elt,&i);
+    INIT (bs,mail_string,s,i);	/* set up stringstruct */
+  }
+  else {			/* read CRLF text in place from file */
+    unix_text_map (stream,elt);
+    INIT (bs,unix_string,stream,elt->private.spare2.data);
+  }
   return T;			/* success */
 }
-
-/* UNIX mail fetch message text worker routine
+
+/* UNIX mail fetch message internal text worker routine
  * Accepts: MAIL stream
  *	    message cache element
- *	    pointer to returned header text length
- *	    option flags
+ *	    pointer to returned text length
+ * Returns: message text with bare newlines
  */
 
 char *unix_text_work (MAILSTREAM *stream,MESSAGECACHE *elt,
-		      unsigned long *length,long flags)
+		      unsigned long *length)
 {
-  FDDATA d;
-  STRING bs;
-  unsigned char c,*s,*t,*tl,tmp[CHUNKSIZE];
+  unsigned char *s,*t,*tl;
 				/* go to text position */
   lseek (LOCAL->fd,elt->private.special.offset +
 	 elt->private.msg.text.offset,L_SET);
-  if (flags & FT_INTERNAL) {	/* initial data OK? */
-    if (elt->private.msg.text.text.size > LOCAL->buflen) {
-      fs_give ((void **) &LOCAL->buf);
-      LOCAL->buf = (char *) fs_get ((LOCAL->buflen =
-				     elt->private.msg.text.text.size) + 1);
-    }
+  if (elt->private.msg.text.text.size > LOCAL->buflen) {
+    fs_give ((void **) &LOCAL->buf);
+    LOCAL->buf = (char *) fs_get ((LOCAL->buflen =
+				   elt->private.msg.text.text.size) + 1);
+  }
 				/* read message */
-    read (LOCAL->fd,LOCAL->buf,elt->private.msg.text.text.size);
+  read (LOCAL->fd,LOCAL->buf,elt->private.msg.text.text.size);
 				/* got text, tie off string */
-    LOCAL->buf[*length = elt->private.msg.text.text.size] = '\0';
+  LOCAL->buf[*length = elt->private.msg.text.text.size] = '\0';
 				/* squeeze out CRs (in case from PC) */
-    for (s = t = LOCAL->buf,tl = LOCAL->buf + *length; t < tl; t++)
-      if (*t != '\r') *s++ = *t;
-    *s = '\0';
-    *length = s - LOCAL->buf;	/* adjust length */
-    return (char *) LOCAL->buf;
-  }
-
-				/* have it cached already? */
-  if (elt->private.uid != LOCAL->uid) {
-				/* not cached, cache it now */
+  for (s = t = LOCAL->buf,tl = LOCAL->buf + *length; t < tl; t++)
+    if (*t != '\r') *s++ = *t;
+  *s = '\0';
+  *length = s - LOCAL->buf;	/* adjust length */
+  return (char *) LOCAL->buf;
+}
+
+/* UNIX text map
+ *
+ * Message text is stored on disk with bare newlines and is returned with CRLF
+ * newlines.  Rather than convert the entire text into memory, the current
+ * message's text is converted a chunk of CHUNKSIZE output bytes at a time.
+ * The map holds, for every chunk reached so far, the on-disk offset where the
+ * chunk starts shifted left one bit, with the low bit set if the chunk starts
+ * with the LF of a CRLF whose CR ended the previous chunk.  A partial fetch
+ * thus only converts the chunks it wants, and text before a late body part is
+ * only scanned once to find the chunk boundaries.
+ */
+
+
+/* UNIX set up text map for message
+ * Accepts: MAIL stream
+ *	    message cache element
+ */
+
+void unix_text_map (MAILSTREAM *stream,MESSAGECACHE *elt)
+{
+  off_t pos = elt->private.special.offset + elt->private.msg.text.offset;
+				/* map already set up for this text? */
+  if ((elt->private.uid != LOCAL->uid) || (pos != LOCAL->textpos) ||
+      (elt->private.msg.text.text.size != LOCAL->textraw)) {
     LOCAL->uid = elt->private.uid;
-				/* is buffer big enough? */
-    if (elt->rfc822_size > LOCAL->text.size) {
-      /* excessively conservative, but the right thing is too hard to do */
-      fs_give ((void **) &LOCAL->text.data);
-      LOCAL->text.data = (unsigned char *)
-	fs_get ((LOCAL->text.size = elt->rfc822_size) + 1);
+    LOCAL->textpos = pos;	/* note where text is and its disk size */
+    LOCAL->textraw = elt->private.msg.text.text.size;
+    if (!LOCAL->map) LOCAL->map = (unsigned long *)
+      fs_get ((LOCAL->mapsize = 16) * sizeof (unsigned long));
+    LOCAL->map[0] = 0;		/* first chunk starts at the text */
+    LOCAL->maplen = 1;
+    LOCAL->textchunk = -1;	/* no chunk loaded yet */
+  }
+}
+
+
+/* UNIX convert text chunk
+ * Accepts: MAIL stream
+ *	    chunk number, must already be in map
+ *	    destination buffer, or NIL to only scan
+ * Returns: length of converted chunk
+ */
+
+unsigned long unix_text_chunk (MAILSTREAM *stream,unsigned long k,
+			       unsigned char *dst)
+{
+  long i;
+  unsigned char c,*t,*tl,tmp[CHUNKSIZE];
+  unsigned long n = 0;
+  unsigned long raw = LOCAL->map[k] >> 1;
+  int lf = LOCAL->map[k] & 1;
+  for (t = tl = tmp; (n < CHUNKSIZE) && (raw < LOCAL->textraw);) {
+    if (t == tl) {		/* need more data from the file? */
+      lseek (LOCAL->fd,LOCAL->textpos + raw,L_SET);
+      if ((i = read (LOCAL->fd,t = tmp,
+		     (size_t) min (CHUNKSIZE,LOCAL->textraw - raw))) <= 0)
+	break;
+      tl = tmp + i;
     }
-    d.fd = LOCAL->fd;		/* yes, set up file descriptor */
-    d.pos = elt->private.special.offset + elt->private.msg.text.offset;
-    d.chunk = tmp;		/* initial buffer chunk */
-    d.chunksize = CHUNKSIZE;	/* file chunk size */
-    INIT (&bs,fd_string,&d,elt->private.msg.text.text.size);
-    for (s = (char *) LOCAL->text.data; SIZE (&bs);) switch (c = SNX (&bs)) {
-    case '\r':			/* carriage return seen */
-      break;
-    case '\n':
-      *s++ = '\r';		/* insert a CR */
-    default:
-      *s++ = c;			/* copy characters */
+    if ((c = *t) == '\r') {	/* carriage return seen */
+      ++t;
+      ++raw;
+    }
+    else if ((c == '\n') && !lf) {
+      if (dst) dst[n] = '\r';	/* insert a CR */
+      ++n;
+      lf = T;			/* LF comes next */
+    }
+    else {			/* copy characters */
+      if (dst) dst[n] = c;
+      ++n;
+      ++t;
+      ++raw;
+      lf = NIL;
     }
-    *s = '\0';			/* tie off buffer */
-				/* calculate length of cached data */
-    LOCAL->textlen = s - LOCAL->text.data;
   }
-  *length = LOCAL->textlen;	/* return from cache */
-  return (char *) LOCAL->text.data;
+  if (k + 1 == LOCAL->maplen) {	/* note where the next chunk starts */
+    if (LOCAL->maplen == LOCAL->mapsize)
+      fs_resize ((void **) &LOCAL->map,
+		 (LOCAL->mapsize *= 2) * sizeof (unsigned long));
+    LOCAL->map[LOCAL->maplen++] = (raw << 1) | lf;
+  }
+  return n;
 }
-
+
+/* Initialize string structure for UNIX text stringstruct
+ * Accepts: string structure
+ *	    MAIL stream, with text map set up for the message
+ *	    size of text in CRLF form
+ */
+
+static void unix_string_init (STRING *s,void *data,unsigned long size)
+{
+  MAILSTREAM *stream = (MAILSTREAM *) data;
+  s->data = data;		/* note stream */
+  s->data1 = LOCAL->uid;	/* and UID of the message */
+  s->size = size;		/* note size */
+  s->curpos = s->chunk = (char *) LOCAL->text;
+  s->chunksize = CHUNKSIZE;
+  s->offset = s->cursize = 0;	/* initial position */
+  SETPOS (s,0);			/* load first chunk */
+}
+
+
+/* Get next character from UNIX text stringstruct
+ * Accepts: string structure
+ * Returns: character, string structure chunk refreshed
+ */
+
+static char unix_string_next (STRING *s)
+{
+  char c = *s->curpos++;	/* get next byte */
+  SETPOS (s,GETPOS (s));	/* move to next chunk */
+  return c;			/* return the byte */
+}
+
+
+/* Set string pointer position for UNIX text stringstruct
+ * Accepts: string structure
+ *	    new position
+ */
+
+static void unix_string_setpos (STRING *s,unsigned long i)
+{
+  MAILSTREAM *stream = (MAILSTREAM *) s->data;
+  unsigned long j,k,msgno;
+  if (i > s->size) i = s->size;	/* don't permit setting beyond EOF */
+  s->offset = i;		/* assume no data there */
+  s->curpos = s->chunk;
+  s->cursize = 0;
+				/* message still there? */
+  if ((i < s->size) && (msgno = mail_msgno (stream,s->data1))) {
+    unix_text_map (stream,mail_elt (stream,msgno));
+				/* want a different chunk? */
+    if (LOCAL->textchunk != (long) (k = i / s->chunksize)) {
+				/* scan to it if not in map yet */
+      while (LOCAL->maplen <= k)
+	unix_text_chunk (stream,LOCAL->maplen - 1,NIL);
+      LOCAL->textlen = unix_text_chunk (stream,k,LOCAL->text);
+      LOCAL->textchunk = k;
+    }
+				/* position within chunk */
+    if ((j = i - k * s->chunksize) < LOCAL->textlen) {
+      s->offset = k * s->chunksize;
+      s->curpos += j;
+      s->cursize = LOCAL->textlen - j;
+    }
+  }
+}
+
 /* UNIX per-message modify flag
  * Accepts: MAIL stream
  *	    message cache element
@@ -816,6 +1041,24 @@ long unix_ping (MAILSTREAM *stream)
   }
   return LOCAL ? LONGT : NIL;	/* return if still alive */
 }
+
+
+/* UNIX mail watch mailbox for changes
+ * Accepts: MAIL stream
+ * Returns: descriptor readable on change, or -1 if can't watch
+ */
+
+int unix_watch (MAILSTREAM *stream)
+{
+  char *files[3];
+  files[0] = stream->mailbox;
+				/* mbox also depends upon system INBOX */
+  files[1] = (stream->dtb == &mboxdriver) ? sysinbox () : NIL;
+  files[2] = NIL;
+				/* snarf promptly if anything changed */
+  if (notify_watch (&LOCAL->wfd,files,NIL)) LOCAL->lastsnarf = 0;
+  return LOCAL->wfd;
+}
 
 /* UNIX mail check mailbox
  * Accepts: MAIL stream
@@ -977,7 +1220,7 @@ long unix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
 	    unix_xstatus (stream,LOCAL->buf,elt,NIL,NIL);
 	  if (write (fd,LOCAL->buf,j) < 0) ret = NIL;
 	  else {		/* message status succeeded */
-	    s = unix_text_work (stream,elt,&j,FT_INTERNAL);
+	    s = unix_text_work (stream,elt,&j);
 	    if ((write (fd,s,j) < 0) || (write (fd,"\n",1) < 0)) ret = NIL;
 	    else if (cu) {	/* need to pass back new UID? */
 	      mail_append_set (source,mail_uid (stream,i));
@@ -1024,6 +1267,43 @@ long unix_copy (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
   return ret;
 }
 
+/* UNIX mail move message(s)
+ * Accepts: MAIL stream
+ *	    sequence
+ *	    destination mailbox
+ *	    copy options
+ * Returns: T if move successful, else NIL
+ */
+
+long unix_move (MAILSTREAM *stream,char *sequence,char *mailbox,long options)
+{
+  long ret;
+  unsigned long i;
+  DOTLOCK lock;
+  char file[MAILTMPLEN];
+  /* Copy marks source deleted and dirty, so the rewrite is done just once.
+   * The source stays locked from the copy through the rewrite, taking the
+   * destination lock inside it.  Two moves in opposite directions would
+   * deadlock doing that, so it's only done when the destination sorts after
+   * the source; otherwise the copy is done before locking the source.
+   */
+  if (!(LOCAL && (LOCAL->ld >= 0) && !stream->lock &&
+	dummy_file (file,mailbox) && (strcmp (file,stream->mailbox) > 0)))
+    return unix_copy (stream,sequence,mailbox,options | CP_MOVE) &&
+      unix_expunge (stream,sequence,(options & CP_UID) ? EX_UID : NIL);
+  if (!unix_parse (stream,&lock,LOCK_EX)) return NIL;
+  if (!(ret = unix_copy (stream,sequence,mailbox,options | CP_MOVE)) ||
+      !unix_rewrite (stream,&i,&lock,LONGT))
+    unix_unlock (LOCAL->fd,stream,&lock);
+  else if (i && !stream->silent) {
+    sprintf (LOCAL->buf,"Expunged %lu messages",i);
+    MM_LOG (LOCAL->buf,NIL);
+  }
+  mail_unlock (stream);		/* unlock the stream */
+  MM_NOCRITICAL (stream);	/* done with critical */
+  return ret;
+}
+
 /* UNIX mail append message from stringstruct
  * Accepts: MAIL stream
  *	    destination mailbox
@@ -1336,6 +1616,33 @@ int unix_append_msgs (MAILSTREAM *stream,FILE *sf,FILE *df,SEARCHSET *set)
   }
   return T;
 }
+
+
+/* UNIX mail garbage collect stream
+ * Accepts: MAIL stream
+ *	    garbage collection flags
+ */
+
+void unix_gc (MAILSTREAM *stream,long gcflags)
+{
+  if (LOCAL && (gcflags & GC_TEXTS)) {
+				/* shrink grown buffers back to initial size */
+    if (LOCAL->buflen > CHUNKSIZE - 1) {
+      fs_give ((void **) &LOCAL->buf);
+      LOCAL->buf = (char *) fs_get (CHUNKSIZE);
+      LOCAL->buflen = CHUNKSIZE - 1;
+    }
+    if (LOCAL->map) {		/* flush text checkpoint map */
+      fs_give ((void **) &LOCAL->map);
+      LOCAL->uid = 0;		/* no current text now */
+    }
+    if (LOCAL->linebuflen > CHUNKSIZE - 1) {
+      fs_give ((void **) &LOCAL->linebuf);
+      LOCAL->linebuf = (char *) fs_get (CHUNKSIZE);
+      LOCAL->linebuflen = CHUNKSIZE - 1;
+    }
+  }
+}
 
 /* Internal routines */
 
@@ -1354,9 +1661,13 @@ void unix_abort (MAILSTREAM *stream)
       unlink (LOCAL->lname);	/* and delete it */
     }
     if (LOCAL->lname) fs_give ((void **) &LOCAL->lname);
+    if (LOCAL->structcache) fs_give ((void **) &LOCAL->structcache);
+				/* close change notification if open */
+    if (LOCAL->wfd >= 0) close (LOCAL->wfd);
 				/* free local text buffers */
     if (LOCAL->buf) fs_give ((void **) &LOCAL->buf);
-    if (LOCAL->text.data) fs_give ((void **) &LOCAL->text.data);
+    if (LOCAL->text) fs_give ((void **) &LOCAL->text);
+    if (LOCAL->map) fs_give ((void **) &LOCAL->map);
     if (LOCAL->linebuf) fs_give ((void **) &LOCAL->linebuf);
     if (LOCAL->line) fs_give ((void **) &LOCAL->line);
 				/* nuke the local data */
@@ -1801,6 +2112,8 @@ int unix_parse (MAILSTREAM *stream,DOTLOCK *lock,int op)
 	   (LOCAL->filesize + GETPOS (&bs)) - elt->private.special.offset) -
 	     elt->private.special.text.size;
 	k = m = 0;		/* no previous line size yet */
+				/* note message size before text */
+	elt->private.spare2.data = elt->rfc822_size;
 				/* note current position */
 	j = LOCAL->filesize + GETPOS (&bs);
 	if (i) do {		/* look for next message */
@@ -1836,6 +2149,8 @@ int unix_parse (MAILSTREAM *stream,DOTLOCK *lock,int op)
 				/* flush ending blank line */
 	elt->private.msg.text.text.size -= m;
 	elt->rfc822_size -= k;
+				/* size of text in CRLF form */
+	elt->private.spare2.data = elt->rfc822_size - elt->private.spare2.data;
 				/* until end of buffer */
       } while (!stream->sniff && i);
       if (pseudoseen) {		/* flush pseudo-message if present */
@@ -2186,7 +2501,7 @@ long unix_rewrite (MAILSTREAM *stream,unsigned long *nexp,DOTLOCK *lock,
 				/* did text move? */
 	  if (f.curpos != f.protect) {
 				/* get message text */
-	    s = unix_text_work (stream,elt,&j,FT_INTERNAL);
+	    s = unix_text_work (stream,elt,&j);
 				/* this can happen if CRs were squeezed */
 	    if (j < elt->private.msg.text.text.size) {
 				/* so fix up counts */
@@ -2451,11 +2766,14 @@ DRIVER mboxdriver = {
   NIL,				/* sort messages */
   NIL,				/* thread messages */
   mbox_ping,			/* ping mailbox to see if still alive */
+  unix_watch,			/* watch mailbox for changes */
+  NIL,				/* highest modseq */
   mbox_check,			/* check for new messages */
   mbox_expunge,			/* expunge deleted messages */
   unix_copy,			/* copy messages to another mailbox */
+  unix_move,			/* move messages to another mailbox */
   mbox_append,			/* append string message to mailbox */
-  NIL				/* garbage collect stream */
+  unix_gc			/* garbage collect stream */
 };
 
 				/* prototype stream */
@@ -2544,6 +2862,7 @@ long mbox_status (MAILSTREAM *stream,char *mbx,long flags)
       if (!mail_elt (stream,i)->seen) status.unseen++;
   status.uidnext = stream->uid_last + 1;
   status.uidvalidity = stream->uid_validity;
+  status.highestmodseq = 0;	/* no modseqs in this format */
   if (!status.recent &&		/* calculate post-snarf results */
       (systream = mail_open (NIL,sysinbox (),OP_READONLY|OP_SILENT))) {
     status.messages += systream->nmsgs;
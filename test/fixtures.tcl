@@ -0,0 +1,42 @@
+# Shared fixtures for the expect tests
+
+# Make an empty scratch home directory for the server and point HOME at it
+#   name: test name, the directory is <name>.home in the current directory
+# Returns: directory name
+
+proc scratch_home {name} {
+  set home [file join [pwd] $name.home]
+  file delete -force $home
+  file mkdir $home
+  set ::env(HOME) $home
+  return $home
+}
+
+
+# Write a unix mailbox of generated messages
+#   file: mailbox file name
+#   n: number of messages, at most 1440
+#
+# Message i is from user<i mod 5>, has subject "Topic <i mod 7>", a sent
+# date i minutes into 2024, and refers to message i-1 when i is even.  Its
+# body has the word "word<i mod 11>".
+
+proc write_mbox {file n} {
+  set f [open $file w]
+  fconfigure $f -translation lf
+  for {set i 1} {$i <= $n} {incr i} {
+    set from "user[expr {$i % 5}]@example.com"
+    set date [format "%02d:%02d:00" [expr {$i / 60}] [expr {$i % 60}]]
+    puts $f "From $from Mon Jan  1 $date 2024"
+    puts $f "Date: Mon, 1 Jan 2024 $date +0000"
+    puts $f "From: $from"
+    puts $f "To: list@example.com"
+    puts $f "Subject: Topic [expr {$i % 7}]"
+    puts $f "Message-ID: <m$i@example.com>"
+    if {!($i % 2)} { puts $f "References: <m[expr {$i - 1}]@example.com>" }
+    puts $f ""
+    puts $f "Body of message $i has word[expr {$i % 11}] in it."
+    puts $f ""
+  }
+  close $f
+}